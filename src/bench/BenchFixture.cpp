@@ -0,0 +1,499 @@
+#include "BenchFixture.h"
+#include "Bsp.h"
+#include "Entity.h"
+#include "vis.h"
+#include "util.h"
+#include <map>
+#include <random>
+#include <cfloat>
+#include <algorithm>
+
+struct FixtureCell
+{
+	int x, y, z;
+};
+
+struct FixtureBuilder
+{
+	const BenchFixtureOptions& opt;
+	int nx, ny, nz;
+	std::vector<char> solid;
+	std::vector<int> cellLeaf;
+
+	std::vector<BSPPLANE> planes;
+	std::map<std::pair<int, int>, int> planeIds;
+	std::vector<BSPNODE16> nodes;
+	std::vector<BSPLEAF32> leaves;
+	std::vector<FixtureCell> leafCells;
+
+	FixtureBuilder(const BenchFixtureOptions& options) : opt(options)
+	{
+		nx = ny = opt.size;
+		nz = std::max(opt.size / 2, 1);
+	}
+
+	int cellIdx(int x, int y, int z) const
+	{
+		return (z * ny + y) * nx + x;
+	}
+
+	bool isSolid(int x, int y, int z) const
+	{
+		if (x < 0 || y < 0 || z < 0 || x >= nx || y >= ny || z >= nz)
+			return true;
+		return solid[cellIdx(x, y, z)] != 0;
+	}
+
+	int addPlane(int axis, int dist)
+	{
+		auto key = std::make_pair(axis, dist);
+		auto it = planeIds.find(key);
+		if (it != planeIds.end())
+			return it->second;
+		vec3 normal;
+		normal[axis] = 1.0f;
+		planes.push_back(BSPPLANE(normal, (float)dist, axis));
+		planeIds[key] = (int)planes.size() - 1;
+		return (int)planes.size() - 1;
+	}
+
+	// splits the longest side of the cell range in half, like a compiler would for a grid
+	int build(const int lo[3], const int hi[3])
+	{
+		int sizes[3] = { hi[0] - lo[0], hi[1] - lo[1], hi[2] - lo[2] };
+		int axis = 0;
+		for (int i = 1; i < 3; i++)
+		{
+			if (sizes[i] > sizes[axis])
+				axis = i;
+		}
+
+		if (sizes[axis] == 1)
+		{
+			if (isSolid(lo[0], lo[1], lo[2]))
+				return ~0;
+
+			BSPLEAF32 leaf = BSPLEAF32();
+			leaf.nContents = CONTENTS_EMPTY;
+			leaf.nVisOffset = -1;
+			for (int i = 0; i < 3; i++)
+			{
+				leaf.nMins[i] = (float)(lo[i] * opt.cellSize);
+				leaf.nMaxs[i] = (float)(hi[i] * opt.cellSize);
+			}
+			cellLeaf[cellIdx(lo[0], lo[1], lo[2])] = (int)leaves.size();
+			leafCells.push_back({ lo[0], lo[1], lo[2] });
+			leaves.push_back(leaf);
+			return ~((int)leaves.size() - 1);
+		}
+
+		int mid = (lo[axis] + hi[axis]) / 2;
+		int nodeIdx = (int)nodes.size();
+		nodes.push_back(BSPNODE16());
+
+		int frontLo[3] = { lo[0], lo[1], lo[2] };
+		int backHi[3] = { hi[0], hi[1], hi[2] };
+		frontLo[axis] = mid;
+		backHi[axis] = mid;
+
+		int plane = addPlane(axis, mid * opt.cellSize);
+		int front = build(frontLo, hi);
+		int back = build(lo, backHi);
+
+		BSPNODE16& node = nodes[nodeIdx];
+		node.iPlane = plane;
+		node.iChildren[0] = (short)front;
+		node.iChildren[1] = (short)back;
+		for (int i = 0; i < 3; i++)
+		{
+			node.nMins[i] = (short)(lo[i] * opt.cellSize);
+			node.nMaxs[i] = (short)(hi[i] * opt.cellSize);
+		}
+		return nodeIdx;
+	}
+};
+
+template<class T>
+static void append_lump(std::string& lump, const std::vector<T>& data)
+{
+	lump.append((const char*)data.data(), data.size() * sizeof(T));
+}
+
+static std::string make_texture_lump(const BenchFixtureOptions& opt, std::mt19937& rng)
+{
+	int w = opt.textureSize;
+	int h = opt.textureSize;
+	int mipSize = w * h + (w / 2) * (h / 2) + (w / 4) * (h / 4) + (w / 8) * (h / 8);
+	int texSize = (int)sizeof(BSPMIPTEX) + mipSize + 2 + 256 * (int)sizeof(COLOR3) + 2;
+
+	std::string lump;
+	int count = opt.textures;
+	lump.append((const char*)&count, sizeof(int));
+	for (int t = 0; t < count; t++)
+	{
+		int offset = (int)sizeof(int) * (count + 1) + t * texSize;
+		lump.append((const char*)&offset, sizeof(int));
+	}
+
+	for (int t = 0; t < count; t++)
+	{
+		BSPMIPTEX tex = BSPMIPTEX();
+		snprintf(tex.szName, MAXTEXTURENAME, "BENCH%d", t);
+		tex.nWidth = w;
+		tex.nHeight = h;
+		tex.nOffsets[0] = sizeof(BSPMIPTEX);
+		tex.nOffsets[1] = tex.nOffsets[0] + w * h;
+		tex.nOffsets[2] = tex.nOffsets[1] + (w / 2) * (h / 2);
+		tex.nOffsets[3] = tex.nOffsets[2] + (w / 4) * (h / 4);
+		lump.append((const char*)&tex, sizeof(BSPMIPTEX));
+
+		// noisy checkers, so the palette and every mip have something to compress
+		for (int mip = 0; mip < MIPLEVELS; mip++)
+		{
+			int mw = w >> mip;
+			int mh = h >> mip;
+			for (int y = 0; y < mh; y++)
+			{
+				for (int x = 0; x < mw; x++)
+				{
+					int checker = (((x << mip) / 16 + (y << mip) / 16) & 1) * 128;
+					lump.push_back((char)(checker + rng() % 128));
+				}
+			}
+		}
+
+		short colors = 256;
+		lump.append((const char*)&colors, sizeof(short));
+		for (int c = 0; c < 256; c++)
+		{
+			COLOR3 color((unsigned char)c, (unsigned char)(c * (t + 1)), (unsigned char)(255 - c));
+			lump.append((const char*)&color, sizeof(COLOR3));
+		}
+		lump.append(2, '\0');
+	}
+
+	return lump;
+}
+
+bool write_bench_fixture(const std::string& path, const BenchFixtureOptions& options, BenchFixtureInfo* info)
+{
+	BenchFixtureOptions opt = options;
+	opt.size = std::max(opt.size, 2);
+	opt.cellSize = std::clamp(opt.cellSize / 16 * 16, 16, 256);
+	opt.textures = std::max(opt.textures, 1);
+	opt.textureSize = std::clamp(opt.textureSize / 16 * 16, 16, 512);
+	opt.visRadius = std::max(opt.visRadius, 0);
+
+	std::mt19937 rng(opt.seed);
+	FixtureBuilder b(opt);
+
+	int cellCount = b.nx * b.ny * b.nz;
+	b.solid.resize(cellCount);
+	b.cellLeaf.assign(cellCount, -1);
+	for (int i = 0; i < cellCount; i++)
+		b.solid[i] = (int)(rng() % 100) < opt.solidPercent;
+	b.solid[0] = 0; // player start
+
+	// leaf 0 is the shared solid leaf
+	BSPLEAF32 solidLeaf = BSPLEAF32();
+	solidLeaf.nContents = CONTENTS_SOLID;
+	solidLeaf.nVisOffset = -1;
+	b.leaves.push_back(solidLeaf);
+	b.leafCells.push_back({ -1, -1, -1 });
+
+	int lo[3] = { 0, 0, 0 };
+	int hi[3] = { b.nx, b.ny, b.nz };
+	b.build(lo, hi);
+
+	int visLeafCount = (int)b.leaves.size() - 1;
+	if (b.nodes.size() >= 32767 || b.leaves.size() >= 32767)
+	{
+		logf("Fixture has too many nodes/leaves ({} / {}), use a smaller size\n", b.nodes.size(), b.leaves.size());
+		return false;
+	}
+
+	// faces on every side of an empty cell that touches a solid one, facing into the cell
+	std::vector<vec3> verts;
+	std::vector<int> vertIds((b.nx + 1) * (b.ny + 1) * (b.nz + 1), -1);
+	std::vector<BSPEDGE16> edges(1);
+	std::map<std::pair<int, int>, int> edgeIds;
+	std::vector<int> surfedges;
+	std::vector<BSPFACE16> faces;
+	std::vector<unsigned short> marksurfs;
+	std::vector<COLOR3> lighting;
+
+	std::vector<BSPTEXTUREINFO> texinfos;
+	for (int t = 0; t < opt.textures; t++)
+	{
+		for (int axis = 0; axis < 3; axis++)
+		{
+			BSPTEXTUREINFO info = BSPTEXTUREINFO();
+			info.vS = axis == 0 ? vec3(0, 1, 0) : vec3(1, 0, 0);
+			info.vT = axis == 2 ? vec3(0, -1, 0) : vec3(0, 0, -1);
+			info.iMiptex = t;
+			texinfos.push_back(info);
+		}
+	}
+
+	auto vertex_id = [&](int x, int y, int z) {
+		int& id = vertIds[(z * (b.ny + 1) + y) * (b.nx + 1) + x];
+		if (id < 0)
+		{
+			id = (int)verts.size();
+			verts.push_back(vec3((float)(x * opt.cellSize), (float)(y * opt.cellSize), (float)(z * opt.cellSize)));
+		}
+		return id;
+	};
+
+	for (int leafIdx = 1; leafIdx < (int)b.leaves.size(); leafIdx++)
+	{
+		FixtureCell cell = b.leafCells[leafIdx];
+		BSPLEAF32& leaf = b.leaves[leafIdx];
+		leaf.iFirstMarkSurface = (int)marksurfs.size();
+
+		for (int side = 0; side < 6; side++)
+		{
+			int axis = side / 2;
+			int dir = side % 2 ? 1 : -1;
+			int c[3] = { cell.x, cell.y, cell.z };
+			int n[3] = { cell.x, cell.y, cell.z };
+			n[axis] += dir;
+			if (!b.isSolid(n[0], n[1], n[2]))
+				continue;
+
+			// corners in the two other axes, clockwise seen from inside the cell
+			int u = (axis + 1) % 3;
+			int v = (axis + 2) % 3;
+			static const int windPos[4][2] = { {0, 0}, {0, 1}, {1, 1}, {1, 0} };
+			static const int windNeg[4][2] = { {0, 0}, {1, 0}, {1, 1}, {0, 1} };
+			const int(*wind)[2] = dir < 0 ? windPos : windNeg;
+
+			BSPFACE16 face = BSPFACE16();
+			face.iPlane = (unsigned short)b.addPlane(axis, (c[axis] + (dir > 0 ? 1 : 0)) * opt.cellSize);
+			face.nPlaneSide = dir > 0;
+			face.iFirstEdge = (int)surfedges.size();
+			face.nEdges = 4;
+			face.iTextureInfo = (short)((rng() % opt.textures) * 3 + axis);
+
+			int corner[4];
+			for (int k = 0; k < 4; k++)
+			{
+				int p[3];
+				p[axis] = c[axis] + (dir > 0 ? 1 : 0);
+				p[u] = c[u] + wind[k][0];
+				p[v] = c[v] + wind[k][1];
+				corner[k] = vertex_id(p[0], p[1], p[2]);
+			}
+			for (int k = 0; k < 4; k++)
+			{
+				int v0 = corner[k];
+				int v1 = corner[(k + 1) % 4];
+				auto edge = edgeIds.find(std::make_pair(v1, v0));
+				if (edge != edgeIds.end())
+				{
+					surfedges.push_back(-edge->second);
+					continue;
+				}
+				edgeIds[std::make_pair(v0, v1)] = (int)edges.size();
+				surfedges.push_back((int)edges.size());
+				edges.push_back(BSPEDGE16((unsigned int)v0, (unsigned int)v1));
+			}
+
+			// one light style, luxel brightness falls off from the cell corner
+			BSPTEXTUREINFO& texinfo = texinfos[face.iTextureInfo];
+			float mins[2] = { FLT_MAX, FLT_MAX };
+			float maxs[2] = { -FLT_MAX, -FLT_MAX };
+			for (int k = 0; k < 4; k++)
+			{
+				float st[2] = { dotProduct(texinfo.vS, verts[corner[k]]), dotProduct(texinfo.vT, verts[corner[k]]) };
+				for (int i = 0; i < 2; i++)
+				{
+					mins[i] = std::min(mins[i], st[i]);
+					maxs[i] = std::max(maxs[i], st[i]);
+				}
+			}
+			int lw = (int)(ceil(maxs[0] / 16.0f) - floor(mins[0] / 16.0f)) + 1;
+			int lh = (int)(ceil(maxs[1] / 16.0f) - floor(mins[1] / 16.0f)) + 1;
+			face.nStyles[0] = 0;
+			face.nStyles[1] = face.nStyles[2] = face.nStyles[3] = 255;
+			face.nLightmapOffset = (int)(lighting.size() * sizeof(COLOR3));
+			int base = 64 + (int)(rng() % 128);
+			for (int y = 0; y < lh; y++)
+			{
+				for (int x = 0; x < lw; x++)
+				{
+					unsigned char l = (unsigned char)std::max(base - (x + y) * 4, 8);
+					lighting.push_back(COLOR3(l, l, (unsigned char)(l / 2 + 32)));
+				}
+			}
+
+			marksurfs.push_back((unsigned short)faces.size());
+			faces.push_back(face);
+		}
+
+		leaf.nMarkSurfaces = (int)marksurfs.size() - leaf.iFirstMarkSurface;
+	}
+
+	if (faces.size() >= 65535 || verts.size() >= 65535 || edges.size() >= 65535)
+	{
+		logf("Fixture has too many faces/verts ({} / {}), use a smaller size\n", faces.size(), verts.size());
+		return false;
+	}
+
+	// every leaf sees the leaves in a cube around it
+	unsigned int rowSize = ((visLeafCount + 63) & ~63) >> 3;
+	std::vector<unsigned char> uncompressed((size_t)visLeafCount * rowSize);
+	for (int leafIdx = 1; leafIdx < (int)b.leaves.size(); leafIdx++)
+	{
+		FixtureCell cell = b.leafCells[leafIdx];
+		unsigned char* row = uncompressed.data() + (size_t)(leafIdx - 1) * rowSize;
+		int r = opt.visRadius;
+		for (int z = std::max(cell.z - r, 0); z <= std::min(cell.z + r, b.nz - 1); z++)
+		{
+			for (int y = std::max(cell.y - r, 0); y <= std::min(cell.y + r, b.ny - 1); y++)
+			{
+				for (int x = std::max(cell.x - r, 0); x <= std::min(cell.x + r, b.nx - 1); x++)
+				{
+					int other = b.cellLeaf[b.cellIdx(x, y, z)];
+					if (other > 0)
+						row[(other - 1) >> 3] |= 1 << ((other - 1) & 7);
+				}
+			}
+		}
+	}
+	std::vector<unsigned char> visdata(uncompressed.size() * 2 + 64);
+	int visSize = visLeafCount ? CompressAll(b.leaves.data(), uncompressed.data(), visdata.data(), visLeafCount, visLeafCount,
+		(int)visdata.size(), (int)b.leaves.size()) : 0;
+	visdata.resize(visSize);
+
+	// hulls 1-3 get copies of the hull 0 tree with contents instead of leaves
+	std::vector<BSPCLIPNODE16> clipnodes;
+	for (int hull = 1; hull < MAX_MAP_HULLS; hull++)
+	{
+		int base = (int)clipnodes.size();
+		for (BSPNODE16& node : b.nodes)
+		{
+			BSPCLIPNODE16 clipnode;
+			clipnode.iPlane = node.iPlane;
+			for (int i = 0; i < 2; i++)
+			{
+				int child = node.iChildren[i];
+				if (child >= 0)
+					clipnode.iChildren[i] = (short)(child + base);
+				else
+					clipnode.iChildren[i] = (short)(~child == 0 ? CONTENTS_SOLID : CONTENTS_EMPTY);
+			}
+			clipnodes.push_back(clipnode);
+		}
+	}
+
+	std::vector<BSPLEAF16> leaves16(b.leaves.size());
+	for (size_t i = 0; i < b.leaves.size(); i++)
+	{
+		BSPLEAF32& leaf = b.leaves[i];
+		BSPLEAF16& out = leaves16[i];
+		out = BSPLEAF16();
+		out.nContents = leaf.nContents;
+		out.nVisOffset = leaf.nVisOffset;
+		for (int k = 0; k < 3; k++)
+		{
+			out.nMins[k] = (short)leaf.nMins[k];
+			out.nMaxs[k] = (short)leaf.nMaxs[k];
+		}
+		out.iFirstMarkSurface = (unsigned short)leaf.iFirstMarkSurface;
+		out.nMarkSurfaces = (unsigned short)leaf.nMarkSurfaces;
+	}
+
+	BSPMODEL world = BSPMODEL();
+	world.nMaxs = vec3((float)(b.nx * opt.cellSize), (float)(b.ny * opt.cellSize), (float)(b.nz * opt.cellSize));
+	world.iHeadnodes[0] = 0;
+	for (int hull = 1; hull < MAX_MAP_HULLS; hull++)
+		world.iHeadnodes[hull] = (int)b.nodes.size() * (hull - 1);
+	world.nVisLeafs = visLeafCount;
+	world.nFaces = (int)faces.size();
+
+	std::string ents = "{\n\"classname\" \"worldspawn\"\n\"mapversion\" \"220\"\n\"wad\" \"\"\n}\n";
+	float half = opt.cellSize * 0.5f;
+	ents += fmt::format("{{\n\"classname\" \"info_player_start\"\n\"origin\" \"{} {} {}\"\n}}\n", half, half, half);
+	for (int leafIdx = 1; leafIdx < (int)b.leaves.size(); leafIdx += 16)
+	{
+		FixtureCell cell = b.leafCells[leafIdx];
+		ents += fmt::format("{{\n\"classname\" \"light\"\n\"origin\" \"{} {} {}\"\n\"_light\" \"255 240 200 200\"\n}}\n",
+			cell.x * opt.cellSize + half, cell.y * opt.cellSize + half, cell.z * opt.cellSize + half);
+	}
+	ents.push_back('\0');
+
+	std::string lumps[HEADER_LUMPS];
+	lumps[LUMP_ENTITIES] = ents;
+	append_lump(lumps[LUMP_PLANES], b.planes);
+	lumps[LUMP_TEXTURES] = make_texture_lump(opt, rng);
+	append_lump(lumps[LUMP_VERTICES], verts);
+	append_lump(lumps[LUMP_VISIBILITY], visdata);
+	append_lump(lumps[LUMP_NODES], b.nodes);
+	append_lump(lumps[LUMP_TEXINFO], texinfos);
+	append_lump(lumps[LUMP_FACES], faces);
+	append_lump(lumps[LUMP_LIGHTING], lighting);
+	append_lump(lumps[LUMP_CLIPNODES], clipnodes);
+	append_lump(lumps[LUMP_LEAVES], leaves16);
+	append_lump(lumps[LUMP_MARKSURFACES], marksurfs);
+	append_lump(lumps[LUMP_EDGES], edges);
+	append_lump(lumps[LUMP_SURFEDGES], surfedges);
+	append_lump(lumps[LUMP_MODELS], std::vector<BSPMODEL>(1, world));
+
+	BSPHEADER header;
+	header.nVersion = 30;
+	std::string data;
+	int offset = (int)sizeof(BSPHEADER);
+	for (int i = 0; i < HEADER_LUMPS; i++)
+	{
+		header.lump[i].nOffset = offset + (int)data.size();
+		header.lump[i].nLength = (int)lumps[i].size();
+		data += lumps[i];
+		while (data.size() % 4)
+			data.push_back('\0');
+	}
+	data.insert(0, (const char*)&header, sizeof(BSPHEADER));
+
+	if (!writeFile(path, data.data(), (int)data.size()))
+	{
+		logf("Failed to write {}\n", path);
+		return false;
+	}
+
+	// brush entities go through the same code the editor uses to create them
+	if (opt.models > 0)
+	{
+		Bsp* map = new Bsp(path);
+		if (!map->bsp_valid)
+		{
+			delete map;
+			return false;
+		}
+		for (int i = 0; i < opt.models; i++)
+		{
+			FixtureCell cell = b.leafCells[1 + rng() % visLeafCount];
+			vec3 center((cell.x + 0.5f) * opt.cellSize, (cell.y + 0.5f) * opt.cellSize, (cell.z + 0.5f) * opt.cellSize);
+			float size = 8.0f + (float)(rng() % (unsigned int)(opt.cellSize / 2 - 16 + 1));
+			int modelIdx = map->create_solid(center - vec3(size, size, size), center + vec3(size, size, size), (int)(rng() % opt.textures));
+
+			Entity* ent = new Entity("func_wall");
+			ent->setOrAddKeyvalue("model", "*" + std::to_string(modelIdx));
+			map->ents.push_back(ent);
+		}
+		map->update_ent_lump();
+		map->write(path);
+		delete map;
+	}
+
+	if (info)
+	{
+		info->leaves = visLeafCount;
+		info->faces = (int)faces.size() + opt.models * 6;
+		info->nodes = (int)b.nodes.size();
+		info->models = 1 + std::max(opt.models, 0);
+		info->visBytes = visSize;
+		info->lightBytes = (int)(lighting.size() * sizeof(COLOR3));
+		info->fileSize = (int)fileSize(path);
+	}
+	return true;
+}
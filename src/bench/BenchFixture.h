@@ -0,0 +1,31 @@
+#pragma once
+#include <string>
+
+// procedurally generated map for benchmarks, so timings can be compared across commits without
+// game assets. The same options always give the same file.
+struct BenchFixtureOptions
+{
+	int size = 12;            // the world is a grid of size x size x size/2 cells
+	int cellSize = 128;       // multiple of 16, at most 256 (lightmap extents)
+	int solidPercent = 30;    // chance of a cell being solid
+	int models = 32;          // func_wall boxes, added with create_solid like the editor does
+	int textures = 8;         // embedded textures, with mips and palette
+	int textureSize = 64;
+	int visRadius = 4;        // leaves see every leaf this many cells away or closer
+	unsigned int seed = 1;
+};
+
+struct BenchFixtureInfo
+{
+	int leaves = 0;
+	int faces = 0;
+	int nodes = 0;
+	int models = 0;
+	int visBytes = 0;
+	int lightBytes = 0;
+	int fileSize = 0;
+};
+
+// writes a lit map with vis data, clipnodes for every hull, embedded textures and brush entities.
+// Returns false if the options would overflow the bsp30 limits or the file can't be written.
+bool write_bench_fixture(const std::string& path, const BenchFixtureOptions& options, BenchFixtureInfo* info = NULL);
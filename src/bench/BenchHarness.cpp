@@ -0,0 +1,102 @@
+#include "BenchHarness.h"
+#include "Bsp.h"
+#include "util.h"
+#include <algorithm>
+#include <chrono>
+#include <numeric>
+
+QuietLog g_quiet;
+bool g_peak_reset = true;
+
+double BenchResult::min() const
+{
+	return *std::min_element(times.begin(), times.end());
+}
+
+double BenchResult::max() const
+{
+	return *std::max_element(times.begin(), times.end());
+}
+
+double BenchResult::mean() const
+{
+	return std::accumulate(times.begin(), times.end(), 0.0) / times.size();
+}
+
+double BenchResult::median() const
+{
+	std::vector<double> sorted = times;
+	std::sort(sorted.begin(), sorted.end());
+	return sorted[sorted.size() / 2];
+}
+
+void QuietLog::begin()
+{
+	if (!g_verbose)
+		out = std::cout.rdbuf(NULL);
+}
+
+void QuietLog::end()
+{
+	if (out)
+	{
+		std::cout.rdbuf(out);
+		std::cout.clear();
+		out = NULL;
+	}
+	g_log_buffer.clear();
+}
+
+bool BenchContext::enabled(const std::string& name) const
+{
+	return only.empty() || std::find(only.begin(), only.end(), name) != only.end();
+}
+
+Bsp* BenchContext::loadFixture() const
+{
+	g_quiet.begin();
+	Bsp* map = new Bsp(pathA);
+	g_quiet.end();
+	return map;
+}
+
+void BenchContext::check(bool ok, const std::string& what)
+{
+	if (ok)
+		return;
+	logf("CHECK FAILED: {}\n", what);
+	failedChecks++;
+}
+
+BenchResult run_bench(const std::string& name, int iterations, size_t bytes, const std::function<void()>& setup,
+	const std::function<void()>& run, const std::function<void()>& teardown)
+{
+	BenchResult result;
+	result.name = name;
+	result.bytes = bytes;
+
+	for (int i = 0; i < iterations; i++)
+	{
+		g_quiet.begin();
+		if (setup)
+			setup();
+
+		g_peak_reset = resetPeakMemoryUsage() && g_peak_reset;
+		size_t before = getMemoryUsage();
+		auto start = std::chrono::high_resolution_clock::now();
+		run();
+		auto end = std::chrono::high_resolution_clock::now();
+		size_t peak = getPeakMemoryUsage();
+
+		if (teardown)
+			teardown();
+		g_quiet.end();
+
+		result.times.push_back(std::chrono::duration<double>(end - start).count());
+		result.memoryBefore = std::max(result.memoryBefore, before);
+		if (peak > before)
+			result.peakGrowth = std::max(result.peakGrowth, peak - before);
+	}
+
+	return result;
+}
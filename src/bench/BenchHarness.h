@@ -0,0 +1,73 @@
+#pragma once
+#include "BenchFixture.h"
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+class Bsp;
+
+struct BenchResult
+{
+	std::string name;
+	std::vector<double> times; // seconds per iteration
+	size_t bytes = 0;          // processed per iteration, for throughput
+	size_t items = 0;          // rays, points, queries... per iteration
+	size_t memoryBefore = 0;
+	size_t peakGrowth = 0;     // highest peak over memoryBefore of all iterations
+
+	double min() const;
+	double max() const;
+	double mean() const;
+	double median() const;
+};
+
+// bsp loading and merging log a lot, which would be most of the time measured
+struct QuietLog
+{
+	std::streambuf* out = NULL;
+
+	void begin();
+	void end();
+};
+
+extern QuietLog g_quiet;
+extern bool g_peak_reset; // false if the os can't reset the peak memory, peakGrowth is unknown then
+
+// everything a benchmark needs to know about the run
+struct BenchContext
+{
+	int iterations = 10;
+	std::string dir;			// scratch space, removed after the run unless -keep is used
+	std::string pathA;			// fixture map
+	std::string pathB;			// second fixture with a different layout, for merging
+	BenchFixtureOptions fixture;
+	BenchFixtureInfo info;
+	BenchFixtureInfo infoB;
+	std::vector<std::string> only;
+	std::string exportGolden;	// file with the expected crc of every exported file (-golden)
+	bool writeGolden = false;	// write that file instead of checking it (-writegolden)
+	std::vector<BenchResult> results;
+	int failedChecks = 0;
+
+	bool enabled(const std::string& name) const;
+
+	// a fresh copy of the fixture map, so that no benchmark sees the edits of another one
+	Bsp* loadFixture() const;
+
+	// logs a failed result check, which makes bspguy_bench exit with an error
+	void check(bool ok, const std::string& what);
+};
+
+// only run is timed. setup and teardown run around every iteration
+BenchResult run_bench(const std::string& name, int iterations, size_t bytes, const std::function<void()>& setup,
+	const std::function<void()>& run, const std::function<void()>& teardown);
+
+// benchmarks of the editor side code (EditorBench.cpp), each loads its own fixture map
+void bench_trace(BenchContext& ctx);
+void bench_tree(BenchContext& ctx);
+void bench_drag(BenchContext& ctx);
+void bench_entity_search(BenchContext& ctx);
+void bench_thumbnails(BenchContext& ctx);
+void bench_fgd(BenchContext& ctx);
+void bench_export(BenchContext& ctx);
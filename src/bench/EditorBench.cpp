@@ -0,0 +1,777 @@
+// benchmarks of the code behind the editor tools. Every benchmark loads its own copy of the
+// fixture map, and the ones that compare two implementations check that the results match.
+
+#include "BenchHarness.h"
+#include "Bsp.h"
+#include "BspRenderer.h"
+#include "EntitySearch.h"
+#include "Fgd.h"
+#include "GeometryExport.h"
+#include "HullTrace.h"
+#include "ThumbnailCache.h"
+#include "forcecrc32.h"
+#include "util.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <future>
+#include <map>
+#include <thread>
+
+// fixed seed, so the rays and points are the same between runs
+struct BenchRandom
+{
+	unsigned int seed = 12345;
+
+	float next()
+	{
+		seed = seed * 1664525u + 1013904223u;
+		return (seed >> 8) * (1.0f / 16777216.0f);
+	}
+};
+
+void bench_trace(BenchContext& ctx)
+{
+	if (!ctx.enabled("trace"))
+		return;
+
+	Bsp* map = ctx.loadFixture();
+	HullTracer tracer(map, 0);
+	if (!tracer.hasHull(0))
+	{
+		ctx.check(false, "trace: the fixture has no world nodes");
+		delete map;
+		return;
+	}
+
+	// coherent packets, like picking or lighting rays: one origin and nearby directions
+	const int rayCount = 1 << 16;
+	std::vector<vec3> starts(rayCount);
+	std::vector<vec3> ends(rayCount);
+	BenchRandom rnd;
+	vec3 mins = map->models[0].nMins;
+	vec3 size = map->models[0].nMaxs - mins;
+	float length = size.length();
+	for (int i = 0; i < rayCount; i += TRACE_PACKET_MAX)
+	{
+		vec3 origin(mins.x + size.x * rnd.next(), mins.y + size.y * rnd.next(), mins.z + size.z * rnd.next());
+		vec3 dir(rnd.next() - 0.5f, rnd.next() - 0.5f, rnd.next() - 0.5f);
+		for (int k = 0; k < TRACE_PACKET_MAX; k++)
+		{
+			vec3 jitter(rnd.next() - 0.5f, rnd.next() - 0.5f, rnd.next() - 0.5f);
+			starts[i + k] = origin;
+			ends[i + k] = origin + (dir + jitter * 0.1f).normalize() * length;
+		}
+	}
+
+	std::vector<TraceResult> reference(rayCount);
+	std::vector<TraceResult> results(rayCount);
+	for (int hull = 0; hull < 2; hull++)
+	{
+		if (!tracer.hasHull(hull))
+			continue;
+
+		for (int i = 0; i < rayCount; i++)
+			reference[i] = tracer.traceLine(starts[i], ends[i], hull);
+
+		for (int packet : { 1, 4, TRACE_PACKET_MAX })
+		{
+			BenchResult result = run_bench(fmt::format("trace_h{}_x{}", hull, packet), ctx.iterations, 0, NULL, [&]() {
+				for (int i = 0; i < rayCount; i += packet)
+					tracer.tracePacket(&starts[i], &ends[i], packet, hull, &results[i]);
+				}, NULL);
+			result.items = rayCount;
+			ctx.results.push_back(result);
+
+			int mismatches = 0;
+			for (int i = 0; i < rayCount; i++)
+			{
+				if (fabs(results[i].fraction - reference[i].fraction) > 0.0001f || results[i].allSolid != reference[i].allSolid)
+					mismatches++;
+			}
+			ctx.check(mismatches == 0, fmt::format("trace: {} of the {} ray packets in hull {} differ from single rays", mismatches, packet, hull));
+		}
+	}
+
+	std::vector<int> tracerContents(rayCount);
+	std::vector<int> mapContents(rayCount);
+	BenchResult result = run_bench("trace_point", ctx.iterations, 0, NULL, [&]() {
+		for (int i = 0; i < rayCount; i++)
+			tracerContents[i] = tracer.pointContents(ends[i], 0);
+		}, NULL);
+	result.items = rayCount;
+	ctx.results.push_back(result);
+
+	result = run_bench("trace_point_map", ctx.iterations, 0, NULL, [&]() {
+		for (int i = 0; i < rayCount; i++)
+			mapContents[i] = map->pointContents(map->models[0].iHeadnodes[0], ends[i], 0);
+		}, NULL);
+	result.items = rayCount;
+	ctx.results.push_back(result);
+	ctx.check(tracerContents == mapContents, "trace: tracer point contents differ from the map tree");
+
+	delete map;
+}
+
+// walks the lumps directly, like the map walkers did before the flattened layout
+static int lump_point_contents(Bsp* map, int iNode, const vec3& p, int hull)
+{
+	if (iNode < 0)
+		return CONTENTS_EMPTY;
+
+	while (iNode >= 0)
+	{
+		const int* children = hull == 0 ? map->nodes[iNode].iChildren : map->clipnodes[iNode].iChildren;
+		const BSPPLANE& plane = map->planes[hull == 0 ? map->nodes[iNode].iPlane : map->clipnodes[iNode].iPlane];
+		iNode = children[dotProduct(plane.vNormal, p) - plane.fDist < 0 ? 1 : 0];
+	}
+	return hull == 0 ? map->leaves[~iNode].nContents : iNode;
+}
+
+void bench_tree(BenchContext& ctx)
+{
+	if (!ctx.enabled("tree"))
+		return;
+
+	Bsp* map = ctx.loadFixture();
+
+	BenchResult result = run_bench("tree_build", ctx.iterations, 0, NULL, [&]() {
+		map->invalidate_traversal_layout();
+		map->getNodeTree();
+		map->getClipnodeTree();
+		}, NULL);
+	result.items = map->nodeCount + map->clipnodeCount;
+	ctx.results.push_back(result);
+
+	const int pointCount = 1 << 16;
+	std::vector<vec3> points(pointCount);
+	BenchRandom rnd;
+	vec3 mins = map->models[0].nMins;
+	vec3 size = map->models[0].nMaxs - mins;
+	for (int i = 0; i < pointCount; i++)
+		points[i] = vec3(mins.x + size.x * rnd.next(), mins.y + size.y * rnd.next(), mins.z + size.z * rnd.next());
+
+	std::vector<int> flatContents(pointCount);
+	std::vector<int> lumpContents(pointCount);
+	for (int hull = 0; hull < 2; hull++)
+	{
+		int headnode = map->models[0].iHeadnodes[hull];
+		if (headnode < 0)
+			continue;
+
+		result = run_bench(fmt::format("tree_point_h{}", hull), ctx.iterations, 0, NULL, [&]() {
+			for (int i = 0; i < pointCount; i++)
+				flatContents[i] = map->pointContents(headnode, points[i], hull);
+			}, NULL);
+		result.items = pointCount;
+		ctx.results.push_back(result);
+
+		result = run_bench(fmt::format("tree_point_lump_h{}", hull), ctx.iterations, 0, NULL, [&]() {
+			for (int i = 0; i < pointCount; i++)
+				lumpContents[i] = lump_point_contents(map, headnode, points[i], hull);
+			}, NULL);
+		result.items = pointCount;
+		ctx.results.push_back(result);
+
+		ctx.check(flatContents == lumpContents, fmt::format("tree: flattened point contents differ from the lumps in hull {}", hull));
+	}
+
+	// the per model usage stats mark every model. The cold run includes the layout build, like the
+	// first walk after an edit.
+	std::vector<STRUCTUSAGE*> modelInfos;
+	auto deleteInfos = [&]() {
+		for (STRUCTUSAGE* info : modelInfos)
+			delete info;
+		modelInfos.clear();
+	};
+	auto markModels = [&]() { modelInfos = map->get_sorted_model_infos(SORT_NODES); };
+
+	result = run_bench("tree_mark_cold", ctx.iterations, 0, [&]() { map->invalidate_traversal_layout(); }, markModels, deleteInfos);
+	ctx.results.push_back(result);
+
+	result = run_bench("tree_mark_warm", ctx.iterations, 0, NULL, markModels, deleteInfos);
+	ctx.results.push_back(result);
+
+	delete map;
+}
+
+void bench_drag(BenchContext& ctx)
+{
+	if (!ctx.enabled("drag"))
+		return;
+
+	Bsp* map = ctx.loadFixture();
+
+	// the convex brush model with the most faces, like a func_detail being edited with the vertex tool
+	int modelIdx = -1;
+	for (int i = 1; i < map->modelCount; i++)
+	{
+		if ((modelIdx < 0 || map->models[i].nFaces > map->models[modelIdx].nFaces) && map->is_convex(i))
+			modelIdx = i;
+	}
+
+	std::vector<TransformVert> hullVerts;
+	if (modelIdx < 0 || !map->getModelPlaneIntersectVerts(modelIdx, hullVerts))
+	{
+		ctx.check(false, "drag: the fixture has no convex brush models");
+		delete map;
+		return;
+	}
+
+	// drags the verts of one hull face back and forth along its normal, so the solid stays valid
+	int iPlane = -1;
+	for (size_t i = 0; i < hullVerts.size() && iPlane < 0; i++)
+	{
+		if (hullVerts[i].iPlanes.size())
+			iPlane = hullVerts[i].iPlanes[0];
+	}
+	if (iPlane < 0)
+	{
+		ctx.check(false, fmt::format("drag: model {} has no hull planes", modelIdx));
+		delete map;
+		return;
+	}
+	vec3 normal = map->planes[iPlane].vNormal;
+
+	std::vector<int> dragged;
+	std::vector<int> movedVerts;
+	for (size_t i = 0; i < hullVerts.size(); i++)
+	{
+		std::vector<int>& iPlanes = hullVerts[i].iPlanes;
+		if (std::find(iPlanes.begin(), iPlanes.end(), iPlane) == iPlanes.end())
+			continue;
+		dragged.push_back((int)i);
+		if (hullVerts[i].ptr)
+			movedVerts.push_back((int)(hullVerts[i].ptr - map->verts));
+	}
+
+	int step = 0;
+	int invalidSteps = 0;
+	int steps = ctx.iterations * 10; // even, so the face ends where it started
+	auto moveVerts = [&]() {
+		float offset = step++ % 2 == 0 ? 0.5f : 0.0f;
+		for (int i : dragged)
+		{
+			hullVerts[i].pos = hullVerts[i].startPos + normal * offset;
+			if (hullVerts[i].ptr)
+				*hullVerts[i].ptr = hullVerts[i].pos;
+		}
+	};
+
+	BenchResult result = run_bench("drag_sync", steps, 0, moveVerts, [&]() {
+		if (!map->vertex_manipulation_sync(modelIdx, hullVerts, false))
+			invalidSteps++;
+		}, NULL);
+	result.items = dragged.size();
+	ctx.results.push_back(result);
+	ctx.check(invalidSteps == 0, fmt::format("drag: {} of {} steps made an invalid solid", invalidSteps, steps));
+
+	FaceRenderVerts faceVerts;
+	std::vector<int> faces;
+	result = run_bench("drag_face_verts", steps, 0, NULL, [&]() {
+		faces = map->get_model_faces_using_verts(modelIdx, movedVerts);
+		for (int faceIdx : faces)
+			BspRenderer::buildFaceVerts(map, faceIdx, NULL, NULL, false, faceVerts);
+		}, NULL);
+	result.items = faces.size();
+	ctx.results.push_back(result);
+
+	BSPMODEL& model = map->models[modelIdx];
+	result = run_bench("drag_model_verts", steps, 0, NULL, [&]() {
+		for (int i = 0; i < model.nFaces; i++)
+			BspRenderer::buildFaceVerts(map, model.iFirstFace + i, NULL, NULL, false, faceVerts);
+		}, NULL);
+	result.items = model.nFaces;
+	ctx.results.push_back(result);
+
+	delete map;
+}
+
+// the entity report filter before it was indexed (without the spawnflag filter), kept as the reference
+// the index is checked against
+static std::vector<int> scan_entities(Bsp* map, const EntityFilter& filter)
+{
+	std::vector<int> visibleEnts;
+	for (size_t i = 1; i < map->ents.size(); i++)
+	{
+		Entity* ent = map->ents[i];
+		bool visible = true;
+
+		if (!filter.classname.empty() && strcasecmp(ent->keyvalues["classname"].c_str(), filter.classname.c_str()) != 0)
+			visible = false;
+
+		for (size_t k = 0; k < filter.keys.size() && visible; k++)
+		{
+			const std::string& searchKey = filter.keys[k];
+			const std::string& searchValue = filter.values[k];
+			if (!searchKey.empty())
+			{
+				bool foundKey = false;
+				std::string actualKey;
+				for (size_t c = 0; c < ent->keyOrder.size(); c++)
+				{
+					std::string key = toLowerCase(ent->keyOrder[c]);
+					if (key == searchKey || (filter.partialMatches && key.find(searchKey) != std::string::npos))
+					{
+						foundKey = true;
+						actualKey = std::move(key);
+						break;
+					}
+				}
+				if (!foundKey)
+					visible = false;
+				else if (!searchValue.empty())
+				{
+					if ((filter.partialMatches && ent->keyvalues[actualKey].find(searchValue) == std::string::npos) ||
+						(!filter.partialMatches && ent->keyvalues[actualKey] != searchValue))
+						visible = false;
+				}
+			}
+			else if (!searchValue.empty())
+			{
+				bool foundMatch = false;
+				for (size_t c = 0; c < ent->keyOrder.size() && !foundMatch; c++)
+				{
+					std::string val = toLowerCase(ent->keyvalues[ent->keyOrder[c]]);
+					foundMatch = val == searchValue || (filter.partialMatches && val.find(searchValue) != std::string::npos);
+				}
+				if (!foundMatch)
+					visible = false;
+			}
+		}
+
+		if (visible)
+			visibleEnts.push_back((int)i);
+	}
+	return visibleEnts;
+}
+
+void bench_entity_search(BenchContext& ctx)
+{
+	if (!ctx.enabled("entity_search"))
+		return;
+
+	Bsp* map = ctx.loadFixture();
+
+	// fills the map up to 50k entities that look like the ones in big maps
+	const char* classnames[] = { "func_door", "trigger_multiple", "multi_manager", "env_sprite", "light",
+		"info_target", "func_breakable", "ambient_generic", "monster_scientist", "path_corner" };
+	for (int i = (int)map->ents.size(); i < 50000; i++)
+	{
+		Entity* ent = new Entity(classnames[i % 10]);
+		ent->addKeyvalue("targetname", fmt::format("{}_{}", classnames[i % 10] + 5, i));
+		if (i % 3 == 0)
+			ent->addKeyvalue("target", fmt::format("{}_{}", classnames[(i / 3) % 10] + 5, i / 3));
+		ent->addKeyvalue("origin", fmt::format("{} {} {}", i % 4096 - 2048, (i * 7) % 4096 - 2048, i % 512));
+		if (i % 10 == 2)
+			ent->addKeyvalue(fmt::format("door_{}", i % 200), "#0");
+		if (i % 10 == 7)
+			ent->addKeyvalue("message", fmt::format("ambience/Sound{}.wav", i % 50));
+		map->ents.push_back(ent);
+	}
+
+	// typing into the entity report, one character at a time
+	struct typed_filter
+	{
+		std::string classname;
+		std::string key;
+		std::string value;
+	};
+	std::vector<typed_filter> typing = {
+		{ "", "", "door_1234" },
+		{ "", "targetname", "manager_42" },
+		{ "func_door", "", "sprite_7" },
+		{ "", "message", "sound4" },
+		{ "ambient_generic", "mess", "" },
+	};
+	std::vector<EntityFilter> keystrokes;
+	for (const typed_filter& typed : typing)
+	{
+		for (size_t len = 0; len <= typed.key.size() + typed.value.size(); len++)
+		{
+			EntityFilter filter;
+			filter.classname = typed.classname;
+			filter.keys.push_back(typed.key.substr(0, len));
+			filter.values.push_back(len > typed.key.size() ? typed.value.substr(0, len - typed.key.size()) : "");
+			keystrokes.push_back(filter);
+		}
+	}
+
+	EntitySearchIndex index;
+	BenchResult result = run_bench("entity_search_index", ctx.iterations, 0, [&]() { index.clear(); }, [&]() { index.update(map); }, NULL);
+	result.items = map->ents.size();
+	ctx.results.push_back(result);
+
+	std::vector<std::vector<int>> expected(keystrokes.size());
+	std::vector<std::vector<int>> found(keystrokes.size());
+	result = run_bench("entity_search_scan", ctx.iterations, 0, NULL, [&]() {
+		for (size_t i = 0; i < keystrokes.size(); i++)
+			expected[i] = scan_entities(map, keystrokes[i]);
+		}, NULL);
+	ctx.results.push_back(result);
+
+	for (size_t i = 0; i < keystrokes.size(); i++)
+		found[i] = EntitySearchIndex::scan(map, NULL, keystrokes[i]);
+	ctx.check(found == expected, "entity_search: EntitySearchIndex::scan differs from the old report filter");
+
+	result = run_bench("entity_search_query", ctx.iterations, 0, NULL, [&]() {
+		for (size_t i = 0; i < keystrokes.size(); i++)
+			found[i] = index.query(map, NULL, keystrokes[i]);
+		}, NULL);
+	ctx.results.push_back(result);
+	ctx.check(found == expected, "entity_search: indexed results differ from the old report filter");
+
+	// an edit between keystrokes only reindexes the edited entity
+	int edits = 0;
+	result = run_bench("entity_search_reindex", ctx.iterations, 0, [&]() {
+		map->ents[map->ents.size() / 2]->setOrAddKeyvalue("targetname", fmt::format("door_1234_{}", edits++));
+		}, [&]() { index.update(map); }, NULL);
+	ctx.results.push_back(result);
+	ctx.check(index.lastReindexCount == 1, fmt::format("entity_search: one edit reindexed {} entities", index.lastReindexCount));
+
+	delete map;
+}
+
+void bench_thumbnails(BenchContext& ctx)
+{
+	if (!ctx.enabled("thumbnails"))
+		return;
+
+	// a wad collection of 5000 128x128 textures, in one block like a loaded wad file
+	const int texCount = 5000;
+	const int texWidth = 128;
+	const int texHeight = 128;
+	int mipSizes[MIPLEVELS] = { texWidth * texHeight, texWidth * texHeight / 4, texWidth * texHeight / 16, texWidth * texHeight / 64 };
+	size_t texSize = sizeof(BSPMIPTEX) + mipSizes[0] + mipSizes[1] + mipSizes[2] + mipSizes[3] + sizeof(short) + sizeof(COLOR3) * 256;
+	std::vector<unsigned char> wadData(texSize * texCount);
+	for (int i = 0; i < texCount; i++)
+	{
+		unsigned char* miptex = wadData.data() + texSize * i;
+		BSPMIPTEX header = BSPMIPTEX();
+		snprintf(header.szName, MAXTEXTURENAME, "tex%d", i);
+		header.nWidth = texWidth;
+		header.nHeight = texHeight;
+		header.nOffsets[0] = sizeof(BSPMIPTEX);
+		for (int m = 1; m < MIPLEVELS; m++)
+			header.nOffsets[m] = header.nOffsets[m - 1] + mipSizes[m - 1];
+		memcpy(miptex, &header, sizeof(BSPMIPTEX));
+		for (size_t k = sizeof(BSPMIPTEX); k < texSize; k++)
+			miptex[k] = (unsigned char)(k * 7 + i);
+	}
+
+	// 8x6 visible cells, scrolling 2 rows per frame to the end and then waiting for the last screen.
+	// The workers decode between frames, so only the frames are timed.
+	const int columns = 8;
+	const int visibleRows = 6;
+	const int scrollRows = 2;
+	int totalRows = (texCount + columns - 1) / columns;
+
+	BenchResult frames;
+	frames.name = "thumbnails_frame";
+	frames.items = columns * visibleRows;
+	for (int it = 0; it < ctx.iterations; it++)
+	{
+		ThumbnailCache cache;
+		cache.uploadToGpu = false;
+		cache.maxThumbnails = 256;
+
+		int firstRow = 0;
+		int settleFrames = 0;
+		bool settled = false;
+		while (!settled && settleFrames < 10000)
+		{
+			auto start = std::chrono::high_resolution_clock::now();
+			cache.beginFrame();
+			int ready = 0;
+			int visible = 0;
+			for (int row = firstRow; row < firstRow + visibleRows && row < totalRows; row++)
+			{
+				for (int col = 0; col < columns && row * columns + col < texCount; col++)
+				{
+					int i = row * columns + col;
+					ThumbnailRequest req;
+					req.owner = &wadData;
+					req.index = i;
+					req.miptex = wadData.data() + texSize * i;
+					req.size = texSize;
+					req.maxSize = 64;
+					visible++;
+					if (cache.get(req))
+						ready++;
+				}
+			}
+			frames.times.push_back(std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count());
+
+			if (firstRow + visibleRows < totalRows)
+				firstRow += scrollRows;
+			else
+			{
+				settleFrames++;
+				settled = ready == visible;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(4));
+		}
+		ctx.check(settled, "thumbnails: the last screen never finished decoding");
+	}
+	ctx.results.push_back(frames);
+
+	// decoding every full size texture up front, like loading a wad for the renderer
+	BenchResult result = run_bench("thumbnails_decode_all", ctx.iterations, wadData.size(), NULL, [&]() {
+		for (int i = 0; i < texCount; i++)
+		{
+			ThumbnailImage image;
+			if (decode_thumbnail(wadData.data() + texSize * i, texSize, texWidth, NULL, image))
+				delete[] image.data;
+		}
+		}, NULL);
+	result.items = texCount;
+	ctx.results.push_back(result);
+}
+
+// cheap summary of the resolved classes, to check that cached fgds match parsed ones
+static std::string fgd_summary(Fgd* fgd)
+{
+	std::string summary;
+	for (FgdClass* c : fgd->classes)
+	{
+		summary += fmt::format("{} {} {} {} {};", c->name, c->classType, c->keyvalues.size(), c->model, c->spawnFlagNames[0]);
+		for (KeyvalueDef& def : c->keyvalues)
+			summary += fmt::format("{}={}:{},", def.name, def.defaultValue, def.choices.size());
+	}
+	summary += fmt::format("|{} {} {}", fgd->pointEntGroups.size(), fgd->solidEntGroups.size(), fgd->existsFlagNames.size());
+	return summary;
+}
+
+void bench_fgd(BenchContext& ctx)
+{
+	if (!ctx.enabled("fgd"))
+		return;
+
+	// a few fgds the size of the big community ones (~1 MB each)
+	const int fgdCount = 4;
+	const int baseCount = 40;
+	const int classCount = 1500;
+	std::error_code ec;
+	std::string dir = ctx.dir + "fgd/";
+	std::string cacheDir = dir + "cache/";
+	fs::remove_all(dir, ec);
+	createDir(dir);
+
+	std::vector<std::string> paths;
+	size_t totalSize = 0;
+	for (int f = 0; f < fgdCount; f++)
+	{
+		std::string fgd;
+		for (int b = 0; b < baseCount; b++)
+		{
+			fgd += fmt::format("@BaseClass {}= Base{}_{}\n[\n", b % 5 ? fmt::format("base(Base{}_{}) ", f, b - 1) : "", f, b);
+			fgd += fmt::format("\tkey{}(string) : \"Key {}\" : \"default {}\"\n", b, b, b);
+			fgd += fmt::format("\trendermode{}(choices) : \"Render Mode\" : 0 =\n\t[\n", b);
+			for (int c = 0; c < 6; c++)
+				fgd += fmt::format("\t\t{} : \"Mode {}\"\n", c, c);
+			fgd += "\t]\n]\n\n";
+		}
+		for (int i = 0; i < classCount; i++)
+		{
+			bool solid = i % 3 == 0;
+			fgd += fmt::format("@{}Class base(Base{}_{}) {}= {}_ent{}_{} : \"Entity {} of fgd {}\"\n[\n",
+				solid ? "Solid" : "Point", f, i % baseCount, solid ? "" : "size(-16 -16 0, 16 16 72) color(255 128 0) ",
+				i % 7 == 0 ? "monster" : i % 7 == 1 ? "func" : "item", f, i, i, f);
+			fgd += "\ttargetname(target_source) : \"Name\"\n\ttarget(target_destination) : \"Target\"\n";
+			fgd += fmt::format("\tmodel(studio) : \"Model\" : \"models/ent{}.mdl\"\n", i);
+			fgd += "\tspawnflags(flags) =\n\t[\n";
+			for (int k = 0; k < 6; k++)
+				fgd += fmt::format("\t\t{} : \"Flag {}\" : 0\n", 1 << k, (i + k) % 20);
+			fgd += "\t]\n";
+			for (int k = 0; k < 8; k++)
+				fgd += fmt::format("\tprop{}(integer) : \"Property {}\" : {} // comment\n", k, k, i * k);
+			fgd += "]\n\n";
+		}
+		paths.push_back(dir + fmt::format("bench{}.fgd", f));
+		writeFile(paths.back(), fgd);
+		totalSize += fgd.size();
+	}
+
+	int parseFailures = 0;
+	auto loadAll = [&](bool parallel, bool cached, std::vector<Fgd*>& fgds) {
+		for (const std::string& path : paths)
+			fgds.push_back(new Fgd(path));
+		std::vector<std::future<bool>> parses;
+		for (Fgd* fgd : fgds)
+		{
+			if (parallel)
+				parses.push_back(std::async(std::launch::async, [fgd, cached, &cacheDir]() {
+				return cached ? fgd->parse(cacheDir) : fgd->parse();
+					}));
+			else if (!(cached ? fgd->parse(cacheDir) : fgd->parse()))
+				parseFailures++;
+		}
+		for (auto& parse : parses)
+		{
+			if (!parse.get())
+				parseFailures++;
+		}
+	};
+	std::vector<Fgd*> fgds;
+	auto deleteFgds = [&]() {
+		for (Fgd* fgd : fgds)
+			delete fgd;
+		fgds.clear();
+	};
+	auto clearCache = [&]() {
+		fs::remove_all(cacheDir, ec);
+		createDir(cacheDir);
+	};
+
+	BenchResult result = run_bench("fgd_parse", ctx.iterations, totalSize, NULL, [&]() { loadAll(false, false, fgds); }, deleteFgds);
+	ctx.results.push_back(result);
+
+	result = run_bench("fgd_parse_parallel", ctx.iterations, totalSize, NULL, [&]() { loadAll(true, false, fgds); }, deleteFgds);
+	ctx.results.push_back(result);
+
+	// startup without a cache: parse and write the cache
+	result = run_bench("fgd_cache_cold", ctx.iterations, totalSize, clearCache, [&]() { loadAll(true, true, fgds); }, deleteFgds);
+	ctx.results.push_back(result);
+
+	int cachedCount = 0;
+	result = run_bench("fgd_cache_warm", ctx.iterations, totalSize, NULL, [&]() { loadAll(true, true, fgds); }, [&]() {
+		for (Fgd* fgd : fgds)
+			cachedCount += fgd->loadedFromCache;
+		deleteFgds();
+		});
+	ctx.results.push_back(result);
+
+	ctx.check(parseFailures == 0, fmt::format("fgd: {} parses failed", parseFailures));
+	ctx.check(cachedCount == fgdCount * ctx.iterations, fmt::format("fgd: {} of {} warm loads came from the cache", cachedCount, fgdCount * ctx.iterations));
+
+	std::vector<Fgd*> parsed;
+	std::vector<Fgd*> parsedParallel;
+	std::vector<Fgd*> cached;
+	g_quiet.begin();
+	loadAll(false, false, parsed);
+	loadAll(true, false, parsedParallel);
+	loadAll(true, true, cached);
+	g_quiet.end();
+	int mismatches = 0;
+	for (int f = 0; f < fgdCount; f++)
+	{
+		std::string summary = fgd_summary(parsed[f]);
+		if (summary != fgd_summary(parsedParallel[f]) || summary != fgd_summary(cached[f]))
+			mismatches++;
+	}
+	ctx.check(mismatches == 0, fmt::format("fgd: {} cached or parallel fgds differ from parsed ones", mismatches));
+	for (std::vector<Fgd*>* list : { &parsed, &parsedParallel, &cached })
+	{
+		for (Fgd* fgd : *list)
+			delete fgd;
+	}
+
+	fs::remove_all(dir, ec);
+}
+
+// every file in the directory and its contents, sorted by name
+static std::map<std::string, std::string> read_dir_files(const std::string& dir)
+{
+	std::map<std::string, std::string> files;
+	std::error_code ec;
+	for (auto& entry : fs::recursive_directory_iterator(dir, ec))
+	{
+		if (!entry.is_regular_file())
+			continue;
+		std::ifstream file(entry.path(), std::ios::binary);
+		std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		files[fs::relative(entry.path(), dir, ec).generic_string()] = data;
+	}
+	return files;
+}
+
+// the fixture and the crc, size and name of every exported file, one per line
+static std::string export_hashes(const BenchContext& ctx, const std::map<std::string, std::string>& files)
+{
+	const BenchFixtureOptions& f = ctx.fixture;
+	std::string hashes = fmt::format("fixture size {} cell {} solid {} models {} textures {} texsize {} visradius {} seed {}\n",
+		f.size, f.cellSize, f.solidPercent, f.models, f.textures, f.textureSize, f.visRadius, f.seed);
+	for (auto& file : files)
+	{
+		unsigned int crc = GetCrc32InMemory((unsigned char*)file.second.data(), (unsigned int)file.second.size());
+		hashes += fmt::format("{:08x} {} {}\n", crc, file.second.size(), file.first);
+	}
+	return hashes;
+}
+
+// compares the export with the hashes that were written by an earlier -writegolden run
+static void check_export_golden(BenchContext& ctx, const std::map<std::string, std::string>& files)
+{
+	std::string hashes = export_hashes(ctx, files);
+	if (ctx.writeGolden)
+	{
+		if (!writeFile(ctx.exportGolden, hashes.c_str(), (int)hashes.size()))
+			ctx.check(false, fmt::format("export: failed to write {}", ctx.exportGolden));
+		return;
+	}
+
+	if (!fileExists(ctx.exportGolden))
+	{
+		ctx.check(false, fmt::format("export: {} does not exist", ctx.exportGolden));
+		return;
+	}
+
+	int length = 0;
+	char* data = loadFile(ctx.exportGolden, length);
+	std::string golden(data, length);
+	delete[] data;
+	golden.erase(std::remove(golden.begin(), golden.end(), '\r'), golden.end());
+
+	std::vector<std::string> expected = splitString(golden, "\n");
+	std::vector<std::string> actual = splitString(hashes, "\n");
+	if (expected.empty() || actual.empty() || expected[0] != actual[0])
+	{
+		ctx.check(false, fmt::format("export: {} was made from another fixture", ctx.exportGolden));
+		return;
+	}
+
+	int differences = 0;
+	for (size_t i = 0; i < std::max(expected.size(), actual.size()); i++)
+	{
+		std::string want = i < expected.size() ? expected[i] : "(none)";
+		std::string got = i < actual.size() ? actual[i] : "(none)";
+		if (want != got && differences++ < 8)
+			logf("    expected {}, got {}\n", want, got);
+	}
+	ctx.check(differences == 0, fmt::format("export: {} lines differ from {}", differences, ctx.exportGolden));
+}
+
+void bench_export(BenchContext& ctx)
+{
+	if (!ctx.enabled("export"))
+		return;
+
+	Bsp* map = ctx.loadFixture();
+	std::error_code ec;
+	std::string serialDir = ctx.dir + "export_serial/";
+	std::string parallelDir = ctx.dir + "export_parallel/";
+
+	GeometryExportOptions options;
+	options.gltf = true;
+
+	options.parallel = false;
+	BenchResult result = run_bench("export", ctx.iterations, 0, [&]() { fs::remove_all(serialDir, ec); },
+		[&]() { export_geometry(map, serialDir, options); }, NULL);
+	ctx.results.push_back(result);
+
+	options.parallel = true;
+	result = run_bench("export_parallel", ctx.iterations, 0, [&]() { fs::remove_all(parallelDir, ec); },
+		[&]() { export_geometry(map, parallelDir, options); }, NULL);
+	ctx.results.push_back(result);
+
+	// the output must not depend on which thread finished first
+	auto serial = read_dir_files(serialDir);
+	ctx.check(!serial.empty(), "export: nothing was written");
+	ctx.check(serial == read_dir_files(parallelDir), "export: the parallel export differs from the serial one");
+	if (!ctx.exportGolden.empty())
+		check_export_golden(ctx, serial);
+
+	fs::remove_all(serialDir, ec);
+	fs::remove_all(parallelDir, ec);
+	delete map;
+}
@@ -0,0 +1,293 @@
+// bspguy_bench: times the core bsp code on generated maps, no window or game files needed.
+// Run with -json to get results that can be diffed between commits. Exits with 2 if a benchmark
+// found results that don't match.
+
+#include "BenchHarness.h"
+#include "Bsp.h"
+#include "BspMerger.h"
+#include "forcecrc32.h"
+#include "quantizer.h"
+#include "vis.h"
+#include "util.h"
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <random>
+
+static void print_help()
+{
+	logf("{}",
+		"bspguy_bench - Time bspguy's bsp code on generated maps\n\n"
+
+		"Usage:   bspguy_bench [options]\n"
+		"Example: bspguy_bench -size 16 -iterations 20 -json results.json\n"
+		"Exits with 2 if a benchmark finds results that don't match.\n"
+
+		"\n[Options]\n"
+		"  -iterations #  : Runs of each benchmark. Default is 10.\n"
+		"  -only a,b,...  : Run only these benchmarks (load, crc, vis_decompress, vis_compress,\n"
+		"                   cleanup, merge, quantize, quantize_dither, trace, tree, drag,\n"
+		"                   entity_search, thumbnails, fgd, export).\n"
+		"  -json [file]   : Write the results as json to the file, or print them instead of the table.\n"
+		"  -keep <dir>    : Write the fixture maps to dir and don't delete them.\n"
+		"  -golden <file> : Check the files of the export benchmark against the hashes in file.\n"
+		"                   src/bench/export_golden.txt has them for the default fixture.\n"
+		"  -writegolden <file> : Write the hashes to file instead, after an intended export change.\n"
+		"  -v             : Show the log output of the benchmarked code.\n"
+
+		"\n[Fixture options]\n"
+		"  -size #        : World grid is # x # x #/2 cells. Default is 12.\n"
+		"  -cell #        : Cell size in units. Default is 128.\n"
+		"  -solid #       : Percent of solid cells. Default is 30.\n"
+		"  -models #      : Brush entities. Default is 32.\n"
+		"  -textures #    : Embedded textures. Default is 8.\n"
+		"  -texsize #     : Texture width and height. Default is 64.\n"
+		"  -visradius #   : Leaves see other leaves up to # cells away. Default is 4.\n"
+		"  -seed #        : Random seed. Default is 1.\n"
+	);
+}
+
+int main(int argc, char* argv[])
+{
+	setlocale(LC_ALL, ".utf8");
+	setlocale(LC_NUMERIC, "C");
+
+	std::map<std::string, std::string> args;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = toLowerCase(argv[i]);
+		if (arg == "help" || arg == "-help" || arg == "--help" || arg == "-h" || arg == "/?")
+		{
+			print_help();
+			return 0;
+		}
+		bool hasValue = i + 1 < argc && argv[i + 1][0] != '-';
+		args[arg] = hasValue ? argv[++i] : "";
+	}
+	auto intArg = [&](const char* name, int def) {
+		return args.count(name) ? atoi(args[name].c_str()) : def;
+	};
+
+	g_verbose = args.count("-v") != 0;
+	g_progress.hide = true;
+
+	BenchContext ctx;
+	int iterations = ctx.iterations = std::max(intArg("-iterations", 10), 1);
+	if (args.count("-only"))
+	{
+		for (std::string name : splitString(args["-only"], ","))
+			ctx.only.push_back(toLowerCase(trimSpaces(name)));
+	}
+	auto enabled = [&](const std::string& name) {
+		return ctx.enabled(name);
+	};
+
+	if (args.count("-golden"))
+		ctx.exportGolden = args["-golden"];
+	if (args.count("-writegolden"))
+	{
+		ctx.exportGolden = args["-writegolden"];
+		ctx.writeGolden = true;
+	}
+
+	BenchFixtureOptions& fixture = ctx.fixture;
+	fixture.size = intArg("-size", fixture.size);
+	fixture.cellSize = intArg("-cell", fixture.cellSize);
+	fixture.solidPercent = intArg("-solid", fixture.solidPercent);
+	fixture.models = intArg("-models", fixture.models);
+	fixture.textures = intArg("-textures", fixture.textures);
+	fixture.textureSize = intArg("-texsize", fixture.textureSize);
+	fixture.visRadius = intArg("-visradius", fixture.visRadius);
+	fixture.seed = (unsigned int)intArg("-seed", (int)fixture.seed);
+
+	std::error_code ec;
+	bool keep = args.count("-keep") && !args["-keep"].empty();
+	std::string dir = ctx.dir = keep ? args["-keep"] + "/" : (fs::temp_directory_path(ec) / "bspguy_bench").string() + "/";
+	createDir(dir);
+	std::string pathA = ctx.pathA = dir + "bench_a.bsp";
+	std::string pathB = ctx.pathB = dir + "bench_b.bsp";
+
+	// the second map is for merging, same size but a different layout
+	BenchFixtureOptions fixtureB = fixture;
+	fixtureB.seed = fixture.seed + 1;
+	BenchFixtureInfo& info = ctx.info;
+	BenchFixtureInfo& infoB = ctx.infoB;
+	g_quiet.begin();
+	auto fixtureStart = std::chrono::high_resolution_clock::now();
+	bool ok = write_bench_fixture(pathA, fixture, &info) && write_bench_fixture(pathB, fixtureB, &infoB);
+	double fixtureTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - fixtureStart).count();
+	g_quiet.end();
+	if (!ok)
+	{
+		logf("Failed to generate the benchmark maps in {}\n", dir);
+		return 1;
+	}
+
+	std::vector<BenchResult>& results = ctx.results;
+	Bsp* map = NULL;
+	Bsp* other = NULL;
+	auto deleteMaps = [&]() {
+		delete map;
+		delete other;
+		map = other = NULL;
+	};
+
+	if (enabled("load"))
+	{
+		results.push_back(run_bench("load", iterations, info.fileSize, NULL,
+			[&]() { map = new Bsp(pathA); }, deleteMaps));
+	}
+
+	if (enabled("crc"))
+	{
+		int length = 0;
+		char* data = loadFile(pathA, length);
+		unsigned int crc = 0;
+		results.push_back(run_bench("crc", iterations, length, NULL,
+			[&]() { crc = GetCrc32InMemory((unsigned char*)data, length); }, NULL));
+		delete[] data;
+	}
+
+	if (enabled("vis_decompress") || enabled("vis_compress"))
+	{
+		g_quiet.begin();
+		map = new Bsp(pathA);
+		g_quiet.end();
+
+		int visLeafCount = map->leafCount - 1;
+		int worldLeaves = map->models[0].nVisLeafs;
+		unsigned int rowSize = ((visLeafCount + 63) & ~63) >> 3;
+		int decompressedSize = worldLeaves * rowSize;
+		std::vector<unsigned char> decompressed(decompressedSize);
+		std::vector<unsigned char> compressed(decompressedSize * 2 + 64);
+		std::vector<BSPLEAF32> leaves(map->leaves, map->leaves + map->leafCount);
+
+		auto decompress = [&]() {
+			decompress_vis_lump(map->leaves, map->visdata, decompressed.data(), worldLeaves, visLeafCount, visLeafCount,
+				map->leafCount * sizeof(BSPLEAF32), map->visDataLength);
+		};
+
+		if (enabled("vis_decompress"))
+		{
+			results.push_back(run_bench("vis_decompress", iterations, decompressedSize,
+				[&]() { memset(decompressed.data(), 0xFF, decompressedSize); }, decompress, NULL));
+		}
+		if (enabled("vis_compress"))
+		{
+			memset(decompressed.data(), 0xFF, decompressedSize);
+			decompress();
+			results.push_back(run_bench("vis_compress", iterations, decompressedSize, NULL, [&]() {
+				CompressAll(leaves.data(), decompressed.data(), compressed.data(), visLeafCount, worldLeaves, (int)compressed.size(), map->leafCount);
+				}, NULL));
+		}
+		deleteMaps();
+	}
+
+	if (enabled("cleanup"))
+	{
+		// half of the brush entities deleted, like after cutting a map down in the editor
+		results.push_back(run_bench("cleanup", iterations, info.fileSize, [&]() {
+			map = new Bsp(pathA);
+			for (int m = map->modelCount - 1; m > 0; m -= 2)
+				map->delete_model(m);
+			}, [&]() { map->remove_unused_model_structures(); }, deleteMaps));
+	}
+
+	if (enabled("merge"))
+	{
+		results.push_back(run_bench("merge", iterations, info.fileSize + infoB.fileSize, [&]() {
+			map = new Bsp(pathA);
+			other = new Bsp(pathB);
+			}, [&]() {
+				BspMerger merger;
+				merger.merge({ map, other }, vec3(), "bench_merged", true, true);
+			}, deleteMaps));
+	}
+
+	// an imported 256x256 truecolor texture
+	const int imageSize = 256;
+	std::vector<COLOR3> image(imageSize * imageSize);
+	std::mt19937 rng(fixture.seed);
+	for (int y = 0; y < imageSize; y++)
+	{
+		for (int x = 0; x < imageSize; x++)
+			image[y * imageSize + x] = COLOR3((unsigned char)x, (unsigned char)(y + rng() % 32), (unsigned char)((x ^ y) + rng() % 32));
+	}
+	std::vector<COLOR3> quantized;
+
+	if (enabled("quantize"))
+	{
+		results.push_back(run_bench("quantize", iterations, image.size() * sizeof(COLOR3), [&]() { quantized = image; }, [&]() {
+			Quantizer quantizer(256, 8);
+			quantizer.ApplyColorTable(quantized.data(), (unsigned int)quantized.size());
+			}, NULL));
+	}
+	if (enabled("quantize_dither"))
+	{
+		results.push_back(run_bench("quantize_dither", iterations, image.size() * sizeof(COLOR3), [&]() { quantized = image; }, [&]() {
+			Quantizer quantizer(256, 8);
+			quantizer.ApplyColorTableDither(quantized.data(), imageSize, imageSize);
+			}, NULL));
+	}
+
+	bench_trace(ctx);
+	bench_tree(ctx);
+	bench_drag(ctx);
+	bench_entity_search(ctx);
+	bench_thumbnails(ctx);
+	bench_fgd(ctx);
+	bench_export(ctx);
+
+	if (!keep)
+		fs::remove_all(dir, ec);
+
+	int exitCode = ctx.failedChecks ? 2 : 0;
+
+	std::string json = fmt::format("{{\n  \"version\": \"{}\",\n  \"iterations\": {},\n  \"peak_reset\": {},\n", g_version_string, iterations, g_peak_reset);
+	json += fmt::format("  \"failed_checks\": {},\n", ctx.failedChecks);
+	json += fmt::format("  \"fixture\": {{\"size\": {}, \"cell\": {}, \"solid\": {}, \"models\": {}, \"textures\": {}, \"texsize\": {}, \"visradius\": {}, \"seed\": {}, "
+		"\"leaves\": {}, \"faces\": {}, \"nodes\": {}, \"vis_bytes\": {}, \"light_bytes\": {}, \"file_bytes\": {}, \"generate_ms\": {:.3f}}},\n",
+		fixture.size, fixture.cellSize, fixture.solidPercent, fixture.models, fixture.textures, fixture.textureSize, fixture.visRadius, fixture.seed,
+		info.leaves, info.faces, info.nodes, info.visBytes, info.lightBytes, info.fileSize, fixtureTime * 1000.0);
+	json += "  \"results\": [\n";
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		BenchResult& r = results[i];
+		json += fmt::format("    {{\"name\": \"{}\", \"min_ms\": {:.4f}, \"median_ms\": {:.4f}, \"mean_ms\": {:.4f}, \"max_ms\": {:.4f}, "
+			"\"mb_per_s\": {:.2f}, \"m_items_per_s\": {:.3f}, \"memory_kb\": {}, \"peak_growth_kb\": {}}}{}\n",
+			r.name, r.min() * 1000.0, r.median() * 1000.0, r.mean() * 1000.0, r.max() * 1000.0,
+			r.bytes / (1024.0 * 1024.0) / std::max(r.median(), 1e-9), r.items / 1000000.0 / std::max(r.median(), 1e-9),
+			r.memoryBefore / 1024, r.peakGrowth / 1024,
+			i + 1 < results.size() ? "," : "");
+	}
+	json += "  ]\n}\n";
+
+	bool jsonToFile = args.count("-json") && !args["-json"].empty();
+	if (jsonToFile && !writeFile(args["-json"], json))
+	{
+		logf("Failed to write {}\n", args["-json"]);
+		return 1;
+	}
+
+	if (args.count("-json") && !jsonToFile)
+	{
+		logf("{}", json);
+		return exitCode;
+	}
+
+	logf("{} ({} iterations)\n", g_version_string, iterations);
+	logf("Fixture: {} leaves, {} faces, {} models, {:.1f} KB ({:.0f} ms to generate)\n\n",
+		info.leaves, info.faces, info.models, info.fileSize / 1024.0, fixtureTime * 1000.0);
+	logf("{:<24} {:>10} {:>10} {:>10} {:>10} {:>10} {:>12}\n", "", "median ms", "min ms", "max ms", "MB/s", "M/s", "peak +KB");
+	for (BenchResult& r : results)
+	{
+		double seconds = std::max(r.median(), 1e-9);
+		logf("{:<24} {:>10.3f} {:>10.3f} {:>10.3f} {:>10} {:>10} {:>12}\n", r.name, r.median() * 1000.0, r.min() * 1000.0, r.max() * 1000.0,
+			r.bytes ? fmt::format("{:.1f}", r.bytes / (1024.0 * 1024.0) / seconds) : "",
+			r.items ? fmt::format("{:.3f}", r.items / 1000000.0 / seconds) : "",
+			g_peak_reset ? std::to_string(r.peakGrowth / 1024) : "n/a");
+	}
+	if (ctx.failedChecks)
+		logf("\n{} checks FAILED\n", ctx.failedChecks);
+	return exitCode;
+}
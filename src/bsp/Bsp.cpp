@@ -5,6 +5,7 @@
 #include "lodepng.h"
 #include "rad.h"
 #include "vis.h"
+#include "visflow.h"
 #include "remap.h"
 #include "Settings.h"
 #include "Renderer.h"
@@ -14,9 +15,17 @@
 #include "Wad.h"
 #include <vector>
 #include "forcecrc32.h"
+#include "BspWriter.h"
+#include "BspValidator.h"
 #include "quantizer.h"
+#include "mipmap.h"
 
 #include <unordered_set>
+#include <functional>
+#include <execution>
+#include <numeric>
+#include <atomic>
+#include <memory>
 
 typedef std::map< std::string, vec3 > mapStringToVector;
 
@@ -40,6 +49,7 @@ void Bsp::init_empty_bsp()
 		replacedLump[i] = true;
 		lumps[i] = new unsigned char[512];
 		memset(lumps[i], 0, 512);
+		lumpCapacity[i] = 512;
 		bsp_header.lump[i].nOffset = 0;
 		bsp_header.lump[i].nLength = 4;
 	}
@@ -88,7 +98,7 @@ void Bsp::init_empty_bsp()
 			create_leaf(CONTENTS_EMPTY);*/
 }
 
-void Bsp::selectModelEnt()
+void Bsp::selectModelEnt(int parentEntIdx)
 {
 	if (!is_bsp_model || ents.empty())
 		return;
@@ -102,15 +112,8 @@ void Bsp::selectModelEnt()
 		{
 			g_app->clearSelection();
 			g_app->selectMap(map);
-			vec3 worldOrigin = map->ents[0]->getOrigin();
-			for (int n = 1; n < map->ents.size(); n++)
-			{
-				if (map->ents[n]->hasKey("model") && (map->ents[n]->getOrigin() + worldOrigin) == ents[0]->getOrigin())
-				{
-					g_app->pickInfo.SetSelectedEnt(n);
-					return;
-				}
-			}
+			if (parentEntIdx > 0 && parentEntIdx < (int)map->ents.size())
+				g_app->pickInfo.SetSelectedEnt(parentEntIdx);
 			return;
 		}
 	}
@@ -136,6 +139,7 @@ Bsp::Bsp()
 	bsp_header = BSPHEADER();
 	bsp_header_ex = BSPHEADER_EX();
 	parentMap = NULL;
+	memset(lumpCapacity, 0, sizeof(lumpCapacity));
 
 	init_empty_bsp();
 }
@@ -160,6 +164,7 @@ Bsp::Bsp(std::string fpath)
 	bsp_header = BSPHEADER();
 	bsp_header_ex = BSPHEADER_EX();
 	parentMap = NULL;
+	memset(lumpCapacity, 0, sizeof(lumpCapacity));
 
 	if (fpath.empty())
 	{
@@ -387,6 +392,33 @@ void Bsp::get_model_vertex_bounds(int modelIdx, vec3& mins, vec3& maxs)
 	}
 }
 
+std::vector<int> Bsp::get_model_faces_using_verts(int modelIdx, std::vector<int> vertIdxs)
+{
+	std::vector<int> modelFaces;
+	if (modelIdx < 0 || modelIdx >= modelCount || vertIdxs.empty())
+		return modelFaces;
+
+	std::sort(vertIdxs.begin(), vertIdxs.end());
+
+	BSPMODEL& model = models[modelIdx];
+	for (int i = 0; i < model.nFaces; i++)
+	{
+		BSPFACE32& face = faces[model.iFirstFace + i];
+		for (int e = 0; e < face.nEdges; e++)
+		{
+			BSPEDGE32& edge = edges[abs(surfedges[face.iFirstEdge + e])];
+			if (std::binary_search(vertIdxs.begin(), vertIdxs.end(), (int)edge.iVertex[0]) ||
+				std::binary_search(vertIdxs.begin(), vertIdxs.end(), (int)edge.iVertex[1]))
+			{
+				modelFaces.push_back(model.iFirstFace + i);
+				break;
+			}
+		}
+	}
+
+	return modelFaces;
+}
+
 std::vector<TransformVert> Bsp::getModelVerts(int modelIdx)
 {
 	std::vector<TransformVert> allVerts;
@@ -595,94 +627,84 @@ std::vector<NodeVolumeCuts> Bsp::get_model_leaf_volume_cuts(int modelIdx, int hu
 
 void Bsp::get_clipnode_leaf_cuts(int iNode, int iStartNode, std::vector<BSPPLANE>& clipOrder, std::vector<NodeVolumeCuts>& output)
 {
-	BSPCLIPNODE32& node = clipnodes[iNode];
+	get_leaf_cuts(getClipnodeTree(), true, iNode, iStartNode, clipOrder, output);
+}
+
+void Bsp::get_node_leaf_cuts(int iNode, int iStartNode, std::vector<BSPPLANE>& clipOrder, std::vector<NodeVolumeCuts>& output)
+{
+	get_leaf_cuts(getNodeTree(), false, iNode, iStartNode, clipOrder, output);
+}
 
-	if (node.iPlane < 0 || node.iPlane >= planeCount)
+void Bsp::get_leaf_cuts(const FlatTree& tree, bool isClipnodeTree, int iNode, int iStartNode, std::vector<BSPPLANE>& clipOrder, std::vector<NodeVolumeCuts>& output)
+{
+	struct CutFrame
 	{
-		return;
-	}
+		int node; // flat index
+		int side; // next child to visit
+	};
+	std::vector<CutFrame> stack;
+	stack.push_back({ tree.flatIndex(iNode), 0 });
+
+	// the plane leading to a node is popped when the node is done, like the recursive version did
+	auto leave_node = [&]() {
+		stack.pop_back();
+		if (!stack.empty())
+			clipOrder.pop_back();
+	};
 
-	for (int i = 0; i < 2; i++)
+	while (!stack.empty())
 	{
-		BSPPLANE plane = planes[node.iPlane];
-		if (i != 0)
-		{
-			plane.vNormal = plane.vNormal.invert();
-			plane.fDist = -plane.fDist;
-		}
-		if (node.iChildren[i] == iStartNode)
+		CutFrame& frame = stack.back();
+		if (frame.node < 0 || frame.node >= (int)tree.nodes.size())
 		{
-			logf("Detect stack overflowing! clipnode.iChildren[i] {} already processed!\n ", node.iChildren[i]);
-			return;
+			leave_node();
+			continue;
 		}
-		clipOrder.push_back(plane);
 
-		if (node.iChildren[i] >= 0)
+		int iPlane = tree.planeIndex[frame.node];
+		if (frame.side == 2 || (isClipnodeTree && (iPlane < 0 || iPlane >= planeCount)))
 		{
-			get_clipnode_leaf_cuts(node.iChildren[i], iStartNode, clipOrder, output);
+			leave_node();
+			continue;
 		}
-		else if (node.iChildren[i] != CONTENTS_EMPTY)
-		{
-			NodeVolumeCuts nodeVolumeCuts;
-			nodeVolumeCuts.nodeIdx = iNode;
 
-			if (clipOrder.size())
-			{
-				// reverse order of branched planes = order of cuts to the world which define this node's volume
-				// https://qph.fs.quoracdn.net/main-qimg-2a8faad60cc9d437b58a6e215e6e874d
-				for (int k = (int)clipOrder.size() - 1; k >= 0; k--)
-				{
-					nodeVolumeCuts.cuts.push_back(clipOrder[k]);
-				}
-			}
-			output.push_back(nodeVolumeCuts);
+		int i = frame.side++;
+		int child = tree.nodes[frame.node].children[i];
+		int lumpChild = child >= 0 && child < (int)tree.nodes.size() ? tree.lumpIndex[child] : child;
+		if (lumpChild == iStartNode)
+		{
+			logf("Detect stack overflowing! {}.iChildren[i] {} already processed!\n ", isClipnodeTree ? "clipnode" : "node", lumpChild);
+			leave_node();
+			continue;
 		}
 
-		clipOrder.pop_back();
-	}
-}
-
-void Bsp::get_node_leaf_cuts(int iNode, int iStartNode, std::vector<BSPPLANE>& clipOrder, std::vector<NodeVolumeCuts>& output)
-{
-	BSPNODE32& node = nodes[iNode];
-
-	for (int i = 0; i < 2; i++)
-	{
-		BSPPLANE plane = planes[node.iPlane];
+		BSPPLANE plane = planes[iPlane];
 		if (i != 0)
 		{
 			plane.vNormal = plane.vNormal.invert();
 			plane.fDist = -plane.fDist;
 		}
-
-		if (node.iChildren[i] == iStartNode)
-		{
-			logf("Detect stack overflowing! node.iChildren[i] {} already processed!\n ", node.iChildren[i]);
-			return;
-		}
-
 		clipOrder.push_back(plane);
 
-		if (node.iChildren[i] >= 0)
+		if (child >= 0)
 		{
-			get_node_leaf_cuts(node.iChildren[i], iStartNode, clipOrder, output);
+			stack.push_back({ child, 0 });
+			continue;
 		}
-		else if (leaves[~node.iChildren[i]].nContents != CONTENTS_EMPTY)
+
+		bool solid = isClipnodeTree ? child != CONTENTS_EMPTY : leaves[~child].nContents != CONTENTS_EMPTY;
+		if (solid)
 		{
 			NodeVolumeCuts nodeVolumeCuts;
-			nodeVolumeCuts.nodeIdx = iNode;
-			if (clipOrder.size())
+			nodeVolumeCuts.nodeIdx = tree.lumpIndex[frame.node];
+			// reverse order of branched planes = order of cuts to the world which define this node's volume
+			// https://qph.fs.quoracdn.net/main-qimg-2a8faad60cc9d437b58a6e215e6e874d
+			for (int k = (int)clipOrder.size() - 1; k >= 0; k--)
 			{
-				// reverse order of branched planes = order of cuts to the world which define this node's volume
-				// https://qph.fs.quoracdn.net/main-qimg-2a8faad60cc9d437b58a6e215e6e874d
-				for (int k = (int)clipOrder.size() - 1; k >= 0; k--)
-				{
-					nodeVolumeCuts.cuts.push_back(clipOrder[k]);
-				}
+				nodeVolumeCuts.cuts.push_back(clipOrder[k]);
 			}
 			output.push_back(nodeVolumeCuts);
 		}
-
 		clipOrder.pop_back();
 	}
 }
@@ -766,31 +788,40 @@ bool Bsp::vertex_manipulation_sync(int modelIdx, std::vector<TransformVert>& hul
 	if (modelIdx < 0)
 		return false;
 
-	std::set<int> affectedPlanes;
-
-	std::map<int, std::vector<vec3>> planeVerts;
-	std::vector<vec3> allVertPos;
+	// (plane, hull vert) pairs sorted by plane. This runs on every drag step, so there are no
+	// per plane containers.
+	std::vector<std::pair<int, int>> planeVerts;
+	std::vector<vec3> allVertPos(hullVerts.size());
 
 	for (int i = 0; i < hullVerts.size(); i++)
 	{
 		for (int k = 0; k < hullVerts[i].iPlanes.size(); k++)
 		{
-			int iPlane = hullVerts[i].iPlanes[k];
-			if (!affectedPlanes.count(hullVerts[i].iPlanes[k]))
-				affectedPlanes.insert(hullVerts[i].iPlanes[k]);
-			planeVerts[iPlane].push_back(hullVerts[i].pos);
+			planeVerts.emplace_back(hullVerts[i].iPlanes[k], i);
 		}
-		allVertPos.push_back(hullVerts[i].pos);
+		allVertPos[i] = hullVerts[i].pos;
 	}
+	std::sort(planeVerts.begin(), planeVerts.end());
+
+	struct PlaneUpdate
+	{
+		int iPlane;
+		BSPPLANE plane;
+		bool flipChildren;
+	};
 
 	int planeUpdates = 0;
-	std::map<int, BSPPLANE> newPlanes;
-	std::map<int, bool> shouldFlipChildren;
-	for (auto it = planeVerts.begin(); it != planeVerts.end(); ++it)
+	std::vector<PlaneUpdate> newPlanes;
+	std::vector<vec3> tverts;
+	for (size_t first = 0, last = 0; first < planeVerts.size(); first = last)
 	{
-		int iPlane = it->first;
+		int iPlane = planeVerts[first].first;
 
-		std::vector<vec3>& tverts = it->second;
+		tverts.clear();
+		for (last = first; last < planeVerts.size() && planeVerts[last].first == iPlane; last++)
+		{
+			tverts.push_back(hullVerts[planeVerts[last].second].pos);
+		}
 
 		if (tverts.size() < 3)
 		{
@@ -827,22 +858,20 @@ bool Bsp::vertex_manipulation_sync(int modelIdx, std::vector<TransformVert>& hul
 			return false;
 		}
 
-		newPlanes[iPlane] = newPlane;
-		shouldFlipChildren[iPlane] = flipped != expectedFlip;
+		newPlanes.push_back({ iPlane, newPlane, flipped != expectedFlip });
 	}
 
 	if (convexCheckOnly)
 		return true;
 
-	for (auto it = newPlanes.begin(); it != newPlanes.end(); ++it)
+	for (const PlaneUpdate& update : newPlanes)
 	{
-		auto iPlane = it->first;
-		BSPPLANE& newPlane = it->second;
+		int iPlane = update.iPlane;
 
-		planes[iPlane] = newPlane;
+		planes[iPlane] = update.plane;
 		planeUpdates++;
 
-		if (shouldFlipChildren[iPlane])
+		if (update.flipChildren)
 		{
 			for (int i = 0; i < faceCount; i++)
 			{
@@ -866,6 +895,7 @@ bool Bsp::vertex_manipulation_sync(int modelIdx, std::vector<TransformVert>& hul
 	}
 
 	//logf("UPDATED {} planes\n", planeUpdates);
+	invalidate_traversal_layout();
 
 	BSPMODEL& model = models[modelIdx];
 	getBoundingBox(allVertPos, model.nMins, model.nMaxs);
@@ -1046,6 +1076,7 @@ bool Bsp::move(vec3 offset, int modelIdx, bool onlyModel, bool forceMove, bool l
 		// get distance between new plane origin and the origin-aligned plane
 		plane.fDist = dotProduct(plane.vNormal, newPlaneOri) / dotProduct(plane.vNormal, plane.vNormal);
 	}
+	invalidate_traversal_layout();
 
 	for (int i = 0; i < texinfoCount; i++)
 	{
@@ -1360,7 +1391,7 @@ void Bsp::split_shared_model_structures(int modelIdx)
 	memcpy(newClipnodes, clipnodes, clipnodeCount * sizeof(BSPCLIPNODE32));
 
 	BSPTEXTUREINFO* newTexinfos = new BSPTEXTUREINFO[newTexinfoCount];
-	memcpy(newTexinfos, texinfos, newTexinfoCount * sizeof(BSPTEXTUREINFO));
+	memcpy(newTexinfos, texinfos, texinfoCount * sizeof(BSPTEXTUREINFO));
 
 	int addIdx = planeCount;
 	for (unsigned int i = 0; i < shouldNotMove.count.planes; i++)
@@ -1517,6 +1548,8 @@ int Bsp::delete_embedded_textures()
 
 void Bsp::replace_lumps(LumpState& state)
 {
+	stop_render_face_build();
+
 	for (unsigned int i = 0; i < HEADER_LUMPS; i++)
 	{
 		if (!state.lumps[i])
@@ -1526,6 +1559,7 @@ void Bsp::replace_lumps(LumpState& state)
 
 		delete[] lumps[i];
 		lumps[i] = new unsigned char[state.lumpLen[i]];
+		lumpCapacity[i] = 0;
 		memcpy(lumps[i], state.lumps[i], state.lumpLen[i]);
 		bsp_header.lump[i].nLength = state.lumpLen[i];
 
@@ -1540,6 +1574,7 @@ void Bsp::replace_lumps(LumpState& state)
 
 unsigned int Bsp::remove_unused_structs(int lumpIdx, bool* usedStructs, int* remappedIndexes)
 {
+	ProfileScope profile(g_lump_names[lumpIdx]);
 	int structSize = 0;
 
 	switch (lumpIdx)
@@ -1605,6 +1640,7 @@ unsigned int Bsp::remove_unused_structs(int lumpIdx, bool* usedStructs, int* rem
 
 unsigned int Bsp::remove_unused_textures(bool* usedTextures, int* remappedIndexes, int* removeddata)
 {
+	ProfileScope profile("TEXTURES");
 	int oldTexCount = textureCount;
 
 	int removeCount = 0;
@@ -1721,6 +1757,7 @@ unsigned int Bsp::remove_unused_textures(bool* usedTextures, int* remappedIndexe
 
 unsigned int Bsp::remove_unused_lightmaps(bool* usedFaces)
 {
+	ProfileScope profile("LIGHTING");
 	int oldLightdataSize = lightDataLength;
 
 	int* lightmapSizes = new int[faceCount] {};
@@ -1764,6 +1801,7 @@ unsigned int Bsp::remove_unused_lightmaps(bool* usedFaces)
 
 unsigned int Bsp::remove_unused_visdata(bool* usedLeaves, BSPLEAF32* oldLeaves, int oldLeafCount, int oldLeavesMemSize)
 {
+	ProfileScope profile("VISIBILITY");
 	int oldVisLength = visDataLength;
 
 	// exclude solid leaf
@@ -1774,46 +1812,35 @@ unsigned int Bsp::remove_unused_visdata(bool* usedLeaves, BSPLEAF32* oldLeaves,
 	int newWorldLeaves = ((BSPMODEL*)lumps[LUMP_MODELS])->nVisLeafs;
 
 	unsigned int oldVisRowSize = ((oldVisLeafCount + 63) & ~63) >> 3;
-	unsigned int newVisRowSize = ((newVisLeafCount + 63) & ~63) >> 3;
-
-	int decompressedVisSize = oldLeafCount * oldVisRowSize;
-	unsigned char* decompressedVis = new unsigned char[decompressedVisSize];
-	memset(decompressedVis, 0xFF, decompressedVisSize);
-	decompress_vis_lump(oldLeaves, lumps[LUMP_VISIBILITY], decompressedVis,
-		oldWorldLeaves, oldVisLeafCount - 1, oldVisLeafCount - 1, oldLeavesMemSize, bsp_header.lump[LUMP_VISIBILITY].nLength);
-
-	if (oldVisRowSize != newVisRowSize)
-	{
-		int newDecompressedVisSize = oldLeafCount * newVisRowSize;
-		int minRowSize = std::min(oldVisRowSize, newVisRowSize);
-		unsigned char* newDecompressedVis = new unsigned char[newDecompressedVisSize];
-		memset(newDecompressedVis, 0xFF, newDecompressedVisSize);
 
-		for (int i = 0; i < oldWorldLeaves; i++)
-		{
-			if ((int)(i * newVisRowSize + minRowSize) >= newDecompressedVisSize)
-			{
-				logf("Overflow decompressedVis!\n");
-				break;
-			}
-			memcpy(newDecompressedVis + i * newVisRowSize, decompressedVis + i * oldVisRowSize, minRowSize);
-		}
-
-		delete[] decompressedVis;
-		decompressedVis = newDecompressedVis;
-	}
-
-	unsigned char* compressedVis = new unsigned char[decompressedVisSize];
-	memset(compressedVis, 0, decompressedVisSize);
-	int newVisLen = CompressAll(leaves, decompressedVis, compressedVis, newVisLeafCount - 1, newWorldLeaves, decompressedVisSize, leafCount);
+	// rows are decompressed one at a time and cut to the new row size while recompressing,
+	// the full vis matrix is never held in memory
+	unsigned int oldDecompressedRowSize = ((oldVisLeafCount - 1 + 63) & ~63) >> 3;
+	unsigned int newDecompressedRowSize = ((newVisLeafCount - 1 + 63) & ~63) >> 3;
+	unsigned int minRowSize = std::min(oldDecompressedRowSize, newDecompressedRowSize);
+
+	unsigned char* oldVisLump = lumps[LUMP_VISIBILITY];
+	int oldVisLumpLen = bsp_header.lump[LUMP_VISIBILITY].nLength;
+	int oldVisRows = count_vis_rows(oldLeaves, oldWorldLeaves, oldLeavesMemSize, oldVisLumpLen);
+
+	auto getRow = [&](int row, unsigned char* dest)
+		{
+			if (row >= oldVisRows)
+				return; // everything visible
+			thread_local std::vector<unsigned char> oldRow;
+			oldRow.assign(oldDecompressedRowSize, 0xFF);
+			decompress_vis_row(oldLeaves, oldVisLump, oldRow.data(), row,
+				oldWorldLeaves, oldVisLeafCount - 1, oldVisLeafCount - 1, oldVisLumpLen);
+			memcpy(dest, oldRow.data(), minRowSize);
+		};
 
-	unsigned char* compressedVisResized = new unsigned char[newVisLen];
-	memcpy(compressedVisResized, compressedVis, newVisLen);
+	std::vector<unsigned char> compressedVis;
+	int newVisLen = CompressAllStreamed(leaves, getRow, compressedVis, newVisLeafCount - 1, newWorldLeaves, oldLeafCount * oldVisRowSize, leafCount);
 
-	replace_lump(LUMP_VISIBILITY, compressedVisResized, newVisLen);
+	unsigned char* newVisLump = new unsigned char[newVisLen];
+	memcpy(newVisLump, compressedVis.data(), newVisLen);
 
-	delete[] decompressedVis;
-	delete[] compressedVis;
+	replace_lump(LUMP_VISIBILITY, newVisLump, newVisLen);
 
 	return oldVisLength - newVisLen;
 	/*int oldVisLength = visDataLength;
@@ -1924,6 +1951,7 @@ void Bsp::clean_unused_texinfos()
 
 int Bsp::merge_all_verts(float epsilon)
 {
+	ProfileScope profile("Merge vertices");
 	int merged_verts = 0;
 	std::vector<vec3> result_verts;
 
@@ -1958,6 +1986,7 @@ STRUCTCOUNT Bsp::remove_unused_model_structures(unsigned int target)
 	if (!modelCount)
 		return STRUCTCOUNT();
 
+	ProfileScope profile("Clean " + bsp_name);
 	update_lump_pointers();
 
 	if (g_settings.mark_unused_texinfos && target & CLEAN_TEXINFOS)
@@ -1987,6 +2016,7 @@ STRUCTCOUNT Bsp::remove_unused_model_structures(unsigned int target)
 	// reversed so models can be deleted without shifting the next delete index
 	if (modelCount > 0)
 	{
+		ProfileScope markProfile("Mark used structures");
 		for (int i = modelCount - 1; i >= 0; i--)
 		{
 			if (!usedModels[i])
@@ -2132,6 +2162,8 @@ STRUCTCOUNT Bsp::remove_unused_model_structures(unsigned int target)
 				models[i].iHeadnodes[k] = remap.clipnodes[models[i].iHeadnodes[k]];
 		}
 	}
+	invalidate_traversal_layout();
+	invalidate_face_indexes();
 
 	delete[] usedModels;
 
@@ -2316,6 +2348,7 @@ bool Bsp::has_hull2_ents()
 
 STRUCTCOUNT Bsp::delete_unused_hulls(bool noProgress)
 {
+	ProfileScope profile("Delete unused hulls");
 	if (!noProgress)
 	{
 		if (g_verbose)
@@ -2749,32 +2782,31 @@ int Bsp::lightmap_count(int faceIdx)
 	return lightmapCount;
 }
 
-void Bsp::write(const std::string& path)
+// converted copy of a lump, produced chunk by chunk while writing
+struct LumpOutput
 {
-	// Make single backup
-	if (g_settings.backUpMap && fileExists(path) && !fileExists(path + ".bak"))
-	{
-		int len;
-		char* oldfile = loadFile(path, len);
-		std::ofstream file(path + ".bak", std::ios::trunc | std::ios::binary);
-		if (!file.is_open())
-		{
-			logf("Failed to open backup file for writing:\n{}\n", path);
-			return;
-		}
-		logf("Writing backup to {}\n", path + ".bak");
+	unsigned char* data = NULL; // unconverted lump
+	int count = 0;              // elements to convert
+	int elemSize = 0;           // size of one converted element
+	std::function<void(int first, int n, unsigned char* dst)> convert;
 
-		file.write(oldfile, len);
-		delete[] oldfile;
+	void raw(unsigned char* lump, int len)
+	{
+		data = lump;
+		count = len;
+		elemSize = 1;
+		convert = nullptr;
 	}
 
-	std::ofstream file(path, std::ios::trunc | std::ios::binary);
-	if (!file.is_open())
+	int length() const
 	{
-		logf("Failed to open BSP file for writing:\n{}\n", path);
-		return;
+		return count * elemSize;
 	}
+};
 
+void Bsp::write(const std::string& path)
+{
+	ProfileScope profile("Write " + bsp_name);
 	//if (is_bsp2_old)
 	//{
 	//	is_bsp2_old = false;
@@ -2784,222 +2816,268 @@ void Bsp::write(const std::string& path)
 
 	update_lump_pointers();
 
+	// describe every lump as it should look on disk, conversions are done chunk by chunk while writing
+	LumpOutput output[HEADER_LUMPS];
+	for (int i = 0; i < HEADER_LUMPS; i++)
+	{
+		output[i].raw(lumps[i], bsp_header.lump[i].nLength);
+	}
 
-	unsigned char* nulls = new unsigned char[sizeof(BSPHEADER) + sizeof(BSPHEADER_EX)];
-
-	file.write((const char*)nulls, is_bsp30ext && extralumps ? sizeof(BSPHEADER) + sizeof(BSPHEADER_EX) : sizeof(BSPHEADER));
-
-	delete[] nulls;
-
-	unsigned char* oldLighting = (unsigned char*)lightdata;
-	unsigned char* freelighting = NULL;
-
-	// first process, for face restore offsets
 	if (!is_colored_lightmap)
 	{
-		int lightPixels = bsp_header.lump[LUMP_LIGHTING].nLength / sizeof(COLOR3);
-
 		COLOR3* oldLight = (COLOR3*)lightdata;
-		freelighting = new unsigned char[lightPixels];
-
-		for (int m = 0; m < lightPixels; m++)
-		{
-			freelighting[m] = (unsigned char)((int)(oldLight[m].r + oldLight[m].g + oldLight[m].b) / 3);
-		}
-
-		bsp_header.lump[LUMP_LIGHTING].nLength = lightPixels;
-		lumps[LUMP_LIGHTING] = (unsigned char*)freelighting;
-
-
-		int offset = 0;
-
-		for (int n = 0; n < faceCount; n++)
+		output[LUMP_LIGHTING].count = bsp_header.lump[LUMP_LIGHTING].nLength / sizeof(COLOR3);
+		output[LUMP_LIGHTING].elemSize = 1;
+		output[LUMP_LIGHTING].convert = [oldLight](int first, int n, unsigned char* dst)
 		{
-			faces[n].nLightmapOffset /= sizeof(COLOR3);
-		}
+			for (int m = 0; m < n; m++)
+			{
+				const COLOR3& c = oldLight[first + m];
+				dst[m] = (unsigned char)((int)(c.r + c.g + c.b) / 3);
+			}
+		};
 	}
 
-	unsigned char* oldClipnodes = (unsigned char*)clipnodes;
-	BSPCLIPNODE16* freeClipnodes16 = NULL;
-
 	if (!is_bsp2 && (is_broken_clipnodes || !is_32bit_clipnodes || bsp_header.lump[LUMP_CLIPNODES].nLength / sizeof(BSPCLIPNODE32) < MAX_MAP_CLIPNODES_DEFAULT))
 	{
-		freeClipnodes16 = new BSPCLIPNODE16[clipnodeCount];
-		for (int n = 0; n < clipnodeCount; n++)
+		output[LUMP_CLIPNODES].count = clipnodeCount;
+		output[LUMP_CLIPNODES].elemSize = sizeof(BSPCLIPNODE16);
+		output[LUMP_CLIPNODES].convert = [this](int first, int n, unsigned char* dst)
 		{
-			if (is_broken_clipnodes)
-			{
-				freeClipnodes16[n].iChildren[0] =
-					(unsigned short)clipnodes[n].iChildren[0] > clipnodeCount ? 65536 - (unsigned short)clipnodes[n].iChildren[0] : clipnodes[n].iChildren[0];
-				freeClipnodes16[n].iChildren[1] =
-					(unsigned short)clipnodes[n].iChildren[1] > clipnodeCount ? 65536 - (unsigned short)clipnodes[n].iChildren[0] : clipnodes[n].iChildren[1];
-			}
-			else
+			BSPCLIPNODE16* out = (BSPCLIPNODE16*)dst;
+			for (int k = 0; k < n; k++)
 			{
-				freeClipnodes16[n].iChildren[0] = (short)clipnodes[n].iChildren[0];
-				freeClipnodes16[n].iChildren[1] = (short)clipnodes[n].iChildren[1];
+				const BSPCLIPNODE32& node = clipnodes[first + k];
+				if (is_broken_clipnodes)
+				{
+					out[k].iChildren[0] =
+						(unsigned short)node.iChildren[0] > clipnodeCount ? 65536 - (unsigned short)node.iChildren[0] : node.iChildren[0];
+					out[k].iChildren[1] =
+						(unsigned short)node.iChildren[1] > clipnodeCount ? 65536 - (unsigned short)node.iChildren[0] : node.iChildren[1];
+				}
+				else
+				{
+					out[k].iChildren[0] = (short)node.iChildren[0];
+					out[k].iChildren[1] = (short)node.iChildren[1];
+				}
+				out[k].iPlane = node.iPlane;
 			}
-			freeClipnodes16[n].iPlane = clipnodes[n].iPlane;
-		}
-		bsp_header.lump[LUMP_CLIPNODES].nLength = clipnodeCount * sizeof(BSPCLIPNODE16);
-		lumps[LUMP_CLIPNODES] = (unsigned char*)freeClipnodes16;
+		};
 	}
 
-	unsigned char* oldnodes = (unsigned char*)nodes;
-	BSPNODE16* freenodes16 = NULL;
-	BSPNODE32A* freenodes32a = NULL;
-
 	if (!is_bsp2)
 	{
-		freenodes16 = new BSPNODE16[nodeCount];
-		for (int n = 0; n < nodeCount; n++)
+		output[LUMP_NODES].count = nodeCount;
+		output[LUMP_NODES].elemSize = sizeof(BSPNODE16);
+		output[LUMP_NODES].convert = [this](int first, int n, unsigned char* dst)
 		{
-			freenodes16[n].iChildren[0] = (short)nodes[n].iChildren[0];
-			freenodes16[n].iChildren[1] = (short)nodes[n].iChildren[1];
-			freenodes16[n].iPlane = nodes[n].iPlane;
-
-			freenodes16[n].firstFace = (unsigned short)nodes[n].firstFace;
-			freenodes16[n].nFaces = (unsigned short)nodes[n].nFaces;
-			for (int m = 0; m < 3; m++)
+			BSPNODE16* out = (BSPNODE16*)dst;
+			for (int k = 0; k < n; k++)
 			{
-				freenodes16[n].nMaxs[m] = (short)round(nodes[n].nMaxs[m]);
-				freenodes16[n].nMins[m] = (short)round(nodes[n].nMins[m]);
+				const BSPNODE32& node = nodes[first + k];
+				out[k].iChildren[0] = (short)node.iChildren[0];
+				out[k].iChildren[1] = (short)node.iChildren[1];
+				out[k].iPlane = node.iPlane;
+
+				out[k].firstFace = (unsigned short)node.firstFace;
+				out[k].nFaces = (unsigned short)node.nFaces;
+				for (int m = 0; m < 3; m++)
+				{
+					out[k].nMaxs[m] = (short)round(node.nMaxs[m]);
+					out[k].nMins[m] = (short)round(node.nMins[m]);
+				}
 			}
-		}
-		bsp_header.lump[LUMP_NODES].nLength = nodeCount * sizeof(BSPNODE16);
-		lumps[LUMP_NODES] = (unsigned char*)freenodes16;
+		};
 	}
 	else if (is_bsp2_old)
 	{
-		freenodes32a = new BSPNODE32A[nodeCount];
-		for (int n = 0; n < nodeCount; n++)
+		output[LUMP_NODES].count = nodeCount;
+		output[LUMP_NODES].elemSize = sizeof(BSPNODE32A);
+		output[LUMP_NODES].convert = [this](int first, int n, unsigned char* dst)
 		{
-			freenodes32a[n].iChildren[0] = nodes[n].iChildren[0];
-			freenodes32a[n].iChildren[1] = nodes[n].iChildren[1];
-			freenodes32a[n].iPlane = nodes[n].iPlane;
-
-			freenodes32a[n].firstFace = nodes[n].firstFace;
-			freenodes32a[n].nFaces = nodes[n].nFaces;
-			for (int m = 0; m < 3; m++)
+			BSPNODE32A* out = (BSPNODE32A*)dst;
+			for (int k = 0; k < n; k++)
 			{
-				freenodes32a[n].nMaxs[m] = (short)round(nodes[n].nMaxs[m]);
-				freenodes32a[n].nMins[m] = (short)round(nodes[n].nMins[m]);
+				const BSPNODE32& node = nodes[first + k];
+				out[k].iChildren[0] = node.iChildren[0];
+				out[k].iChildren[1] = node.iChildren[1];
+				out[k].iPlane = node.iPlane;
+
+				out[k].firstFace = node.firstFace;
+				out[k].nFaces = node.nFaces;
+				for (int m = 0; m < 3; m++)
+				{
+					out[k].nMaxs[m] = (short)round(node.nMaxs[m]);
+					out[k].nMins[m] = (short)round(node.nMins[m]);
+				}
 			}
-		}
-		bsp_header.lump[LUMP_NODES].nLength = nodeCount * sizeof(BSPNODE32A);
-		lumps[LUMP_NODES] = (unsigned char*)freenodes32a;
+		};
 	}
 
-
-	unsigned char* oldfaces = (unsigned char*)faces;
-	BSPFACE16* freefaces16 = NULL;
+	// monochrome lightmaps are addressed by pixel instead of by rgb triplet
+	bool monoLightOffsets = !is_colored_lightmap;
+	auto faceLightOffset = [monoLightOffsets](int offset)
+	{
+		return monoLightOffsets && offset > 0 ? offset / (int)sizeof(COLOR3) : offset;
+	};
 
 	if (!is_bsp2)
 	{
-		freefaces16 = new BSPFACE16[faceCount];
-		for (int n = 0; n < faceCount; n++)
+		output[LUMP_FACES].count = faceCount;
+		output[LUMP_FACES].elemSize = sizeof(BSPFACE16);
+		output[LUMP_FACES].convert = [this, faceLightOffset](int first, int n, unsigned char* dst)
+		{
+			BSPFACE16* out = (BSPFACE16*)dst;
+			for (int k = 0; k < n; k++)
+			{
+				const BSPFACE32& face = faces[first + k];
+				out[k].iFirstEdge = face.iFirstEdge;
+				out[k].iPlane = (unsigned short)face.iPlane;
+				out[k].iTextureInfo = (short)face.iTextureInfo;
+				out[k].nEdges = (short)face.nEdges;
+				out[k].nLightmapOffset = faceLightOffset(face.nLightmapOffset);
+				out[k].nPlaneSide = (short)face.nPlaneSide;
+				for (int m = 0; m < MAXLIGHTMAPS; m++)
+				{
+					out[k].nStyles[m] = face.nStyles[m];
+				}
+			}
+		};
+	}
+	else if (monoLightOffsets)
+	{
+		output[LUMP_FACES].count = faceCount;
+		output[LUMP_FACES].elemSize = sizeof(BSPFACE32);
+		output[LUMP_FACES].convert = [this, faceLightOffset](int first, int n, unsigned char* dst)
 		{
-			freefaces16[n].iFirstEdge = faces[n].iFirstEdge;
-			freefaces16[n].iPlane = (unsigned short)faces[n].iPlane;
-			freefaces16[n].iTextureInfo = (short)faces[n].iTextureInfo;
-			freefaces16[n].nEdges = (short)faces[n].nEdges;
-			freefaces16[n].nLightmapOffset = faces[n].nLightmapOffset;
-			freefaces16[n].nPlaneSide = (short)faces[n].nPlaneSide;
-			for (int m = 0; m < MAXLIGHTMAPS; m++)
+			BSPFACE32* out = (BSPFACE32*)dst;
+			memcpy(out, faces + first, n * sizeof(BSPFACE32));
+			for (int k = 0; k < n; k++)
 			{
-				freefaces16[n].nStyles[m] = faces[n].nStyles[m];
+				out[k].nLightmapOffset = faceLightOffset(out[k].nLightmapOffset);
 			}
-		}
-		bsp_header.lump[LUMP_FACES].nLength = faceCount * sizeof(BSPFACE16);
-		lumps[LUMP_FACES] = (unsigned char*)freefaces16;
+		};
 	}
 
-	unsigned char* oldmarksurfs = (unsigned char*)marksurfs;
-	unsigned short* freemarksurfs16 = NULL;
-
 	if (!is_bsp2)
 	{
-		freemarksurfs16 = new unsigned short[marksurfCount];
-		for (int n = 0; n < marksurfCount; n++)
+		output[LUMP_MARKSURFACES].count = marksurfCount;
+		output[LUMP_MARKSURFACES].elemSize = sizeof(unsigned short);
+		output[LUMP_MARKSURFACES].convert = [this](int first, int n, unsigned char* dst)
 		{
-			freemarksurfs16[n] = (unsigned short)marksurfs[n];
-		}
-		bsp_header.lump[LUMP_MARKSURFACES].nLength = marksurfCount * sizeof(unsigned short);
-		lumps[LUMP_MARKSURFACES] = (unsigned char*)freemarksurfs16;
+			unsigned short* out = (unsigned short*)dst;
+			for (int k = 0; k < n; k++)
+			{
+				out[k] = (unsigned short)marksurfs[first + k];
+			}
+		};
 	}
 
-	unsigned char* oldleaves = (unsigned char*)leaves;
-	BSPLEAF16* freeleaves16 = NULL;
-	BSPLEAF32A* freeleaves32a = NULL;
-
 	if (!is_bsp2)
 	{
-		freeleaves16 = new BSPLEAF16[leafCount];
-		for (int n = 0; n < leafCount; n++)
+		output[LUMP_LEAVES].count = leafCount;
+		output[LUMP_LEAVES].elemSize = sizeof(BSPLEAF16);
+		output[LUMP_LEAVES].convert = [this](int first, int n, unsigned char* dst)
 		{
-			freeleaves16[n].iFirstMarkSurface = (unsigned short)leaves[n].iFirstMarkSurface;
-			freeleaves16[n].nMarkSurfaces = (unsigned short)leaves[n].nMarkSurfaces;
-			for (int m = 0; m < MAX_AMBIENTS; m++)
-			{
-				freeleaves16[n].nAmbientLevels[m] = leaves[n].nAmbientLevels[m];
-			}
-			freeleaves16[n].nContents = leaves[n].nContents;
-			freeleaves16[n].nVisOffset = leaves[n].nVisOffset;
-			for (int m = 0; m < 3; m++)
+			BSPLEAF16* out = (BSPLEAF16*)dst;
+			for (int k = 0; k < n; k++)
 			{
-				freeleaves16[n].nMaxs[m] = (short)round(leaves[n].nMaxs[m]);
-				freeleaves16[n].nMins[m] = (short)round(leaves[n].nMins[m]);
+				const BSPLEAF32& leaf = leaves[first + k];
+				out[k].iFirstMarkSurface = (unsigned short)leaf.iFirstMarkSurface;
+				out[k].nMarkSurfaces = (unsigned short)leaf.nMarkSurfaces;
+				for (int m = 0; m < MAX_AMBIENTS; m++)
+				{
+					out[k].nAmbientLevels[m] = leaf.nAmbientLevels[m];
+				}
+				out[k].nContents = leaf.nContents;
+				out[k].nVisOffset = leaf.nVisOffset;
+				for (int m = 0; m < 3; m++)
+				{
+					out[k].nMaxs[m] = (short)round(leaf.nMaxs[m]);
+					out[k].nMins[m] = (short)round(leaf.nMins[m]);
+				}
 			}
-		}
-		bsp_header.lump[LUMP_LEAVES].nLength = leafCount * sizeof(BSPLEAF16);
-		lumps[LUMP_LEAVES] = (unsigned char*)freeleaves16;
+		};
 	}
 	else if (is_bsp2_old)
 	{
-		freeleaves32a = new BSPLEAF32A[leafCount];
-		for (int n = 0; n < leafCount; n++)
+		output[LUMP_LEAVES].count = leafCount;
+		output[LUMP_LEAVES].elemSize = sizeof(BSPLEAF32A);
+		output[LUMP_LEAVES].convert = [this](int first, int n, unsigned char* dst)
 		{
-			freeleaves32a[n].iFirstMarkSurface = leaves[n].iFirstMarkSurface;
-			freeleaves32a[n].nMarkSurfaces = leaves[n].nMarkSurfaces;
-			for (int m = 0; m < MAX_AMBIENTS; m++)
+			BSPLEAF32A* out = (BSPLEAF32A*)dst;
+			for (int k = 0; k < n; k++)
 			{
-				freeleaves32a[n].nAmbientLevels[m] = leaves[n].nAmbientLevels[m];
+				const BSPLEAF32& leaf = leaves[first + k];
+				out[k].iFirstMarkSurface = leaf.iFirstMarkSurface;
+				out[k].nMarkSurfaces = leaf.nMarkSurfaces;
+				for (int m = 0; m < MAX_AMBIENTS; m++)
+				{
+					out[k].nAmbientLevels[m] = leaf.nAmbientLevels[m];
+				}
+				out[k].nContents = leaf.nContents;
+				out[k].nVisOffset = leaf.nVisOffset;
+				for (int m = 0; m < 3; m++)
+				{
+					out[k].nMaxs[m] = (short)round(leaf.nMaxs[m]);
+					out[k].nMins[m] = (short)round(leaf.nMins[m]);
+				}
 			}
-			freeleaves32a[n].nContents = leaves[n].nContents;
-			freeleaves32a[n].nVisOffset = leaves[n].nVisOffset;
-			for (int m = 0; m < 3; m++)
+		};
+	}
+
+	if (!is_bsp2)
+	{
+		output[LUMP_EDGES].count = edgeCount;
+		output[LUMP_EDGES].elemSize = sizeof(BSPEDGE16);
+		output[LUMP_EDGES].convert = [this](int first, int n, unsigned char* dst)
+		{
+			BSPEDGE16* out = (BSPEDGE16*)dst;
+			for (int k = 0; k < n; k++)
 			{
-				freeleaves32a[n].nMaxs[m] = (short)round(leaves[n].nMaxs[m]);
-				freeleaves32a[n].nMins[m] = (short)round(leaves[n].nMins[m]);
+				out[k].iVertex[0] = (unsigned short)edges[first + k].iVertex[0];
+				out[k].iVertex[1] = (unsigned short)edges[first + k].iVertex[1];
 			}
-		}
-		bsp_header.lump[LUMP_LEAVES].nLength = leafCount * sizeof(BSPLEAF32A);
-		lumps[LUMP_LEAVES] = (unsigned char*)freeleaves32a;
+		};
+	}
+
+	// file lump slot -> lump
+	int lumpOrder[HEADER_LUMPS];
+	for (int i = 0; i < HEADER_LUMPS; i++)
+	{
+		lumpOrder[i] = i;
+	}
+	if (is_blue_shift)
+	{
+		std::swap(lumpOrder[LUMP_PLANES], lumpOrder[LUMP_ENTITIES]);
 	}
 
-	unsigned char* oldedges = (unsigned char*)edges;
-	BSPEDGE16* freeedges16 = NULL;
+	// build the header and the lump layout before writing anything
+	bool writeExtraLumps = is_bsp30ext && extralumps;
+	int extralumpscount = bsp_header_ex.nVersion <= 3 ? EXTRA_LUMPS_OLD : EXTRA_LUMPS;
 
-	if (!is_bsp2)
+	BSPHEADER outHeader = bsp_header;
+	int offset = sizeof(BSPHEADER);
+
+	if (writeExtraLumps)
 	{
-		freeedges16 = new BSPEDGE16[edgeCount];
-		for (int n = 0; n < edgeCount; n++)
+		offset += sizeof(BSPHEADER_EX);
+		for (int i = 0; i < extralumpscount; i++)
 		{
-			freeedges16[n].iVertex[0] = (unsigned short)edges[n].iVertex[0];
-			freeedges16[n].iVertex[1] = (unsigned short)edges[n].iVertex[1];
+			bsp_header_ex.lump[i].nOffset = offset;
+			offset += (bsp_header_ex.lump[i].nLength + 3) & ~3;
 		}
-		bsp_header.lump[LUMP_EDGES].nLength = edgeCount * sizeof(BSPEDGE16);
-		lumps[LUMP_EDGES] = (unsigned char*)freeedges16;
 	}
 
-
-	if (is_blue_shift)
+	for (int i = 0; i < HEADER_LUMPS; i++)
 	{
-		std::swap(bsp_header.lump[LUMP_PLANES], bsp_header.lump[LUMP_ENTITIES]);
-		std::swap(lumps[LUMP_PLANES], lumps[LUMP_ENTITIES]);
+		outHeader.lump[i].nOffset = offset;
+		outHeader.lump[i].nLength = output[lumpOrder[i]].length();
+		offset += (outHeader.lump[i].nLength + 3) & ~3;
 	}
 
-	if (g_settings.preserveCrc32 && !force_skip_crc)
+	bool spoofCrc = g_settings.preserveCrc32 && !force_skip_crc;
+	if (spoofCrc)
 	{
 		if (ents.size() && ents[0]->hasKey("CRC"))
 		{
@@ -3009,200 +3087,111 @@ void Bsp::write(const std::string& path)
 		}
 		else
 			logf("SPOOFING CRC value.\nOriginal crc: {}. ", reverse_bits(originCrc32));
+	}
 
-		unsigned int crc32 = UINT32_C(0xFFFFFFFF);
-
-		for (int i = 0; i < HEADER_LUMPS; i++)
-		{
-			if (i != LUMP_ENTITIES)
-				crc32 = GetCrc32InMemory(lumps[i], bsp_header.lump[i].nLength, crc32);
-		}
-
-		logf("Current value: {}. ", reverse_bits(crc32));
-
-		if (originCrc32 == crc32)
-		{
-			logf("Same values. Skip hacking.\n");
-		}
-		else
-		{
-			int originsize = bsp_header.lump[LUMP_MODELS].nLength;
-
-			unsigned char* tmpNewModelds = new unsigned char[originsize + sizeof(BSPMODEL)];
-
-			memset(tmpNewModelds, 0, originsize + sizeof(BSPMODEL));
-
-			memcpy(tmpNewModelds, lumps[LUMP_MODELS], originsize);
-
-			BSPMODEL* lastmodel = (BSPMODEL*)(tmpNewModelds + (modelCount * sizeof(BSPMODEL)));
-
-			lastmodel->vOrigin.z = 9999.0f;
-
-			delete[] lumps[LUMP_MODELS];
-			lumps[LUMP_MODELS] = tmpNewModelds;
-
-			bsp_header.lump[LUMP_MODELS].nLength = originsize + sizeof(BSPMODEL);
-
-			crc32 = UINT32_C(0xFFFFFFFF);
-
-
-			for (int i = 0; i < HEADER_LUMPS; i++)
-			{
-				if (i != LUMP_ENTITIES)
-					crc32 = GetCrc32InMemory(lumps[i], bsp_header.lump[i].nLength, crc32);
-			}
-
-			PathCrc32InMemory(lumps[LUMP_MODELS], bsp_header.lump[LUMP_MODELS].nLength, originsize, crc32, originCrc32);
-
-			crc32 = UINT32_C(0xFFFFFFFF);
-			for (int i = 0; i < HEADER_LUMPS; i++)
-			{
-				if (i != LUMP_ENTITIES)
-					crc32 = GetCrc32InMemory(lumps[i], bsp_header.lump[i].nLength, crc32);
-			}
-
-			logf("Hacked value: {}. \n", reverse_bits(crc32));
-		}
+	BspWriter file(path);
+	if (!file.open())
+	{
+		logf("Failed to open BSP file for writing:\n{}\n", path);
+		return;
 	}
 
 	logf("Writing {}\n", bsp_path);
-	// calculate lump offsets
-	int offset = sizeof(BSPHEADER);
 
-	if (is_bsp30ext && extralumps)
+	// appended to the models lump to force the crc, must live until the writer is flushed
+	BSPMODEL spoofModel = BSPMODEL();
+	spoofModel.vOrigin.z = 9999.0f;
+
+	file.write(&outHeader, sizeof(BSPHEADER));
+	if (writeExtraLumps)
 	{
-		offset += sizeof(BSPHEADER_EX);
+		file.write(&bsp_header_ex, sizeof(BSPHEADER_EX));
 
-		int extralumpscount = bsp_header_ex.nVersion <= 3 ? EXTRA_LUMPS_OLD : EXTRA_LUMPS;
 		for (int i = 0; i < extralumpscount; i++)
 		{
-			bsp_header_ex.lump[i].nOffset = offset;
-			offset += bsp_header_ex.lump[i].nLength;
-			file.write((char*)extralumps[i], bsp_header_ex.lump[i].nLength);
-
 			int padding = ((bsp_header_ex.lump[i].nLength + 3) & ~3) - bsp_header_ex.lump[i].nLength;
-			if (padding > 0)
-			{
-				offset += padding;
-				unsigned char* zeropad = new unsigned char[padding];
-				memset(zeropad, 0, padding);
-				file.write((const char*)zeropad, padding);
-				delete[] zeropad;
-			}
+			file.write(extralumps[i], bsp_header_ex.lump[i].nLength);
+			file.pad(padding);
 			if (g_settings.verboseLogs)
 				logf("Write extra lump {} size {} offset {} + {} align bytes\n", i, bsp_header_ex.lump[i].nLength, bsp_header_ex.lump[i].nOffset, padding);
-
 		}
 	}
 
-	// write the lumps
+	// write the lumps, the crc is computed on the fly (the entity slot is not part of it)
 	for (int i = 0; i < HEADER_LUMPS; i++)
 	{
-		bsp_header.lump[i].nOffset = offset;
-		offset += bsp_header.lump[i].nLength;
-		file.write((char*)lumps[i], bsp_header.lump[i].nLength);
+		const LumpOutput& lump = output[lumpOrder[i]];
+		bool crc = i != LUMP_ENTITIES;
 
-		int padding = ((bsp_header.lump[i].nLength + 3) & ~3) - bsp_header.lump[i].nLength;
-		if (padding > 0)
+		if (!lump.convert)
 		{
-			offset += padding;
-			unsigned char* zeropad = new unsigned char[padding];
-			memset(zeropad, 0, padding);
-			file.write((const char*)zeropad, padding);
-			delete[] zeropad;
+			file.write(lump.data, lump.length(), crc);
+		}
+		else
+		{
+			int chunkCount = (int)(BspWriter::CHUNK_SIZE / lump.elemSize);
+			for (int first = 0; first < lump.count; first += chunkCount)
+			{
+				int n = std::min(chunkCount, lump.count - first);
+				unsigned char* chunk = file.reserve(n * lump.elemSize);
+				if (!chunk)
+					break;
+				lump.convert(first, n, chunk);
+				file.write(chunk, n * lump.elemSize, crc);
+			}
 		}
 
-		if (g_settings.verboseLogs)
-			logf("Write lump {} size {} offset {} + {} align bytes\n", i, bsp_header.lump[i].nLength, bsp_header.lump[i].nOffset, padding);
-	}
+		int padding = ((outHeader.lump[i].nLength + 3) & ~3) - outHeader.lump[i].nLength;
 
-	file.seekp(0);
-	file.write((char*)&bsp_header, sizeof(BSPHEADER));
-	if (is_bsp30ext && extralumps)
-	{
-		file.write((char*)&bsp_header_ex, sizeof(BSPHEADER_EX));
-	}
+		// the models lump is last, the spoof model goes between its data and the padding
+		if (i == LUMP_MODELS && spoofCrc)
+		{
+			logf("Current value: {}. ", reverse_bits(file.crc32));
 
-	if (is_blue_shift)
-	{
-		std::swap(bsp_header.lump[LUMP_PLANES], bsp_header.lump[LUMP_ENTITIES]);
-		std::swap(lumps[LUMP_PLANES], lumps[LUMP_ENTITIES]);
-	}
+			if (originCrc32 == file.crc32)
+			{
+				logf("Same values. Skip hacking.\n");
+			}
+			else
+			{
+				unsigned int crc32 = GetCrc32InMemory((unsigned char*)&spoofModel, sizeof(BSPMODEL), file.crc32);
+				PathCrc32InMemory((unsigned char*)&spoofModel, sizeof(BSPMODEL), 0, crc32, originCrc32);
+				file.write(&spoofModel, sizeof(BSPMODEL), true);
 
-	if (freeClipnodes16)
-	{
-		delete[] freeClipnodes16;
-		lumps[LUMP_CLIPNODES] = (unsigned char*)oldClipnodes;
-		bsp_header.lump[LUMP_CLIPNODES].nLength = clipnodeCount * sizeof(BSPCLIPNODE32);
-	}
+				outHeader.lump[i].nLength += sizeof(BSPMODEL);
+				padding = ((outHeader.lump[i].nLength + 3) & ~3) - outHeader.lump[i].nLength;
 
-	if (freenodes16)
-	{
-		delete[] freenodes16;
-		lumps[LUMP_NODES] = (unsigned char*)oldnodes;
-		bsp_header.lump[LUMP_NODES].nLength = nodeCount * sizeof(BSPNODE32);
-	}
-	else if (freenodes32a)
-	{
-		delete[] freenodes32a;
-		lumps[LUMP_NODES] = (unsigned char*)oldnodes;
-		bsp_header.lump[LUMP_NODES].nLength = nodeCount * sizeof(BSPNODE32);
-	}
+				logf("Hacked value: {}. \n", reverse_bits(file.crc32));
+			}
+		}
 
-	if (freeedges16)
-	{
-		delete[] freeedges16;
-		lumps[LUMP_EDGES] = (unsigned char*)oldedges;
-		bsp_header.lump[LUMP_EDGES].nLength = edgeCount * sizeof(BSPEDGE32);
-	}
+		file.pad(padding);
 
-	if (freemarksurfs16)
-	{
-		delete[] freemarksurfs16;
-		lumps[LUMP_MARKSURFACES] = (unsigned char*)oldmarksurfs;
-		bsp_header.lump[LUMP_MARKSURFACES].nLength = marksurfCount * sizeof(int);
+		if (g_settings.verboseLogs)
+			logf("Write lump {} size {} offset {} + {} align bytes\n", i, outHeader.lump[i].nLength, outHeader.lump[i].nOffset, padding);
 	}
 
-	if (freefaces16)
+	// only the spoofed models lump length can differ from the prebuilt header
+	if (outHeader.lump[LUMP_MODELS].nLength != output[lumpOrder[LUMP_MODELS]].length())
 	{
-		delete[] freefaces16;
-		lumps[LUMP_FACES] = (unsigned char*)oldfaces;
-		bsp_header.lump[LUMP_FACES].nLength = faceCount * sizeof(BSPFACE32);
+		file.writeAt(0, &outHeader, sizeof(BSPHEADER));
 	}
 
-	if (freeleaves16)
+	if (!file.commit(g_settings.backUpMap ? path + ".bak" : std::string()))
 	{
-		delete[] freeleaves16;
-		lumps[LUMP_LEAVES] = (unsigned char*)oldleaves;
-		bsp_header.lump[LUMP_LEAVES].nLength = leafCount * sizeof(BSPLEAF32);
-	}
-	else if (freeleaves32a)
-	{
-		delete[] freeleaves32a;
-		lumps[LUMP_LEAVES] = (unsigned char*)oldleaves;
-		bsp_header.lump[LUMP_LEAVES].nLength = leafCount * sizeof(BSPLEAF32);
+		logf("Failed to write BSP file:\n{}\n", path);
+		return;
 	}
 
-	// revert monochrome lighting and face offsets
-	if (freelighting)
+	for (int i = 0; i < HEADER_LUMPS; i++)
 	{
-		delete[] freelighting;
-		lumps[LUMP_LIGHTING] = (unsigned char*)oldLighting;
-		bsp_header.lump[LUMP_LIGHTING].nLength = lightDataLength * sizeof(COLOR3);
-		if (!is_colored_lightmap)
-		{
-			for (int n = 0; n < faceCount; n++)
-			{
-				faces[n].nLightmapOffset = faces[n].nLightmapOffset * sizeof(COLOR3);
-			}
-		}
+		bsp_header.lump[lumpOrder[i]].nOffset = outHeader.lump[i].nOffset;
 	}
-
-	update_lump_pointers();
 }
 
 bool Bsp::load_lumps(std::string fpath)
 {
+	ProfileScope profile("Load " + fpath);
 	bool valid = true;
 
 	// Read all BSP Data
@@ -3754,10 +3743,10 @@ bool Bsp::load_lumps(std::string fpath)
 			newLight[m] = COLOR3(lumps[LUMP_LIGHTING][m], lumps[LUMP_LIGHTING][m], lumps[LUMP_LIGHTING][m]);
 		}
 
-		delete lumps[LUMP_LIGHTING];
+		delete[] lumps[LUMP_LIGHTING];
+		lumps[LUMP_LIGHTING] = NULL;
 
-		lumps[LUMP_LIGHTING] = (unsigned char*)newLight;
-		bsp_header.lump[LUMP_LIGHTING].nLength = lightPixels * sizeof(COLOR3);
+		replace_lump(LUMP_LIGHTING, newLight, lightPixels * sizeof(COLOR3));
 
 
 		for (int n = 0; n < faceCount; n++)
@@ -3914,14 +3903,14 @@ void Bsp::print_stat(const std::string& name, unsigned int val, unsigned int max
 		print_color(PRINT_RED | PRINT_GREEN | PRINT_BLUE);
 	}
 
-	logf("{:-12s}  ", name);
+	logf("{:<12}  ", name);
 	if (isMem)
 	{
 		logf("{:8.2f} /{:5.2f} MB", val / meg, max / meg);
 	}
 	else
 	{
-		logf("{:8u} / {:-8u}", val, max);
+		logf("{:>8} / {:<8}", val, max);
 	}
 	logf(" {:6.1f}%", percent);
 
@@ -3953,11 +3942,11 @@ void Bsp::print_model_stat(STRUCTUSAGE* modelInfo, unsigned int val, int max, bo
 
 	if (isMem)
 	{
-		logf("{:8.1f} / {:-5.1f} MB", val / meg, max / meg);
+		logf("{:8.1f} / {:<5.1f} MB", val / meg, max / meg);
 	}
 	else
 	{
-		logf("{:-26s} {:-26s} *{:-6d} {:9d}", classname, targetname, modelInfo->modelIdx, val);
+		logf("{:<26} {:<26} *{:<6} {:9}", classname, targetname, modelInfo->modelIdx, val);
 	}
 	if (percent >= 0.1f)
 		logf("  {:6.1f}%", percent);
@@ -4002,246 +3991,9 @@ bool Bsp::isValid()
 
 bool Bsp::validate()
 {
-	bool isValid = true;
-
-	for (int i = 0; i < marksurfCount; i++)
-	{
-		if (marksurfs[i] >= faceCount)
-		{
-			logf("Bad face reference in marksurf {}: {} / {}\n", i, marksurfs[i], faceCount);
-			isValid = false;
-		}
-	}
-	for (int i = 0; i < surfedgeCount; i++)
-	{
-		if (abs(surfedges[i]) >= edgeCount)
-		{
-			logf("Bad edge reference in surfedge {}: {} / {}\n", i, surfedges[i], edgeCount);
-			isValid = false;
-		}
-	}
-	for (int i = 0; i < texinfoCount; i++)
-	{
-		if (texinfos[i].iMiptex >= textureCount)
-		{
-			logf("Bad texture reference in textureinfo {}: {} / {}\n", i, texinfos[i].iMiptex, textureCount);
-			isValid = false;
-		}
-	}
-	for (int i = 0; i < faceCount; i++)
-	{
-		if (faces[i].iPlane >= planeCount)
-		{
-			logf("Bad plane reference in face {}: {} / {}\n", i, faces[i].iPlane, planeCount);
-			isValid = false;
-		}
-		if (faces[i].nEdges > 0 && faces[i].iFirstEdge >= surfedgeCount)
-		{
-			logf("Bad surfedge reference in face {}: {} / {}\n", i, faces[i].iFirstEdge, surfedgeCount);
-			isValid = false;
-		}
-		if (faces[i].iTextureInfo >= texinfoCount)
-		{
-			logf("Bad textureinfo reference in face {}: {} / {}\n", i, faces[i].iTextureInfo, texinfoCount);
-			isValid = false;
-		}
-		if (lightDataLength > 0 &&
-			faces[i].nLightmapOffset >= 0 && faces[i].nLightmapOffset > lightDataLength)
-		{
-			logf("Bad lightmap offset in face {}: {} / {}\n", i, faces[i].nLightmapOffset, lightDataLength);
-			isValid = false;
-		}
-	}
-	for (int i = 0; i < leafCount; i++)
-	{
-		if (leaves[i].nMarkSurfaces > 0 && leaves[i].iFirstMarkSurface >= marksurfCount)
-		{
-			logf("Bad marksurf reference in leaf {}: {} / {}\n", i, leaves[i].iFirstMarkSurface, marksurfCount);
-			isValid = false;
-		}
-		if (visDataLength > 0 &&
-			leaves[i].nVisOffset != -1 && (leaves[i].nVisOffset < 0 || leaves[i].nVisOffset >= visDataLength))
-		{
-			logf("Bad vis offset in leaf {}: {} / {}\n", i, leaves[i].nVisOffset, visDataLength);
-			isValid = false;
-		}
-
-		for (int n = 0; n < 3; n++)
-		{
-			if (leaves[i].nMins[n] > leaves[i].nMaxs[n])
-			{
-				logf("backwards mins / maxs in leaf {} Mins: ({}, {}, {}) Maxs: ({} {} {})", i, leaves[i].nMins[0], leaves[i].nMins[1], leaves[i].nMins[2],
-					leaves[i].nMaxs[0], leaves[i].nMaxs[1], leaves[i].nMaxs[2]);
-				isValid = false;
-			}
-		}
-	}
-	for (int i = 0; i < edgeCount; i++)
-	{
-		for (int k = 0; k < 2; k++)
-		{
-			if (edges[i].iVertex[k] >= vertCount)
-			{
-				logf("Bad vertex reference in edge {}: {} / {}\n", i, edges[i].iVertex[k], vertCount);
-				isValid = false;
-			}
-		}
-	}
-	for (int i = 0; i < nodeCount; i++)
-	{
-		if (nodes[i].nFaces > 0 && nodes[i].firstFace >= faceCount)
-		{
-			logf("Bad face reference in node {}: {} / {}\n", i, nodes[i].firstFace, faceCount);
-			isValid = false;
-		}
-		if (nodes[i].iPlane >= planeCount)
-		{
-			logf("Bad plane reference in node {}: {} / {}\n", i, nodes[i].iPlane, planeCount);
-			isValid = false;
-		}
-		for (int k = 0; k < 2; k++)
-		{
-			if (nodes[i].iChildren[k] != -1 && nodes[i].iChildren[k] > 0 && nodes[i].iChildren[k] >= nodeCount)
-			{
-				logf("Bad node reference in node {} child {}: {} / {}\n", i, k, nodes[i].iChildren[k], nodeCount);
-				isValid = false;
-			}
-			else if (~nodes[i].iChildren[k] != -1 && nodes[i].iChildren[k] < 0 && ~nodes[i].iChildren[k] >= leafCount)
-			{
-				logf("Bad leaf reference in ~node {} child {}: {} / {}\n", i, k, ~nodes[i].iChildren[k], leafCount);
-				isValid = false;
-			}
-		}
-	}
-	for (int i = 0; i < clipnodeCount; i++)
-	{
-		if (clipnodes[i].iPlane < 0 || clipnodes[i].iPlane >= planeCount)
-		{
-			logf("Bad plane reference in clipnode {}: {} / {}\n", i, clipnodes[i].iPlane, planeCount);
-			isValid = false;
-		}
-		for (int k = 0; k < 2; k++)
-		{
-			if (clipnodes[i].iChildren[k] > 0 && clipnodes[i].iChildren[k] >= clipnodeCount)
-			{
-				logf("Bad clipnode reference in clipnode {} child {}: {} / {}\n", i, k, clipnodes[i].iChildren[k], clipnodeCount);
-				isValid = false;
-			}
-		}
-	}
-	for (int i = 0; i < ents.size(); i++)
-	{
-		if (ents[i]->getBspModelIdxForce() > 0 && ents[i]->getBspModelIdxForce() >= modelCount)
-		{
-			logf("Bad model reference in entity {}: {} / {}\n", i, ents[i]->getBspModelIdxForce(), modelCount);
-			isValid = false;
-		}
-	}
-
-
-	int totalVisLeaves = 1; // solid leaf not included in model leaf counts
-	int totalFaces = 0;
-	for (int i = 0; i < modelCount; i++)
-	{
-		totalVisLeaves += models[i].nVisLeafs;
-		totalFaces += models[i].nFaces;
-		if (models[i].nFaces > 0 && (models[i].iFirstFace < 0 || models[i].iFirstFace >= faceCount))
-		{
-			logf("Bad face reference in model {}: {} / {}\n", i, models[i].iFirstFace, faceCount);
-			isValid = false;
-		}
-		if (models[i].iHeadnodes[0] >= nodeCount)
-		{
-			logf("Bad node reference in model {} hull 0: {} / {}\n", i, models[i].iHeadnodes[0], nodeCount);
-			isValid = false;
-		}
-		for (int k = 1; k < MAX_MAP_HULLS; k++)
-		{
-			if (models[i].iHeadnodes[k] >= clipnodeCount)
-			{
-				logf("Bad clipnode reference in model {} hull {}: {} / {}\n", i, k, models[i].iHeadnodes[k], clipnodeCount);
-				isValid = false;
-			}
-		}
-		if (models[i].nMins.x > models[i].nMaxs.x ||
-			models[i].nMins.y > models[i].nMaxs.y ||
-			models[i].nMins.z > models[i].nMaxs.z)
-		{
-			logf("Backwards mins/maxs in model {}. Mins: ({}, {}, {}) Maxs: ({} {} {})\n", i,
-				models[i].nMins.x, models[i].nMins.y, models[i].nMins.z,
-				models[i].nMaxs.x, models[i].nMaxs.y, models[i].nMaxs.z);
-			isValid = false;
-		}
-	}
-	if (totalVisLeaves != leafCount)
-	{
-		logf("Bad model vis leaf sum: {} / {}\n", totalVisLeaves, leafCount);
-		isValid = false;
-	}
-
-	if (totalFaces > faceCount)
-	{
-		logf("Bad model face sum: {} / {}\n", totalFaces, faceCount);
-		isValid = false;
-	}
-
-	unsigned int worldspawn_count = 0;
-	for (unsigned int i = 0; i < ents.size(); i++)
-	{
-		if (ents[i]->isWorldSpawn())
-		{
-			worldspawn_count++;
-		}
-	}
-	if (worldspawn_count != 1)
-	{
-		logf("Found {} worldspawn entities (expected 1).All ents:{}\nThis can cause crashes and svc_bad errors.\n", worldspawn_count, ents.size());
-		isValid = false;
-	}
-
-	std::set<int> used_models; // Protected map
-	used_models.insert(0);
-
-	for (auto const& s : ents)
-	{
-		int ent_mdl_id = s->getBspModelIdx();
-		if (ent_mdl_id >= 0)
-		{
-			if (!used_models.count(ent_mdl_id))
-			{
-				used_models.insert(ent_mdl_id);
-			}
-		}
-	}
-
-	for (int i = 0; i < modelCount; i++)
-	{
-		if (!used_models.count(i))
-		{
-			logf("Warning: in map {} found unused model: {}.\n", bsp_name, i);
-		}
-	}
-
-	for (int i = 0; i < textureCount; i++)
-	{
-		int texOffset = ((int*)textures)[i + 1];
-		if (texOffset >= 0)
-		{
-			int texlen = getBspTextureSize(i);
-			int dataOffset = (textureCount + 1) * sizeof(int);
-			BSPMIPTEX* tex = (BSPMIPTEX*)(textures + texOffset);
-			if (tex->szName[0] == '\0' || strlen(tex->szName) >= MAXTEXTURENAME)
-			{
-				logf("Warning: invalid texture name in {} texture.\n", i);
-			}
-			if (tex->nOffsets[0] > 0 && dataOffset + texOffset + texlen > bsp_header.lump[LUMP_TEXTURES].nLength)
-			{
-				logf("Warning: texture data buffer overrun in {} texture.\n", i);
-			}
-		}
-	}
-
-	return isValid;
+	ValidationReport report = validate_bsp(this);
+	report.print();
+	return report.valid();
 }
 
 std::vector<STRUCTUSAGE*> Bsp::get_sorted_model_infos(int sortMode)
@@ -4294,7 +4046,7 @@ void Bsp::print_info(bool perModelStats, int perModelLimit, int sortMode)
 		case SORT_FACES:		maxCount = faceCount; countName = "  Faces";  break;
 		}
 
-		logf("       Classname                  Targetname          Model  {:-10s}  Usage\n", countName);
+		logf("       Classname                  Targetname          Model  {:<10}  Usage\n", countName);
 		logf("-------------------------  -------------------------  -----  ----------  --------\n");
 
 		for (int i = 0; i < modelCount && i < perModelLimit; i++)
@@ -4345,27 +4097,38 @@ void Bsp::print_model_bsp(int modelIdx)
 
 void Bsp::print_clipnode_tree(int iNode, int depth)
 {
-	for (int i = 0; i < depth; i++)
-	{
-		logf("    ");
-	}
+	const FlatTree& tree = getClipnodeTree();
+	std::vector<std::pair<int, int>> stack; // flat index or contents, depth
+	stack.push_back({ tree.flatIndex(iNode), depth });
 
-	if (iNode < 0)
-	{
-		logf(getLeafContentsName(iNode));
-		logf("\n");
-		return;
-	}
-	else
+	while (!stack.empty())
 	{
-		BSPPLANE& plane = planes[clipnodes[iNode].iPlane];
-		logf("NODE ({:.2f}, {:.2f}, {:.2f} @ {:.2}\n", plane.vNormal.x, plane.vNormal.y, plane.vNormal.z, plane.fDist);
-	}
+		int node = stack.back().first;
+		int nodeDepth = stack.back().second;
+		stack.pop_back();
 
+		for (int i = 0; i < nodeDepth; i++)
+		{
+			logf("    ");
+		}
 
-	for (int i = 0; i < 2; i++)
-	{
-		print_clipnode_tree(clipnodes[iNode].iChildren[i], depth + 1);
+		if (node < 0)
+		{
+			logf(getLeafContentsName(node));
+			logf("\n");
+			continue;
+		}
+		if (node >= (int)tree.nodes.size())
+		{
+			logf("BAD CLIPNODE\n");
+			continue;
+		}
+
+		const FlatNode& flat = tree.nodes[node];
+		logf("NODE ({:.2f}, {:.2f}, {:.2f} @ {:.2}\n", flat.normal[0], flat.normal[1], flat.normal[2], flat.dist);
+
+		stack.push_back({ flat.children[1], nodeDepth + 1 });
+		stack.push_back({ flat.children[0], nodeDepth + 1 });
 	}
 }
 
@@ -4434,26 +4197,40 @@ std::vector<int> Bsp::get_model_ents_ids(int modelIdx)
 
 void Bsp::recurse_node(int nodeIdx, int depth)
 {
-	for (int i = 0; i < depth; i++)
-	{
-		logf("    ");
-	}
+	const FlatTree& tree = getNodeTree();
+	std::vector<std::pair<int, int>> stack; // flat index or ~leaf, depth
+	stack.push_back({ tree.flatIndex(nodeIdx), depth });
 
-	if (nodeIdx < 0)
-	{
-		BSPLEAF32& leaf = leaves[~nodeIdx];
-		print_leaf(leaf);
-		logf(" (LEAF {})\n", ~nodeIdx);
-		return;
-	}
-	else
+	while (!stack.empty())
 	{
-		print_node(nodes[nodeIdx]);
+		int node = stack.back().first;
+		int nodeDepth = stack.back().second;
+		stack.pop_back();
+
+		for (int i = 0; i < nodeDepth; i++)
+		{
+			logf("    ");
+		}
+
+		if (node < 0)
+		{
+			BSPLEAF32& leaf = leaves[~node];
+			print_leaf(leaf);
+			logf(" (LEAF {})\n", ~node);
+			continue;
+		}
+		if (node >= (int)tree.nodes.size())
+		{
+			logf("BAD NODE\n");
+			continue;
+		}
+
+		print_node(nodes[tree.lumpIndex[node]]);
 		logf("\n");
-	}
 
-	recurse_node(nodes[nodeIdx].iChildren[0], depth + 1);
-	recurse_node(nodes[nodeIdx].iChildren[1], depth + 1);
+		stack.push_back({ tree.nodes[node].children[1], nodeDepth + 1 });
+		stack.push_back({ tree.nodes[node].children[0], nodeDepth + 1 });
+	}
 }
 
 void Bsp::print_node(const BSPNODE32& node)
@@ -4467,70 +4244,59 @@ void Bsp::print_node(const BSPNODE32& node)
 		node.nMaxs[0], node.nMaxs[1], node.nMaxs[2]);
 }
 
-int Bsp::pointContents(int iNode, const vec3& p, int hull, std::vector<int>& nodeBranch, int& leafIdx, int& childIdx)
+int Bsp::pointContents(int iNode, const vec3& p, int hull, std::vector<int>& nodeBranch, int& leafIdx, int& childIdx)
+{
+	leafIdx = -1;
+	childIdx = -1;
+	if (iNode < 0)
+	{
+		return CONTENTS_EMPTY;
+	}
+
+	const FlatTree& tree = hull == 0 ? getNodeTree() : getClipnodeTree();
+	int node = tree.flatIndex(iNode);
+	while (node >= 0)
+	{
+		if (node >= (int)tree.nodes.size())
+			return CONTENTS_SOLID;
+
+		nodeBranch.push_back(tree.lumpIndex[node]);
+		const FlatNode& flat = tree.nodes[node];
+		float d = flat.normal[0] * p.x + flat.normal[1] * p.y + flat.normal[2] * p.z - flat.dist;
+		childIdx = d < 0 ? 1 : 0;
+		node = flat.children[childIdx];
+	}
+
+	if (hull == 0)
+	{
+		leafIdx = ~node;
+		return leaves[~node].nContents;
+	}
+	return node;
+}
+
+int Bsp::pointContents(int iNode, const vec3& p, int hull)
 {
-	leafIdx = -1;
-	childIdx = -1;
 	if (iNode < 0)
 	{
 		return CONTENTS_EMPTY;
 	}
 
-	if (hull == 0)
-	{
-		while (iNode >= 0)
-		{
-			nodeBranch.push_back(iNode);
-			BSPNODE32& node = nodes[iNode];
-			BSPPLANE& plane = planes[node.iPlane];
-
-			float d = dotProduct(plane.vNormal, p) - plane.fDist;
-			if (d < 0)
-			{
-				iNode = node.iChildren[1];
-				childIdx = 1;
-			}
-			else
-			{
-				iNode = node.iChildren[0];
-				childIdx = 0;
-			}
-		}
-
-		leafIdx = ~iNode;
-		return leaves[~iNode].nContents;
-	}
-	else
+	const FlatTree& tree = hull == 0 ? getNodeTree() : getClipnodeTree();
+	const FlatNode* flatNodes = tree.nodes.data();
+	int flatCount = (int)tree.nodes.size();
+	int node = tree.flatIndex(iNode);
+	while (node >= 0)
 	{
-		while (iNode >= 0)
-		{
-			nodeBranch.push_back(iNode);
-			BSPCLIPNODE32& node = clipnodes[iNode];
-			BSPPLANE& plane = planes[node.iPlane];
-
-			float d = dotProduct(plane.vNormal, p) - plane.fDist;
-			if (d < 0)
-			{
-				iNode = node.iChildren[1];
-				childIdx = 1;
-			}
-			else
-			{
-				iNode = node.iChildren[0];
-				childIdx = 0;
-			}
-		}
+		if (node >= flatCount)
+			return CONTENTS_SOLID;
 
-		return iNode;
+		const FlatNode& flat = flatNodes[node];
+		float d = flat.normal[0] * p.x + flat.normal[1] * p.y + flat.normal[2] * p.z - flat.dist;
+		node = flat.children[d < 0 ? 1 : 0];
 	}
-}
 
-int Bsp::pointContents(int iNode, const vec3& p, int hull)
-{
-	std::vector<int> nodeBranch;
-	int leafIdx;
-	int childIdx;
-	return pointContents(iNode, p, hull, nodeBranch, leafIdx, childIdx);
+	return hull == 0 ? leaves[~node].nContents : node;
 }
 
 const char* Bsp::getLeafContentsName(int contents)
@@ -4598,58 +4364,77 @@ void Bsp::mark_face_structures(int iFace, STRUCTUSAGE* usage)
 
 void Bsp::mark_node_structures(int iNode, STRUCTUSAGE* usage, bool skipLeaves)
 {
-	if (iNode > nodeCount)
-	{
-		logf("Warning! Found bad node. Skipping.\n");
-		return;
-	}
-	BSPNODE32& node = nodes[iNode];
-
-	usage->nodes[iNode] = true;
-	usage->planes[node.iPlane] = true;
+	const FlatTree& tree = getNodeTree();
+	std::vector<int> stack;
+	stack.push_back(tree.flatIndex(iNode));
 
-	for (int i = 0; i < node.nFaces; i++)
+	while (!stack.empty())
 	{
-		mark_face_structures(node.firstFace + i, usage);
-	}
+		int node = stack.back();
+		stack.pop_back();
+		if (node < 0 || node >= (int)tree.nodes.size())
+		{
+			logf("Warning! Found bad node. Skipping.\n");
+			continue;
+		}
 
-	for (int i = 0; i < 2; i++)
-	{
-		if (node.iChildren[i] >= 0)
+		usage->nodes[tree.lumpIndex[node]] = true;
+		usage->planes[tree.planeIndex[node]] = true;
+
+		int firstFace = tree.firstFace[node];
+		int nFaces = tree.faceCount[node];
+		for (int i = 0; i < nFaces; i++)
 		{
-			mark_node_structures(node.iChildren[i], usage, skipLeaves);
+			mark_face_structures(firstFace + i, usage);
 		}
-		else if (!skipLeaves)
+
+		const FlatNode& flat = tree.nodes[node];
+		for (int i = 1; i >= 0; i--)
 		{
-			BSPLEAF32& leaf = leaves[~node.iChildren[i]];
-			for (int n = 0; n < leaf.nMarkSurfaces; n++)
+			int child = flat.children[i];
+			if (child >= 0)
 			{
-				usage->markSurfs[leaf.iFirstMarkSurface + n] = true;
-				mark_face_structures(marksurfs[leaf.iFirstMarkSurface + n], usage);
+				stack.push_back(child);
 			}
+			else if (!skipLeaves)
+			{
+				BSPLEAF32& leaf = leaves[~child];
+				for (int n = 0; n < leaf.nMarkSurfaces; n++)
+				{
+					usage->markSurfs[leaf.iFirstMarkSurface + n] = true;
+					mark_face_structures(marksurfs[leaf.iFirstMarkSurface + n], usage);
+				}
 
-			usage->leaves[~node.iChildren[i]] = true;
+				usage->leaves[~child] = true;
+			}
 		}
 	}
 }
 
 void Bsp::mark_clipnode_structures(int iNode, STRUCTUSAGE* usage)
 {
-	if (iNode > clipnodeCount)
+	const FlatTree& tree = getClipnodeTree();
+	std::vector<int> stack;
+	stack.push_back(tree.flatIndex(iNode));
+
+	while (!stack.empty())
 	{
-		logf("Warning! Found bad clipnode. Skipping.\n");
-		return;
-	}
-	BSPCLIPNODE32& node = clipnodes[iNode];
+		int node = stack.back();
+		stack.pop_back();
+		if (node < 0 || node >= (int)tree.nodes.size())
+		{
+			logf("Warning! Found bad clipnode. Skipping.\n");
+			continue;
+		}
 
-	usage->clipnodes[iNode] = true;
-	usage->planes[node.iPlane] = true;
+		usage->clipnodes[tree.lumpIndex[node]] = true;
+		usage->planes[tree.planeIndex[node]] = true;
 
-	for (int i = 0; i < 2; i++)
-	{
-		if (node.iChildren[i] >= 0)
+		const FlatNode& flat = tree.nodes[node];
+		for (int i = 1; i >= 0; i--)
 		{
-			mark_clipnode_structures(node.iChildren[i], usage);
+			if (flat.children[i] >= 0)
+				stack.push_back(flat.children[i]);
 		}
 	}
 }
@@ -4703,30 +4488,40 @@ void Bsp::remap_face_structures(int faceIdx, STRUCTREMAP* remap)
 
 void Bsp::remap_node_structures(int iNode, STRUCTREMAP* remap)
 {
-	if (iNode > nodeCount)
-	{
-		logf("Warning! Found bad node. Skipping.\n");
-		return;
-	}
-	BSPNODE32& node = nodes[iNode];
+	// nodes are marked visited when queued, so shared nodes are remapped once
+	std::vector<int> stack;
+	stack.push_back(iNode);
+	if (iNode >= 0 && iNode < nodeCount)
+		remap->visitedNodes[iNode] = true;
 
-	remap->visitedNodes[iNode] = true;
+	while (!stack.empty())
+	{
+		int n = stack.back();
+		stack.pop_back();
+		if (n < 0 || n >= nodeCount)
+		{
+			logf("Warning! Found bad node. Skipping.\n");
+			continue;
+		}
+		BSPNODE32& node = nodes[n];
 
-	node.iPlane = remap->planes[node.iPlane];
+		node.iPlane = remap->planes[node.iPlane];
 
-	for (int i = 0; i < node.nFaces; i++)
-	{
-		remap_face_structures(node.firstFace + i, remap);
-	}
+		for (int i = 0; i < node.nFaces; i++)
+		{
+			remap_face_structures(node.firstFace + i, remap);
+		}
 
-	for (int i = 0; i < 2; i++)
-	{
-		if (node.iChildren[i] >= 0)
+		for (int i = 1; i >= 0; i--)
 		{
-			node.iChildren[i] = remap->nodes[node.iChildren[i]];
-			if (!remap->visitedNodes[node.iChildren[i]])
+			if (node.iChildren[i] >= 0)
 			{
-				remap_node_structures(node.iChildren[i], remap);
+				node.iChildren[i] = remap->nodes[node.iChildren[i]];
+				if (!remap->visitedNodes[node.iChildren[i]])
+				{
+					remap->visitedNodes[node.iChildren[i]] = true;
+					stack.push_back(node.iChildren[i]);
+				}
 			}
 		}
 	}
@@ -4734,27 +4529,39 @@ void Bsp::remap_node_structures(int iNode, STRUCTREMAP* remap)
 
 void Bsp::remap_clipnode_structures(int iNode, STRUCTREMAP* remap)
 {
-	if (iNode > clipnodeCount)
+	std::vector<int> stack;
+	stack.push_back(iNode);
+	if (iNode >= 0 && iNode < clipnodeCount)
+		remap->visitedClipnodes[iNode] = true;
+
+	while (!stack.empty())
 	{
-		logf("Warning! Found bad clipnode. Skipping.\n");
-		return;
-	}
-	BSPCLIPNODE32& node = clipnodes[iNode];
+		int n = stack.back();
+		stack.pop_back();
+		if (n < 0 || n >= clipnodeCount)
+		{
+			logf("Warning! Found bad clipnode. Skipping.\n");
+			continue;
+		}
+		BSPCLIPNODE32& node = clipnodes[n];
 
-	remap->visitedClipnodes[iNode] = true;
-	node.iPlane = remap->planes[node.iPlane];
+		node.iPlane = remap->planes[node.iPlane];
 
-	for (int i = 0; i < 2; i++)
-	{
-		if (node.iChildren[i] >= 0)
+		for (int i = 1; i >= 0; i--)
 		{
-			if (node.iChildren[i] < (int)remap->count.clipnodes)
+			if (node.iChildren[i] >= 0)
 			{
-				node.iChildren[i] = remap->clipnodes[node.iChildren[i]];
-			}
+				if (node.iChildren[i] < (int)remap->count.clipnodes)
+				{
+					node.iChildren[i] = remap->clipnodes[node.iChildren[i]];
+				}
 
-			if (!remap->visitedClipnodes[node.iChildren[i]])
-				remap_clipnode_structures(node.iChildren[i], remap);
+				if (!remap->visitedClipnodes[node.iChildren[i]])
+				{
+					remap->visitedClipnodes[node.iChildren[i]] = true;
+					stack.push_back(node.iChildren[i]);
+				}
+			}
 		}
 	}
 }
@@ -4767,6 +4574,8 @@ void Bsp::remap_model_structures(int modelIdx, STRUCTREMAP* remap)
 		return;
 	}
 	BSPMODEL& model = ((BSPMODEL*)lumps[LUMP_MODELS])[modelIdx];
+	invalidate_traversal_layout();
+	invalidate_face_indexes();
 
 	// sometimes the face index is invalid when the model has no faces
 	if (model.nFaces > 0)
@@ -5166,28 +4975,20 @@ int Bsp::add_texture(const char* oldname, unsigned char* data, int width, int he
 			int mipWidth = width / div;
 			int mipHeight = height / div;
 			texDataSize += mipWidth * mipHeight;
-			mip[i] = new unsigned char[texDataSize];
+			mip[i] = new unsigned char[mipWidth * mipHeight];
+		}
 
-			src = (COLOR3*)data;
-			for (int y = 0; y < mipHeight; y++)
+		int transparentIdx = -1;
+		if (name[0] == '{')
+		{
+			for (int k = 0; k < colorCount; k++)
 			{
-				for (int x = 0; x < mipWidth; x++)
-				{
-					int paletteIdx = -1;
-					for (int k = 0; k < colorCount; k++)
-					{
-						if (*src == palette[k])
-						{
-							paletteIdx = k;
-							break;
-						}
-					}
-
-					mip[i][y * mipWidth + x] = (unsigned char)paletteIdx;
-					src += div;
-				}
+				if (palette[k] == COLOR3(0, 0, 255))
+					transparentIdx = k;
 			}
 		}
+
+		GenerateMipMaps(mip, width, height, palette, colorCount, g_settings.mipFilter, transparentIdx);
 	}
 	else
 	{
@@ -5457,17 +5258,14 @@ int Bsp::add_texture(WADTEX* tex)
 
 int Bsp::create_leaf(int contents)
 {
-	BSPLEAF32* newLeaves = new BSPLEAF32[leafCount + 1]{};
-	memcpy(newLeaves, leaves, leafCount * sizeof(BSPLEAF32));
-
-	BSPLEAF32& newLeaf = newLeaves[leafCount];
+	BSPLEAF32 newLeaf = BSPLEAF32();
 
 	newLeaf.nVisOffset = -1;
 	newLeaf.nContents = contents;
 
 	unsigned int newLeafIdx = leafCount;
 
-	replace_lump(LUMP_LEAVES, newLeaves, (leafCount + 1) * sizeof(BSPLEAF32));
+	append_lump(LUMP_LEAVES, &newLeaf, sizeof(BSPLEAF32));
 
 	return newLeafIdx;
 }
@@ -6001,50 +5799,29 @@ void Bsp::simplify_model_collision(int modelIdx, int hullIdx)
 
 int Bsp::create_clipnode()
 {
-	BSPCLIPNODE32* newNodes = new BSPCLIPNODE32[clipnodeCount + 1];
-	memcpy(newNodes, clipnodes, clipnodeCount * sizeof(BSPCLIPNODE32));
-
-	BSPCLIPNODE32* newNode = &newNodes[clipnodeCount];
-	memset(newNode, 0, sizeof(BSPCLIPNODE32));
-
-	replace_lump(LUMP_CLIPNODES, newNodes, (clipnodeCount + 1) * sizeof(BSPCLIPNODE32));
+	append_lump(LUMP_CLIPNODES, NULL, sizeof(BSPCLIPNODE32));
 
 	return clipnodeCount - 1;
 }
 
 int Bsp::create_plane()
 {
-	BSPPLANE* newPlanes = new BSPPLANE[planeCount + 1]{};
-	memcpy(newPlanes, planes, planeCount * sizeof(BSPPLANE));
-
-	BSPPLANE& newPlane = newPlanes[planeCount];
-
-	replace_lump(LUMP_PLANES, newPlanes, (planeCount + 1) * sizeof(BSPPLANE));
+	append_lump(LUMP_PLANES, NULL, sizeof(BSPPLANE));
 
 	return planeCount - 1;
 }
 
 int Bsp::create_model()
 {
-	BSPMODEL* newModels = new BSPMODEL[modelCount + 1]{};
-	memcpy(newModels, models, modelCount * sizeof(BSPMODEL));
-
-	BSPMODEL& newModel = newModels[modelCount];
-
 	int newModelIdx = modelCount;
-	replace_lump(LUMP_MODELS, newModels, (modelCount + 1) * sizeof(BSPMODEL));
+	append_lump(LUMP_MODELS, NULL, sizeof(BSPMODEL));
 
 	return newModelIdx;
 }
 
 int Bsp::create_texinfo()
 {
-	BSPTEXTUREINFO* newTexinfos = new BSPTEXTUREINFO[texinfoCount + 1]{};
-	memcpy(newTexinfos, texinfos, texinfoCount * sizeof(BSPTEXTUREINFO));
-
-	BSPTEXTUREINFO& newTexinfo = newTexinfos[texinfoCount];
-
-	replace_lump(LUMP_TEXINFO, newTexinfos, (texinfoCount + 1) * sizeof(BSPTEXTUREINFO));
+	append_lump(LUMP_TEXINFO, NULL, sizeof(BSPTEXTUREINFO));
 
 	return texinfoCount - 1;
 }
@@ -6420,6 +6197,7 @@ int Bsp::regenerate_clipnodes_from_nodes(int iNode, int hullIdx)
 
 void Bsp::regenerate_clipnodes(int modelIdx, int hullIdx)
 {
+	ProfileScope profile("Regenerate clipnodes");
 	BSPMODEL& model = models[modelIdx];
 
 	for (int i = 1; i < MAX_MAP_HULLS; i++)
@@ -6442,6 +6220,7 @@ void Bsp::regenerate_clipnodes(int modelIdx, int hullIdx)
 		// TODO: create clipnodes to "cap" edges that are 90+ degrees (most CSG clip types do this)
 		// that will fix broken collision around those edges (invisible solid areas)
 	}
+	invalidate_traversal_layout();
 }
 
 void Bsp::write_csg_outputs(const std::string& path)
@@ -6463,6 +6242,7 @@ void Bsp::write_csg_outputs(const std::string& path)
 	}
 	delete[] lumps[LUMP_PLANES];
 	lumps[LUMP_PLANES] = (unsigned char*)newPlanes;
+	lumpCapacity[LUMP_PLANES] = 0;
 	numPlanes *= 2;
 	bsp_header.lump[LUMP_PLANES].nLength = numPlanes * sizeof(BSPPLANE);
 	thisPlanes = newPlanes;
@@ -6621,90 +6401,179 @@ void Bsp::print_leaf(const BSPLEAF32& leaf)
 
 void Bsp::update_lump_pointers()
 {
-	planes = (BSPPLANE*)lumps[LUMP_PLANES];
-	texinfos = (BSPTEXTUREINFO*)lumps[LUMP_TEXINFO];
-	leaves = (BSPLEAF32*)lumps[LUMP_LEAVES];
-	models = (BSPMODEL*)lumps[LUMP_MODELS];
-	nodes = (BSPNODE32*)lumps[LUMP_NODES];
-	clipnodes = (BSPCLIPNODE32*)lumps[LUMP_CLIPNODES];
-	faces = (BSPFACE32*)lumps[LUMP_FACES];
-	verts = (vec3*)lumps[LUMP_VERTICES];
-	lightdata = lumps[LUMP_LIGHTING];
-	surfedges = (int*)lumps[LUMP_SURFEDGES];
-	edges = (BSPEDGE32*)lumps[LUMP_EDGES];
-	marksurfs = (int*)lumps[LUMP_MARKSURFACES];
-	visdata = lumps[LUMP_VISIBILITY];
-	textures = lumps[LUMP_TEXTURES];
-
-	planeCount = bsp_header.lump[LUMP_PLANES].nLength / sizeof(BSPPLANE);
-	texinfoCount = bsp_header.lump[LUMP_TEXINFO].nLength / sizeof(BSPTEXTUREINFO);
-	leafCount = bsp_header.lump[LUMP_LEAVES].nLength / sizeof(BSPLEAF32);
-	modelCount = bsp_header.lump[LUMP_MODELS].nLength / sizeof(BSPMODEL);
-	nodeCount = bsp_header.lump[LUMP_NODES].nLength / sizeof(BSPNODE32);
-	vertCount = bsp_header.lump[LUMP_VERTICES].nLength / sizeof(vec3);
-	faceCount = bsp_header.lump[LUMP_FACES].nLength / sizeof(BSPFACE32);
-	clipnodeCount = bsp_header.lump[LUMP_CLIPNODES].nLength / sizeof(BSPCLIPNODE32);
-	marksurfCount = bsp_header.lump[LUMP_MARKSURFACES].nLength / sizeof(int);
-	surfedgeCount = bsp_header.lump[LUMP_SURFEDGES].nLength / sizeof(int);
-	edgeCount = bsp_header.lump[LUMP_EDGES].nLength / sizeof(BSPEDGE32);
-	textureCount = *((int*)(textures));
-	textureDataLength = bsp_header.lump[LUMP_TEXTURES].nLength;
-	lightDataLength = bsp_header.lump[LUMP_LIGHTING].nLength;
-	visDataLength = bsp_header.lump[LUMP_VISIBILITY].nLength;
-
-	if (planeCount > (is_bsp2 ? INT_MAX : MAX_MAP_PLANES))
-		logf("Overflowed Planes !!!\n");
-	if (texinfoCount > (is_bsp2 ? INT_MAX : MAX_MAP_TEXINFOS))
-		logf("Overflowed texinfos !!!\n");
-	if (leafCount > (is_bsp2 ? INT_MAX : (int)MAX_MAP_LEAVES))
-		logf("Overflowed leaves !!!\n");
-	if (modelCount > (int)MAX_MAP_MODELS)
-		logf("Overflowed models !!!\n");
-	if (texinfoCount > (is_bsp2 ? INT_MAX : MAX_MAP_TEXINFOS))
-		logf("Overflowed texinfos !!!\n");
-	if (nodeCount > (is_bsp2 ? INT_MAX : (int)MAX_MAP_NODES))
-		logf("Overflowed nodes !!!\n");
-	if (vertCount > (is_bsp2 ? INT_MAX : MAX_MAP_VERTS))
-		logf("Overflowed verts !!!\n");
-	if (faceCount > (is_bsp2 ? INT_MAX : MAX_MAP_FACES))
-		logf("Overflowed faces !!!\n");
-	if (clipnodeCount > (int)(is_32bit_clipnodes ? INT_MAX : is_broken_clipnodes ? (MAX_MAP_CLIPNODES_DEFAULT * 2 - 15) : MAX_MAP_CLIPNODES))
-		logf("Overflowed clipnodes !!!\n");
-	if (marksurfCount > (is_bsp2 ? INT_MAX : MAX_MAP_MARKSURFS))
-		logf("Overflowed marksurfs !!!\n");
-	if (surfedgeCount > (is_bsp2 ? INT_MAX : (int)MAX_MAP_SURFEDGES))
-		logf("Overflowed surfedges !!!\n");
-	if (edgeCount > (is_bsp2 ? INT_MAX : (int)MAX_MAP_EDGES))
-		logf("Overflowed edges !!!\n");
-	if (textureCount > (int)MAX_MAP_TEXTURES)
-		logf("Overflowed textures !!!\n");
-	if (lightDataLength > (int)MAX_MAP_LIGHTDATA)
-		logf("Overflowed lightdata !!!\n");
-	if (visDataLength > (int)MAX_MAP_VISDATA)
-		logf("Overflowed visdata !!!\n");
+	stop_render_face_build();
+
+	for (int i = 0; i < HEADER_LUMPS; i++)
+	{
+		update_lump_pointer(i);
+	}
+}
+
+void Bsp::update_lump_pointer(int lumpIdx)
+{
+	int lumpLen = bsp_header.lump[lumpIdx].nLength;
+
+	if (lumpIdx == LUMP_LEAVES || lumpIdx == LUMP_MARKSURFACES || lumpIdx == LUMP_FACES)
+		faceLeafIndex.clear();
+	if (lumpIdx == LUMP_PLANES || lumpIdx == LUMP_FACES)
+		planeFaceIndex.clear();
+	if (lumpIdx == LUMP_PLANES || lumpIdx == LUMP_NODES)
+		nodeTree.clear();
+	if (lumpIdx == LUMP_PLANES || lumpIdx == LUMP_CLIPNODES)
+		clipnodeTree.clear();
+
+	switch (lumpIdx)
+	{
+	case LUMP_PLANES:
+		planes = (BSPPLANE*)lumps[LUMP_PLANES];
+		planeCount = lumpLen / sizeof(BSPPLANE);
+		if (planeCount > (is_bsp2 ? INT_MAX : MAX_MAP_PLANES))
+			logf("Overflowed Planes !!!\n");
+		break;
+	case LUMP_TEXTURES:
+		textures = lumps[LUMP_TEXTURES];
+		textureCount = *((int*)(textures));
+		textureDataLength = lumpLen;
+		if (textureCount > (int)MAX_MAP_TEXTURES)
+			logf("Overflowed textures !!!\n");
+		break;
+	case LUMP_VERTICES:
+		verts = (vec3*)lumps[LUMP_VERTICES];
+		vertCount = lumpLen / sizeof(vec3);
+		if (vertCount > (is_bsp2 ? INT_MAX : MAX_MAP_VERTS))
+			logf("Overflowed verts !!!\n");
+		break;
+	case LUMP_VISIBILITY:
+		visdata = lumps[LUMP_VISIBILITY];
+		visDataLength = lumpLen;
+		if (visDataLength > (int)MAX_MAP_VISDATA)
+			logf("Overflowed visdata !!!\n");
+		break;
+	case LUMP_NODES:
+		nodes = (BSPNODE32*)lumps[LUMP_NODES];
+		nodeCount = lumpLen / sizeof(BSPNODE32);
+		if (nodeCount > (is_bsp2 ? INT_MAX : (int)MAX_MAP_NODES))
+			logf("Overflowed nodes !!!\n");
+		break;
+	case LUMP_TEXINFO:
+		texinfos = (BSPTEXTUREINFO*)lumps[LUMP_TEXINFO];
+		texinfoCount = lumpLen / sizeof(BSPTEXTUREINFO);
+		if (texinfoCount > (is_bsp2 ? INT_MAX : MAX_MAP_TEXINFOS))
+			logf("Overflowed texinfos !!!\n");
+		break;
+	case LUMP_FACES:
+		faces = (BSPFACE32*)lumps[LUMP_FACES];
+		faceCount = lumpLen / sizeof(BSPFACE32);
+		if (faceCount > (is_bsp2 ? INT_MAX : MAX_MAP_FACES))
+			logf("Overflowed faces !!!\n");
+		break;
+	case LUMP_LIGHTING:
+		lightdata = lumps[LUMP_LIGHTING];
+		lightDataLength = lumpLen;
+		if (lightDataLength > (int)MAX_MAP_LIGHTDATA)
+			logf("Overflowed lightdata !!!\n");
+		break;
+	case LUMP_CLIPNODES:
+		clipnodes = (BSPCLIPNODE32*)lumps[LUMP_CLIPNODES];
+		clipnodeCount = lumpLen / sizeof(BSPCLIPNODE32);
+		if (clipnodeCount > (int)(is_32bit_clipnodes ? INT_MAX : is_broken_clipnodes ? (MAX_MAP_CLIPNODES_DEFAULT * 2 - 15) : MAX_MAP_CLIPNODES))
+			logf("Overflowed clipnodes !!!\n");
+		break;
+	case LUMP_LEAVES:
+		leaves = (BSPLEAF32*)lumps[LUMP_LEAVES];
+		leafCount = lumpLen / sizeof(BSPLEAF32);
+		if (leafCount > (is_bsp2 ? INT_MAX : (int)MAX_MAP_LEAVES))
+			logf("Overflowed leaves !!!\n");
+		break;
+	case LUMP_MARKSURFACES:
+		marksurfs = (int*)lumps[LUMP_MARKSURFACES];
+		marksurfCount = lumpLen / sizeof(int);
+		if (marksurfCount > (is_bsp2 ? INT_MAX : MAX_MAP_MARKSURFS))
+			logf("Overflowed marksurfs !!!\n");
+		break;
+	case LUMP_EDGES:
+		edges = (BSPEDGE32*)lumps[LUMP_EDGES];
+		edgeCount = lumpLen / sizeof(BSPEDGE32);
+		if (edgeCount > (is_bsp2 ? INT_MAX : (int)MAX_MAP_EDGES))
+			logf("Overflowed edges !!!\n");
+		break;
+	case LUMP_SURFEDGES:
+		surfedges = (int*)lumps[LUMP_SURFEDGES];
+		surfedgeCount = lumpLen / sizeof(int);
+		if (surfedgeCount > (is_bsp2 ? INT_MAX : (int)MAX_MAP_SURFEDGES))
+			logf("Overflowed surfedges !!!\n");
+		break;
+	case LUMP_MODELS:
+		models = (BSPMODEL*)lumps[LUMP_MODELS];
+		modelCount = lumpLen / sizeof(BSPMODEL);
+		if (modelCount > (int)MAX_MAP_MODELS)
+			logf("Overflowed models !!!\n");
+		break;
+	default:
+		break;
+	}
 }
 
 void Bsp::replace_lump(int lumpIdx, void* newData, size_t newLength)
 {
-	if (replacedLump[lumpIdx] && lumps[lumpIdx])
+	stop_render_face_build();
+
+	if (replacedLump[lumpIdx] && lumps[lumpIdx] && lumps[lumpIdx] != newData)
 	{
 		delete[] lumps[lumpIdx];
 	}
 	lumps[lumpIdx] = (unsigned char*)newData;
+	lumpCapacity[lumpIdx] = 0;
 	bsp_header.lump[lumpIdx].nLength = (int)newLength;
 	replacedLump[lumpIdx] = true;
-	update_lump_pointers();
+	update_lump_pointer(lumpIdx);
+}
+
+void Bsp::reserve_lump(int lumpIdx, size_t capacity)
+{
+	size_t oldLen = (size_t)bsp_header.lump[lumpIdx].nLength;
+	if (capacity <= oldLen || (lumps[lumpIdx] && capacity <= lumpCapacity[lumpIdx]))
+	{
+		return;
+	}
+
+	stop_render_face_build();
+
+	unsigned char* newLump = new unsigned char[capacity];
+	if (oldLen > 0 && lumps[lumpIdx])
+	{
+		memcpy(newLump, lumps[lumpIdx], oldLen);
+	}
+	memset(newLump + oldLen, 0, capacity - oldLen);
+
+	if (replacedLump[lumpIdx] && lumps[lumpIdx])
+	{
+		delete[] lumps[lumpIdx];
+	}
+	lumps[lumpIdx] = newLump;
+	lumpCapacity[lumpIdx] = capacity;
+	replacedLump[lumpIdx] = true;
+	update_lump_pointer(lumpIdx);
 }
 
 void Bsp::append_lump(int lumpIdx, void* newData, size_t appendLength)
 {
-	int oldLen = bsp_header.lump[lumpIdx].nLength;
-	unsigned char* newLump = new unsigned char[oldLen + appendLength];
+	size_t oldLen = (size_t)bsp_header.lump[lumpIdx].nLength;
+	size_t newLen = oldLen + appendLength;
+
+	if (!lumps[lumpIdx] || newLen > lumpCapacity[lumpIdx])
+	{
+		// grow by half so repeated single element appends don't copy the whole lump every time
+		reserve_lump(lumpIdx, std::max(newLen, oldLen + oldLen / 2 + 64));
+	}
 
-	memcpy(newLump, lumps[lumpIdx], oldLen);
-	memcpy(newLump + oldLen, newData, appendLength);
+	if (newData)
+		memcpy(lumps[lumpIdx] + oldLen, newData, appendLength);
+	else
+		memset(lumps[lumpIdx] + oldLen, 0, appendLength);
 
-	replace_lump(lumpIdx, newLump, oldLen + appendLength);
+	bsp_header.lump[lumpIdx].nLength = (int)newLen;
+	update_lump_pointer(lumpIdx);
 }
 
 bool Bsp::isModelHasFaceIdx(const BSPMODEL& bspmdl, int faceid)
@@ -7007,24 +6876,24 @@ void Bsp::ExportPortalFile()
 	logf("Writing view portal file to {}\n", targetViewFileName);*/
 	logf("Writing portal file to {}\n", targetFileName);
 
-	targetFile << fmt::format("{}\n", leafCount - 1);
-
-	/*int nodeIdx = models[0].iHeadnodes[0];
-
-	std::vector<NodeVolumeCuts> solidNodes;
-	std::vector<BSPPLANE> planesx;
-	get_node_leaf_cuts(nodeIdx,0, planesx, solidNodes);
+	std::vector<VisPortal> portals;
+	qvis_make_portals(this, portals);
+	g_progress.clear();
 
-	targetFile << fmt::format("{}\n", solidNodes.size());
-	for (int i = 0; i < leafCount; i++)
-	{
-		targetFile << fmt::format("{}\n", 1);
-	}
-	for (int i = 0; i < solidNodes.size(); i++)
+	// PRT1 format as written by qbsp, leaf numbers exclude the shared solid leaf
+	targetFile << "PRT1\n";
+	targetFile << fmt::format("{}\n", models[0].nVisLeafs);
+	targetFile << fmt::format("{}\n", portals.size());
+	for (const VisPortal& p : portals)
 	{
-		targetFile << fmt::format("{}\n", solidNodes[i].cuts.size(), solidNodes[i].nodeIdx);
+		targetFile << fmt::format("{} {} {}", p.points.size(), p.leafs[0] - 1, p.leafs[1] - 1);
+		for (const vec3& v : p.points)
+		{
+			targetFile << fmt::format(" ({:f} {:f} {:f})", v.x, v.y, v.z);
+		}
+		targetFile << "\n";
 	}
-	targetFile.flush();*/
+	targetFile.flush();
 }
 void Bsp::ExportLightFile()
 {
@@ -7244,7 +7113,7 @@ void Bsp::ExportToMapWIP(const std::string& path)
 
 BspRenderer* Bsp::getBspRender()
 {
-	if (!renderer)
+	if (!renderer && g_app)
 		for (int i = 0; i < g_app->mapRenderers.size(); i++)
 			if (g_app->mapRenderers[i]->map == this)
 				renderer = g_app->mapRenderers[i];
@@ -7253,12 +7122,21 @@ BspRenderer* Bsp::getBspRender()
 
 int Bsp::getBspRenderId()
 {
+	if (!g_app)
+		return -1;
 	for (int i = 0; i < g_app->mapRenderers.size(); i++)
 		if (g_app->mapRenderers[i]->map == this)
 			return i;
 	return -1;
 }
 
+void Bsp::stop_render_face_build()
+{
+	// the render faces are built from the lumps in another thread
+	if (renderer)
+		renderer->discardRenderFaces();
+}
+
 void Bsp::setBspRender(BspRenderer* rnd)
 {
 	renderer = rnd;
@@ -7327,73 +7205,178 @@ void Bsp::hideEnts(bool hide)
 	}
 }
 
-std::vector<int> Bsp::getLeafFaces(BSPLEAF32& leaf)
+IndexSpan CsrIndex::get(int key) const
 {
-	std::vector<int> retFaces;
-	for (int i = 0; i < leaf.nMarkSurfaces; i++)
+	if (!valid || key < 0 || key + 1 >= (int)offsets.size())
+		return IndexSpan();
+	return IndexSpan(items.data() + offsets[key], offsets[key + 1] - offsets[key]);
+}
+
+void CsrIndex::clear()
+{
+	valid = false;
+	offsets.clear();
+	items.clear();
+}
+
+// Builds a CSR index from (key, value) pairs produced by emitPairs(source, emit) for every source.
+// Counting and filling run in parallel over the sources, then every span is sorted
+// so the results are in the same order as a linear scan would return them.
+template<typename F>
+static void build_csr_index(CsrIndex& index, int keyCount, int sourceCount, F emitPairs)
+{
+	std::vector<int> sources(std::max(sourceCount, 0));
+	std::iota(sources.begin(), sources.end(), 0);
+
+	std::unique_ptr<std::atomic<int>[]> counts(new std::atomic<int>[keyCount + 1]);
+	for (int i = 0; i <= keyCount; i++)
+		counts[i].store(0, std::memory_order_relaxed);
+
+	std::for_each(std::execution::par, sources.begin(), sources.end(), [&](int source)
+		{
+			emitPairs(source, [&](int key, int) { counts[key].fetch_add(1, std::memory_order_relaxed); });
+		});
+
+	index.offsets.resize(keyCount + 1);
+	index.offsets[0] = 0;
+	for (int i = 0; i < keyCount; i++)
 	{
-		retFaces.push_back(marksurfs[leaf.iFirstMarkSurface + i]);
+		index.offsets[i + 1] = index.offsets[i] + counts[i].load(std::memory_order_relaxed);
+		counts[i].store(index.offsets[i], std::memory_order_relaxed);
 	}
-	return retFaces;
+	index.items.resize(index.offsets[keyCount]);
+
+	std::for_each(std::execution::par, sources.begin(), sources.end(), [&](int source)
+		{
+			emitPairs(source, [&](int key, int value) { index.items[counts[key].fetch_add(1, std::memory_order_relaxed)] = value; });
+		});
+
+	std::vector<int> keys(keyCount);
+	std::iota(keys.begin(), keys.end(), 0);
+	std::for_each(std::execution::par_unseq, keys.begin(), keys.end(), [&](int key)
+		{
+			std::sort(index.items.begin() + index.offsets[key], index.items.begin() + index.offsets[key + 1]);
+		});
+
+	index.valid = true;
 }
 
-std::vector<int> Bsp::getLeafFaces(int leafIdx)
+void Bsp::invalidate_face_indexes()
 {
-	std::vector<int> retFaces;
-	if (leafIdx < 0)
-		return retFaces;
+	faceLeafIndex.clear();
+	planeFaceIndex.clear();
+}
 
-	BSPLEAF32& leaf = leaves[leafIdx];
-	for (int i = 0; i < leaf.nMarkSurfaces; i++)
+const FlatTree& Bsp::getNodeTree()
+{
+	if (!nodeTree.valid.load(std::memory_order_acquire))
 	{
-		retFaces.push_back(marksurfs[leaf.iFirstMarkSurface + i]);
+		std::lock_guard<std::mutex> lock(traversalMutex);
+		if (!nodeTree.valid.load(std::memory_order_relaxed))
+			nodeTree.build(this, false);
 	}
-	return retFaces;
+	return nodeTree;
 }
 
-std::vector<int> Bsp::getFaceLeafs(int faceIdx)
+const FlatTree& Bsp::getClipnodeTree()
 {
-	std::vector<int> retLeafes;
-
-	for (int l = 1; l < leafCount; l++)
+	if (!clipnodeTree.valid.load(std::memory_order_acquire))
 	{
-		BSPLEAF32& leaf = leaves[l];
+		std::lock_guard<std::mutex> lock(traversalMutex);
+		if (!clipnodeTree.valid.load(std::memory_order_relaxed))
+			clipnodeTree.build(this, true);
+	}
+	return clipnodeTree;
+}
 
-		for (int i = 0; i < leaf.nMarkSurfaces; i++)
-		{
-			if (marksurfs[leaf.iFirstMarkSurface + i] == faceIdx)
+void Bsp::invalidate_traversal_layout()
+{
+	nodeTree.clear();
+	clipnodeTree.clear();
+}
+
+IndexSpan Bsp::getLeafFaceSpan(int leafIdx)
+{
+	if (leafIdx < 0 || leafIdx >= leafCount)
+		return IndexSpan();
+
+	BSPLEAF32& leaf = leaves[leafIdx];
+	if (leaf.nMarkSurfaces <= 0 || leaf.iFirstMarkSurface < 0 || leaf.iFirstMarkSurface + leaf.nMarkSurfaces > marksurfCount)
+		return IndexSpan();
+
+	// marksurfaces already are a leaf->face index
+	return IndexSpan(marksurfs + leaf.iFirstMarkSurface, leaf.nMarkSurfaces);
+}
+
+IndexSpan Bsp::getFaceLeafSpan(int faceIdx)
+{
+	if (!faceLeafIndex.valid)
+	{
+		// leaf 0 is the shared solid leaf, it never references faces
+		build_csr_index(faceLeafIndex, faceCount, leafCount, [&](int l, auto&& emit)
 			{
-				retLeafes.push_back(l);
-			}
-		}
+				if (l == 0)
+					return;
+				BSPLEAF32& leaf = leaves[l];
+				if (leaf.iFirstMarkSurface < 0 || leaf.iFirstMarkSurface + leaf.nMarkSurfaces > marksurfCount)
+					return;
+				for (int i = 0; i < leaf.nMarkSurfaces; i++)
+				{
+					int face = marksurfs[leaf.iFirstMarkSurface + i];
+					if (face >= 0 && face < faceCount)
+						emit(face, l);
+				}
+			});
 	}
-
-	return retLeafes;
+	return faceLeafIndex.get(faceIdx);
 }
 
-int Bsp::getFaceFromPlane(int iPlane)
+IndexSpan Bsp::getPlaneFaceSpan(int iPlane)
 {
-	for (int i = 0; i < faceCount; i++)
+	if (!planeFaceIndex.valid)
 	{
-		if (faces[i].iPlane == iPlane)
-		{
-			return i;
-		}
+		build_csr_index(planeFaceIndex, planeCount, faceCount, [&](int f, auto&& emit)
+			{
+				int plane = faces[f].iPlane;
+				if (plane >= 0 && plane < planeCount)
+					emit(plane, f);
+			});
 	}
-	return -1;
+	return planeFaceIndex.get(iPlane);
 }
 
-std::vector<int> Bsp::getFacesFromPlane(int iPlane)
+std::vector<int> Bsp::getLeafFaces(BSPLEAF32& leaf)
 {
-	std::vector<int> retval;
-	for (int i = 0; i < faceCount; i++)
+	std::vector<int> retFaces;
+	for (int i = 0; i < leaf.nMarkSurfaces; i++)
 	{
-		if (faces[i].iPlane == iPlane)
-		{
-			retval.push_back(i);
-		}
+		retFaces.push_back(marksurfs[leaf.iFirstMarkSurface + i]);
 	}
-	return retval;
+	return retFaces;
+}
+
+std::vector<int> Bsp::getLeafFaces(int leafIdx)
+{
+	IndexSpan span = getLeafFaceSpan(leafIdx);
+	return std::vector<int>(span.begin(), span.end());
+}
+
+std::vector<int> Bsp::getFaceLeafs(int faceIdx)
+{
+	IndexSpan span = getFaceLeafSpan(faceIdx);
+	return std::vector<int>(span.begin(), span.end());
+}
+
+int Bsp::getFaceFromPlane(int iPlane)
+{
+	IndexSpan span = getPlaneFaceSpan(iPlane);
+	return span.empty() ? -1 : span[0];
+}
+
+std::vector<int> Bsp::getFacesFromPlane(int iPlane)
+{
+	IndexSpan span = getPlaneFaceSpan(iPlane);
+	return std::vector<int>(span.begin(), span.end());
 }
 
 int Bsp::getBspTextureSize(int textureid)
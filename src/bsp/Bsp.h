@@ -8,8 +8,10 @@
 #include <string.h>
 #include "remap.h"
 #include <set>
+#include <mutex>
 #include "bsptypes.h"
 #include "mdl_studio.h"
+#include "FlatTree.h"
 
 class BspRenderer;
 
@@ -28,6 +30,46 @@ enum ExportObjOrder
 };
 
 
+// read-only view of a CsrIndex entry (or any other int array), valid until the index or lump changes
+struct IndexSpan
+{
+	const int* data;
+	int count;
+
+	IndexSpan()
+	{
+		data = NULL;
+		count = 0;
+	}
+	IndexSpan(const int* data, int count)
+	{
+		this->data = data;
+		this->count = count;
+	}
+
+	const int* begin() const { return data; }
+	const int* end() const { return data + count; }
+	int size() const { return count; }
+	bool empty() const { return count == 0; }
+	int operator[](int i) const { return data[i]; }
+};
+
+// compressed sparse row index: values of key k are items[offsets[k] .. offsets[k + 1])
+struct CsrIndex
+{
+	std::vector<int> offsets;
+	std::vector<int> items;
+	bool valid;
+
+	CsrIndex()
+	{
+		valid = false;
+	}
+
+	IndexSpan get(int key) const;
+	void clear();
+};
+
 struct LeafDebug
 {
 	int leafIdx;
@@ -97,6 +139,7 @@ public:
 	std::string bsp_name;
 
 	bool replacedLump[32];
+	size_t lumpCapacity[32]; // allocated size of lumps grown by append_lump/reserve_lump, 0 = exact length
 
 	bool bsp_valid;
 	bool is_bsp_model;
@@ -104,7 +147,7 @@ public:
 	StudioModel* mdl;
 
 	Bsp* parentMap;
-	void selectModelEnt();
+	void selectModelEnt(int parentEntIdx = -1);
 
 
 	Bsp();
@@ -146,6 +189,8 @@ public:
 	// get all verts used by this model
 	// TODO: split any verts shared with other models!
 	std::vector<TransformVert> getModelVerts(int modelIdx);
+	// faces of the model with an edge that uses any of the verts
+	std::vector<int> get_model_faces_using_verts(int modelIdx, std::vector<int> vertIdxs);
 
 	// gets verts formed by plane intersections with the nodes in this model
 	bool getModelPlaneIntersectVerts(int modelIdx, std::vector<TransformVert>& outVerts);
@@ -197,7 +242,7 @@ public:
 	// returns true if the map has eny entities that make use of hull 2
 	bool has_hull2_ents();
 
-	// check for bad indexes
+	// check for bad indexes and log them (validate_bsp returns the full report)
 	bool validate();
 
 	// creates a solid cube
@@ -219,8 +264,13 @@ public:
 	int add_texture(const char* name, unsigned char* data, int width, int height, const unsigned char* custompal = NULL, bool force_quake_pal = false);
 	int add_texture(WADTEX* tex);
 
+	// replacing, growing or reloading lumps first waits for a render face build that reads them
 	void replace_lump(int lumpIdx, void* newData, size_t newLength);
+	// appends to the end of the lump, newData = NULL appends zeroes.
+	// lumps grow with spare capacity, so typed pointers only change when the capacity is exceeded
 	void append_lump(int lumpIdx, void* newData, size_t appendLength);
+	// preallocates lump memory (in bytes), use before adding many structures one by one
+	void reserve_lump(int lumpIdx, size_t capacity);
 
 	bool is_invisible_solid(Entity* ent);
 
@@ -276,6 +326,8 @@ public:
 	BSPMIPTEX* find_embedded_wad_texture(const char* name, int& texid);
 
 	void update_lump_pointers();
+	// refreshes the typed pointer and count of a single lump
+	void update_lump_pointer(int lumpIdx);
 
 	int getBspRenderId();
 	BspRenderer* getBspRender();
@@ -294,6 +346,22 @@ public:
 
 	void hideEnts(bool hide = true);
 
+	// Allocation free face lookups. The face->leaves and plane->faces indexes are built on first use
+	// and dropped when the faces/leaves/marksurfaces/planes lumps are replaced or appended to.
+	// Call invalidate_face_indexes() after changing face planes or leaf marksurfaces in place.
+	IndexSpan getLeafFaceSpan(int leafIdx);
+	IndexSpan getFaceLeafSpan(int faceIdx);
+	IndexSpan getPlaneFaceSpan(int iPlane);
+	void invalidate_face_indexes();
+
+	// Flattened node/clipnode trees used by the tree walkers. Built on first use and dropped when the
+	// planes/nodes/clipnodes lumps are replaced or appended to.
+	// Call invalidate_traversal_layout() after changing planes, nodes or clipnodes in place.
+	// The getters may be called from several threads at once, but not while the lumps are edited.
+	const FlatTree& getNodeTree();
+	const FlatTree& getClipnodeTree();
+	void invalidate_traversal_layout();
+
 	std::vector<int> getLeafFaces(int leafIdx);
 	std::vector<int> getLeafFaces(BSPLEAF32& leaf);
 	std::vector<int> getFaceLeafs(int faceIdx);
@@ -302,6 +370,15 @@ public:
 	bool is_texture_with_pal(int textureid);
 	int getBspTextureSize(int textureid);
 private:
+	CsrIndex faceLeafIndex;
+	CsrIndex planeFaceIndex;
+	FlatTree nodeTree;
+	FlatTree clipnodeTree;
+	std::mutex traversalMutex;
+
+	void stop_render_face_build();
+	void get_leaf_cuts(const FlatTree& tree, bool isClipnodeTree, int iNode, int iStartNode, std::vector<BSPPLANE>& clipOrder, std::vector<NodeVolumeCuts>& output);
+
 	unsigned int remove_unused_lightmaps(bool* usedFaces);
 	unsigned int remove_unused_visdata(bool* usedLeaves, BSPLEAF32* oldLeaves, int oldWorldLeaves, int oldLeavesMemSize); // called after removing unused leaves
 	unsigned int remove_unused_textures(bool* usedTextures, int* remappedIndexes, int * removeddata = NULL);
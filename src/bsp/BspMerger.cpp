@@ -12,6 +12,7 @@ Bsp* BspMerger::merge(std::vector<Bsp*> maps, const vec3& gap, const std::string
 		logf("\nMore than 1 map is required for merging. Aborting merge.\n");
 		return NULL;
 	}
+	ProfileScope profile("Merge maps");
 	std::vector<std::vector<std::vector<MAPBLOCK>>> blocks = separate(maps, gap);
 
 
@@ -119,6 +120,7 @@ Bsp* BspMerger::merge(std::vector<Bsp*> maps, const vec3& gap, const std::string
 					flattenedBlocks.push_back(blocks[z][y][x]);
 
 		logf("\nUpdating map series entity logic:\n");
+		ProfileScope seriesProfile("Update map series entity logic");
 		update_map_series_entity_logic(output, flattenedBlocks, maps, output_name, maps[0]->bsp_name, noscript);
 	}
 
@@ -130,8 +132,9 @@ void BspMerger::merge(MAPBLOCK& dst, MAPBLOCK& src, std::string resultType)
 	std::string thisName = dst.merge_name.size() ? dst.merge_name : dst.map->bsp_name;
 	std::string otherName = src.merge_name.size() ? src.merge_name : src.map->bsp_name;
 	dst.merge_name = std::move(resultType);
-	logf("    {:-8s} = {} + {}\n", dst.merge_name, thisName, otherName);
+	logf("    {:<8} = {} + {}\n", dst.merge_name, thisName, otherName);
 
+	ProfileScope profile(dst.merge_name + " = " + thisName + " + " + otherName);
 	merge(*dst.map, *src.map);
 }
 
@@ -455,7 +458,8 @@ void BspMerger::update_map_series_entity_logic(Bsp* mergedMap, std::vector<MAPBL
 		{
 			// info_player_start ents are ignored if there is any active info_player_deathmatch,
 			// so this may break spawns if there are a mix of spawn types
-			cname = ent->keyvalues["classname"] = "info_player_deathmatch";
+			cname = "info_player_deathmatch";
+			ent->setOrAddKeyvalue("classname", cname);
 		}
 
 		if (noscript && !isInFirstMap)
@@ -483,7 +487,7 @@ void BspMerger::update_map_series_entity_logic(Bsp* mergedMap, std::vector<MAPBL
 			if (cname == "trigger_auto")
 			{
 				ent->addKeyvalue("targetname", "bspguy_autos_" + source_map);
-				ent->keyvalues["classname"] = "trigger_relay";
+				ent->setOrAddKeyvalue("classname", "trigger_relay");
 			}
 			if (cname.starts_with("monster_") && cname.rfind("_dead") != cname.size() - 5)
 			{
@@ -940,9 +944,9 @@ bool BspMerger::merge(Bsp& mapA, Bsp& mapB, bool modelMerge)
 			if (!modelMerge)
 			{
 				logf("Replacing {} lump\n", g_lump_names[i]);
-				mapA.bsp_header.lump[i].nLength = mapB.bsp_header.lump[i].nLength;
-				mapA.lumps[i] = new unsigned char[mapB.bsp_header.lump[i].nLength];
-				memcpy(mapA.lumps[i], mapB.lumps[i], mapB.bsp_header.lump[i].nLength);
+				unsigned char* newLump = new unsigned char[mapB.bsp_header.lump[i].nLength];
+				memcpy(newLump, mapB.lumps[i], mapB.bsp_header.lump[i].nLength);
+				mapA.replace_lump(i, newLump, mapB.bsp_header.lump[i].nLength);
 
 				// process the lump here (TODO: faster to just copy wtv needs copying)
 				switch (i)
@@ -1095,7 +1099,7 @@ void BspMerger::merge_ents(Bsp& mapA, Bsp& mapB)
 		}
 
 		size_t newModelIdx = atoi(modelIdxStr.c_str()) + otherModelCount;
-		mapA.ents[i]->keyvalues["model"] = "*" + std::to_string(newModelIdx);
+		mapA.ents[i]->setOrAddKeyvalue("model", "*" + std::to_string(newModelIdx));
 
 		g_progress.tick();
 	}
@@ -1496,6 +1500,8 @@ void BspMerger::merge_leaves(Bsp& mapA, Bsp& mapB)
 		mergedLeaves.push_back(mapA.leaves[i]);
 	}
 
+	// B's leaves were shifted in place
+	mapB.invalidate_face_indexes();
 	otherLeafCount -= 1; // solid leaf removed
 
 	size_t newLen = mergedLeaves.size() * sizeof(BSPLEAF32);
@@ -1798,46 +1804,45 @@ void BspMerger::merge_vis(Bsp& mapA, Bsp& mapB)
 	unsigned int newVisRowSize = ((totalVisLeaves + 63) & ~63) >> 3;
 	int decompressedVisSize = totalVisLeaves * newVisRowSize;
 
-	g_progress.update("Merging visibility", thisWorldLeafCount + otherWorldLeafCount * 2 + mergedWorldLeafCount);
+	g_progress.update("Merging visibility", mergedWorldLeafCount + 1);
 	g_progress.tick();
 
-	unsigned char* decompressedVis = new unsigned char[decompressedVisSize];
-	memset(decompressedVis, 0xFF, decompressedVisSize);
-
-	// decompress this map's world leaves
 	// model leaves don't need to be decompressed because the game ignores VIS for them.
-	decompress_vis_lump(allLeaves, mapA.visdata, decompressedVis,
-		thisWorldLeafCount, thisVisLeaves, totalVisLeaves, mapA.bsp_header.lump[LUMP_VISIBILITY].nLength, mapA.visDataLength);
-
-	// decompress other map's world-leaf vis data (skip empty first leaf, which now only the first map should have)
-	unsigned char* decompressedOtherVis = decompressedVis + thisWorldLeafCount * newVisRowSize;
-	decompress_vis_lump(allLeaves + thisWorldLeafCount, mapB.visdata, decompressedOtherVis,
-		otherWorldLeafCount, otherLeafCount, totalVisLeaves, mapB.bsp_header.lump[LUMP_VISIBILITY].nLength, mapB.visDataLength);
-
-	// shift mapB's world leaves after mapA's world leaves
+	int thisVisRows = count_vis_rows(allLeaves, thisWorldLeafCount, mapA.bsp_header.lump[LUMP_VISIBILITY].nLength, mapA.visDataLength);
+	// other map's world-leaf vis data (skip empty first leaf, which now only the first map should have)
+	BSPLEAF32* otherLeaves = allLeaves + thisWorldLeafCount;
+	int otherVisRows = count_vis_rows(otherLeaves, otherWorldLeafCount, mapB.bsp_header.lump[LUMP_VISIBILITY].nLength, mapB.visDataLength);
+
+	// rows are decompressed, shifted and recompressed one at a time instead of building the full vis matrix.
+	// CompressAllStreamed only writes a leaf's vis offset after its row was read here.
+	auto getRow = [&](int row, unsigned char* dest)
+		{
+			if (row < thisWorldLeafCount)
+			{
+				if (row < thisVisRows)
+					decompress_vis_row(allLeaves, mapA.visdata, dest, row, thisWorldLeafCount, thisVisLeaves, totalVisLeaves, mapA.visDataLength);
+				return;
+			}
 
+			int otherRow = row - thisWorldLeafCount;
+			if (otherRow < otherVisRows)
+				decompress_vis_row(otherLeaves, mapB.visdata, dest, otherRow, otherWorldLeafCount, otherLeafCount, totalVisLeaves, mapB.visDataLength);
 
-	for (int i = 0; i < otherWorldLeafCount; i++)
-	{
-		shiftVis(decompressedOtherVis + i * newVisRowSize, newVisRowSize, 0, thisWorldLeafCount);
-		g_progress.tick();
-	}
+			// shift mapB's world leaves after mapA's world leaves
+			shiftVis(dest, newVisRowSize, 0, thisWorldLeafCount);
+		};
 
 	// recompress the combined vis data
-	unsigned char* compressedVis = new unsigned char[decompressedVisSize];
-	memset(compressedVis, 0, decompressedVisSize);
-	int newVisLen = CompressAll(allLeaves, decompressedVis, compressedVis, totalVisLeaves, mergedWorldLeafCount, decompressedVisSize, thisWorldLeafCount + otherWorldLeafCount);
+	std::vector<unsigned char> compressedVis;
+	int newVisLen = CompressAllStreamed(allLeaves, getRow, compressedVis, totalVisLeaves, mergedWorldLeafCount, decompressedVisSize, thisWorldLeafCount + otherWorldLeafCount);
 	unsigned int oldLen = mapA.bsp_header.lump[LUMP_VISIBILITY].nLength;
 
 	unsigned char* compressedVisResize = new unsigned char[newVisLen];
-	memcpy(compressedVisResize, compressedVis, newVisLen);
+	memcpy(compressedVisResize, compressedVis.data(), newVisLen);
 
 	mapA.replace_lump(LUMP_VISIBILITY, compressedVisResize, newVisLen);
 
 	logf("\rVis data length {} > {}                            \n", oldLen, newVisLen);
-
-	delete[] decompressedVis;
-	delete[] compressedVis;
 }
 
 void BspMerger::merge_lighting(Bsp& mapA, Bsp& mapB)
@@ -1859,8 +1864,7 @@ void BspMerger::merge_lighting(Bsp& mapA, Bsp& mapB)
 		thisColorCount = MAX_SURFACE_EXTENT * MAX_SURFACE_EXTENT;
 		totalColorCount += thisColorCount;
 		int sz = thisColorCount * sizeof(COLOR3);
-		mapA.lumps[LUMP_LIGHTING] = new unsigned char[sz];
-		mapA.bsp_header.lump[LUMP_LIGHTING].nLength = sz;
+		mapA.replace_lump(LUMP_LIGHTING, new unsigned char[sz], sz);
 		thisRad = (COLOR3*)mapA.lumps[LUMP_LIGHTING];
 
 		memset(thisRad, 255, sz);
@@ -0,0 +1,475 @@
+#include "BspValidator.h"
+#include "Bsp.h"
+#include "rad.h"
+#include "util.h"
+#include <algorithm>
+#include <chrono>
+#include <execution>
+#include <functional>
+#include <numeric>
+#include <set>
+
+void ValidationCheck::fail(const char* what, int index, const std::string& detail, bool warning)
+{
+	ValidationProblem* problem = NULL;
+	for (auto& p : problems)
+	{
+		if (p.what == what)
+		{
+			problem = &p;
+			break;
+		}
+	}
+	if (!problem)
+	{
+		problems.push_back(ValidationProblem());
+		problem = &problems.back();
+		problem->what = what;
+		problem->warning = warning;
+		problem->count = 0;
+	}
+
+	problem->count++;
+	if ((int)problem->offenders.size() < maxOffenders)
+		problem->offenders.push_back({ index, detail });
+}
+
+int ValidationCheck::errorCount() const
+{
+	int count = 0;
+	for (auto& p : problems)
+		if (!p.warning)
+			count += p.count;
+	return count;
+}
+
+int ValidationCheck::warningCount() const
+{
+	int count = 0;
+	for (auto& p : problems)
+		if (p.warning)
+			count += p.count;
+	return count;
+}
+
+void ValidationReport::print() const
+{
+	for (auto& check : checks)
+	{
+		for (auto& p : check.problems)
+		{
+			for (auto& o : p.offenders)
+			{
+				const char* prefix = p.warning ? "Warning: " : "";
+				if (o.index >= 0)
+					logf("{}{} {}: {}\n", prefix, p.what, o.index, o.detail);
+				else
+					logf("{}{}: {}\n", prefix, p.what, o.detail);
+			}
+			if (p.count > (int)p.offenders.size())
+			{
+				logf("    ... and {} more\n", p.count - (int)p.offenders.size());
+			}
+		}
+	}
+	if (errors || warnings)
+	{
+		logf("Validated {} in {:.3f} seconds: {} errors, {} warnings\n", mapName, seconds, errors, warnings);
+	}
+}
+
+static std::string json_string(const std::string& s)
+{
+	std::string out = "\"";
+	for (char c : s)
+	{
+		switch (c)
+		{
+		case '"': out += "\\\""; break;
+		case '\\': out += "\\\\"; break;
+		case '\n': out += "\\n"; break;
+		case '\r': out += "\\r"; break;
+		case '\t': out += "\\t"; break;
+		default:
+			if ((unsigned char)c < 0x20)
+				out += fmt::format("\\u{:04x}", (int)(unsigned char)c);
+			else
+				out += c;
+		}
+	}
+	return out + "\"";
+}
+
+std::string ValidationReport::toJson() const
+{
+	std::string out = "{\n";
+	out += fmt::format("  \"map\": {},\n", json_string(mapName));
+	out += fmt::format("  \"valid\": {},\n", valid() ? "true" : "false");
+	out += fmt::format("  \"errors\": {},\n", errors);
+	out += fmt::format("  \"warnings\": {},\n", warnings);
+	out += fmt::format("  \"seconds\": {:.6f},\n", seconds);
+	out += "  \"checks\": [";
+	for (size_t i = 0; i < checks.size(); i++)
+	{
+		const ValidationCheck& check = checks[i];
+		out += i ? ",\n" : "\n";
+		out += "    {\n";
+		out += fmt::format("      \"name\": {},\n", json_string(check.name));
+		out += fmt::format("      \"items\": {},\n", check.itemsChecked);
+		out += fmt::format("      \"errors\": {},\n", check.errorCount());
+		out += fmt::format("      \"warnings\": {},\n", check.warningCount());
+		out += fmt::format("      \"seconds\": {:.6f},\n", check.seconds);
+		out += "      \"problems\": [";
+		for (size_t k = 0; k < check.problems.size(); k++)
+		{
+			const ValidationProblem& p = check.problems[k];
+			out += k ? ",\n" : "\n";
+			out += "        {\n";
+			out += fmt::format("          \"what\": {},\n", json_string(p.what));
+			out += fmt::format("          \"severity\": \"{}\",\n", p.warning ? "warning" : "error");
+			out += fmt::format("          \"count\": {},\n", p.count);
+			out += "          \"offenders\": [";
+			for (size_t n = 0; n < p.offenders.size(); n++)
+			{
+				out += n ? ", " : "";
+				out += fmt::format("{{\"index\": {}, \"detail\": {}}}", p.offenders[n].index, json_string(p.offenders[n].detail));
+			}
+			out += "]\n        }";
+		}
+		out += check.problems.empty() ? "]\n    }" : "\n      ]\n    }";
+	}
+	out += checks.empty() ? "]\n}\n" : "\n  ]\n}\n";
+	return out;
+}
+
+// true if the edges and vertexes of a face can be read safely
+static bool face_refs_valid(Bsp* map, int faceIdx)
+{
+	BSPFACE32& face = map->faces[faceIdx];
+	if (face.iTextureInfo < 0 || face.iTextureInfo >= map->texinfoCount ||
+		face.iFirstEdge < 0 || face.nEdges < 0 || face.iFirstEdge + face.nEdges > map->surfedgeCount)
+		return false;
+
+	for (int e = 0; e < face.nEdges; e++)
+	{
+		int edgeIdx = abs(map->surfedges[face.iFirstEdge + e]);
+		if (edgeIdx >= map->edgeCount)
+			return false;
+		BSPEDGE32& edge = map->edges[edgeIdx];
+		if ((unsigned int)edge.iVertex[0] >= (unsigned int)map->vertCount || (unsigned int)edge.iVertex[1] >= (unsigned int)map->vertCount)
+			return false;
+	}
+	return true;
+}
+
+int face_lightmap_errors(Bsp* map, int faceIdx)
+{
+	int mins[2], maxs[2];
+	if (!GetFaceExtents(map, faceIdx, mins, maxs))
+		return FACE_BAD_EXTENTS;
+
+	int flags = 0;
+	int size[2] = { maxs[0] - mins[0] + 1, maxs[1] - mins[1] + 1 };
+	if (size[0] > MAX_SURFACE_EXTENT || size[1] > MAX_SURFACE_EXTENT || size[0] < 0 || size[1] < 0)
+	{
+		flags |= FACE_BAD_EXTENTS;
+		size[0] = std::min(size[0], MAX_SURFACE_EXTENT);
+		size[1] = std::min(size[1], MAX_SURFACE_EXTENT);
+	}
+	if (size[0] * size[1] > MAX_LUXELS)
+	{
+		flags |= FACE_LIGHTMAP_TOO_LARGE;
+	}
+	return flags;
+}
+
+static void check_marksurfs(Bsp* map, ValidationCheck& res)
+{
+	res.itemsChecked = map->marksurfCount;
+	for (int i = 0; i < map->marksurfCount; i++)
+	{
+		if (map->marksurfs[i] >= map->faceCount)
+			res.fail("Bad face reference in marksurf", i, fmt::format("{} / {}", map->marksurfs[i], map->faceCount));
+	}
+}
+
+static void check_surfedges(Bsp* map, ValidationCheck& res)
+{
+	res.itemsChecked = map->surfedgeCount;
+	for (int i = 0; i < map->surfedgeCount; i++)
+	{
+		if (abs(map->surfedges[i]) >= map->edgeCount)
+			res.fail("Bad edge reference in surfedge", i, fmt::format("{} / {}", map->surfedges[i], map->edgeCount));
+	}
+}
+
+static void check_edges(Bsp* map, ValidationCheck& res)
+{
+	res.itemsChecked = map->edgeCount;
+	for (int i = 0; i < map->edgeCount; i++)
+	{
+		for (int k = 0; k < 2; k++)
+		{
+			if ((unsigned int)map->edges[i].iVertex[k] >= (unsigned int)map->vertCount)
+				res.fail("Bad vertex reference in edge", i, fmt::format("{} / {}", map->edges[i].iVertex[k], map->vertCount));
+		}
+	}
+}
+
+static void check_texinfos(Bsp* map, ValidationCheck& res)
+{
+	res.itemsChecked = map->texinfoCount;
+	for (int i = 0; i < map->texinfoCount; i++)
+	{
+		if (map->texinfos[i].iMiptex >= map->textureCount)
+			res.fail("Bad texture reference in textureinfo", i, fmt::format("{} / {}", map->texinfos[i].iMiptex, map->textureCount));
+	}
+}
+
+static void check_faces(Bsp* map, ValidationCheck& res)
+{
+	res.itemsChecked = map->faceCount;
+	for (int i = 0; i < map->faceCount; i++)
+	{
+		BSPFACE32& face = map->faces[i];
+		if (face.iPlane >= map->planeCount)
+			res.fail("Bad plane reference in face", i, fmt::format("{} / {}", face.iPlane, map->planeCount));
+		if (face.nEdges > 0 && face.iFirstEdge >= map->surfedgeCount)
+			res.fail("Bad surfedge reference in face", i, fmt::format("{} / {}", face.iFirstEdge, map->surfedgeCount));
+		if (face.iTextureInfo >= map->texinfoCount)
+			res.fail("Bad textureinfo reference in face", i, fmt::format("{} / {}", face.iTextureInfo, map->texinfoCount));
+		if (map->lightDataLength > 0 && face.nLightmapOffset >= 0 && face.nLightmapOffset > map->lightDataLength)
+			res.fail("Bad lightmap offset in face", i, fmt::format("{} / {}", face.nLightmapOffset, map->lightDataLength));
+	}
+}
+
+static void check_lightmaps(Bsp* map, ValidationCheck& res)
+{
+	for (int i = 0; i < map->faceCount; i++)
+	{
+		BSPFACE32& face = map->faces[i];
+		if (!face_refs_valid(map, i) || (map->texinfos[face.iTextureInfo].nFlags & TEX_SPECIAL))
+			continue;
+		res.itemsChecked++;
+
+		int flags = face_lightmap_errors(map, i);
+		if (flags & FACE_BAD_EXTENTS)
+			res.fail("Bad surface extents in face", i, "", true);
+		if (flags & FACE_LIGHTMAP_TOO_LARGE)
+			res.fail("Lightmap too large in face", i, "", true);
+
+		if (flags || map->lightDataLength <= 0 || face.nLightmapOffset < 0 || face.nStyles[0] == 255 ||
+			face.nLightmapOffset > map->lightDataLength)
+			continue;
+
+		// only a warning, Bsp::validate() never rejected maps for this
+		int size = GetFaceLightmapSizeBytes(map, i);
+		if (face.nLightmapOffset + size > map->lightDataLength)
+			res.fail("Lightmap data overrun in face", i, fmt::format("{} + {} / {}", face.nLightmapOffset, size, map->lightDataLength), true);
+	}
+}
+
+static void check_leaves(Bsp* map, ValidationCheck& res)
+{
+	res.itemsChecked = map->leafCount;
+	for (int i = 0; i < map->leafCount; i++)
+	{
+		BSPLEAF32& leaf = map->leaves[i];
+		if (leaf.nMarkSurfaces > 0 && leaf.iFirstMarkSurface >= map->marksurfCount)
+			res.fail("Bad marksurf reference in leaf", i, fmt::format("{} / {}", leaf.iFirstMarkSurface, map->marksurfCount));
+
+		if (leaf.nMins[0] > leaf.nMaxs[0] || leaf.nMins[1] > leaf.nMaxs[1] || leaf.nMins[2] > leaf.nMaxs[2])
+		{
+			res.fail("Backwards mins/maxs in leaf", i, fmt::format("Mins: ({}, {}, {}) Maxs: ({} {} {})",
+				leaf.nMins[0], leaf.nMins[1], leaf.nMins[2], leaf.nMaxs[0], leaf.nMaxs[1], leaf.nMaxs[2]));
+		}
+	}
+}
+
+static void check_visdata(Bsp* map, ValidationCheck& res)
+{
+	if (map->visDataLength <= 0)
+		return;
+
+	res.itemsChecked = map->leafCount;
+	for (int i = 0; i < map->leafCount; i++)
+	{
+		int offset = map->leaves[i].nVisOffset;
+		if (offset != -1 && (offset < 0 || offset >= map->visDataLength))
+			res.fail("Bad vis offset in leaf", i, fmt::format("{} / {}", offset, map->visDataLength));
+	}
+}
+
+static void check_nodes(Bsp* map, ValidationCheck& res)
+{
+	res.itemsChecked = map->nodeCount;
+	for (int i = 0; i < map->nodeCount; i++)
+	{
+		BSPNODE32& node = map->nodes[i];
+		if (node.nFaces > 0 && (unsigned int)node.firstFace >= (unsigned int)map->faceCount)
+			res.fail("Bad face reference in node", i, fmt::format("{} / {}", node.firstFace, map->faceCount));
+		if (node.iPlane >= map->planeCount)
+			res.fail("Bad plane reference in node", i, fmt::format("{} / {}", node.iPlane, map->planeCount));
+		for (int k = 0; k < 2; k++)
+		{
+			int child = node.iChildren[k];
+			if (child > 0 && child >= map->nodeCount)
+				res.fail("Bad node reference in node", i, fmt::format("child {}: {} / {}", k, child, map->nodeCount));
+			else if (child < -1 && ~child >= map->leafCount)
+				res.fail("Bad leaf reference in node", i, fmt::format("child {}: {} / {}", k, ~child, map->leafCount));
+		}
+	}
+}
+
+static void check_clipnodes(Bsp* map, ValidationCheck& res)
+{
+	res.itemsChecked = map->clipnodeCount;
+	for (int i = 0; i < map->clipnodeCount; i++)
+	{
+		BSPCLIPNODE32& node = map->clipnodes[i];
+		if (node.iPlane < 0 || node.iPlane >= map->planeCount)
+			res.fail("Bad plane reference in clipnode", i, fmt::format("{} / {}", node.iPlane, map->planeCount));
+		for (int k = 0; k < 2; k++)
+		{
+			if (node.iChildren[k] > 0 && node.iChildren[k] >= map->clipnodeCount)
+				res.fail("Bad clipnode reference in clipnode", i, fmt::format("child {}: {} / {}", k, node.iChildren[k], map->clipnodeCount));
+		}
+	}
+}
+
+static void check_models(Bsp* map, ValidationCheck& res)
+{
+	res.itemsChecked = map->modelCount;
+
+	int totalVisLeaves = 1; // solid leaf not included in model leaf counts
+	int totalFaces = 0;
+	for (int i = 0; i < map->modelCount; i++)
+	{
+		BSPMODEL& model = map->models[i];
+		totalVisLeaves += model.nVisLeafs;
+		totalFaces += model.nFaces;
+		if (model.nFaces > 0 && (model.iFirstFace < 0 || model.iFirstFace >= map->faceCount))
+			res.fail("Bad face reference in model", i, fmt::format("{} / {}", model.iFirstFace, map->faceCount));
+		if (model.iHeadnodes[0] >= map->nodeCount)
+			res.fail("Bad node reference in model", i, fmt::format("hull 0: {} / {}", model.iHeadnodes[0], map->nodeCount));
+		for (int k = 1; k < MAX_MAP_HULLS; k++)
+		{
+			if (model.iHeadnodes[k] >= map->clipnodeCount)
+				res.fail("Bad clipnode reference in model", i, fmt::format("hull {}: {} / {}", k, model.iHeadnodes[k], map->clipnodeCount));
+		}
+		if (model.nMins.x > model.nMaxs.x || model.nMins.y > model.nMaxs.y || model.nMins.z > model.nMaxs.z)
+		{
+			res.fail("Backwards mins/maxs in model", i, fmt::format("Mins: ({}, {}, {}) Maxs: ({} {} {})",
+				model.nMins.x, model.nMins.y, model.nMins.z, model.nMaxs.x, model.nMaxs.y, model.nMaxs.z));
+		}
+	}
+
+	if (totalVisLeaves != map->leafCount)
+		res.fail("Bad model vis leaf sum", -1, fmt::format("{} / {}", totalVisLeaves, map->leafCount));
+	if (totalFaces > map->faceCount)
+		res.fail("Bad model face sum", -1, fmt::format("{} / {}", totalFaces, map->faceCount));
+}
+
+static void check_entities(Bsp* map, ValidationCheck& res)
+{
+	res.itemsChecked = (int)map->ents.size();
+
+	int worldspawnCount = 0;
+	std::set<int> usedModels;
+	usedModels.insert(0);
+
+	for (int i = 0; i < (int)map->ents.size(); i++)
+	{
+		Entity* ent = map->ents[i];
+		int modelIdx = ent->getBspModelIdxForce();
+		if (modelIdx > 0 && modelIdx >= map->modelCount)
+			res.fail("Bad model reference in entity", i, fmt::format("{} / {}", modelIdx, map->modelCount));
+		if (ent->isWorldSpawn())
+			worldspawnCount++;
+
+		modelIdx = ent->getBspModelIdx();
+		if (modelIdx >= 0)
+			usedModels.insert(modelIdx);
+	}
+
+	if (worldspawnCount != 1)
+	{
+		res.fail("Wrong number of worldspawn entities", -1, fmt::format("found {} (expected 1) in {} entities. "
+			"This can cause crashes and svc_bad errors.", worldspawnCount, map->ents.size()));
+	}
+
+	for (int i = 0; i < map->modelCount; i++)
+	{
+		if (!usedModels.count(i))
+			res.fail("Unused model", i, "no entity uses it", true);
+	}
+}
+
+static void check_textures(Bsp* map, ValidationCheck& res)
+{
+	res.itemsChecked = map->textureCount;
+	for (int i = 0; i < map->textureCount; i++)
+	{
+		int texOffset = ((int*)map->textures)[i + 1];
+		if (texOffset < 0)
+			continue;
+
+		int texlen = map->getBspTextureSize(i);
+		int dataOffset = (map->textureCount + 1) * sizeof(int);
+		BSPMIPTEX* tex = (BSPMIPTEX*)(map->textures + texOffset);
+		if (tex->szName[0] == '\0' || strnlen(tex->szName, MAXTEXTURENAME) >= MAXTEXTURENAME)
+			res.fail("Invalid texture name in texture", i, "", true);
+		if (tex->nOffsets[0] > 0 && dataOffset + texOffset + texlen > map->bsp_header.lump[LUMP_TEXTURES].nLength)
+			res.fail("Texture data buffer overrun in texture", i, fmt::format("{} / {}", dataOffset + texOffset + texlen,
+				map->bsp_header.lump[LUMP_TEXTURES].nLength), true);
+	}
+}
+
+ValidationReport validate_bsp(Bsp* map, int maxOffenders)
+{
+	typedef void (*CheckFunc)(Bsp*, ValidationCheck&);
+	static const std::pair<const char*, CheckFunc> checkFuncs[] = {
+		{"marksurfs", check_marksurfs},
+		{"surfedges", check_surfedges},
+		{"edges", check_edges},
+		{"texinfos", check_texinfos},
+		{"faces", check_faces},
+		{"lightmaps", check_lightmaps},
+		{"leaves", check_leaves},
+		{"visdata", check_visdata},
+		{"nodes", check_nodes},
+		{"clipnodes", check_clipnodes},
+		{"models", check_models},
+		{"entities", check_entities},
+		{"textures", check_textures},
+	};
+	const int checkCount = sizeof(checkFuncs) / sizeof(checkFuncs[0]);
+
+	ValidationReport report;
+	report.mapName = map->bsp_name;
+	report.checks.resize(checkCount);
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	// the checks only read the map and each one writes to its own result
+	std::vector<int> ids(checkCount);
+	std::iota(ids.begin(), ids.end(), 0);
+	std::for_each(std::execution::par, ids.begin(), ids.end(), [&](int i)
+		{
+			ValidationCheck& check = report.checks[i];
+			check.name = checkFuncs[i].first;
+			check.maxOffenders = maxOffenders;
+
+			auto checkStart = std::chrono::high_resolution_clock::now();
+			checkFuncs[i].second(map, check);
+			check.seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - checkStart).count();
+		});
+
+	report.seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+	for (auto& check : report.checks)
+	{
+		report.errors += check.errorCount();
+		report.warnings += check.warningCount();
+	}
+	return report;
+}
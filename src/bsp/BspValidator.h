@@ -0,0 +1,61 @@
+#pragma once
+#include <string>
+#include <vector>
+
+class Bsp;
+
+// offenders kept per problem, the rest are only counted
+#define VALIDATE_MAX_OFFENDERS 16
+
+// face_lightmap_errors flags
+#define FACE_BAD_EXTENTS		1
+#define FACE_LIGHTMAP_TOO_LARGE	2
+
+struct ValidationOffender
+{
+	int index;			// index of the offending structure, -1 for map-wide problems
+	std::string detail;
+};
+
+// one kind of problem found by a check, e.g. "Bad face reference in marksurf"
+struct ValidationProblem
+{
+	std::string what;
+	bool warning;		// warnings don't make the map invalid
+	int count;
+	std::vector<ValidationOffender> offenders; // the first VALIDATE_MAX_OFFENDERS
+};
+
+struct ValidationCheck
+{
+	std::string name;
+	int itemsChecked = 0;
+	double seconds = 0.0;
+	int maxOffenders = VALIDATE_MAX_OFFENDERS;
+	std::vector<ValidationProblem> problems;
+
+	void fail(const char* what, int index, const std::string& detail, bool warning = false);
+	int errorCount() const;
+	int warningCount() const;
+};
+
+struct ValidationReport
+{
+	std::string mapName;
+	std::vector<ValidationCheck> checks;
+	double seconds = 0.0;
+	int errors = 0;
+	int warnings = 0;
+
+	bool valid() const { return errors == 0; }
+
+	// logs every problem like the old serial validate did (nothing is logged for a clean map)
+	void print() const;
+	std::string toJson() const;
+};
+
+// Runs every check on the map in parallel. The map must not be edited while this runs.
+ValidationReport validate_bsp(Bsp* map, int maxOffenders = VALIDATE_MAX_OFFENDERS);
+
+// FACE_* flags for the lightmap of one face
+int face_lightmap_errors(Bsp* map, int faceIdx);
@@ -0,0 +1,278 @@
+#include "BspWriter.h"
+#include "util.h"
+#include <cstring>
+#include <algorithm>
+
+#ifdef WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/uio.h>
+#endif
+#include "forcecrc32.h"
+#include "pathcache.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+static const unsigned char g_zero_pad[16] = { 0 };
+
+BspWriter::BspWriter(const std::string& path)
+{
+	this->path = path;
+	tmpPath = path + ".tmp";
+	crc32 = UINT32_C(0xFFFFFFFF);
+	scratchUsed = 0;
+	written = 0;
+	queued = 0;
+	failed = false;
+	committed = false;
+#ifdef WIN32
+	file = NULL;
+#else
+	fd = -1;
+#endif
+}
+
+BspWriter::~BspWriter()
+{
+	if (!committed)
+	{
+		closeFile(false);
+		std::error_code ec;
+		fs::remove(tmpPath, ec);
+	}
+}
+
+bool BspWriter::open()
+{
+#ifdef WIN32
+	if (fopen_s(&file, tmpPath.c_str(), "wb") != 0 || !file)
+	{
+		file = NULL;
+		return false;
+	}
+#else
+	fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return false;
+#endif
+	scratch.resize(CHUNK_SIZE * 4);
+	return true;
+}
+
+size_t BspWriter::tell() const
+{
+	return written + queued;
+}
+
+void BspWriter::write(const void* data, size_t len, bool crc)
+{
+	if (!len)
+		return;
+	if (crc)
+		crc32 = GetCrc32InMemory((unsigned char*)data, (unsigned int)len, crc32);
+	pending.push_back({ data, len });
+	queued += len;
+}
+
+void BspWriter::pad(size_t len, bool crc)
+{
+	while (len > 0)
+	{
+		size_t part = std::min(len, sizeof(g_zero_pad));
+		write(g_zero_pad, part, crc);
+		len -= part;
+	}
+}
+
+unsigned char* BspWriter::reserve(size_t len)
+{
+	if (failed || len > CHUNK_SIZE)
+	{
+		failed = true;
+		return NULL;
+	}
+	if (scratchUsed + len > scratch.size() && !flush())
+	{
+		return NULL;
+	}
+	unsigned char* ret = scratch.data() + scratchUsed;
+	scratchUsed += len;
+	return ret;
+}
+
+bool BspWriter::flush()
+{
+#ifdef WIN32
+	if (!file)
+		failed = true;
+#else
+	if (fd < 0)
+		failed = true;
+#endif
+	if (failed)
+	{
+		// nothing reaches the file after an error, drop what was queued so the scratch space is free again
+		pending.clear();
+		queued = 0;
+		scratchUsed = 0;
+		return false;
+	}
+#ifdef WIN32
+	for (const Segment& seg : pending)
+	{
+		if (fwrite(seg.data, 1, seg.len, file) != seg.len)
+		{
+			failed = true;
+			break;
+		}
+	}
+#else
+	std::vector<iovec> iov;
+	iov.reserve(std::min(pending.size(), (size_t)IOV_MAX));
+	size_t i = 0;
+	while (i < pending.size() && !failed)
+	{
+		iov.clear();
+		for (size_t k = i; k < pending.size() && iov.size() < IOV_MAX; k++)
+		{
+			iov.push_back({ (void*)pending[k].data, pending[k].len });
+		}
+
+		ssize_t ret = ::writev(fd, iov.data(), (int)iov.size());
+		if (ret <= 0)
+		{
+			failed = true;
+			break;
+		}
+
+		// skip fully written segments, and retry the rest of a partially written one
+		size_t done = (size_t)ret;
+		while (i < pending.size() && done >= pending[i].len)
+		{
+			done -= pending[i].len;
+			i++;
+		}
+		if (done > 0)
+		{
+			pending[i].data = (const unsigned char*)pending[i].data + done;
+			pending[i].len -= done;
+		}
+	}
+#endif
+	written += queued;
+	queued = 0;
+	pending.clear();
+	scratchUsed = 0;
+	return !failed;
+}
+
+bool BspWriter::writeAt(size_t offset, const void* data, size_t len)
+{
+	if (!flush())
+		return false;
+#ifdef WIN32
+	if (_fseeki64(file, (long long)offset, SEEK_SET) != 0 || fwrite(data, 1, len, file) != len)
+		failed = true;
+	_fseeki64(file, 0, SEEK_END);
+#else
+	if (::pwrite(fd, data, len, (off_t)offset) != (ssize_t)len)
+		failed = true;
+#endif
+	return !failed;
+}
+
+bool BspWriter::closeFile(bool sync)
+{
+	bool ok = !failed;
+#ifdef WIN32
+	if (file)
+	{
+		if (sync)
+		{
+			ok = fflush(file) == 0 && _commit(_fileno(file)) == 0 && ok;
+		}
+		ok = fclose(file) == 0 && ok;
+		file = NULL;
+	}
+#else
+	if (fd >= 0)
+	{
+		if (sync)
+		{
+			ok = ::fsync(fd) == 0 && ok;
+		}
+		ok = ::close(fd) == 0 && ok;
+		fd = -1;
+	}
+#endif
+	return ok;
+}
+
+bool BspWriter::commit(const std::string& backupPath)
+{
+	if (!flush() || !closeFile(true))
+	{
+		logf("Failed to write {}\n", tmpPath);
+		return false;
+	}
+
+	std::error_code ec;
+	if (fileExists(path))
+	{
+		// the temp file was created with default permissions, keep the mode of the map it replaces
+		fs::perms perms = fs::status(path, ec).permissions();
+		if (!ec)
+			fs::permissions(tmpPath, perms, fs::perm_options::replace, ec);
+		if (ec)
+		{
+			logf("Failed to copy permissions of {}: {}\n", path, ec.message());
+			ec.clear();
+		}
+	}
+
+	if (!backupPath.empty() && fileExists(path) && !fileExists(backupPath))
+	{
+		// the old file becomes the backup without copying any data
+		fs::create_hard_link(path, backupPath, ec);
+		if (ec)
+		{
+			ec.clear();
+			fs::rename(path, backupPath, ec);
+		}
+		if (ec)
+		{
+			logf("Failed to create backup {}\n", backupPath);
+			return false;
+		}
+		logf("Writing backup to {}\n", backupPath);
+	}
+
+	committed = true;
+	g_path_cache.clear(); // the map may be new
+
+	fs::rename(tmpPath, path, ec);
+	if (ec)
+	{
+		// keep the temp file, it is the only complete copy of the new map now
+		logf("Failed to replace {}: {}\nNew map is saved as {}\n", path, ec.message(), tmpPath);
+		return false;
+	}
+
+#ifndef WIN32
+	// make the rename itself durable
+	std::string dir = fs::path(path).parent_path().string();
+	int dirfd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY);
+	if (dirfd >= 0)
+	{
+		::fsync(dirfd);
+		::close(dirfd);
+	}
+#endif
+
+	return true;
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdio>
+
+// Output file for Bsp::write.
+// Everything is written to "<path>.tmp" and only moved over the target by commit(),
+// so a crash or a full disk never leaves a half written map behind.
+// Buffers passed to write() are not copied, they are gathered and flushed with
+// vectored writes, so they must stay valid until the next flush()/commit().
+class BspWriter
+{
+public:
+	unsigned int crc32; // running crc of all data written with crc = true
+
+	BspWriter(const std::string& path);
+	~BspWriter(); // removes the temp file if commit() was not called
+
+	bool open();
+
+	void write(const void* data, size_t len, bool crc = false);
+	void pad(size_t len, bool crc = false);
+
+	// scratch space for converted data, valid until the next flush (which may happen inside this call)
+	// len must not exceed CHUNK_SIZE
+	unsigned char* reserve(size_t len);
+
+	bool flush();
+
+	// overwrites already written data (file header)
+	bool writeAt(size_t offset, const void* data, size_t len);
+
+	// moves the temp file over the target. if backupPath is given and the target exists,
+	// the old file is kept there with a hard link (or a rename) instead of being copied
+	bool commit(const std::string& backupPath = std::string());
+
+	size_t tell() const;
+
+	static const size_t CHUNK_SIZE = 256 * 1024;
+
+private:
+	struct Segment
+	{
+		const void* data;
+		size_t len;
+	};
+
+	std::string path;
+	std::string tmpPath;
+	std::vector<Segment> pending;
+	std::vector<unsigned char> scratch;
+	size_t scratchUsed;
+	size_t written;
+	size_t queued;
+	bool failed;
+	bool committed;
+
+#ifdef WIN32
+	FILE* file;
+#else
+	int fd;
+#endif
+
+	bool closeFile(bool sync);
+};
@@ -3,6 +3,15 @@
 #include "Entity.h"
 #include "util.h"
 #include <algorithm>
+#include <atomic>
+
+// unique across entities, so that a new entity never looks like an old one at the same address
+static std::atomic<unsigned int> g_entity_revision;
+
+unsigned int Entity::lastRevision()
+{
+	return g_entity_revision;
+}
 
 Entity::Entity(const std::string& classname)
 {
@@ -62,6 +71,7 @@ void Entity::addKeyvalue(const std::string key, const std::string value, bool mu
 
 	cachedModelIdx = -2;
 	targetsCached = false;
+	revision = ++g_entity_revision;
 
 	updateRenderModes();
 }
@@ -84,6 +94,7 @@ void Entity::removeKeyvalue(const std::string key)
 	keyvalues.erase(key);
 	cachedModelIdx = -2;
 	targetsCached = false; 
+	revision = ++g_entity_revision;
 	updateRenderModes();
 }
 
@@ -106,15 +117,26 @@ bool Entity::renameKey(int idx, const std::string& newName)
 	keyOrder[idx] = newName;
 	cachedModelIdx = -2;
 	targetsCached = false;
+	revision = ++g_entity_revision;
 	updateRenderModes();
 	return true;
 }
 
+void Entity::swapKeys(int idx1, int idx2)
+{
+	if (idx1 < 0 || idx2 < 0 || idx1 >= (int)keyOrder.size() || idx2 >= (int)keyOrder.size())
+		return;
+	std::swap(keyOrder[idx1], keyOrder[idx2]);
+	// key order decides which key a search matches first
+	revision = ++g_entity_revision;
+}
+
 void Entity::clearAllKeyvalues()
 {
 	keyOrder.clear();
 	keyvalues.clear();
 	cachedModelIdx = -2;
+	revision = ++g_entity_revision;
 }
 
 void Entity::clearEmptyKeyvalues()
@@ -130,6 +152,7 @@ void Entity::clearEmptyKeyvalues()
 	keyOrder = std::move(newKeyOrder);
 	cachedModelIdx = -2;
 	targetsCached = false;
+	revision = ++g_entity_revision;
 }
 
 bool Entity::hasKey(const std::string key)
@@ -502,6 +525,8 @@ void Entity::renameTargetnameValues(const std::string& oldTargetname, const std:
 			}
 		}
 	}
+
+	revision = ++g_entity_revision;
 }
 
 size_t Entity::getMemoryUsage()
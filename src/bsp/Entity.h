@@ -14,6 +14,8 @@ public:
 	std::vector<std::string> cachedTargets;
 	bool targetsCached = false;
 	bool hide = false;
+	unsigned int revision = 0; // changes with every keyvalue edit
+	static unsigned int lastRevision(); // newest revision of any entity
 	Entity(void)
 	{
 		cachedModelIdx = -2;
@@ -40,6 +42,7 @@ public:
 	void addKeyvalue(const std::string key, const std::string value, bool multisupport = false);
 	void removeKeyvalue(const std::string key);
 	bool renameKey(int idx, const std::string& newName);
+	void swapKeys(int idx1, int idx2);
 	void clearAllKeyvalues();
 	void clearEmptyKeyvalues();
 
@@ -0,0 +1,106 @@
+#include "FlatTree.h"
+#include "Bsp.h"
+
+void FlatTree::clear()
+{
+	valid = false;
+	nodes.clear();
+	lumpIndex.clear();
+	planeIndex.clear();
+	firstFace.clear();
+	faceCount.clear();
+	lumpToFlat.clear();
+}
+
+int FlatTree::flatIndex(int lumpIdx) const
+{
+	if (lumpIdx < 0)
+		return lumpIdx;
+	return lumpIdx < (int)lumpToFlat.size() ? lumpToFlat[lumpIdx] : FLAT_BAD_CHILD;
+}
+
+void FlatTree::build(Bsp* map, bool clipnodes)
+{
+	clear();
+
+	int srcCount = clipnodes ? map->clipnodeCount : map->nodeCount;
+	lumpToFlat.assign(srcCount, -1);
+	lumpIndex.reserve(srcCount);
+
+	auto children_of = [&](int iNode) -> const int* {
+		return clipnodes ? map->clipnodes[iNode].iChildren : map->nodes[iNode].iChildren;
+	};
+
+	// depth first from the model head nodes, front child right after its parent. Nodes that no
+	// model reaches go last, and shared subtrees stay shared.
+	std::vector<int> stack;
+	auto add_tree = [&](int headnode) {
+		if (headnode < 0 || headnode >= srcCount || lumpToFlat[headnode] >= 0)
+			return;
+		stack.push_back(headnode);
+		while (!stack.empty())
+		{
+			int iNode = stack.back();
+			stack.pop_back();
+			if (lumpToFlat[iNode] >= 0)
+				continue;
+			lumpToFlat[iNode] = (int)lumpIndex.size();
+			lumpIndex.push_back(iNode);
+
+			const int* children = children_of(iNode);
+			for (int k = 1; k >= 0; k--)
+			{
+				if (children[k] >= 0 && children[k] < srcCount && lumpToFlat[children[k]] < 0)
+					stack.push_back(children[k]);
+			}
+		}
+	};
+
+	for (int m = 0; m < map->modelCount; m++)
+	{
+		for (int hull = clipnodes ? 1 : 0; hull < (clipnodes ? MAX_MAP_HULLS : 1); hull++)
+			add_tree(map->models[m].iHeadnodes[hull]);
+	}
+	for (int i = 0; i < srcCount; i++)
+		add_tree(i);
+
+	nodes.resize(srcCount);
+	planeIndex.resize(srcCount);
+	if (!clipnodes)
+	{
+		firstFace.resize(srcCount);
+		faceCount.resize(srcCount);
+	}
+
+	for (int i = 0; i < srcCount; i++)
+	{
+		int iNode = lumpIndex[i];
+		int iPlane = clipnodes ? map->clipnodes[iNode].iPlane : map->nodes[iNode].iPlane;
+		const int* children = children_of(iNode);
+
+		FlatNode& node = nodes[i];
+		node = FlatNode();
+		planeIndex[i] = iPlane;
+		if (iPlane >= 0 && iPlane < map->planeCount)
+		{
+			const BSPPLANE& plane = map->planes[iPlane];
+			node.normal[0] = plane.vNormal.x;
+			node.normal[1] = plane.vNormal.y;
+			node.normal[2] = plane.vNormal.z;
+			node.dist = plane.fDist;
+			node.planeType = plane.nType;
+		}
+		for (int k = 0; k < 2; k++)
+		{
+			int child = children[k];
+			node.children[k] = child < 0 ? child : child < srcCount ? lumpToFlat[child] : FLAT_BAD_CHILD;
+		}
+		if (!clipnodes)
+		{
+			firstFace[i] = map->nodes[iNode].firstFace;
+			faceCount[i] = map->nodes[iNode].nFaces;
+		}
+	}
+
+	valid.store(true, std::memory_order_release);
+}
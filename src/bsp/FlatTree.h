@@ -0,0 +1,42 @@
+#pragma once
+#include <vector>
+#include <atomic>
+
+class Bsp;
+
+// child index of a node that pointed outside of its lump
+#define FLAT_BAD_CHILD 0x7fffffff
+
+// hot part of a flattened node, two per cache line
+struct FlatNode
+{
+	float normal[3];
+	float dist;
+	int children[2];	// >= 0 flat index, < 0 leaf like in the lump (~leaf for nodes, contents for clipnodes)
+	int planeType;
+	int pad;
+};
+
+// Derived traversal layout for the nodes or the clipnodes of a map. Planes are stored inline with
+// the children and nodes are numbered depth first from the model head nodes, so walking a tree reads
+// memory mostly forward. Lump indexes and the rest of the node data are kept in separate arrays
+// for the walkers that need them.
+class FlatTree
+{
+public:
+	std::vector<FlatNode> nodes;
+	std::vector<int> lumpIndex;		// flat index -> node/clipnode index
+	std::vector<int> planeIndex;	// flat index -> plane index
+	std::vector<int> firstFace;		// nodes only
+	std::vector<int> faceCount;		// nodes only
+	std::atomic<bool> valid = false;	// stored with release order once the arrays are complete
+
+	void build(Bsp* map, bool clipnodes);
+	void clear();
+
+	// flat index of a node/clipnode, or the child value itself for leaves/contents
+	int flatIndex(int lumpIdx) const;
+
+private:
+	std::vector<int> lumpToFlat;
+};
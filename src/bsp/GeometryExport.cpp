@@ -0,0 +1,439 @@
+#include "GeometryExport.h"
+#include "Bsp.h"
+#include "Entity.h"
+#include "Wad.h"
+#include "rad.h"
+#include "util.h"
+#include "lodepng.h"
+#include <algorithm>
+#include <execution>
+#include <numeric>
+#include <atomic>
+#include <cfloat>
+#include <set>
+
+struct ExportVert
+{
+	vec3 pos;
+	vec3 normal;
+	float u, v;   // texture coords, v down
+	float lu, lv; // lightmap atlas coords, v down
+};
+
+struct ExportFace
+{
+	int material;
+	int firstVert;
+	int vertCount;
+};
+
+struct ExportModel
+{
+	std::vector<ExportVert> verts;
+	std::vector<ExportFace> faces;
+	std::vector<int> materials; // miptex indexes in order of first use
+	int lightmapWidth = 0;
+	int lightmapHeight = 0;
+	std::vector<COLOR3> lightmap;
+};
+
+// lightmap of one face in the model's atlas
+struct ExportLightmap
+{
+	int face;
+	int w, h;
+	int x, y;
+	int mins[2];
+};
+
+static BSPMIPTEX* export_miptex(Bsp* map, int miptex)
+{
+	if (miptex < 0 || miptex >= map->textureCount)
+		return NULL;
+	int texOffset = ((int*)map->textures)[miptex + 1];
+	if (texOffset < 0 || texOffset + (int)sizeof(BSPMIPTEX) > map->bsp_header.lump[LUMP_TEXTURES].nLength)
+		return NULL;
+	return (BSPMIPTEX*)(map->textures + texOffset);
+}
+
+static std::string export_material_name(Bsp* map, int miptex)
+{
+	BSPMIPTEX* tex = export_miptex(map, miptex);
+	if (!tex || tex->szName[0] == '\0')
+		return fmt::format("missing_{}", miptex);
+	return std::string(tex->szName, strnlen(tex->szName, MAXTEXTURENAME));
+}
+
+static void pack_lightmaps(Bsp* map, const GeometryExportOptions& options, int modelIdx,
+	std::vector<ExportLightmap>& rects, std::vector<int>& faceRect, ExportModel& out)
+{
+	BSPMODEL& model = map->models[modelIdx];
+	faceRect.assign(model.nFaces, -1);
+	if (!options.lightmaps || !map->lightdata)
+		return;
+
+	int lightLumpLen = map->bsp_header.lump[LUMP_LIGHTING].nLength;
+	int area = 0;
+	int maxWidth = 0;
+	for (int i = 0; i < model.nFaces; i++)
+	{
+		int faceIdx = model.iFirstFace + i;
+		BSPFACE32& face = map->faces[faceIdx];
+		BSPTEXTUREINFO& texinfo = map->texinfos[face.iTextureInfo];
+		if (face.nStyles[0] == 255 || face.nLightmapOffset < 0 || (texinfo.nFlags & TEX_SPECIAL))
+			continue;
+
+		ExportLightmap rect;
+		int maxs[2];
+		rect.face = i;
+		if (!GetFaceExtents(map, faceIdx, rect.mins, maxs))
+			continue;
+		rect.w = maxs[0] - rect.mins[0] + 1;
+		rect.h = maxs[1] - rect.mins[1] + 1;
+		if (face.nLightmapOffset + rect.w * rect.h * (int)sizeof(COLOR3) > lightLumpLen)
+			continue;
+
+		faceRect[i] = (int)rects.size();
+		rects.push_back(rect);
+		area += (rect.w + 1) * (rect.h + 1);
+		maxWidth = std::max(maxWidth, rect.w + 1);
+	}
+	if (rects.empty())
+		return;
+
+	// rows of lightmaps sorted by height, the atlas is about square
+	int width = 16;
+	while (width * width < area || width < maxWidth + 1)
+		width *= 2;
+
+	std::vector<int> order(rects.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::sort(order.begin(), order.end(), [&](int a, int b) {
+		if (rects[a].h != rects[b].h)
+			return rects[a].h > rects[b].h;
+		return a < b;
+		});
+
+	int x = 1, y = 1, rowHeight = 0;
+	for (int i : order)
+	{
+		ExportLightmap& rect = rects[i];
+		if (x + rect.w + 1 > width)
+		{
+			x = 1;
+			y += rowHeight + 1;
+			rowHeight = 0;
+		}
+		rect.x = x;
+		rect.y = y;
+		x += rect.w + 1;
+		rowHeight = std::max(rowHeight, rect.h);
+	}
+
+	out.lightmapWidth = width;
+	out.lightmapHeight = y + rowHeight + 1;
+	out.lightmap.assign(out.lightmapWidth * out.lightmapHeight, COLOR3(0, 0, 0));
+	for (ExportLightmap& rect : rects)
+	{
+		const COLOR3* src = (const COLOR3*)(map->lightdata + map->faces[model.iFirstFace + rect.face].nLightmapOffset);
+		for (int row = 0; row < rect.h; row++)
+		{
+			memcpy(&out.lightmap[(rect.y + row) * out.lightmapWidth + rect.x], src + row * rect.w, rect.w * sizeof(COLOR3));
+		}
+	}
+}
+
+static void build_export_model(Bsp* map, const GeometryExportOptions& options, int modelIdx, ExportModel& out)
+{
+	BSPMODEL& model = map->models[modelIdx];
+
+	vec3 offset;
+	int entIdx = map->get_ent_from_model(modelIdx);
+	if (entIdx >= 0)
+		offset = map->ents[entIdx]->getOrigin();
+
+	std::vector<ExportLightmap> rects;
+	std::vector<int> faceRect;
+	pack_lightmaps(map, options, modelIdx, rects, faceRect, out);
+
+	for (int i = 0; i < model.nFaces; i++)
+	{
+		int faceIdx = model.iFirstFace + i;
+		BSPFACE32& face = map->faces[faceIdx];
+		BSPTEXTUREINFO& texinfo = map->texinfos[face.iTextureInfo];
+		if (face.nEdges < 3)
+			continue;
+
+		BSPMIPTEX* tex = export_miptex(map, texinfo.iMiptex);
+		float texWidth = tex && tex->nWidth > 0 ? (float)tex->nWidth : 16.0f;
+		float texHeight = tex && tex->nHeight > 0 ? (float)tex->nHeight : 16.0f;
+
+		ExportFace exportFace;
+		exportFace.material = (int)(std::find(out.materials.begin(), out.materials.end(), texinfo.iMiptex) - out.materials.begin());
+		if (exportFace.material == (int)out.materials.size())
+			out.materials.push_back(texinfo.iMiptex);
+		exportFace.firstVert = (int)out.verts.size();
+		exportFace.vertCount = face.nEdges;
+
+		BSPPLANE plane = getPlaneFromFace(map, &face);
+		vec3 normal = plane.vNormal.flip();
+		ExportLightmap* rect = faceRect[i] >= 0 ? &rects[faceRect[i]] : NULL;
+
+		for (int e = 0; e < face.nEdges; e++)
+		{
+			int edgeIdx = map->surfedges[face.iFirstEdge + e];
+			BSPEDGE32& edge = map->edges[abs(edgeIdx)];
+			vec3 vert = map->verts[edgeIdx < 0 ? edge.iVertex[1] : edge.iVertex[0]];
+
+			ExportVert v;
+			v.pos = (vert + offset).flip() * options.scale;
+			v.normal = normal;
+
+			float fU = dotProduct(texinfo.vS, vert) + texinfo.shiftS;
+			float fV = dotProduct(texinfo.vT, vert) + texinfo.shiftT;
+			v.u = fU / texWidth;
+			v.v = fV / texHeight;
+
+			v.lu = v.lv = 0.0f;
+			if (rect)
+			{
+				v.lu = (rect->x + fU / 16.0f - rect->mins[0] + 0.5f) / out.lightmapWidth;
+				v.lv = (rect->y + fV / 16.0f - rect->mins[1] + 0.5f) / out.lightmapHeight;
+			}
+			out.verts.push_back(v);
+		}
+		out.faces.push_back(exportFace);
+	}
+}
+
+static bool write_export_file(const std::string& path, const std::string& data)
+{
+	if (!writeFile(path, data.data(), (int)data.size()))
+	{
+		logf("Failed to write {}\n", path);
+		return false;
+	}
+	return true;
+}
+
+static bool write_obj(Bsp* map, const std::string& dir, const std::string& baseName, ExportModel& model)
+{
+	std::string obj = "# Exported using bspguy!\n";
+	fmt::format_to(std::back_inserter(obj), "mtllib {}.mtl\no {}\n", baseName, baseName);
+
+	for (ExportVert& v : model.verts)
+		fmt::format_to(std::back_inserter(obj), "v {:.6f} {:.6f} {:.6f}\n", v.pos.x, v.pos.y, v.pos.z);
+	for (ExportVert& v : model.verts)
+		fmt::format_to(std::back_inserter(obj), "vt {:.6f} {:.6f}\n", v.u, -v.v);
+	for (ExportVert& v : model.verts)
+		fmt::format_to(std::back_inserter(obj), "vn {:.6f} {:.6f} {:.6f}\n", v.normal.x, v.normal.y, v.normal.z);
+
+	// faces grouped by material, reversed because of the flipped handedness
+	for (int m = 0; m < (int)model.materials.size(); m++)
+	{
+		fmt::format_to(std::back_inserter(obj), "usemtl {}\n", export_material_name(map, model.materials[m]));
+		for (ExportFace& face : model.faces)
+		{
+			if (face.material != m)
+				continue;
+			obj += "f";
+			for (int n = face.vertCount - 1; n >= 0; n--)
+			{
+				int id = face.firstVert + n + 1;
+				fmt::format_to(std::back_inserter(obj), " {}/{}/{}", id, id, id);
+			}
+			obj += "\n";
+		}
+	}
+
+	std::string mtl;
+	for (int miptex : model.materials)
+	{
+		std::string name = export_material_name(map, miptex);
+		fmt::format_to(std::back_inserter(mtl), "newmtl {}\nmap_Kd textures/{}.png\n", name, name);
+		if (IsTextureTransparent(name.c_str()) || name[0] == '{')
+			fmt::format_to(std::back_inserter(mtl), "map_d textures/{}.png\n", name);
+		mtl += "\n";
+	}
+
+	return write_export_file(dir + baseName + ".obj", obj) && write_export_file(dir + baseName + ".mtl", mtl);
+}
+
+static bool write_gltf(Bsp* map, const std::string& dir, const std::string& baseName, ExportModel& model)
+{
+	// one primitive per material, triangles fanned like the editor draws them
+	std::string bin;
+	std::string meshes, accessors, views, materials, textures, images;
+	int accessorCount = 0;
+
+	auto add_view = [&](const void* data, size_t len, bool indices) {
+		while (bin.size() % 4)
+			bin.push_back('\0');
+		fmt::format_to(std::back_inserter(views), "{}{{\"buffer\":0,\"byteOffset\":{},\"byteLength\":{},\"target\":{}}}",
+			views.empty() ? "" : ",", bin.size(), len, indices ? 34963 : 34962);
+		bin.append((const char*)data, len);
+	};
+	auto add_accessor = [&](int view, int componentType, int count, const char* type, const std::string& extra) {
+		fmt::format_to(std::back_inserter(accessors), "{}{{\"bufferView\":{},\"componentType\":{},\"count\":{},\"type\":\"{}\"{}}}",
+			accessors.empty() ? "" : ",", view, componentType, count, type, extra);
+		return accessorCount++;
+	};
+
+	int viewCount = 0;
+	std::string primitives;
+	for (int m = 0; m < (int)model.materials.size(); m++)
+	{
+		std::vector<float> positions, normals, uvs, luvs;
+		std::vector<unsigned int> indices;
+		vec3 mins(FLT_MAX, FLT_MAX, FLT_MAX), maxs(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		for (ExportFace& face : model.faces)
+		{
+			if (face.material != m)
+				continue;
+			unsigned int first = (unsigned int)(positions.size() / 3);
+			for (int n = 0; n < face.vertCount; n++)
+			{
+				ExportVert& v = model.verts[face.firstVert + n];
+				positions.insert(positions.end(), { v.pos.x, v.pos.y, v.pos.z });
+				normals.insert(normals.end(), { v.normal.x, v.normal.y, v.normal.z });
+				uvs.insert(uvs.end(), { v.u, v.v });
+				luvs.insert(luvs.end(), { v.lu, v.lv });
+				mins = vec3(std::min(mins.x, v.pos.x), std::min(mins.y, v.pos.y), std::min(mins.z, v.pos.z));
+				maxs = vec3(std::max(maxs.x, v.pos.x), std::max(maxs.y, v.pos.y), std::max(maxs.z, v.pos.z));
+			}
+			for (int n = 2; n < face.vertCount; n++)
+				indices.insert(indices.end(), { first + n, first + n - 1, first });
+		}
+		int count = (int)(positions.size() / 3);
+
+		add_view(positions.data(), positions.size() * sizeof(float), false);
+		int pos = add_accessor(viewCount++, 5126, count, "VEC3", fmt::format(",\"min\":[{:.6f},{:.6f},{:.6f}],\"max\":[{:.6f},{:.6f},{:.6f}]",
+			mins.x, mins.y, mins.z, maxs.x, maxs.y, maxs.z));
+		add_view(normals.data(), normals.size() * sizeof(float), false);
+		int nrm = add_accessor(viewCount++, 5126, count, "VEC3", "");
+		add_view(uvs.data(), uvs.size() * sizeof(float), false);
+		int uv0 = add_accessor(viewCount++, 5126, count, "VEC2", "");
+		add_view(luvs.data(), luvs.size() * sizeof(float), false);
+		int uv1 = add_accessor(viewCount++, 5126, count, "VEC2", "");
+		add_view(indices.data(), indices.size() * sizeof(unsigned int), true);
+		int idx = add_accessor(viewCount++, 5125, (int)indices.size(), "SCALAR", "");
+
+		fmt::format_to(std::back_inserter(primitives), "{}{{\"attributes\":{{\"POSITION\":{},\"NORMAL\":{},\"TEXCOORD_0\":{},\"TEXCOORD_1\":{}}},\"indices\":{},\"material\":{}}}",
+			primitives.empty() ? "" : ",", pos, nrm, uv0, uv1, idx, m);
+
+		std::string name = export_material_name(map, model.materials[m]);
+		fmt::format_to(std::back_inserter(images), "{}{{\"uri\":\"textures/{}.png\"}}", images.empty() ? "" : ",", name);
+		fmt::format_to(std::back_inserter(textures), "{}{{\"source\":{}}}", textures.empty() ? "" : ",", m);
+		fmt::format_to(std::back_inserter(materials), "{}{{\"name\":\"{}\",\"pbrMetallicRoughness\":{{\"baseColorTexture\":{{\"index\":{}}},\"metallicFactor\":0}}{}}}",
+			materials.empty() ? "" : ",", name, m, name[0] == '{' ? ",\"alphaMode\":\"MASK\"" : "");
+	}
+
+	std::string gltf = fmt::format("{{\"asset\":{{\"version\":\"2.0\",\"generator\":\"bspguy\"}},\"scene\":0,\"scenes\":[{{\"nodes\":[0]}}],"
+		"\"nodes\":[{{\"name\":\"{}\",\"mesh\":0}}],\"meshes\":[{{\"primitives\":[{}]}}],\"materials\":[{}],\"textures\":[{}],\"images\":[{}],"
+		"\"accessors\":[{}],\"bufferViews\":[{}],\"buffers\":[{{\"uri\":\"{}.bin\",\"byteLength\":{}}}]}}\n",
+		baseName, primitives, materials, textures, images, accessors, views, baseName, bin.size());
+
+	return write_export_file(dir + baseName + ".gltf", gltf) && write_export_file(dir + baseName + ".bin", bin);
+}
+
+static bool write_export_texture(Bsp* map, const std::string& dir, int miptex)
+{
+	BSPMIPTEX* tex = export_miptex(map, miptex);
+	if (!tex || tex->nOffsets[0] <= 0 || tex->nWidth <= 0 || tex->nHeight <= 0)
+		return true; // in a wad
+
+	std::string path = dir + "textures/" + export_material_name(map, miptex) + ".png";
+	COLOR4* imageData = ConvertMipTexToRGBA(tex, map->is_texture_with_pal(miptex) ? NULL : (COLOR3*)quakeDefaultPalette);
+	unsigned int error = lodepng_encode32_file(path.c_str(), (const unsigned char*)imageData, tex->nWidth, tex->nHeight);
+	delete[] imageData;
+	if (error)
+	{
+		logf("Failed to write {}\n", path);
+		return false;
+	}
+	return true;
+}
+
+bool export_geometry(Bsp* map, const std::string& dir, const GeometryExportOptions& options)
+{
+	if (!dirExists(dir) && !createDir(dir))
+	{
+		logf("Error output path directory \"{}\" can't be created!\n", dir);
+		return false;
+	}
+	if ((options.textures || options.gltf) && !dirExists(dir + "textures") && !createDir(dir + "textures"))
+	{
+		logf("Error output path directory \"{}\" can't be created!\n", dir + "textures");
+		return false;
+	}
+
+	std::vector<int> modelIds(map->modelCount);
+	std::iota(modelIds.begin(), modelIds.end(), 0);
+	std::vector<char> usedTextures(map->textureCount);
+	for (int m = 0; m < map->modelCount; m++)
+	{
+		BSPMODEL& model = map->models[m];
+		for (int i = 0; i < model.nFaces; i++)
+		{
+			int miptex = map->texinfos[map->faces[model.iFirstFace + i].iTextureInfo].iMiptex;
+			if (map->faces[model.iFirstFace + i].nEdges >= 3 && miptex >= 0 && miptex < map->textureCount)
+				usedTextures[miptex] = 1;
+		}
+	}
+	std::atomic<bool> ok = true;
+
+	// each model is built and written by one thread, so only one model per thread is in memory
+	auto export_model = [&](int modelIdx) {
+		ExportModel model;
+		build_export_model(map, options, modelIdx, model);
+		if (model.faces.empty())
+			return;
+
+		std::string baseName = fmt::format("{}_model{}", map->bsp_name, modelIdx);
+		bool written = write_obj(map, dir, baseName, model);
+		if (options.gltf)
+			written = write_gltf(map, dir, baseName, model) && written;
+		if (model.lightmap.size())
+		{
+			std::string lightmapPath = dir + baseName + "_lightmap.png";
+			if (lodepng_encode24_file(lightmapPath.c_str(), (const unsigned char*)model.lightmap.data(), model.lightmapWidth, model.lightmapHeight))
+			{
+				logf("Failed to write {}\n", lightmapPath);
+				written = false;
+			}
+		}
+		if (!written)
+			ok = false;
+	};
+
+	if (options.parallel)
+		std::for_each(std::execution::par, modelIds.begin(), modelIds.end(), export_model);
+	else
+		std::for_each(modelIds.begin(), modelIds.end(), export_model);
+
+	if (options.textures)
+	{
+		// files are named after the textures, so only one of the embedded textures sharing a name is
+		// written (the last one, like a serial export overwriting the others would leave)
+		std::vector<int> texIds;
+		std::set<std::string> names;
+		for (int i = map->textureCount - 1; i >= 0; i--)
+		{
+			BSPMIPTEX* tex = export_miptex(map, i);
+			if (!usedTextures[i] || !tex || tex->nOffsets[0] <= 0)
+				continue;
+			if (names.insert(toLowerCase(export_material_name(map, i))).second)
+				texIds.push_back(i);
+		}
+		auto export_texture = [&](int miptex) {
+			if (!write_export_texture(map, dir, miptex))
+				ok = false;
+		};
+		if (options.parallel)
+			std::for_each(std::execution::par, texIds.begin(), texIds.end(), export_texture);
+		else
+			std::for_each(texIds.begin(), texIds.end(), export_texture);
+	}
+
+	return ok;
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include <string>
+
+class Bsp;
+
+struct GeometryExportOptions
+{
+	float scale = 1.0f;
+	bool gltf = false;        // also write <model>.gltf/.bin with texture and lightmap uvs
+	bool textures = true;     // write the embedded textures (wad textures are only referenced)
+	bool lightmaps = true;    // pack the first lightmap style of each model into <model>_lightmap.png
+	bool parallel = true;
+};
+
+// Exports every brush model of the map to <dir>/<map>_model<N>.obj/.mtl, using only the bsp lumps so
+// it works without a renderer or a window. Models are built in parallel and each one is written out
+// as soon as it's done. Coordinates are converted to Y up like the editor's obj export, vertex
+// order and number formatting are fixed so the same map always gives the same files.
+bool export_geometry(Bsp* map, const std::string& dir, const GeometryExportOptions& options);
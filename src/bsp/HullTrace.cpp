@@ -0,0 +1,401 @@
+#include "HullTrace.h"
+#include "Bsp.h"
+#include "util.h"
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TRACE_SSE
+#endif
+
+#define DIST_EPSILON 0.03125f // engine SV_RecursiveHullCheck
+
+// engine clip hull boxes
+static const vec3 g_hull_mins[MAX_MAP_HULLS] = {
+	vec3(0.0f, 0.0f, 0.0f), vec3(-16.0f, -16.0f, -36.0f), vec3(-32.0f, -32.0f, -32.0f), vec3(-16.0f, -16.0f, -18.0f)
+};
+
+static inline bool trace_blocks(int contents)
+{
+	return contents == CONTENTS_SOLID || contents == CONTENTS_SKY;
+}
+
+HullTracer::HullTracer(Bsp* map, int modelIdx)
+{
+	for (int i = 0; i < MAX_MAP_HULLS; i++)
+	{
+		emptyContents[i] = CONTENTS_EMPTY;
+		headNode[i] = 0;
+		if (modelIdx >= 0 && modelIdx < map->modelCount)
+			copyHull(map, i, map->models[modelIdx].iHeadnodes[i]);
+	}
+}
+
+void HullTracer::copyHull(Bsp* map, int hull, int headnode)
+{
+	const FlatTree& tree = hull == 0 ? map->getNodeTree() : map->getClipnodeTree();
+	int flatCount = (int)tree.nodes.size();
+	int root = tree.flatIndex(headnode);
+	if (root < 0 || root >= flatCount)
+	{
+		if (hull == 0 && headnode < 0 && ~headnode < map->leafCount)
+			emptyContents[hull] = map->leaves[~headnode].nContents;
+		else if (hull != 0 && headnode < 0)
+			emptyContents[hull] = headnode;
+		return;
+	}
+
+	// keep the nodes this model reaches, in the depth first order of the map's tree
+	std::vector<int> remap(flatCount, -1);
+	std::vector<int> stack;
+	remap[root] = 0;
+	stack.push_back(root);
+	while (!stack.empty())
+	{
+		const FlatNode& node = tree.nodes[stack.back()];
+		stack.pop_back();
+		for (int k = 0; k < 2; k++)
+		{
+			int child = node.children[k];
+			if (child >= 0 && child < flatCount && remap[child] < 0)
+			{
+				remap[child] = 0;
+				stack.push_back(child);
+			}
+		}
+	}
+
+	int count = 0;
+	for (int i = 0; i < flatCount; i++)
+	{
+		if (remap[i] >= 0)
+			remap[i] = count++;
+	}
+	headNode[hull] = remap[root];
+
+	std::vector<FlatNode>& out = hulls[hull];
+	out.resize(count);
+	for (int i = 0; i < flatCount; i++)
+	{
+		if (remap[i] < 0)
+			continue;
+
+		FlatNode& node = out[remap[i]];
+		node = tree.nodes[i];
+		for (int k = 0; k < 2; k++)
+		{
+			int child = node.children[k];
+			if (child >= 0)
+			{
+				node.children[k] = child < flatCount ? remap[child] : CONTENTS_EMPTY;
+			}
+			else if (hull == 0)
+			{
+				int contents = ~child < map->leafCount ? map->leaves[~child].nContents : CONTENTS_EMPTY;
+				node.children[k] = contents < 0 ? contents : CONTENTS_EMPTY;
+			}
+		}
+	}
+}
+
+bool HullTracer::hasHull(int hull) const
+{
+	return hull >= 0 && hull < MAX_MAP_HULLS && !hulls[hull].empty();
+}
+
+int HullTracer::nodeCount(int hull) const
+{
+	return hull >= 0 && hull < MAX_MAP_HULLS ? (int)hulls[hull].size() : 0;
+}
+
+int HullTracer::pointContents(const vec3& p, int hull) const
+{
+	if (!hasHull(hull))
+		return hull >= 0 && hull < MAX_MAP_HULLS ? emptyContents[hull] : CONTENTS_EMPTY;
+
+	const FlatNode* nodes = hulls[hull].data();
+	int iNode = headNode[hull];
+	while (iNode >= 0)
+	{
+		const FlatNode& node = nodes[iNode];
+		float d = node.normal[0] * p.x + node.normal[1] * p.y + node.normal[2] * p.z - node.dist;
+		iNode = node.children[d < 0 ? 1 : 0];
+	}
+	return iNode;
+}
+
+TraceResult HullTracer::traceLine(const vec3& start, const vec3& end, int hull) const
+{
+	TraceResult result;
+	tracePacket(&start, &end, 1, hull, &result);
+	return result;
+}
+
+TraceResult HullTracer::traceBox(const vec3& start, const vec3& end, const vec3& mins, const vec3& maxs) const
+{
+	// same hull selection as the engine's SV_HullForBsp
+	vec3 size = maxs - mins;
+	int hull = 0;
+	if (size.x >= 3.0f)
+	{
+		if (size.x <= 36.0f)
+			hull = size.z <= 36.0f ? 3 : 1;
+		else
+			hull = 2;
+	}
+
+	vec3 offset = g_hull_mins[hull] - mins;
+	TraceResult result = traceLine(start - offset, end - offset, hull);
+	result.endpos += offset;
+	result.planeDist += dotProduct(result.planeNormal, offset);
+	return result;
+}
+
+// Packet traversal. Every lane keeps the part [tmin, tmax] of its line that lies in the current
+// node, and the plane it crossed to get there. A node splits the interval of each lane into a front
+// and a back part. Lanes that already hit something closer than their interval are dropped.
+
+struct TracePacketLanes
+{
+	float ox[TRACE_PACKET_MAX], oy[TRACE_PACKET_MAX], oz[TRACE_PACKET_MAX];
+	float dx[TRACE_PACKET_MAX], dy[TRACE_PACKET_MAX], dz[TRACE_PACKET_MAX];
+};
+
+struct TraceFrame
+{
+	int node;
+	unsigned int mask;
+	float tmin[TRACE_PACKET_MAX];
+	float tmax[TRACE_PACKET_MAX];
+	int plane[TRACE_PACKET_MAX]; // crossed plane, node * 2 + (1 if the hit normal is flipped), -1 = none
+};
+
+// splits the lane intervals of a frame by a plane. frontMask/backMask get the lanes that have
+// a part of their interval on that side, startFront the lanes whose interval starts in front.
+static inline void split_lanes(const TracePacketLanes& lanes, const TraceFrame& frame, int lanesUsed, const float* normal, float dist,
+	TraceFrame& front, TraceFrame& back, unsigned int& frontMask, unsigned int& backMask, unsigned int& startFront)
+{
+	unsigned int inFront0 = 0;
+	unsigned int inFront1 = 0;
+
+#ifdef TRACE_SSE
+	const __m128 nx = _mm_set1_ps(normal[0]);
+	const __m128 ny = _mm_set1_ps(normal[1]);
+	const __m128 nz = _mm_set1_ps(normal[2]);
+	const __m128 nd = _mm_set1_ps(dist);
+	const __m128 zero = _mm_setzero_ps();
+	for (int i = 0; i < lanesUsed; i += 4)
+	{
+		__m128 ds = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, _mm_loadu_ps(lanes.ox + i)), _mm_mul_ps(ny, _mm_loadu_ps(lanes.oy + i))),
+			_mm_mul_ps(nz, _mm_loadu_ps(lanes.oz + i))), nd);
+		__m128 dd = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, _mm_loadu_ps(lanes.dx + i)), _mm_mul_ps(ny, _mm_loadu_ps(lanes.dy + i))),
+			_mm_mul_ps(nz, _mm_loadu_ps(lanes.dz + i)));
+		__m128 tmin = _mm_loadu_ps(frame.tmin + i);
+		__m128 tmax = _mm_loadu_ps(frame.tmax + i);
+		__m128 front0 = _mm_cmpge_ps(_mm_add_ps(ds, _mm_mul_ps(dd, tmin)), zero);
+		__m128 front1 = _mm_cmpge_ps(_mm_add_ps(ds, _mm_mul_ps(dd, tmax)), zero);
+		__m128 split = _mm_div_ps(_mm_sub_ps(zero, ds), dd);
+
+		// front part: [front0 ? tmin : split, front1 ? tmax : split], back part is the rest
+		_mm_storeu_ps(front.tmin + i, _mm_or_ps(_mm_and_ps(front0, tmin), _mm_andnot_ps(front0, split)));
+		_mm_storeu_ps(front.tmax + i, _mm_or_ps(_mm_and_ps(front1, tmax), _mm_andnot_ps(front1, split)));
+		_mm_storeu_ps(back.tmin + i, _mm_or_ps(_mm_andnot_ps(front0, tmin), _mm_and_ps(front0, split)));
+		_mm_storeu_ps(back.tmax + i, _mm_or_ps(_mm_andnot_ps(front1, tmax), _mm_and_ps(front1, split)));
+
+		inFront0 |= (unsigned int)_mm_movemask_ps(front0) << i;
+		inFront1 |= (unsigned int)_mm_movemask_ps(front1) << i;
+	}
+#else
+	for (int i = 0; i < lanesUsed; i++)
+	{
+		float ds = normal[0] * lanes.ox[i] + normal[1] * lanes.oy[i] + normal[2] * lanes.oz[i] - dist;
+		float dd = normal[0] * lanes.dx[i] + normal[1] * lanes.dy[i] + normal[2] * lanes.dz[i];
+		bool front0 = ds + dd * frame.tmin[i] >= 0.0f;
+		bool front1 = ds + dd * frame.tmax[i] >= 0.0f;
+		float split = front0 != front1 ? -ds / dd : 0.0f;
+
+		front.tmin[i] = front0 ? frame.tmin[i] : split;
+		front.tmax[i] = front1 ? frame.tmax[i] : split;
+		back.tmin[i] = front0 ? split : frame.tmin[i];
+		back.tmax[i] = front1 ? split : frame.tmax[i];
+
+		inFront0 |= (unsigned int)front0 << i;
+		inFront1 |= (unsigned int)front1 << i;
+	}
+#endif
+
+	frontMask = frame.mask & (inFront0 | inFront1);
+	backMask = frame.mask & ~(inFront0 & inFront1);
+	startFront = inFront0;
+
+	int planeCode = frame.node * 2;
+	for (int i = 0; i < lanesUsed; i++)
+	{
+		unsigned int bit = 1u << i;
+		// lanes that cross into the front side hit the back of the plane, and the other way around
+		front.plane[i] = (inFront0 & bit) ? frame.plane[i] : planeCode + 1;
+		back.plane[i] = (inFront0 & bit) ? planeCode : frame.plane[i];
+	}
+}
+
+void HullTracer::tracePacket(const vec3* starts, const vec3* ends, int count, int hull, TraceResult* results) const
+{
+	count = std::min(std::max(count, 0), TRACE_PACKET_MAX);
+	if (count == 0)
+		return;
+
+	float bestT[TRACE_PACKET_MAX];
+	int bestPlane[TRACE_PACKET_MAX];
+	int bestContents[TRACE_PACKET_MAX];
+	unsigned int startSolid = 0;
+	float firstEmpty[TRACE_PACKET_MAX]; // where the line first enters open space
+
+	// SIMD loads work on groups of 4 lanes, unused lanes repeat the first ray but are masked out
+	int lanesUsed = (count + 3) & ~3;
+	TracePacketLanes lanes;
+	for (int i = 0; i < TRACE_PACKET_MAX; i++)
+	{
+		int src = i < count ? i : 0;
+		lanes.ox[i] = starts[src].x;
+		lanes.oy[i] = starts[src].y;
+		lanes.oz[i] = starts[src].z;
+		lanes.dx[i] = ends[src].x - starts[src].x;
+		lanes.dy[i] = ends[src].y - starts[src].y;
+		lanes.dz[i] = ends[src].z - starts[src].z;
+		bestT[i] = 1.0f;
+		bestPlane[i] = -1;
+		bestContents[i] = CONTENTS_EMPTY;
+		firstEmpty[i] = 2.0f;
+	}
+
+	const FlatNode* nodes = hasHull(hull) ? hulls[hull].data() : NULL;
+	if (!nodes)
+	{
+		int contents = hull >= 0 && hull < MAX_MAP_HULLS ? emptyContents[hull] : CONTENTS_EMPTY;
+		if (trace_blocks(contents))
+			startSolid = (1u << count) - 1;
+		else
+			std::fill(firstEmpty, firstEmpty + count, 0.0f);
+	}
+	else
+	{
+		thread_local std::vector<TraceFrame> stack;
+		stack.clear();
+
+		TraceFrame root;
+		root.node = headNode[hull];
+		root.mask = (1u << count) - 1;
+		for (int i = 0; i < TRACE_PACKET_MAX; i++)
+		{
+			root.tmin[i] = 0.0f;
+			root.tmax[i] = 1.0f;
+			root.plane[i] = -1;
+		}
+		stack.push_back(root);
+
+		TraceFrame front;
+		TraceFrame back;
+		while (!stack.empty())
+		{
+			TraceFrame frame = stack.back();
+			stack.pop_back();
+
+			// drop lanes that already hit something before this part of their line
+			for (int i = 0; i < count; i++)
+			{
+				if ((frame.mask & (1u << i)) && frame.tmin[i] > bestT[i])
+					frame.mask &= ~(1u << i);
+			}
+			if (!frame.mask)
+				continue;
+
+			const FlatNode& node = nodes[frame.node];
+			unsigned int frontMask, backMask, startFront;
+			split_lanes(lanes, frame, lanesUsed, node.normal, node.dist, front, back, frontMask, backMask, startFront);
+
+			int firstLane = 0;
+			while (!(frame.mask & (1u << firstLane)))
+				firstLane++;
+			int nearSide = (startFront & (1u << firstLane)) ? 0 : 1;
+
+			// leaves are resolved right away. Nodes are pushed far side first, so the near side is
+			// popped first and its hits cull the far side.
+			for (int pass = 0; pass < 2; pass++)
+			{
+				int side = pass == 0 ? 1 - nearSide : nearSide;
+				TraceFrame& child = side == 0 ? front : back;
+				unsigned int mask = side == 0 ? frontMask : backMask;
+				int childNode = node.children[side];
+				if (!mask)
+					continue;
+
+				if (childNode >= 0)
+				{
+					child.node = childNode;
+					child.mask = mask;
+					stack.push_back(child);
+					continue;
+				}
+
+				for (int i = 0; i < count; i++)
+				{
+					if (!(mask & (1u << i)))
+						continue;
+					if (!trace_blocks(childNode))
+					{
+						firstEmpty[i] = std::min(firstEmpty[i], child.tmin[i]);
+					}
+					else if (child.plane[i] < 0)
+					{
+						startSolid |= 1u << i;
+					}
+					else if (child.tmin[i] < bestT[i])
+					{
+						bestT[i] = child.tmin[i];
+						bestPlane[i] = child.plane[i];
+						bestContents[i] = childNode;
+					}
+				}
+			}
+		}
+	}
+
+	for (int i = 0; i < count; i++)
+	{
+		TraceResult& res = results[i];
+		vec3 dir = ends[i] - starts[i];
+		res.startSolid = (startSolid & (1u << i)) != 0;
+		// like the engine, a trace that starts in solid has to get out into open space before
+		// it hits anything, or it is stuck
+		res.allSolid = res.startSolid && bestT[i] <= firstEmpty[i];
+		res.contents = bestContents[i];
+		res.planeNormal = vec3();
+		res.planeDist = 0.0f;
+		res.fraction = bestT[i];
+
+		if (res.allSolid)
+		{
+			res.fraction = 0.0f;
+			res.contents = CONTENTS_SOLID;
+		}
+		else if (bestPlane[i] >= 0)
+		{
+			const FlatNode& node = nodes[bestPlane[i] >> 1];
+			vec3 normal(node.normal[0], node.normal[1], node.normal[2]);
+			float dist = node.dist;
+			if (bestPlane[i] & 1)
+			{
+				normal = normal * -1.0f;
+				dist = -dist;
+			}
+			res.planeNormal = normal;
+			res.planeDist = dist;
+
+			// stop just before the plane, like the engine
+			float dd = fabs(dotProduct(normal, dir));
+			if (dd > 0.0f)
+				res.fraction = std::max(0.0f, res.fraction - DIST_EPSILON / dd);
+		}
+		res.endpos = starts[i] + dir * res.fraction;
+	}
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include "vectors.h"
+#include "bsplimits.h"
+#include "FlatTree.h"
+#include <vector>
+
+class Bsp;
+
+#define TRACE_PACKET_MAX 8
+
+struct TraceResult
+{
+	float fraction;		// 1.0 = nothing was hit
+	vec3 endpos;
+	vec3 planeNormal;	// plane that was hit, facing the start of the trace
+	float planeDist;
+	int contents;		// contents that stopped the trace, CONTENTS_EMPTY if nothing was hit
+	bool startSolid;
+	bool allSolid;		// started in solid and never got out into open space
+};
+
+// Point, line and box traces against the hulls of one model.
+// The part of the map's flattened node (hull 0) and clipnode (hulls 1-3) trees that the model
+// reaches is copied when the tracer is created, so edits made to the map afterwards are not seen by it.
+class HullTracer
+{
+public:
+	HullTracer(Bsp* map, int modelIdx = 0);
+
+	bool hasHull(int hull) const;
+	int nodeCount(int hull) const;
+
+	int pointContents(const vec3& p, int hull) const;
+
+	// hull 0 is a line trace, hulls 1-3 trace the standing/large/crouching player box centers
+	TraceResult traceLine(const vec3& start, const vec3& end, int hull = 0) const;
+
+	// traces a box through the hull that fits it best, like the engine does
+	TraceResult traceBox(const vec3& start, const vec3& end, const vec3& mins, const vec3& maxs) const;
+
+	// traces up to TRACE_PACKET_MAX lines together. Plane tests are done for the whole packet
+	// with SIMD, so coherent rays (same origin, nearby directions) are much faster than one by one.
+	void tracePacket(const vec3* starts, const vec3* ends, int count, int hull, TraceResult* results) const;
+
+private:
+	std::vector<FlatNode> hulls[MAX_MAP_HULLS]; // children >= 0 node index, < 0 contents
+	int headNode[MAX_MAP_HULLS];
+	int emptyContents[MAX_MAP_HULLS]; // contents of a hull without nodes
+
+	void copyHull(Bsp* map, int hull, int headnode);
+};
@@ -5,6 +5,8 @@
 #include "util.h"
 #include "Settings.h"
 #include "Renderer.h"
+#include "mipmap.h"
+#include "pathcache.h"
 
 Wad::Wad(void)
 {
@@ -245,6 +247,7 @@ bool Wad::write(std::vector<WADTEX*> textures)
 bool Wad::write(const std::string& _filename, std::vector<WADTEX*> textures)
 {
 	this->filename = _filename;
+	g_path_cache.clear(); // the wad may be new
 
 	std::ofstream myFile(filename, std::ios::trunc | std::ios::binary);
 
@@ -450,29 +453,11 @@ WADTEX* create_wadtex(const char* name, COLOR3* rgbdata, int width, int height)
 		int mipWidth = width / div;
 		int mipHeight = height / div;
 		texDataSize += mipWidth * mipHeight;
-		mip[i] = new unsigned char[texDataSize];
-
-		src = rgbdata;
-		for (int y = 0; y < mipHeight; y++)
-		{
-			for (int x = 0; x < mipWidth; x++)
-			{
-				int paletteIdx = -1;
-				for (int k = 0; k < colorCount; k++)
-				{
-					if (*src == palette[k])
-					{
-						paletteIdx = k;
-						break;
-					}
-				}
-
-				mip[i][y * mipWidth + x] = (unsigned char)paletteIdx;
-				src += div;
-			}
-		}
+		mip[i] = new unsigned char[mipWidth * mipHeight];
 	}
 
+	GenerateMipMaps(mip, width, height, palette, do_magic ? 256 : colorCount, g_settings.mipFilter, do_magic ? 255 : -1);
+
 	size_t newTexLumpSize = sizeof(BSPMIPTEX) + texDataSize;
 
 	//newTexLumpSize = ((newTexLumpSize + 3) & ~3); /* 4 bytes padding */
@@ -498,6 +483,11 @@ WADTEX* create_wadtex(const char* name, COLOR3* rgbdata, int width, int height)
 	memcpy(newTexData + newMipTex->nOffsets[3], mip[3], (width >> 3) * (height >> 3));
 	memcpy(palleteOffset, palette, sizeof(COLOR3) * 256);
 
+	for (int i = 0; i < MIPLEVELS; i++)
+	{
+		delete[] mip[i];
+	}
+
 	palleteOffset[-1] = 0x01;
 	palleteOffset[-2] = 0x00;
 
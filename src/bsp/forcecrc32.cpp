@@ -48,22 +48,51 @@ void PathCrc32InMemory(unsigned char* data, unsigned int len, unsigned int offse
 	}
 }
 
-unsigned int GetCrc32InMemory(unsigned char* f, unsigned int length, unsigned int oldcrc)
+// Feeding bits lsb first into a msb first register is the same as the usual reflected
+// crc32 with a bit reversed state, so the state is reversed once and bytes are
+// processed 8 at a time with slicing tables (0xEDB88320 is POLYNOMIAL reflected).
+static unsigned int g_crc_tables[8][256];
+
+static void InitCrc32Tables()
 {
-	unsigned int crc = oldcrc;
-	for (size_t i = 0; i < length; i++)
-	{
-		for (int j = 0; j < 8; j++)
+	static bool initialized = [] {
+		for (unsigned int i = 0; i < 256; i++)
 		{
-			unsigned int bit = ((unsigned char)f[i] >> j) & 1;
-			crc ^= bit << 31;
-			bool xorval = (crc >> 31) != 0;
-			crc = (crc & UINT32_C(0x7FFFFFFF)) << 1;
-			if (xorval)
-				crc ^= (unsigned int)POLYNOMIAL;
+			unsigned int c = i;
+			for (int j = 0; j < 8; j++)
+				c = (c & 1) ? (c >> 1) ^ UINT32_C(0xEDB88320) : (c >> 1);
+			g_crc_tables[0][i] = c;
 		}
+		for (unsigned int i = 0; i < 256; i++)
+		{
+			for (int t = 1; t < 8; t++)
+				g_crc_tables[t][i] = (g_crc_tables[t - 1][i] >> 8) ^ g_crc_tables[0][g_crc_tables[t - 1][i] & 0xFF];
+		}
+		return true;
+	}();
+	(void)initialized;
+}
+
+unsigned int GetCrc32InMemory(unsigned char* f, unsigned int length, unsigned int oldcrc)
+{
+	InitCrc32Tables();
+
+	unsigned int crc = reverse_bits(oldcrc);
+	size_t i = 0;
+	for (; i + 8 <= length; i += 8)
+	{
+		unsigned int lo = crc ^ ((unsigned int)f[i] | ((unsigned int)f[i + 1] << 8) | ((unsigned int)f[i + 2] << 16) | ((unsigned int)f[i + 3] << 24));
+		unsigned int hi = (unsigned int)f[i + 4] | ((unsigned int)f[i + 5] << 8) | ((unsigned int)f[i + 6] << 16) | ((unsigned int)f[i + 7] << 24);
+		crc = g_crc_tables[7][lo & 0xFF] ^ g_crc_tables[6][(lo >> 8) & 0xFF] ^
+			g_crc_tables[5][(lo >> 16) & 0xFF] ^ g_crc_tables[4][lo >> 24] ^
+			g_crc_tables[3][hi & 0xFF] ^ g_crc_tables[2][(hi >> 8) & 0xFF] ^
+			g_crc_tables[1][(hi >> 16) & 0xFF] ^ g_crc_tables[0][hi >> 24];
+	}
+	for (; i < length; i++)
+	{
+		crc = g_crc_tables[0][(crc ^ f[i]) & 0xFF] ^ (crc >> 8);
 	}
-	return crc;
+	return reverse_bits(crc);
 }
 
 unsigned int reverse_bits(unsigned int x)
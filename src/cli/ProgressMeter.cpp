@@ -1,8 +1,15 @@
 #include "ProgressMeter.h"
 #include <string>
 #include <stdio.h> 
+#include <algorithm>
 #include "util.h"
 
+// stages opened on this thread, innermost last
+static thread_local std::vector<int> t_openStages;
+static thread_local int t_generation = -1;
+static thread_local int t_thread = -1;
+static std::atomic<int> g_profileThreads{ 0 };
+
 ProgressMeter::ProgressMeter()
 {
 	progress_total = progress = 0;
@@ -14,6 +21,14 @@ void ProgressMeter::update(const char* newTitle, int totalProgressTicks)
 	progress_title = newTitle;
 	progress = 0;
 	progress_total = totalProgressTicks;
+	if (profiling)
+	{
+		std::lock_guard<std::mutex> lock(profileMutex);
+		closeAutomaticStage();
+		// only inside a scope, so the stage ends when the operation does
+		if (newTitle[0] != '\0' && t_generation == profileGeneration && t_openStages.size())
+			openStage(newTitle, true);
+	}
 	if (simpleMode && !hide)
 	{
 		logf(std::string(newTitle) + "\n");
@@ -40,11 +55,16 @@ void ProgressMeter::tick()
 	float percent = (progress / (float)progress_total) * 100;
 
 	for (int i = 0; i < 12; i++) logf("\b\b\b\b");
-	logf("\r          {:-32s} {:.0f}%", progress_title, percent);
+	logf("\r          {:<32} {:.0f}%", progress_title, percent);
 }
 
 void ProgressMeter::clear()
 {
+	if (profiling)
+	{
+		std::lock_guard<std::mutex> lock(profileMutex);
+		closeAutomaticStage();
+	}
 	if (simpleMode || hide)
 	{
 		return;
@@ -53,4 +73,282 @@ void ProgressMeter::clear()
 	for (int i = 0; i < 6; i++) logf("\b\b\b\b\b\b\b\b\b\b");
 	for (int i = 0; i < 6; i++) logf("          ");
 	for (int i = 0; i < 6; i++) logf("\b\b\b\b\b\b\b\b\b\b");
-}
\ No newline at end of file
+}
+
+static std::string json_string(const std::string& s)
+{
+	std::string out = "\"";
+	for (char c : s)
+	{
+		switch (c)
+		{
+		case '"': out += "\\\""; break;
+		case '\\': out += "\\\\"; break;
+		case '\n': out += "\\n"; break;
+		case '\r': out += "\\r"; break;
+		case '\t': out += "\\t"; break;
+		default:
+			if ((unsigned char)c < 0x20)
+				out += fmt::format("\\u{:04x}", (int)(unsigned char)c);
+			else
+				out += c;
+		}
+	}
+	return out + "\"";
+}
+
+void ProgressMeter::startProfile()
+{
+	std::lock_guard<std::mutex> lock(profileMutex);
+	stages.clear();
+	openStageCount = 0;
+	profileGeneration++;
+	profileStart = std::chrono::steady_clock::now();
+	peakResets = resetPeakMemoryUsage();
+	profiling = true;
+}
+
+void ProgressMeter::stopProfile()
+{
+	profiling = false;
+}
+
+void ProgressMeter::clearProfile()
+{
+	std::lock_guard<std::mutex> lock(profileMutex);
+	stages.clear();
+	openStageCount = 0;
+	profileGeneration++;
+	profileStart = std::chrono::steady_clock::now();
+}
+
+int ProgressMeter::stageCount()
+{
+	std::lock_guard<std::mutex> lock(profileMutex);
+	return (int)stages.size();
+}
+
+void ProgressMeter::beginStage(const std::string& name)
+{
+	std::lock_guard<std::mutex> lock(profileMutex);
+	openStage(name, false);
+}
+
+void ProgressMeter::endStage()
+{
+	std::lock_guard<std::mutex> lock(profileMutex);
+	if (t_generation != profileGeneration)
+	{
+		// cleared while the stage was open
+		t_openStages.clear();
+		return;
+	}
+	while (t_openStages.size() && stages[t_openStages.back()].automatic)
+	{
+		closeStage(t_openStages.back());
+		t_openStages.pop_back();
+	}
+	if (t_openStages.size())
+	{
+		closeStage(t_openStages.back());
+		t_openStages.pop_back();
+	}
+}
+
+int ProgressMeter::openStage(const std::string& name, bool automatic)
+{
+	if (t_generation != profileGeneration)
+	{
+		t_openStages.clear();
+		t_generation = profileGeneration;
+	}
+	if (t_thread < 0)
+		t_thread = g_profileThreads++;
+
+	ProfileStage stage;
+	stage.name = name;
+	stage.automatic = automatic;
+	stage.thread = t_thread;
+	stage.parent = t_openStages.size() ? t_openStages.back() : -1;
+	stage.depth = (int)t_openStages.size();
+
+	// the peak is restarted for every stage, so hand what was reached so far to the enclosing ones.
+	// The peak is process wide, restarting it would lose the peak of stages open on other threads.
+	bool resetPeak = peakResets && openStageCount == (int)t_openStages.size();
+	size_t peak = getPeakMemoryUsage();
+	for (int p = stage.parent; p >= 0; p = stages[p].parent)
+		stages[p].peakMemory = std::max(stages[p].peakMemory, peak);
+	if (resetPeak)
+		resetPeakMemoryUsage();
+
+	stage.startMemory = getMemoryUsage();
+	stage.peakMemory = resetPeak ? stage.startMemory : peak;
+	stage.cpuTime = getCpuTime();
+	stage.start = std::chrono::duration<double>(std::chrono::steady_clock::now() - profileStart).count();
+
+	stages.push_back(stage);
+	t_openStages.push_back((int)stages.size() - 1);
+	openStageCount++;
+	return (int)stages.size() - 1;
+}
+
+void ProgressMeter::closeStage(int idx)
+{
+	ProfileStage& stage = stages[idx];
+	if (!stage.open)
+		return;
+	stage.wallTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - profileStart).count() - stage.start;
+	stage.cpuTime = getCpuTime() - stage.cpuTime;
+	stage.endMemory = getMemoryUsage();
+	stage.peakMemory = std::max(stage.peakMemory, getPeakMemoryUsage());
+	stage.open = false;
+	openStageCount--;
+	if (stage.parent >= 0)
+		stages[stage.parent].peakMemory = std::max(stages[stage.parent].peakMemory, stage.peakMemory);
+}
+
+void ProgressMeter::closeAutomaticStage()
+{
+	if (t_generation == profileGeneration && t_openStages.size() && stages[t_openStages.back()].automatic)
+	{
+		closeStage(t_openStages.back());
+		t_openStages.pop_back();
+	}
+}
+
+std::string ProgressMeter::profileJson()
+{
+	std::lock_guard<std::mutex> lock(profileMutex);
+
+	// stages still running are reported up to now
+	std::vector<ProfileStage> result = stages;
+	double now = std::chrono::duration<double>(std::chrono::steady_clock::now() - profileStart).count();
+	double cpu = getCpuTime();
+	for (ProfileStage& stage : result)
+	{
+		if (!stage.open)
+			continue;
+		stage.wallTime = now - stage.start;
+		stage.cpuTime = cpu - stage.cpuTime;
+		stage.endMemory = getMemoryUsage();
+		stage.peakMemory = std::max(stage.peakMemory, getPeakMemoryUsage());
+	}
+
+	std::string json = "{\n  \"displayTimeUnit\": \"ms\",\n";
+	json += fmt::format("  \"otherData\": {{\"peak_reset\": {}}},\n", peakResets);
+	json += "  \"traceEvents\": [\n";
+	for (size_t i = 0; i < result.size(); i++)
+	{
+		const ProfileStage& stage = result[i];
+		json += fmt::format("    {{\"name\": {}, \"cat\": \"{}\", \"ph\": \"X\", \"pid\": 1, \"tid\": {}, \"ts\": {:.3f}, \"dur\": {:.3f}, "
+			"\"args\": {{\"cpu_ms\": {:.3f}, \"rss_start\": {}, \"rss_end\": {}, \"rss_peak\": {}}}}}{}\n",
+			json_string(stage.name), stage.automatic ? "progress" : "stage", stage.thread, stage.start * 1000000.0, stage.wallTime * 1000000.0,
+			stage.cpuTime * 1000.0, stage.startMemory, stage.endMemory, stage.peakMemory, i + 1 < result.size() ? "," : "");
+	}
+	json += "  ],\n  \"stages\": [\n";
+	for (size_t i = 0; i < result.size(); i++)
+	{
+		const ProfileStage& stage = result[i];
+		json += fmt::format("    {{\"name\": {}, \"parent\": {}, \"depth\": {}, \"thread\": {}, \"open\": {}, \"start_ms\": {:.3f}, \"wall_ms\": {:.3f}, "
+			"\"cpu_ms\": {:.3f}, \"rss_start\": {}, \"rss_end\": {}, \"rss_peak\": {}}}{}\n",
+			json_string(stage.name), stage.parent, stage.depth, stage.thread, stage.open, stage.start * 1000.0, stage.wallTime * 1000.0,
+			stage.cpuTime * 1000.0, stage.startMemory, stage.endMemory, stage.peakMemory, i + 1 < result.size() ? "," : "");
+	}
+	json += "  ]\n}\n";
+	return json;
+}
+
+bool ProgressMeter::saveProfile(const std::string& path)
+{
+	std::string json = profileJson();
+	if (!writeFile(path, json.data(), (int)json.size()))
+	{
+		logf("Failed to write profile {}\n", path);
+		return false;
+	}
+	logf("Saved profile to {}\n", path);
+	return true;
+}
+
+void ProgressMeter::printProfile()
+{
+	std::vector<ProfileStage> result;
+	{
+		std::lock_guard<std::mutex> lock(profileMutex);
+		result = stages;
+	}
+	if (result.empty())
+	{
+		logf("No stages were profiled\n");
+		return;
+	}
+
+	bool threads = std::any_of(result.begin(), result.end(), [](const ProfileStage& stage) { return stage.thread > 0; });
+	const double mb = 1024.0 * 1024.0;
+	// top level stages by wall time, stages still running last. Children stay in recording order.
+	std::vector<std::vector<int>> children(result.size());
+	std::vector<int> topLevel;
+	for (int i = 0; i < (int)result.size(); i++)
+	{
+		if (result[i].parent >= 0)
+			children[result[i].parent].push_back(i);
+		else
+			topLevel.push_back(i);
+	}
+	std::stable_sort(topLevel.begin(), topLevel.end(), [&](int a, int b)
+		{
+			if (result[a].open != result[b].open)
+				return !result[a].open;
+			return result[a].wallTime > result[b].wallTime;
+		});
+
+	std::vector<int> order;
+	std::vector<int> todo(topLevel.rbegin(), topLevel.rend());
+	while (todo.size())
+	{
+		int idx = todo.back();
+		todo.pop_back();
+		order.push_back(idx);
+		todo.insert(todo.end(), children[idx].rbegin(), children[idx].rend());
+	}
+
+	logf("{:<44} {:>10} {:>10} {:>10} {:>10}\n", "Stage", "Wall ms", "CPU ms", "RSS +MB", "Peak MB");
+	for (int idx : order)
+	{
+		const ProfileStage& stage = result[idx];
+		std::string name = std::string(stage.depth * 2, ' ') + stage.name;
+		if (threads)
+			name = fmt::format("[{}] ", stage.thread) + name;
+		if (name.size() > 44)
+			name = name.substr(0, 41) + "...";
+		if (stage.open)
+		{
+			logf("{:<44} {:>10}\n", name, "running");
+			continue;
+		}
+		logf("{:<44} {:>10.1f} {:>10.1f} {:>10.1f} {:>10.1f}\n", name, stage.wallTime * 1000.0, stage.cpuTime * 1000.0,
+			((double)stage.endMemory - (double)stage.startMemory) / mb, stage.peakMemory / mb);
+	}
+	if (!peakResets)
+		logf("Peak memory can't be reset on this system, so it's the peak of the whole process.\n");
+}
+
+ProfileScope::ProfileScope(const char* name)
+{
+	active = g_progress.isProfiling();
+	if (active)
+		g_progress.beginStage(name);
+}
+
+ProfileScope::ProfileScope(const std::string& name)
+{
+	active = g_progress.isProfiling();
+	if (active)
+		g_progress.beginStage(name);
+}
+
+ProfileScope::~ProfileScope()
+{
+	if (active)
+		g_progress.endStage();
+}
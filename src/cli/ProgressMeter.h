@@ -1,6 +1,26 @@
 #pragma once
+#include <atomic>
 #include <chrono>
 #include <ctime>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct ProfileStage
+{
+	std::string name;
+	int parent = -1;          // index of the enclosing stage, -1 at the top level
+	int depth = 0;
+	int thread = 0;
+	bool automatic = false;   // opened by ProgressMeter::update inside a ProfileScope
+	bool open = true;
+	double start = 0.0;       // seconds since the profile was started
+	double wallTime = 0.0;
+	double cpuTime = 0.0;     // whole process, so it includes worker threads
+	size_t startMemory = 0;
+	size_t endMemory = 0;
+	size_t peakMemory = 0;
+};
 
 class ProgressMeter
 {
@@ -19,10 +39,57 @@ public:
 	// backspace the progress meter until the line is blank
 	void clear();
 
+	// Stage profiling. While it's on, every ProfileScope records wall time, cpu time and peak RSS,
+	// and titles passed to update() inside a scope become child stages of it. The peak is restarted
+	// for a new stage only while no other thread has a stage open, so the peak of a stage that ran
+	// next to stages of other threads can include memory used before it started.
+	void startProfile();
+	void stopProfile();
+	bool isProfiling() const { return profiling; }
+	void clearProfile();
+	int stageCount();
+
+	void beginStage(const std::string& name);
+	void endStage();
+
+	// chrome trace event format (chrome://tracing, ui.perfetto.dev), with the stage tree under "stages"
+	std::string profileJson();
+	bool saveProfile(const std::string& path);
+	// table of the recorded stages, slowest top level stage first with the children of a stage
+	// under it in the order they ran
+	void printProfile();
+
 private:
 	std::chrono::system_clock::time_point last_progress;
 	const char* progress_title;
 	const char* last_progress_title;
 	int progress;
 	int progress_total;
-};
\ No newline at end of file
+
+	std::atomic<bool> profiling{false};
+	bool peakResets = false;
+	int profileGeneration = 0;
+	std::chrono::steady_clock::time_point profileStart;
+	std::vector<ProfileStage> stages;
+	int openStageCount = 0; // in this generation, on all threads
+	std::mutex profileMutex;
+
+	int openStage(const std::string& name, bool automatic);
+	void closeStage(int idx);
+	void closeAutomaticStage();
+};
+
+// times the enclosing block as a stage of g_progress, does nothing unless profiling is on
+class ProfileScope
+{
+public:
+	ProfileScope(const char* name);
+	ProfileScope(const std::string& name);
+	~ProfileScope();
+
+	ProfileScope(const ProfileScope&) = delete;
+	ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+	bool active;
+};
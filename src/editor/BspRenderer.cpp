@@ -12,6 +12,7 @@
 #include "Command.h"
 #include "icons/missing.h"
 #include <execution>
+#include <numeric>
 
 #ifdef WIN32
 #include <Windows.h>
@@ -23,6 +24,7 @@ BspRenderer::BspRenderer(Bsp* _map, ShaderProgram* _bspShader, ShaderProgram* _f
 {
 	this->map = _map;
 	this->map->setBspRender(this);
+	loadStartTime = glfwGetTime();
 	this->bspShader = _bspShader;
 	this->fullBrightBspShader = _fullBrightBspShader;
 	this->colorShader = _colorShader;
@@ -230,7 +232,10 @@ BspRenderer::BspRenderer(Bsp* _map, ShaderProgram* _bspShader, ShaderProgram* _f
 	//loadTextures();
 	//loadLightmaps();
 	calcFaceMaths();
-	preRenderFaces();
+	// nothing is drawn for the faces until the first build is swapped in by delayLoadData
+	renderModels = new RenderModel[map->modelCount];
+	numRenderModels = map->modelCount;
+	startRenderFaces();
 	preRenderEnts();
 	if (bspShader)
 	{
@@ -447,6 +452,7 @@ void BspRenderer::reload()
 
 void BspRenderer::reloadTextures()
 {
+	textureThumbs.clear();
 	texturesLoaded = false;
 	texturesFuture = std::async(std::launch::async, &BspRenderer::loadTextures, this);
 }
@@ -676,7 +682,11 @@ void BspRenderer::updateLightmapInfos()
 void BspRenderer::preRenderFaces()
 {
 	genRenderFaces(numRenderModels);
+	uploadRenderFaces();
+}
 
+void BspRenderer::uploadRenderFaces()
+{
 	for (int i = 0; i < numRenderModels; i++)
 	{
 		RenderModel& model = renderModels[i];
@@ -694,26 +704,134 @@ void BspRenderer::genRenderFaces(int& renderModelCount)
 {
 	deleteRenderFaces();
 
-	renderModels = new RenderModel[map->modelCount];
-	memset(renderModels, 0, sizeof(RenderModel) * map->modelCount);
+	renderModels = buildRenderModels(getRenderModelEnts(), lightmapsUploaded);
 	renderModelCount = map->modelCount;
 
+	std::vector<int> faceIds;
+	for (int m = 0; m < map->modelCount; m++)
+	{
+		for (int i = 0; i < map->models[m].nFaces; i++)
+			faceIds.push_back(map->models[m].iFirstFace + i);
+	}
+	// models can share faces
+	std::sort(faceIds.begin(), faceIds.end());
+	faceIds.erase(std::unique(faceIds.begin(), faceIds.end()), faceIds.end());
+
+	std::for_each(std::execution::par, faceIds.begin(), faceIds.end(), [&](int faceIdx)
+		{
+			refreshFace(faceIdx);
+		});
+}
+
+RenderModelEnt BspRenderer::getRenderModelEnt(int modelIdx)
+{
+	RenderModelEnt modelEnt;
+	int entIdx = map->get_ent_from_model(modelIdx);
+	if (entIdx < 0)
+		return modelEnt;
+
+	Entity* ent = map->ents[entIdx];
+	modelEnt.found = true;
+	modelEnt.transparent = ent->hasKey("classname") && g_app->isEntTransparent(ent->keyvalues["classname"].c_str());
+	modelEnt.rendermode = ent->rendermode;
+	modelEnt.renderamt = ent->renderamt;
+	return modelEnt;
+}
+
+std::vector<RenderModelEnt> BspRenderer::getRenderModelEnts()
+{
+	std::vector<RenderModelEnt> modelEnts(map->modelCount);
+	for (int m = 0; m < map->modelCount; m++)
+	{
+		modelEnts[m] = getRenderModelEnt(m);
+	}
+	return modelEnts;
+}
+
+RenderModel* BspRenderer::buildRenderModels(const std::vector<RenderModelEnt>& modelEnts, bool useLightmaps)
+{
+	RenderModel* models = new RenderModel[map->modelCount];
+
+	std::vector<int> modelIds(map->modelCount);
+	std::iota(modelIds.begin(), modelIds.end(), 0);
+
+	// faces of a model are also split between threads, so the world doesn't hold up the rest
+	std::for_each(std::execution::par, modelIds.begin(), modelIds.end(), [&](int m)
+		{
+			buildRenderModel(m, &models[m], modelEnts[m], useLightmaps);
+		});
+
 	int worldRenderGroups = 0;
 	int modelRenderGroups = 0;
 
 	for (int m = 0; m < map->modelCount; m++)
 	{
-		int groupCount = refreshModel(m, false);
 		if (m == 0)
-			worldRenderGroups += groupCount;
+			worldRenderGroups += models[m].groupCount;
 		else
-			modelRenderGroups += groupCount;
+			modelRenderGroups += models[m].groupCount;
 	}
 
 	logf("Created {} solid render groups ({} world, {} entity)\n",
 		worldRenderGroups + modelRenderGroups,
 		worldRenderGroups,
 		modelRenderGroups);
+
+	return models;
+}
+
+void BspRenderer::loadRenderFaces()
+{
+	numRenderModelsSwap = map->modelCount;
+	renderModelsSwap = buildRenderModels(renderModelEntsSwap, renderFacesSwapLightmaps);
+}
+
+void BspRenderer::startRenderFaces()
+{
+	discardRenderFaces();
+	renderFacesOutdated = false;
+	// the lightmap loader may still be writing, and the entities can be edited while loading
+	renderModelEntsSwap = getRenderModelEnts();
+	renderFacesSwapLightmaps = lightmapsUploaded;
+	renderFacesFuture = std::async(std::launch::async, &BspRenderer::loadRenderFaces, this);
+}
+
+void BspRenderer::swapRenderFaces()
+{
+	renderFacesFuture.get();
+
+	RenderModel* newModels = renderModelsSwap;
+	int newCount = numRenderModelsSwap;
+	renderModelsSwap = NULL;
+	numRenderModelsSwap = 0;
+
+	deleteRenderFaces();
+	renderModels = newModels;
+	numRenderModels = newCount;
+
+	uploadRenderFaces();
+}
+
+void BspRenderer::discardRenderFaces()
+{
+	if (renderFacesFuture.valid())
+	{
+		// the models were built from state that is about to change
+		renderFacesFuture.get();
+		renderFacesOutdated = true;
+	}
+
+	if (renderModelsSwap)
+	{
+		for (int i = 0; i < numRenderModelsSwap; i++)
+		{
+			deleteRenderModel(&renderModelsSwap[i]);
+		}
+		delete[] renderModelsSwap;
+	}
+
+	renderModelsSwap = NULL;
+	numRenderModelsSwap = 0;
 }
 
 void BspRenderer::addNewRenderFace()
@@ -791,6 +909,8 @@ void BspRenderer::deleteRenderModelClipnodes(RenderClipnodes* renderClip)
 
 void BspRenderer::deleteRenderFaces()
 {
+	discardRenderFaces();
+
 	if (renderModels)
 	{
 		for (int i = 0; i < numRenderModels; i++)
@@ -805,6 +925,8 @@ void BspRenderer::deleteRenderFaces()
 
 void BspRenderer::deleteTextures()
 {
+	discardRenderFaces();
+
 	if (glTextures)
 	{
 		for (int i = 0; i < numLoadedTextures; i++)
@@ -823,6 +945,8 @@ void BspRenderer::deleteTextures()
 
 void BspRenderer::deleteLightmapTextures()
 {
+	discardRenderFaces();
+
 	if (glLightmapTextures)
 	{
 		for (int i = 0; i < numLightmapAtlases; i++)
@@ -854,42 +978,123 @@ int BspRenderer::refreshModel(int modelIdx, bool refreshClipnodes, bool noTriang
 	if (modelIdx < 0)
 		return 0;
 
+	discardRenderFaces();
+
 	BSPMODEL& model = map->models[modelIdx];
 	RenderModel* renderModel = &renderModels[modelIdx];
 
 	deleteRenderModel(renderModel);
 
-	renderModel->renderFaces = new RenderFace[model.nFaces];
+	buildRenderModel(modelIdx, renderModel, getRenderModelEnt(modelIdx), lightmapsUploaded, noTriangulate);
 
-	std::vector<RenderGroup> renderGroups;
-	std::vector<std::vector<lightmapVert>> renderGroupVerts;
-	std::vector<std::vector<lightmapVert>> renderGroupWireframeVerts;
+	for (int i = 0; i < model.nFaces; i++)
+	{
+		refreshFace(model.iFirstFace + i);
+	}
 
-	ShaderProgram* activeShader = (g_render_flags & RENDER_LIGHTMAPS) ? bspShader : fullBrightBspShader;
+	if (refreshClipnodes)
+		generateClipnodeBuffer(modelIdx);
 
-	for (int i = 0; i < model.nFaces; i++)
+	return renderModel->groupCount;
+}
+
+void BspRenderer::refreshFaceVerts(const std::vector<int>& faceIdxs)
+{
+	// a running build read the verts before this edit, and its swap would undo the patch below
+	discardRenderFaces();
+
+	std::vector<FaceRenderVerts> faceVerts(faceIdxs.size());
+	std::vector<int> ids(faceIdxs.size());
+	std::iota(ids.begin(), ids.end(), 0);
+
+	std::for_each(std::execution::par, ids.begin(), ids.end(), [&](int i)
+		{
+			int faceIdx = faceIdxs[i];
+			LightmapInfo* lmap = lightmapsGenerated && lightmaps && faceIdx < numRenderLightmapInfos ? &lightmaps[faceIdx] : NULL;
+			buildFaceVerts(map, faceIdx, lmap, NULL, false, faceVerts[i]);
+			refreshFace(faceIdx);
+		});
+
+	std::vector<VertexBuffer*> dirtyBuffers;
+	std::vector<int> fullRefresh;
+
+	for (int i = 0; i < faceIdxs.size(); i++)
 	{
-		int faceIdx = model.iFirstFace + i;
-		BSPFACE32& face = map->faces[faceIdx];
-		BSPTEXTUREINFO& texinfo = map->texinfos[face.iTextureInfo];
-		BSPMIPTEX* tex = NULL;
+		RenderFace* rface;
+		RenderGroup* rgroup;
+		if (!getRenderPointers(faceIdxs[i], &rface, &rgroup))
+			continue;
 
-		int texWidth, texHeight;
-		if (texinfo.iMiptex >= 0 && texinfo.iMiptex < map->textureCount)
+		FaceRenderVerts& fverts = faceVerts[i];
+		if (rface->vertCount != (int)fverts.verts.size() ||
+			rface->wireframeVertOffset + (int)fverts.wireframeVerts.size() > rgroup->wireframeVertCount)
 		{
-			int texOffset = ((int*)map->textures)[texinfo.iMiptex + 1];
-			if (texOffset >= 0)
-			{
-				tex = ((BSPMIPTEX*)(map->textures + texOffset));
-				texWidth = tex->nWidth;
-				texHeight = tex->nHeight;
-			}
-			else
+			// edges were added or removed, the face no longer fits in its place
+			fullRefresh.push_back(map->get_model_from_face(faceIdxs[i]));
+			continue;
+		}
+
+		// only positions and texture coordinates move, colors and highlights stay as they are
+		auto copy_coords = [](lightmapVert& dst, const lightmapVert& src) {
+			dst.pos = src.pos;
+			dst.u = src.u;
+			dst.v = src.v;
+			for (int s = 0; s < MAXLIGHTMAPS; s++)
 			{
-				// missing texture
-				texWidth = 16;
-				texHeight = 16;
+				dst.luv[s][0] = src.luv[s][0];
+				dst.luv[s][1] = src.luv[s][1];
 			}
+		};
+		for (int k = 0; k < rface->vertCount; k++)
+			copy_coords(rgroup->verts[rface->vertOffset + k], fverts.verts[k]);
+		for (int k = 0; k < (int)fverts.wireframeVerts.size(); k++)
+			copy_coords(rgroup->wireframeVerts[rface->wireframeVertOffset + k], fverts.wireframeVerts[k]);
+
+		rgroup->buffer->markDirty(rface->vertOffset, rface->vertCount);
+		rgroup->wireframeBuffer->markDirty(rface->wireframeVertOffset, (int)fverts.wireframeVerts.size());
+		dirtyBuffers.push_back(rgroup->buffer);
+		dirtyBuffers.push_back(rgroup->wireframeBuffer);
+	}
+
+	// buffers upload all of their dirty ranges at once
+	std::sort(dirtyBuffers.begin(), dirtyBuffers.end());
+	dirtyBuffers.erase(std::unique(dirtyBuffers.begin(), dirtyBuffers.end()), dirtyBuffers.end());
+	for (VertexBuffer* buffer : dirtyBuffers)
+		buffer->uploadDirty();
+
+	std::sort(fullRefresh.begin(), fullRefresh.end());
+	fullRefresh.erase(std::unique(fullRefresh.begin(), fullRefresh.end()), fullRefresh.end());
+	for (int modelIdx : fullRefresh)
+		refreshModel(modelIdx, false);
+}
+
+void BspRenderer::refreshModelFaceVerts(int modelIdx)
+{
+	if (modelIdx < 0 || modelIdx >= map->modelCount)
+		return;
+
+	BSPMODEL& model = map->models[modelIdx];
+	std::vector<int> faceIdxs(model.nFaces);
+	std::iota(faceIdxs.begin(), faceIdxs.end(), model.iFirstFace);
+	refreshFaceVerts(faceIdxs);
+}
+
+void BspRenderer::buildFaceVerts(Bsp* map, int faceIdx, LightmapInfo* lmap, const RenderModelEnt* modelEnt,
+	bool noTriangulate, FaceRenderVerts& out)
+{
+	BSPFACE32& face = map->faces[faceIdx];
+	BSPTEXTUREINFO& texinfo = map->texinfos[face.iTextureInfo];
+	BSPMIPTEX* tex = NULL;
+
+	int texWidth, texHeight;
+	if (texinfo.iMiptex >= 0 && texinfo.iMiptex < map->textureCount)
+	{
+		int texOffset = ((int*)map->textures)[texinfo.iMiptex + 1];
+		if (texOffset >= 0)
+		{
+			tex = ((BSPMIPTEX*)(map->textures + texOffset));
+			texWidth = tex->nWidth;
+			texHeight = tex->nHeight;
 		}
 		else
 		{
@@ -897,169 +1102,202 @@ int BspRenderer::refreshModel(int modelIdx, bool refreshClipnodes, bool noTriang
 			texWidth = 16;
 			texHeight = 16;
 		}
+	}
+	else
+	{
+		// missing texture
+		texWidth = 16;
+		texHeight = 16;
+	}
 
 
-		LightmapInfo* lmap = lightmapsGenerated && lightmaps ? &lightmaps[faceIdx] : NULL;
+	std::vector<lightmapVert> verts(face.nEdges);
 
-		lightmapVert* verts = new lightmapVert[face.nEdges];
-		int vertCount = face.nEdges;
-		Texture* lightmapAtlas[MAXLIGHTMAPS]{ NULL };
+	float lw = 0;
+	float lh = 0;
+	if (lmap)
+	{
+		lw = (float)lmap->w / (float)LIGHTMAP_ATLAS_SIZE;
+		lh = (float)lmap->h / (float)LIGHTMAP_ATLAS_SIZE;
+	}
+
+	bool isSpecial = texinfo.nFlags & TEX_SPECIAL;
+	bool hasLighting = face.nStyles[0] != 255 && face.nLightmapOffset >= 0 && !isSpecial;
+	bool isOpacity = isSpecial || (tex && IsTextureTransparent(tex->szName)) || (modelEnt && modelEnt->transparent);
+
+	float opacity = isOpacity ? 0.50f : 1.0f;
 
-		float lw = 0;
-		float lh = 0;
-		if (lmap)
+
+	if (modelEnt && modelEnt->found)
+	{
+		if (modelEnt->rendermode != kRenderNormal)
 		{
-			lw = (float)lmap->w / (float)LIGHTMAP_ATLAS_SIZE;
-			lh = (float)lmap->h / (float)LIGHTMAP_ATLAS_SIZE;
+			opacity = modelEnt->renderamt / 255.f;
+			if (opacity > 0.8f && isOpacity)
+				opacity = 0.8f;
+			else if (opacity < 0.2f)
+				opacity = 0.2f;
 		}
+	}
 
-		bool isSpecial = texinfo.nFlags & TEX_SPECIAL;
-		bool hasLighting = face.nStyles[0] != 255 && face.nLightmapOffset >= 0 && !isSpecial;
-		for (int s = 0; s < MAXLIGHTMAPS; s++)
+	for (int e = 0; e < face.nEdges; e++)
+	{
+		int edgeIdx = map->surfedges[face.iFirstEdge + e];
+		BSPEDGE32& edge = map->edges[abs(edgeIdx)];
+		int vertIdx = edgeIdx < 0 ? edge.iVertex[1] : edge.iVertex[0];
+
+		vec3& vert = map->verts[vertIdx];
+		verts[e].pos = vert.flip();
+
+		verts[e].r = 1.0f;
+		if (modelEnt && modelEnt->found)
 		{
-			lightmapAtlas[s] = lmap ? glLightmapTextures[lmap->atlasId[s]] : NULL;
+			verts[e].g = 1.0f + abs((float)modelEnt->rendermode);
 		}
-
-		if (isSpecial)
+		else
 		{
-			lightmapAtlas[0] = whiteTex;
+			verts[e].g = 1.0f;
 		}
+		verts[e].b = 1.0f;
+		verts[e].a = opacity;
 
-		int entIdx = map->get_ent_from_model(modelIdx);
-		Entity* ent = entIdx >= 0 ? map->ents[entIdx] : NULL;
+		// texture coords
+		float tw = 1.0f / (float)texWidth;
+		float th = 1.0f / (float)texHeight;
+		float fU = dotProduct(texinfo.vS, vert) + texinfo.shiftS;
+		float fV = dotProduct(texinfo.vT, vert) + texinfo.shiftT;
+		verts[e].u = fU * tw;
+		verts[e].v = fV * th;
 
-		bool isOpacity = isSpecial || (tex && IsTextureTransparent(tex->szName)) || (ent && ent->hasKey("classname") && g_app->isEntTransparent(ent->keyvalues["classname"].c_str()));
+		// lightmap texture coords
+		if (hasLighting && lmap)
+		{
+			float fLightMapU = lmap->midTexU + (fU - lmap->midPolyU) / 16.0f;
+			float fLightMapV = lmap->midTexV + (fV - lmap->midPolyV) / 16.0f;
 
-		float opacity = isOpacity ? 0.50f : 1.0f;
+			float uu = (fLightMapU / (float)lmap->w) * lw;
+			float vv = (fLightMapV / (float)lmap->h) * lh;
 
+			float pixelStep = 1.0f / (float)LIGHTMAP_ATLAS_SIZE;
 
-		if (ent)
-		{
-			if (ent->rendermode != kRenderNormal)
+			for (int s = 0; s < MAXLIGHTMAPS; s++)
 			{
-				opacity = ent->renderamt / 255.f;
-				if (opacity > 0.8f && isOpacity)
-					opacity = 0.8f;
-				else if (opacity < 0.2f)
-					opacity = 0.2f;
+				verts[e].luv[s][0] = uu + lmap->x[s] * pixelStep;
+				verts[e].luv[s][1] = vv + lmap->y[s] * pixelStep;
 			}
 		}
-
-		for (int e = 0; e < face.nEdges; e++)
+		// set lightmap scales
+		for (int s = 0; s < MAXLIGHTMAPS; s++)
 		{
-			int edgeIdx = map->surfedges[face.iFirstEdge + e];
-			BSPEDGE32& edge = map->edges[abs(edgeIdx)];
-			int vertIdx = edgeIdx < 0 ? edge.iVertex[1] : edge.iVertex[0];
-
-			vec3& vert = map->verts[vertIdx];
-			verts[e].pos = vert.flip();
-
-			verts[e].r = 1.0f;
-			if (ent)
+			verts[e].luv[s][2] = (hasLighting && face.nStyles[s] != 255) ? 1.0f : 0.0f;
+			if (isSpecial && s == 0)
 			{
-				verts[e].g = 1.0f + abs((float)ent->rendermode);
+				verts[e].luv[s][2] = 1.0f;
 			}
-			else
-			{
-				verts[e].g = 1.0f;
-			}
-			verts[e].b = 1.0f;
-			verts[e].a = opacity;
+		}
+	}
 
-			// texture coords
-			float tw = 1.0f / (float)texWidth;
-			float th = 1.0f / (float)texHeight;
-			float fU = dotProduct(texinfo.vS, vert) + texinfo.shiftS;
-			float fV = dotProduct(texinfo.vT, vert) + texinfo.shiftT;
-			verts[e].u = fU * tw;
-			verts[e].v = fV * th;
+	int idx = 0;
 
-			// lightmap texture coords
-			if (hasLighting && lmap)
-			{
-				float fLightMapU = lmap->midTexU + (fU - lmap->midPolyU) / 16.0f;
-				float fLightMapV = lmap->midTexV + (fV - lmap->midPolyV) / 16.0f;
 
-				float uu = (fLightMapU / (float)lmap->w) * lw;
-				float vv = (fLightMapV / (float)lmap->h) * lh;
+	int wireframeVertCount = face.nEdges * 2;
+	out.wireframeVerts.resize(wireframeVertCount);
 
-				float pixelStep = 1.0f / (float)LIGHTMAP_ATLAS_SIZE;
+	for (int k = 0; k < face.nEdges && (k + 1) % face.nEdges < face.nEdges; k++)
+	{
+		out.wireframeVerts[idx++] = verts[k];
+		out.wireframeVerts[idx++] = verts[(k + 1) % face.nEdges];
+	}
 
-				for (int s = 0; s < MAXLIGHTMAPS; s++)
-				{
-					verts[e].luv[s][0] = uu + lmap->x[s] * pixelStep;
-					verts[e].luv[s][1] = vv + lmap->y[s] * pixelStep;
-				}
-			}
-			// set lightmap scales
-			for (int s = 0; s < MAXLIGHTMAPS; s++)
-			{
-				verts[e].luv[s][2] = (hasLighting && face.nStyles[s] != 255) ? 1.0f : 0.0f;
-				if (isSpecial && s == 0)
-				{
-					verts[e].luv[s][2] = 1.0f;
-				}
-			}
+	for (int k = 0; k < wireframeVertCount; k++)
+	{
+		lightmapVert& wireVert = out.wireframeVerts[k];
+		wireVert.luv[0][2] = 1.0f;
+		wireVert.luv[1][2] = 0.0f;
+		wireVert.luv[2][2] = 0.0f;
+		wireVert.luv[3][2] = 0.0f;
+		wireVert.r = 1.0f;
+		wireVert.g = 1.0f;
+		wireVert.b = 1.0f;
+		wireVert.a = 1.0f;
+	}
+
+	if (!noTriangulate)
+	{
+		// convert TRIANGLE_FAN verts to TRIANGLES so multiple faces can be drawn in a single draw call
+		out.verts.reserve(face.nEdges + std::max(0, face.nEdges - 3) * 2);
+
+		for (int k = 2; k < face.nEdges; k++)
+		{
+			out.verts.push_back(verts[0]);
+			out.verts.push_back(verts[k - 1]);
+			out.verts.push_back(verts[k]);
 		}
+	}
+	else
+	{
+		out.verts = std::move(verts);
+	}
 
-		int idx = 0;
+	out.transparent = opacity < 1.0f || (tex && tex->szName[0] == '{');
+	out.special = isSpecial;
+}
 
+void BspRenderer::buildRenderModel(int modelIdx, RenderModel* renderModel, const RenderModelEnt& modelEnt, bool useLightmaps, bool noTriangulate)
+{
+	BSPMODEL& model = map->models[modelIdx];
 
-		int wireframeVertCount = face.nEdges * 2;
-		lightmapVert* wireframeVerts = new lightmapVert[wireframeVertCount];
+	renderModel->renderFaces = new RenderFace[model.nFaces];
 
-		for (int k = 0; k < face.nEdges && (k + 1) % face.nEdges < face.nEdges; k++)
-		{
-			wireframeVerts[idx++] = verts[k];
-			wireframeVerts[idx++] = verts[(k + 1) % face.nEdges];
-		}
+	ShaderProgram* activeShader = (g_render_flags & RENDER_LIGHTMAPS) ? bspShader : fullBrightBspShader;
 
-		for (int k = 0; k < wireframeVertCount; k++)
-		{
-			wireframeVerts[k].luv[0][2] = 1.0f;
-			wireframeVerts[k].luv[1][2] = 0.0f;
-			wireframeVerts[k].luv[2][2] = 0.0f;
-			wireframeVerts[k].luv[3][2] = 0.0f;
-			wireframeVerts[k].r = 1.0f;
-			wireframeVerts[k].g = 1.0f;
-			wireframeVerts[k].b = 1.0f;
-			wireframeVerts[k].a = 1.0f;
-		}
+	std::vector<FaceRenderVerts> faceVerts(model.nFaces);
+	std::vector<int> faceIds(model.nFaces);
+	std::iota(faceIds.begin(), faceIds.end(), 0);
 
-		if (!noTriangulate)
+	// vertices, uvs and lightmap coordinates of every face, grouped in order afterwards
+	std::for_each(std::execution::par, faceIds.begin(), faceIds.end(), [&](int i)
 		{
-			idx = 0;
-			// convert TRIANGLE_FAN verts to TRIANGLES so multiple faces can be drawn in a single draw call
-			int newCount = face.nEdges + std::max(0, face.nEdges - 3) * 2;
-			lightmapVert* newVerts = new lightmapVert[newCount];
+			int faceIdx = model.iFirstFace + i;
+			FaceRenderVerts& out = faceVerts[i];
+			LightmapInfo* lmap = useLightmaps && lightmaps ? &lightmaps[faceIdx] : NULL;
 
-			for (int k = 2; k < face.nEdges; k++)
+			buildFaceVerts(map, faceIdx, lmap, &modelEnt, noTriangulate, out);
+
+			for (int s = 0; s < MAXLIGHTMAPS; s++)
 			{
-				newVerts[idx++] = verts[0];
-				newVerts[idx++] = verts[k - 1];
-				newVerts[idx++] = verts[k];
+				out.lightmapAtlas[s] = lmap ? glLightmapTextures[lmap->atlasId[s]] : NULL;
 			}
 
-			delete[] verts;
-			verts = newVerts;
-			vertCount = newCount;
-		}
+			if (out.special)
+			{
+				out.lightmapAtlas[0] = whiteTex;
+			}
+		});
+
+	std::vector<RenderGroup> renderGroups;
+	std::vector<std::vector<lightmapVert>> renderGroupVerts;
+	std::vector<std::vector<lightmapVert>> renderGroupWireframeVerts;
 
+	for (int i = 0; i < model.nFaces; i++)
+	{
+		BSPFACE32& face = map->faces[model.iFirstFace + i];
+		BSPTEXTUREINFO& texinfo = map->texinfos[face.iTextureInfo];
+		FaceRenderVerts& fverts = faceVerts[i];
 
 		// add face to a render group (faces that share that same textures and opacity flag)
-		bool isTransparent = opacity < 1.0f || (tex && tex->szName[0] == '{');
 		int groupIdx = -1;
 		for (int k = 0; k < renderGroups.size(); k++)
 		{
 			if (texinfo.iMiptex == -1 || texinfo.iMiptex >= map->textureCount)
 				continue;
 			bool textureMatch = !texturesLoaded || renderGroups[k].texture == glTextures[texinfo.iMiptex];
-			if (textureMatch && renderGroups[k].transparent == isTransparent)
+			if (textureMatch && renderGroups[k].transparent == fverts.transparent)
 			{
 				bool allMatch = true;
 				for (int s = 0; s < MAXLIGHTMAPS; s++)
 				{
-					if (renderGroups[k].lightmapAtlas[s] != lightmapAtlas[s])
+					if (renderGroups[k].lightmapAtlas[s] != fverts.lightmapAtlas[s])
 					{
 						allMatch = false;
 						break;
@@ -1079,12 +1317,12 @@ int BspRenderer::refreshModel(int modelIdx, bool refreshClipnodes, bool noTriang
 			RenderGroup newGroup = RenderGroup();
 			newGroup.vertCount = 0;
 			newGroup.verts = NULL;
-			newGroup.transparent = isTransparent;
-			newGroup.special = isSpecial;
+			newGroup.transparent = fverts.transparent;
+			newGroup.special = fverts.special;
 			newGroup.texture = texturesLoaded && texinfo.iMiptex >= 0 && texinfo.iMiptex < map->textureCount ? glTextures[texinfo.iMiptex] : greyTex;
 			for (int s = 0; s < MAXLIGHTMAPS; s++)
 			{
-				newGroup.lightmapAtlas[s] = lightmapAtlas[s];
+				newGroup.lightmapAtlas[s] = fverts.lightmapAtlas[s];
 			}
 			groupIdx = (int)renderGroups.size();
 			renderGroups.push_back(newGroup);
@@ -1094,13 +1332,11 @@ int BspRenderer::refreshModel(int modelIdx, bool refreshClipnodes, bool noTriang
 
 		renderModel->renderFaces[i].group = groupIdx;
 		renderModel->renderFaces[i].vertOffset = (int)renderGroupVerts[groupIdx].size();
-		renderModel->renderFaces[i].vertCount = vertCount;
-
-		renderGroupVerts[groupIdx].insert(renderGroupVerts[groupIdx].end(), verts, verts + vertCount);
-		renderGroupWireframeVerts[groupIdx].insert(renderGroupWireframeVerts[groupIdx].end(), wireframeVerts, wireframeVerts + wireframeVertCount);
+		renderModel->renderFaces[i].vertCount = (int)fverts.verts.size();
+		renderModel->renderFaces[i].wireframeVertOffset = (int)renderGroupWireframeVerts[groupIdx].size();
 
-		delete[] verts;
-		delete[] wireframeVerts;
+		renderGroupVerts[groupIdx].insert(renderGroupVerts[groupIdx].end(), fverts.verts.begin(), fverts.verts.end());
+		renderGroupWireframeVerts[groupIdx].insert(renderGroupWireframeVerts[groupIdx].end(), fverts.wireframeVerts.begin(), fverts.wireframeVerts.end());
 	}
 
 	renderModel->renderGroups = new RenderGroup[renderGroups.size()];
@@ -1138,16 +1374,6 @@ int BspRenderer::refreshModel(int modelIdx, bool refreshClipnodes, bool noTriang
 
 		renderModel->renderGroups[i] = renderGroups[i];
 	}
-
-	for (int i = 0; i < model.nFaces; i++)
-	{
-		refreshFace(model.iFirstFace + i);
-	}
-
-	if (refreshClipnodes)
-		generateClipnodeBuffer(modelIdx);
-
-	return renderModel->groupCount;
 }
 
 bool BspRenderer::refreshModelClipnodes(int modelIdx)
@@ -1515,6 +1741,7 @@ void BspRenderer::preRenderEnts()
 		delete[] renderEnts;
 	}
 	renderEnts = new RenderEnt[map->ents.size()];
+	pointEntInstancesDirty = true;
 
 	numPointEnts = 0;
 
@@ -1532,6 +1759,7 @@ void BspRenderer::preRenderEnts()
 void BspRenderer::refreshPointEnt(int entIdx)
 {
 	int skipIdx = 0;
+	pointEntInstancesDirty = true;
 
 	if (entIdx == 0)
 		return;
@@ -1630,6 +1858,7 @@ void BspRenderer::refreshEnt(int entIdx)
 {
 	if (entIdx < 0 || !pointEntRenderer)
 		return;
+	pointEntInstancesDirty = true;
 	int skin = -1;
 	int sequence = -1;
 	int body = -1;
@@ -1826,10 +2055,13 @@ void BspRenderer::calcFaceMaths()
 	//vec3 world_y = vec3(0.0f, 1.0f, 0.0f);
 	//vec3 world_z = vec3(0.0f, 0.0f, 1.0f);
 
-	for (int i = 0; i < map->faceCount; i++)
-	{
-		refreshFace(i);
-	}
+	std::vector<int> faceIds(map->faceCount);
+	std::iota(faceIds.begin(), faceIds.end(), 0);
+
+	std::for_each(std::execution::par, faceIds.begin(), faceIds.end(), [&](int faceIdx)
+		{
+			refreshFace(faceIdx);
+		});
 }
 
 void BspRenderer::refreshFace(int faceIdx)
@@ -1901,6 +2133,7 @@ BspRenderer::~BspRenderer()
 		logf("ERROR: Deleted bsp renderer while it was loading\n");
 	}
 
+	textureThumbs.clear();
 	for (int i = 0; i < wads.size(); i++)
 	{
 		delete wads[i];
@@ -1921,6 +2154,7 @@ BspRenderer::~BspRenderer()
 	deleteRenderFaces();
 	deleteRenderClipnodes();
 	deleteFaceMaths();
+	deletePointEntInstances();
 
 	clipnodesBufferCache.clear();
 	nodesBufferCache.clear();
@@ -1940,11 +2174,18 @@ BspRenderer::~BspRenderer()
 }
 
 void BspRenderer::reuploadTextures()
+{
+	if (swapTextures())
+		preRenderFaces();
+}
+
+bool BspRenderer::swapTextures()
 {
 	if (!glTexturesSwap)
-		return;
+		return false;
 
 	deleteTextures();
+	textureThumbs.clear();
 
 	//loadTextures();
 
@@ -1959,29 +2200,45 @@ void BspRenderer::reuploadTextures()
 
 	texturesLoaded = true;
 
-	preRenderFaces();
-
 	needReloadDebugTextures = true;
+
+	return true;
 }
 
 void BspRenderer::delayLoadData()
 {
-	if (!lightmapsUploaded && lightmapFuture.wait_for(std::chrono::milliseconds(0)) == std::future_status::ready)
+	// render faces are built in a separate thread, this thread only uploads them. Lightmaps
+	// and textures are swapped in between builds because the builder reads them.
+	if (renderFacesFuture.valid() && renderFacesFuture.wait_for(std::chrono::milliseconds(0)) == std::future_status::ready)
 	{
-		for (int i = 0; i < numLightmapAtlases; i++)
+		swapRenderFaces();
+	}
+
+	if (!renderFacesFuture.valid())
+	{
+		if (!lightmapsUploaded && lightmapFuture.wait_for(std::chrono::milliseconds(0)) == std::future_status::ready)
 		{
-			if (glLightmapTextures[i])
-				glLightmapTextures[i]->upload(GL_RGB);
-		}
+			for (int i = 0; i < numLightmapAtlases; i++)
+			{
+				if (glLightmapTextures[i])
+					glLightmapTextures[i]->upload(GL_RGB);
+			}
 
-		preRenderFaces();
+			lightmapsUploaded = true;
+			renderFacesOutdated = true;
+		}
 
-		lightmapsUploaded = true;
-	}
+		if (!texturesLoaded && texturesFuture.wait_for(std::chrono::milliseconds(0)) == std::future_status::ready)
+		{
+			if (swapTextures())
+				renderFacesOutdated = true;
+		}
 
-	if (!texturesLoaded && texturesFuture.wait_for(std::chrono::milliseconds(0)) == std::future_status::ready)
-	{
-		reuploadTextures();
+		// lightmaps are written by their loader until they are uploaded
+		if (renderFacesOutdated && lightmapsUploaded)
+		{
+			startRenderFaces();
+		}
 	}
 
 	if (!clipnodesLoaded && clipnodesFuture.wait_for(std::chrono::milliseconds(0)) == std::future_status::ready)
@@ -2006,11 +2263,18 @@ void BspRenderer::delayLoadData()
 		logf("Loaded {} clipnode leaves\n", clipnodeLeafCount);
 		updateClipnodeOpacity((g_render_flags & RENDER_TRANSPARENT) ? 128 : 255);
 	}
+
+	if (loadedTime < 0.0 && isFinishedLoading())
+	{
+		loadedTime = glfwGetTime() - loadStartTime;
+		logf("Finished loading {} in {:.2f} seconds (first frame after {:.2f} seconds)\n",
+			map->bsp_name, loadedTime, firstFrameTime);
+	}
 }
 
 bool BspRenderer::isFinishedLoading()
 {
-	return lightmapsUploaded && texturesLoaded && clipnodesLoaded;
+	return lightmapsUploaded && texturesLoaded && clipnodesLoaded && !renderFacesFuture.valid() && !renderFacesOutdated;
 }
 
 void BspRenderer::highlightFace(int faceIdx, bool highlight, COLOR4 color, bool useColor, bool reupload)
@@ -2046,8 +2310,9 @@ void BspRenderer::highlightFace(int faceIdx, bool highlight, COLOR4 color, bool
 		rgroup->verts[rface->vertOffset + i].g = g;
 		rgroup->verts[rface->vertOffset + i].b = b;
 	}
+	rgroup->buffer->markDirty(rface->vertOffset, rface->vertCount);
 	if (reupload)
-		rgroup->buffer->upload();
+		rgroup->buffer->uploadDirty();
 }
 
 void BspRenderer::updateFaceUVs(int faceIdx)
@@ -2084,14 +2349,16 @@ void BspRenderer::updateFaceUVs(int faceIdx)
 		}
 	}
 
-	rgroup->buffer->upload();
+	rgroup->buffer->markDirty(rface->vertOffset, rface->vertCount);
+	rgroup->buffer->uploadDirty();
 }
 
 bool BspRenderer::getRenderPointers(int faceIdx, RenderFace** renderFace, RenderGroup** renderGroup)
 {
 	int modelIdx = map->get_model_from_face(faceIdx);
 
-	if (modelIdx == -1)
+	// no faces until the first build is swapped in
+	if (modelIdx == -1 || modelIdx >= numRenderModels || !renderModels[modelIdx].renderFaces)
 	{
 		return false;
 	}
@@ -2113,12 +2380,17 @@ unsigned int BspRenderer::getFaceTextureId(int faceIdx)
 }
 
 
-void BspRenderer::render(std::vector<int> highlightEnts, bool highlightAlwaysOnTop, int clipnodeHull)
+void BspRenderer::render(std::vector<int> highlightEnts, bool highlightAlwaysOnTop, int clipnodeHull, const vec3* offset)
 {
 	ShaderProgram* activeShader; vec3 renderOffset;
-	mapOffset = map->ents.size() ? map->ents[0]->getOrigin() : vec3();
+	if (firstFrameTime < 0.0)
+		firstFrameTime = glfwGetTime() - loadStartTime;
+	mapOffset = offset ? *offset : map->ents.size() ? map->ents[0]->getOrigin() : vec3();
 	renderOffset = mapOffset.flip();
 
+	// clipnodes that several entities share are drawn once per render
+	clearDrawCache();
+
 	activeShader = (g_render_flags & RENDER_LIGHTMAPS) ? bspShader : fullBrightBspShader;
 
 	activeShader->bind();
@@ -2150,12 +2422,14 @@ void BspRenderer::render(std::vector<int> highlightEnts, bool highlightAlwaysOnT
 		}
 	}
 
+	// all models of a pass go through one queue, so the draws are sorted by state across models
+	mat4x4 worldMat = *activeShader->modelMat;
 	for (int pass = 0; pass < 2; pass++)
 	{
 		bool drawTransparentFaces = pass == 1;
 
 		if (!renderEnts[0].hide)
-			drawModel(0, drawTransparentFaces, false, false);
+			queueModel(drawQueue, NULL, worldMat, drawTransparentFaces, false, false);
 
 		for (int i = 0, sz = (int)map->ents.size(); i < sz; i++)
 		{
@@ -2163,17 +2437,15 @@ void BspRenderer::render(std::vector<int> highlightEnts, bool highlightAlwaysOnT
 			{
 				if (renderEnts[i].hide)
 					continue;
-				activeShader->pushMatrix(MAT_MODEL);
-				*activeShader->modelMat = renderEnts[i].modelMatAngles;
-				activeShader->modelMat->translate(renderOffset.x, renderOffset.y, renderOffset.z);
-				activeShader->updateMatrixes();
-
-				drawModel(&renderEnts[i], drawTransparentFaces, g_app->pickInfo.IsSelectedEnt(i), false);
+				mat4x4 entMat = renderEnts[i].modelMatAngles;
+				entMat.translate(renderOffset.x, renderOffset.y, renderOffset.z);
 
-				activeShader->popMatrix(MAT_MODEL);
+				queueModel(drawQueue, &renderEnts[i], entMat, drawTransparentFaces, g_app->pickInfo.IsSelectedEnt(i), false);
 			}
 		}
 
+		drawQueue.flush();
+
 		if ((g_render_flags & RENDER_POINT_ENTS) && pass == 0)
 		{
 			drawPointEntities(highlightEnts);
@@ -2258,11 +2530,25 @@ void BspRenderer::render(std::vector<int> highlightEnts, bool highlightAlwaysOnT
 
 void BspRenderer::drawModel(RenderEnt* ent, bool transparent, bool highlight, bool edgesOnly)
 {
-	ShaderProgram* activeShader; vec3 renderOffset;
-	mapOffset = map->ents.size() ? map->ents[0]->getOrigin() : vec3();
-	renderOffset = mapOffset.flip();
+	ShaderProgram* activeShader = (g_render_flags & RENDER_LIGHTMAPS) ? bspShader : fullBrightBspShader;
 
-	activeShader = (g_render_flags & RENDER_LIGHTMAPS) ? bspShader : fullBrightBspShader;
+	DrawQueue queue;
+	queueModel(queue, ent, *activeShader->modelMat, transparent, highlight, edgesOnly);
+	queue.flush();
+}
+
+// draw layers of a model pass. Wireframes go first so that faces at the same depth don't hide them,
+// and the lightmap overlay of entities blends over the finished faces.
+enum model_draw_layers
+{
+	LAYER_WIREFRAME,
+	LAYER_FACES,
+	LAYER_OVERLAY
+};
+
+void BspRenderer::queueModel(DrawQueue& queue, RenderEnt* ent, const mat4x4& modelMat, bool transparent, bool highlight, bool edgesOnly)
+{
+	vec3 renderOffset = mapOffset.flip();
 
 	int modelIdx = ent ? ent->modelIdx : 0;
 
@@ -2271,25 +2557,25 @@ void BspRenderer::drawModel(RenderEnt* ent, bool transparent, bool highlight, bo
 		return;
 	}
 
+	// the world uses id 0, entity matrices (with and without angles) follow
+	int entIdx = ent ? (int)(ent - renderEnts) : -1;
+	int matrixId = ent ? entIdx * 2 + 1 : 0;
+	int originMatrixId = matrixId + 1;
+	mat4x4 originMat;
+	if (ent)
+	{
+		originMat = ent->modelMatOrigin;
+		originMat.translate(renderOffset.x, renderOffset.y, renderOffset.z);
+	}
+
+	Texture* edgeTextures[2] = { highlight ? yellowTex : modelIdx > 0 ? blueTex : greyTex, whiteTex };
+
 	if (edgesOnly)
 	{
 		for (int i = 0; i < renderModels[modelIdx].groupCount; i++)
 		{
 			RenderGroup& rgroup = renderModels[modelIdx].renderGroups[i];
-
-			if (highlight)
-				yellowTex->bind(0);
-			else
-			{
-				if (modelIdx > 0)
-					blueTex->bind(0);
-				else
-					greyTex->bind(0);
-			}
-
-			whiteTex->bind(1);
-
-			rgroup.wireframeBuffer->drawFull();
+			queue.add(LAYER_WIREFRAME, rgroup.wireframeBuffer, DRAW_BLEND_ALPHA, edgeTextures, 2, matrixId, modelMat);
 		}
 		return;
 	}
@@ -2319,40 +2605,23 @@ void BspRenderer::drawModel(RenderEnt* ent, bool transparent, bool highlight, bo
 
 		if (ent && ent->needAngles)
 		{
-			activeShader->pushMatrix(MAT_MODEL);
-			*activeShader->modelMat = ent->modelMatOrigin;
-			activeShader->modelMat->translate(renderOffset.x, renderOffset.y, renderOffset.z);
-			activeShader->updateMatrixes();
-			yellowTex->bind(0);
-			greyTex->bind(1);
-			rgroup.wireframeBuffer->drawFull();
-			activeShader->popMatrix(MAT_MODEL);
+			Texture* angleTextures[2] = { yellowTex, greyTex };
+			queue.add(LAYER_WIREFRAME, rgroup.wireframeBuffer, DRAW_BLEND_ALPHA, angleTextures, 2, originMatrixId, originMat);
 		}
 
 		if (highlight || (g_render_flags & RENDER_WIREFRAME))
 		{
-			if (highlight)
-				yellowTex->bind(0);
-			else
-			{
-				if (modelIdx > 0)
-					blueTex->bind(0);
-				else
-					greyTex->bind(0);
-			}
-			whiteTex->bind(1);
-
-			rgroup.wireframeBuffer->drawFull();
+			queue.add(LAYER_WIREFRAME, rgroup.wireframeBuffer, DRAW_BLEND_ALPHA, edgeTextures, 2, matrixId, modelMat);
 		}
 
-
+		Texture* textures[DRAW_TEXTURE_UNITS] = { NULL };
 		if (texturesLoaded && g_render_flags & RENDER_TEXTURES)
 		{
-			rgroup.texture->bind(0);
+			textures[0] = rgroup.texture;
 		}
 		else
 		{
-			whiteTex->bind(0);
+			textures[0] = whiteTex;
 		}
 
 		if (g_render_flags & RENDER_LIGHTMAPS)
@@ -2361,7 +2630,7 @@ void BspRenderer::drawModel(RenderEnt* ent, bool transparent, bool highlight, bo
 			{
 				if (highlight)
 				{
-					redTex->bind(s + 1);
+					textures[s + 1] = redTex;
 				}
 				else if (lightmapsUploaded && lightmapsGenerated)
 				{
@@ -2369,54 +2638,35 @@ void BspRenderer::drawModel(RenderEnt* ent, bool transparent, bool highlight, bo
 					{
 						if (showLightFlag == s)
 						{
-							blackTex->bind(s + 1);
+							textures[s + 1] = blackTex;
 							continue;
 						}
 					}
 					if (rgroup.lightmapAtlas[s])
-						rgroup.lightmapAtlas[s]->bind(s + 1);
+						textures[s + 1] = rgroup.lightmapAtlas[s];
 				}
 				else
 				{
 					if (s == 0)
 					{
-						greyTex->bind(s + 1);
+						textures[s + 1] = greyTex;
 					}
 					else
 					{
-						blackTex->bind(s + 1);
+						textures[s + 1] = blackTex;
 					}
 				}
 			}
 		}
-		/*if (!ent)
-		{
-			//test
-			tempmodel->mdl_meshes[0][0].tex->bind(0);
-			whiteTex->bind(1);
-			whiteTex->bind(2);
-			whiteTex->bind(3);
-			whiteTex->bind(4);
-			tempmodelBuff->drawFull();
-		}
-		else*/
-		rgroup.buffer->drawFull();
+		queue.add(LAYER_FACES, rgroup.buffer, DRAW_BLEND_ALPHA, textures, DRAW_TEXTURE_UNITS, matrixId, modelMat);
 
 		if (ent)
 		{
 			for (int s = 0; s < MAXLIGHTMAPS; s++)
 			{
-				whiteTex->bind(s + 1);
+				textures[s + 1] = whiteTex;
 			}
-
-			activeShader->pushMatrix(MAT_MODEL);
-			*activeShader->modelMat = ent->modelMatOrigin;
-			activeShader->modelMat->translate(renderOffset.x, renderOffset.y, renderOffset.z);
-			activeShader->updateMatrixes();
-			glBlendFunc(GL_SRC_ALPHA_SATURATE, GL_SRC_COLOR);
-			rgroup.buffer->drawFull();
-			glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-			activeShader->popMatrix(MAT_MODEL);
+			queue.add(LAYER_OVERLAY, rgroup.buffer, DRAW_BLEND_SATURATE, textures, DRAW_TEXTURE_UNITS, originMatrixId, originMat);
 		}
 	}
 }
@@ -2492,7 +2742,6 @@ void BspRenderer::drawModelClipnodes(int modelIdx, bool highlight, int hullIdx)
 void BspRenderer::drawPointEntities(std::vector<int> highlightEnts)
 {
 	ShaderProgram* activeShader; vec3 renderOffset;
-	mapOffset = map->ents.size() ? map->ents[0]->getOrigin() : vec3();
 	renderOffset = mapOffset.flip();
 	activeShader = (g_render_flags & RENDER_LIGHTMAPS) ? bspShader : fullBrightBspShader;
 
@@ -2500,12 +2749,31 @@ void BspRenderer::drawPointEntities(std::vector<int> highlightEnts)
 	colorShader->pushMatrix(MAT_MODEL);
 	fullBrightBspShader->pushMatrix(MAT_MODEL);
 
+	bool instanced = pointEntRenderer && pointEntRenderer->instanceShader;
+	if (instanced)
+	{
+		updatePointEntInstances(renderOffset);
+
+		// entity transforms are in the instance data
+		ShaderProgram* instanceShader = pointEntRenderer->instanceShader;
+		instanceShader->bind();
+		instanceShader->modelMat->loadIdentity();
+		instanceShader->updateMatrixes();
+
+		for (auto& it : pointEntInstances)
+		{
+			it.second->draw(it.first->instanceBuffer, GL_TRIANGLES);
+		}
+	}
+
 	for (int i = 1, sz = (int)map->ents.size(); i < sz; i++)
 	{
 		if (renderEnts[i].modelIdx >= 0)
 			continue;
 		if (renderEnts[i].hide)
 			continue;
+		if (instanced && isInstancedPointEnt(i))
+			continue;
 
 		if (g_app->pickInfo.IsSelectedEnt(i))
 		{
@@ -2570,7 +2838,99 @@ void BspRenderer::drawPointEntities(std::vector<int> highlightEnts)
 	colorShader->popMatrix(MAT_MODEL);
 }
 
-bool BspRenderer::pickPoly(vec3 start, const vec3& dir, int hullIdx, PickInfo& tempPickInfo, Bsp** tmpMap)
+bool BspRenderer::isInstancedPointEnt(int entIdx)
+{
+	RenderEnt& ent = renderEnts[entIdx];
+	if (ent.modelIdx >= 0 || ent.hide || !ent.pointEntCube || !ent.pointEntCube->instanceBuffer)
+		return false;
+	if ((g_render_flags & RENDER_MODELS) && ent.mdl && ent.mdl->mdl_mesh_groups.size())
+		return false;
+	return !g_app->pickInfo.IsSelectedEnt(entIdx);
+}
+
+void BspRenderer::updatePointEntInstances(const vec3& renderOffset)
+{
+	bool renderModels = (g_render_flags & RENDER_MODELS) != 0;
+
+	if (!pointEntInstancesDirty)
+	{
+		pointEntInstancesDirty = pointEntInstancesRenderer != pointEntRenderer
+			|| pointEntInstancesModels != renderModels
+			|| pointEntInstancesOffset != renderOffset
+			|| pointEntInstancesSelection != g_app->pickInfo.selectedEnts;
+	}
+
+	if (!pointEntInstancesDirty && renderModels)
+	{
+		// models load in the background, they replace the cube once ready
+		for (int entIdx : pointEntInstancesPendingMdl)
+		{
+			if (renderEnts[entIdx].mdl && renderEnts[entIdx].mdl->mdl_mesh_groups.size())
+			{
+				pointEntInstancesDirty = true;
+				break;
+			}
+		}
+	}
+
+	if (!pointEntInstancesDirty)
+		return;
+
+	// cubes of a replaced PointEntRenderer are already deleted
+	if (pointEntInstancesRenderer != pointEntRenderer)
+		deletePointEntInstances();
+
+	for (auto& it : pointEntInstances)
+	{
+		it.second->clear();
+	}
+	pointEntInstancesPendingMdl.clear();
+
+	for (int i = 1, sz = (int)map->ents.size(); i < sz; i++)
+	{
+		if (!isInstancedPointEnt(i))
+			continue;
+
+		RenderEnt& ent = renderEnts[i];
+		if (ent.mdl && ent.mdl->mdl_mesh_groups.empty())
+			pointEntInstancesPendingMdl.push_back(i);
+
+		InstanceBuffer*& instances = pointEntInstances[ent.pointEntCube];
+		if (!instances)
+		{
+			instances = new InstanceBuffer(pointEntRenderer->instanceShader);
+			instances->addAttribute(4, 4, "vInstanceMat");
+			instances->addAttribute(4, 1, "vInstanceColor");
+		}
+
+		mat4x4 modelMat = ent.modelMatAngles;
+		modelMat.translate(renderOffset.x, renderOffset.y, renderOffset.z);
+		modelMat = modelMat.transpose();
+
+		float* instance = instances->addInstance();
+		memcpy(instance, modelMat.m, sizeof(modelMat.m));
+		instance[16] = instance[17] = instance[18] = instance[19] = 1.0f;
+	}
+
+	pointEntInstancesRenderer = pointEntRenderer;
+	pointEntInstancesModels = renderModels;
+	pointEntInstancesOffset = renderOffset;
+	pointEntInstancesSelection = g_app->pickInfo.selectedEnts;
+	pointEntInstancesDirty = false;
+}
+
+void BspRenderer::deletePointEntInstances()
+{
+	for (auto& it : pointEntInstances)
+	{
+		delete it.second;
+	}
+	pointEntInstances.clear();
+	pointEntInstancesPendingMdl.clear();
+	pointEntInstancesDirty = true;
+}
+
+bool BspRenderer::pickPoly(vec3 start, const vec3& dir, int hullIdx, PickInfo& tempPickInfo, Bsp** tmpMap, const vec3* offset)
 {
 	bool foundBetterPick = false;
 
@@ -2581,7 +2941,7 @@ bool BspRenderer::pickPoly(vec3 start, const vec3& dir, int hullIdx, PickInfo& t
 
 	int sz = (int)map->ents.size();
 
-	start -= mapOffset;
+	start -= offset ? *offset : mapOffset;
 
 	if (pickModelPoly(start, dir, vec3(), 0, hullIdx, tempPickInfo))
 	{
@@ -3052,6 +3412,7 @@ PickInfo::PickInfo()
 {
 	selectedEnts.clear();
 	selectedFaces.clear();
+	selectedEntBits.clear();
 	bestDist = 0.0f;
 }
 
@@ -3064,30 +3425,75 @@ int PickInfo::GetSelectedEnt()
 
 void PickInfo::AddSelectedEnt(int entIdx)
 {
-	if (!IsSelectedEnt(entIdx))
+	if (entIdx >= -1 && !IsSelectedEnt(entIdx))
 	{
 		selectedEnts.push_back(entIdx);
+		setSelectedBit(entIdx, true);
 	}
 	pickCount++;
 }
 
 void PickInfo::SetSelectedEnt(int entIdx)
 {
-	selectedEnts.clear();
+	ClearSelectedEnts();
 	AddSelectedEnt(entIdx);
 }
 
+void PickInfo::SetSelectedEnts(const std::vector<int>& entIdxs)
+{
+	ClearSelectedEnts();
+	selectedEnts.reserve(entIdxs.size());
+	for (int entIdx : entIdxs)
+	{
+		if (entIdx >= -1 && !IsSelectedEnt(entIdx))
+		{
+			selectedEnts.push_back(entIdx);
+			setSelectedBit(entIdx, true);
+		}
+	}
+	pickCount++;
+}
+
 void PickInfo::DelSelectedEnt(int entIdx)
 {
 	if (IsSelectedEnt(entIdx))
 	{
 		pickCount++;
+		setSelectedBit(entIdx, false);
 		selectedEnts.erase(std::find(selectedEnts.begin(), selectedEnts.end(), entIdx));
 	}
 }
 
+void PickInfo::ClearSelectedEnts()
+{
+	// only clear the words that were used, the bitmap keeps its size for the next selection
+	for (int entIdx : selectedEnts)
+	{
+		selectedEntBits[(entIdx + 1) >> 6] = 0;
+	}
+	selectedEnts.clear();
+}
+
 bool PickInfo::IsSelectedEnt(int entIdx)
 {
-	return std::find(selectedEnts.begin(), selectedEnts.end(), entIdx) != selectedEnts.end();
+	unsigned int bit = (unsigned int)(entIdx + 1);
+	if (entIdx < -1 || (bit >> 6) >= selectedEntBits.size())
+		return false;
+	return (selectedEntBits[bit >> 6] >> (bit & 63)) & 1;
+}
+
+void PickInfo::setSelectedBit(int entIdx, bool selected)
+{
+	unsigned int bit = (unsigned int)(entIdx + 1);
+	if ((bit >> 6) >= selectedEntBits.size())
+	{
+		if (!selected)
+			return;
+		selectedEntBits.resize((bit >> 6) + 1, 0);
+	}
+	if (selected)
+		selectedEntBits[bit >> 6] |= 1ULL << (bit & 63);
+	else
+		selectedEntBits[bit >> 6] &= ~(1ULL << (bit & 63));
 }
 
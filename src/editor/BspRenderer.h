@@ -6,6 +6,10 @@
 #include "VertexBuffer.h"
 #include "primitives.h"
 #include "PointEntRenderer.h"
+#include "InstanceBuffer.h"
+#include "DrawQueue.h"
+#include "EntitySearch.h"
+#include "ThumbnailCache.h"
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 #include <future>
@@ -107,12 +111,33 @@ struct RenderFace
 	int group;
 	int vertOffset;
 	int vertCount;
+	int wireframeVertOffset; // face.nEdges * 2 wireframe verts
 	RenderFace()
 	{
-		group = vertOffset = vertCount = 0;
+		group = vertOffset = vertCount = wireframeVertOffset = 0;
 	}
 };
 
+// vertices of one face before it is added to a render group
+struct FaceRenderVerts
+{
+	std::vector<lightmapVert> verts;
+	std::vector<lightmapVert> wireframeVerts;
+	Texture* lightmapAtlas[MAXLIGHTMAPS];
+	bool transparent;
+	bool special;
+};
+
+// entity state of a model that its faces are built with, copied on the main thread before a build
+// so entity commands allowed during loading can't change it under the worker
+struct RenderModelEnt
+{
+	bool found = false;
+	bool transparent = false;
+	int rendermode = kRenderNormal;
+	int renderamt = 0;
+};
+
 struct RenderModel
 {
 	int groupCount;
@@ -152,9 +177,18 @@ struct RenderClipnodes
 	}
 };
 
+// a parent map entity that shows a shared bsp model renderer
+struct BspModelInstance
+{
+	int entIdx;		// in the parent map
+	vec3 origin;	// where the model origin is drawn
+};
+
 class PickInfo
 {
 public:
+	// selected entities in selection order. read only, change it with the methods
+	// below so that the membership bitmap stays in sync
 	std::vector<int> selectedEnts;
 	std::vector<int> selectedFaces;
 
@@ -165,10 +199,18 @@ public:
 	void AddSelectedEnt(int entIdx);
 
 	void SetSelectedEnt(int entIdx);
+	void SetSelectedEnts(const std::vector<int>& entIdxs);
 
 	void DelSelectedEnt(int entIdx);
+	void ClearSelectedEnts();
+
+	bool IsSelectedEnt(int entIdx); // O(1)
+
+private:
+	// bit (entIdx + 1) is set for every entity in selectedEnts (-1 is a valid selection)
+	std::vector<unsigned long long> selectedEntBits;
 
-	bool IsSelectedEnt(int entIdx);
+	void setSelectedBit(int entIdx, bool selected);
 };
 
 class BspRenderer
@@ -181,17 +223,28 @@ public:
 	std::vector<Wad*> wads;
 	bool texturesLoaded = false;
 	bool needReloadDebugTextures = false;
+	// for bsp models (map->is_bsp_model): lowercase "model" values of the parent map
+	// entities that share this renderer, it is drawn once at each of them
+	std::vector<std::string> modelInstanceKeys;
+	// the parent map entities that use them, cached by Renderer::getBspModelInstances
+	std::vector<BspModelInstance> modelInstances;
+	unsigned int modelInstancesRevision = 0;
+	size_t modelInstancesEntCount = 0;
+	bool modelInstancesValid = false;
 
 	BspRenderer(Bsp* map, ShaderProgram* bspShader, ShaderProgram* fullBrightBspShader, ShaderProgram* colorShader, PointEntRenderer* pointEntRenderer);
 	~BspRenderer();
 
-	void render(std::vector<int> highlightEnts, bool highlightAlwaysOnTop, int clipnodeHull);
+	// offset replaces the worldspawn origin, to draw one instance of a bsp model
+	void render(std::vector<int> highlightEnts, bool highlightAlwaysOnTop, int clipnodeHull, const vec3* offset = NULL);
 
 	void drawModel(RenderEnt* ent, bool transparent, bool highlight, bool edgesOnly);
+	// queues the draws of drawModel. modelMat is the matrix drawModel would find in the shader
+	void queueModel(DrawQueue& queue, RenderEnt* ent, const mat4x4& modelMat, bool transparent, bool highlight, bool edgesOnly);
 	void drawModelClipnodes(int modelIdx, bool highlight, int hullIdx);
 	void drawPointEntities(std::vector<int> highlightEnts);
 
-	bool pickPoly(vec3 start, const vec3& dir, int hullIdx, PickInfo& pickInfo, Bsp** map);
+	bool pickPoly(vec3 start, const vec3& dir, int hullIdx, PickInfo& pickInfo, Bsp** map, const vec3* offset = NULL);
 	bool pickModelPoly(vec3 start, const vec3& dir, vec3 offset, int modelIdx, int hullIdx, PickInfo& pickInfo);
 	bool pickFaceMath(const vec3& start, const vec3& dir, FaceMath& faceMath, float& bestDist);
 
@@ -200,6 +253,10 @@ public:
 	int refreshModel(int modelIdx, bool refreshClipnodes = true, bool noTriangulate = false);
 	bool refreshModelClipnodes(int modelIdx);
 	void refreshFace(int faceIdx);
+	// updates the vertices of faces that were moved or reshaped without rebuilding their models.
+	// Faces that gained or lost edges fall back to refreshModel.
+	void refreshFaceVerts(const std::vector<int>& faceIdxs);
+	void refreshModelFaceVerts(int modelIdx);
 	void refreshPointEnt(int entIdx);
 	void updateClipnodeOpacity(unsigned char newValue);
 
@@ -218,6 +275,7 @@ public:
 	void loadTextures(); // will reload them if already loaded
 	void reloadTextures();
 	void reuploadTextures();
+	bool swapTextures(); // uploads the textures loaded by loadTextures, without rebuilding faces
 
 	void updateLightmapInfos();
 	bool isFinishedLoading();
@@ -271,8 +329,41 @@ public:
 	int clipnodeLeafCount = 0;
 	std::future<void> clipnodesFuture;
 
+	// render faces built in a separate thread, the buffers are uploaded in this one
+	RenderModel* renderModelsSwap = NULL;
+	int numRenderModelsSwap = 0;
+	std::vector<RenderModelEnt> renderModelEntsSwap; // input of the running build
+	bool renderFacesSwapLightmaps = false;
+	bool renderFacesOutdated = false; // rebuild once lightmaps are uploaded and no build is running
+	std::future<void> renderFacesFuture;
+
+	// loadStartTime is a glfwGetTime value, the others are seconds after it (-1 until reached)
+	double loadStartTime = 0.0;
+	double firstFrameTime = -1.0;
+	double loadedTime = -1.0;
+
+	// entity report filtering, entities are reindexed as they are edited
+	EntitySearchIndex entSearch;
+
+	// texture browser thumbnails, they point into the wads so they're cleared before wads are reloaded
+	ThumbnailCache textureThumbs;
+
 	void loadLightmaps();
 	void genRenderFaces(int& renderModelCount);
+	// vertices of one face with their texture and lightmap coordinates. Only reads the map,
+	// lightmapAtlas is left to the caller.
+	static void buildFaceVerts(Bsp* map, int faceIdx, LightmapInfo* lmap, const RenderModelEnt* modelEnt,
+		bool noTriangulate, FaceRenderVerts& out);
+	RenderModelEnt getRenderModelEnt(int modelIdx);
+	std::vector<RenderModelEnt> getRenderModelEnts();
+	// CPU part of refreshModel, doesn't touch GL or the entities so it can run in any thread
+	void buildRenderModel(int modelIdx, RenderModel* renderModel, const RenderModelEnt& modelEnt, bool useLightmaps, bool noTriangulate = false);
+	RenderModel* buildRenderModels(const std::vector<RenderModelEnt>& modelEnts, bool useLightmaps); // every model, in parallel
+	void uploadRenderFaces();
+	void loadRenderFaces();
+	void startRenderFaces();
+	void swapRenderFaces();
+	void discardRenderFaces(); // waits for a running build and drops its result
 	void addNewRenderFace();
 	void loadClipnodes();
 	void generateClipnodeBufferForHull(int modelIdx, int hullId);
@@ -324,4 +415,21 @@ private:
 
 	std::set<int> drawedNodes;
 	std::set<int> drawedClipnodes;
+
+	// model draws of the current pass, issued sorted by state
+	DrawQueue drawQueue;
+
+	// unselected point entity cubes, one instanced draw call per cube type.
+	// rebuilt only when something that affects them changes
+	std::map<EntCube*, InstanceBuffer*> pointEntInstances;
+	bool pointEntInstancesDirty = true;
+	PointEntRenderer* pointEntInstancesRenderer = NULL;
+	std::vector<int> pointEntInstancesSelection;
+	std::vector<int> pointEntInstancesPendingMdl; // ents drawn as cubes until their model finishes loading
+	vec3 pointEntInstancesOffset;
+	bool pointEntInstancesModels = false;
+
+	bool isInstancedPointEnt(int entIdx);
+	void updatePointEntInstances(const vec3& renderOffset);
+	void deletePointEntInstances();
 };
\ No newline at end of file
@@ -0,0 +1,383 @@
+#include "EntitySearch.h"
+#include "Bsp.h"
+#include "Entity.h"
+#include "Fgd.h"
+#include "util.h"
+#include <algorithm>
+#include <execution>
+#include <iterator>
+
+static unsigned int trigram(const std::string& s, size_t i)
+{
+	return (unsigned char)s[i] | ((unsigned char)s[i + 1] << 8) | ((unsigned char)s[i + 2] << 16);
+}
+
+static void add_trigrams(const std::string& s, std::vector<unsigned int>& out)
+{
+	for (size_t i = 0; i + 2 < s.size(); i++)
+		out.push_back(trigram(s, i));
+}
+
+// true if the fgd class has a spawnflag with that name, or no flag is asked for
+static bool has_spawnflag(Fgd* fgd, const std::string& classname, const std::string& spawnflag, std::unordered_map<std::string, bool>& cache)
+{
+	if (spawnflag.empty())
+		return true;
+
+	auto cached = cache.find(classname);
+	if (cached == cache.end())
+	{
+		bool hasFlag = false;
+		FgdClass* fgdClass = fgd ? fgd->getFgdClass(classname) : NULL;
+		for (int f = 0; fgdClass && f < 32; f++)
+		{
+			if (fgdClass->spawnFlagNames[f] == spawnflag)
+				hasFlag = true;
+		}
+		cached = cache.emplace(classname, hasFlag).first;
+	}
+	return cached->second;
+}
+
+bool EntityFilter::narrows(const EntityFilter& other) const
+{
+	// growing text only narrows substring matches
+	if (!partialMatches || !other.partialMatches || strcasecmp(classname.c_str(), other.classname.c_str()) != 0 ||
+		spawnflag != other.spawnflag || keys.size() != other.keys.size() || values.size() != other.values.size())
+	{
+		return false;
+	}
+
+	for (size_t k = 0; k < keys.size(); k++)
+	{
+		bool sameKey = keys[k] == other.keys[k];
+		bool valueNarrows = values[k].find(other.values[k]) != std::string::npos;
+
+		if (sameKey && valueNarrows)
+			continue;
+
+		// the value is compared with the first matching key, which changes with the key text
+		if (!sameKey && !other.keys[k].empty() && keys[k].find(other.keys[k]) != std::string::npos && other.values[k].empty())
+			continue;
+
+		// a key that holds the value was also a match for the value in any key
+		if (other.keys[k].empty() && valueNarrows)
+			continue;
+
+		return false;
+	}
+
+	return true;
+}
+
+const std::vector<int>& EntitySearchIndex::Postings::sorted()
+{
+	if (sortedSize != ids.size())
+	{
+		std::sort(ids.begin(), ids.end());
+		ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+		sortedSize = ids.size();
+	}
+	return ids;
+}
+
+void EntitySearchIndex::clear()
+{
+	ents.clear();
+	classBuckets.clear();
+	keyTrigrams.clear();
+	valueTrigrams.clear();
+	staleEntities = 0;
+	generation++;
+	hasLastResult = false;
+	lastResult.clear();
+}
+
+void EntitySearchIndex::tokenize(IndexedEntity& indexed, Entity* ent)
+{
+	indexed.ent = ent;
+	indexed.revision = ent->revision;
+	indexed.keys.clear();
+	indexed.values.clear();
+	indexed.keyValues.clear();
+
+	auto classname = ent->keyvalues.find("classname");
+	indexed.classname = classname != ent->keyvalues.end() ? classname->second : std::string();
+	indexed.lowerClassname = toLowerCase(indexed.classname);
+
+	for (const std::string& key : ent->keyOrder)
+	{
+		auto value = ent->keyvalues.find(key);
+		indexed.keys.push_back(toLowerCase(key));
+		indexed.values.push_back(value != ent->keyvalues.end() ? toLowerCase(value->second) : std::string());
+
+		auto lowerKeyValue = ent->keyvalues.find(indexed.keys.back());
+		indexed.keyValues.push_back(lowerKeyValue != ent->keyvalues.end() ? lowerKeyValue->second : std::string());
+	}
+}
+
+void EntitySearchIndex::addPostings(int idx)
+{
+	IndexedEntity& indexed = ents[idx];
+	classBuckets[indexed.lowerClassname].ids.push_back(idx);
+
+	std::vector<unsigned int> grams;
+	for (int pass = 0; pass < 2; pass++)
+	{
+		const std::vector<std::string>& tokens = pass == 0 ? indexed.keys : indexed.values;
+		auto& postings = pass == 0 ? keyTrigrams : valueTrigrams;
+
+		grams.clear();
+		for (const std::string& token : tokens)
+			add_trigrams(token, grams);
+		std::sort(grams.begin(), grams.end());
+		grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+
+		for (unsigned int gram : grams)
+			postings[gram].ids.push_back(idx);
+	}
+}
+
+void EntitySearchIndex::rebuildPostings()
+{
+	classBuckets.clear();
+	keyTrigrams.clear();
+	valueTrigrams.clear();
+	staleEntities = 0;
+
+	for (int i = 0; i < (int)ents.size(); i++)
+	{
+		if (ents[i].ent)
+			addPostings(i);
+	}
+}
+
+void EntitySearchIndex::update(Bsp* map)
+{
+	lastReindexCount = 0;
+
+	if (ents.size() > map->ents.size())
+	{
+		// removed entities stay in the posting lists until the next rebuild
+		staleEntities += ents.size() - map->ents.size();
+		ents.resize(map->ents.size());
+		generation++;
+	}
+	ents.resize(map->ents.size());
+
+	std::vector<int> changed;
+	for (int i = 0; i < (int)ents.size(); i++)
+	{
+		Entity* ent = map->ents[i];
+		if (ents[i].ent != ent || (ent && ents[i].revision != ent->revision))
+			changed.push_back(i);
+	}
+
+	if (changed.empty())
+		return;
+
+	for (int i : changed)
+	{
+		if (ents[i].ent)
+			staleEntities++;
+	}
+
+	std::for_each(std::execution::par, changed.begin(), changed.end(), [&](int i)
+		{
+			if (map->ents[i])
+				tokenize(ents[i], map->ents[i]);
+			else
+				ents[i] = IndexedEntity();
+		});
+
+	// deleting an entity shifts all of the ones after it, which is cheaper to index from scratch
+	if (staleEntities > ents.size() / 4)
+	{
+		rebuildPostings();
+	}
+	else
+	{
+		for (int i : changed)
+		{
+			if (ents[i].ent)
+				addPostings(i);
+		}
+	}
+
+	lastReindexCount = (int)changed.size();
+	generation++;
+}
+
+bool EntitySearchIndex::matches(const IndexedEntity& indexed, const EntityFilter& filter)
+{
+	if (!filter.classname.empty() && strcasecmp(indexed.classname.c_str(), filter.classname.c_str()) != 0)
+		return false;
+
+	for (size_t k = 0; k < filter.keys.size(); k++)
+	{
+		const std::string& searchKey = filter.keys[k];
+		const std::string& searchValue = k < filter.values.size() ? filter.values[k] : std::string();
+
+		if (!searchKey.empty())
+		{
+			size_t c = 0;
+			for (; c < indexed.keys.size(); c++)
+			{
+				const std::string& key = indexed.keys[c];
+				if (key == searchKey || (filter.partialMatches && key.find(searchKey) != std::string::npos))
+					break;
+			}
+			if (c == indexed.keys.size())
+				return false;
+
+			if (!searchValue.empty())
+			{
+				const std::string& value = indexed.keyValues[c];
+				if ((filter.partialMatches && value.find(searchValue) == std::string::npos) ||
+					(!filter.partialMatches && value != searchValue))
+				{
+					return false;
+				}
+			}
+		}
+		else if (!searchValue.empty())
+		{
+			bool foundMatch = false;
+			for (const std::string& value : indexed.values)
+			{
+				if (value == searchValue || (filter.partialMatches && value.find(searchValue) != std::string::npos))
+				{
+					foundMatch = true;
+					break;
+				}
+			}
+			if (!foundMatch)
+				return false;
+		}
+	}
+
+	return true;
+}
+
+std::vector<int> EntitySearchIndex::query(Bsp* map, Fgd* fgd, const EntityFilter& filter)
+{
+	update(map);
+
+	std::vector<int> candidates;
+	bool allEntities = true;
+	bool noMatches = false;
+
+	auto narrow = [&](const std::vector<int>& ids) {
+		if (allEntities)
+		{
+			candidates = ids;
+			allEntities = false;
+		}
+		else
+		{
+			std::vector<int> both;
+			std::set_intersection(candidates.begin(), candidates.end(), ids.begin(), ids.end(), std::back_inserter(both));
+			candidates.swap(both);
+		}
+	};
+
+	if (hasLastResult && lastGeneration == generation && lastFgd == fgd && filter.narrows(lastFilter))
+	{
+		narrow(lastResult);
+	}
+
+	if (!filter.classname.empty())
+	{
+		auto bucket = classBuckets.find(toLowerCase(filter.classname));
+		if (bucket == classBuckets.end())
+			noMatches = true;
+		else
+			narrow(bucket->second.sorted());
+	}
+
+	// every trigram of the search text must be in a key/value of the entity. Raw values compared
+	// with a key's value contain the text only if their lowercase version does.
+	std::vector<Postings*> lists;
+	std::vector<unsigned int> grams;
+	for (size_t k = 0; k < filter.keys.size() && !noMatches; k++)
+	{
+		for (int pass = 0; pass < 2 && !noMatches; pass++)
+		{
+			const std::string& text = pass == 0 ? filter.keys[k] : k < filter.values.size() ? filter.values[k] : std::string();
+			auto& postings = pass == 0 ? keyTrigrams : valueTrigrams;
+
+			grams.clear();
+			add_trigrams(text, grams);
+			for (unsigned int gram : grams)
+			{
+				auto list = postings.find(gram);
+				if (list == postings.end())
+				{
+					noMatches = true;
+					break;
+				}
+				lists.push_back(&list->second);
+			}
+		}
+	}
+
+	if (!noMatches)
+	{
+		// shortest lists first, and stop once there are few enough entities to just check them
+		std::sort(lists.begin(), lists.end(), [](Postings* a, Postings* b) {
+			return a->ids.size() < b->ids.size();
+			});
+		for (Postings* list : lists)
+		{
+			if (!allEntities && candidates.size() <= 32)
+				break;
+			narrow(list->sorted());
+		}
+	}
+
+	std::vector<int> result;
+	lastCheckCount = 0;
+	if (!noMatches)
+	{
+		if (allEntities)
+		{
+			candidates.resize(ents.size());
+			for (int i = 0; i < (int)ents.size(); i++)
+				candidates[i] = i;
+		}
+
+		std::unordered_map<std::string, bool> classHasFlag;
+		for (int i : candidates)
+		{
+			if (i <= 0 || i >= (int)ents.size() || !ents[i].ent)
+				continue;
+
+			const IndexedEntity& indexed = ents[i];
+			lastCheckCount++;
+			if (matches(indexed, filter) && has_spawnflag(fgd, indexed.classname, filter.spawnflag, classHasFlag))
+				result.push_back(i);
+		}
+	}
+
+	lastFilter = filter;
+	lastFgd = fgd;
+	lastGeneration = generation;
+	lastResult = result;
+	hasLastResult = true;
+
+	return result;
+}
+
+std::vector<int> EntitySearchIndex::scan(Bsp* map, Fgd* fgd, const EntityFilter& filter)
+{
+	std::vector<int> result;
+	std::unordered_map<std::string, bool> classHasFlag;
+	IndexedEntity indexed;
+	for (size_t i = 1; i < map->ents.size(); i++)
+	{
+		tokenize(indexed, map->ents[i]);
+		if (matches(indexed, filter) && has_spawnflag(fgd, indexed.classname, filter.spawnflag, classHasFlag))
+			result.push_back((int)i);
+	}
+	return result;
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+class Bsp;
+class Entity;
+class Fgd;
+
+// What the entity report filters by. Keys and values are lowercase and trimmed. A filter with an
+// empty key matches the value against every key, empty values match anything.
+struct EntityFilter
+{
+	std::string classname; // case insensitive, empty for any class
+	std::string spawnflag; // name of a spawnflag the fgd class must have, empty for any
+	std::vector<std::string> keys;
+	std::vector<std::string> values;
+	bool partialMatches = true;
+
+	// true if everything this filter matches is also matched by the other one (e.g. more text typed)
+	bool narrows(const EntityFilter& other) const;
+};
+
+// Search index of the entities of one map, for the entity report. Keys and values are lowercased
+// once, entities are bucketed by classname and keys/values are split into trigrams, so that a
+// query only checks the entities that can match. Entities are reindexed when they are replaced or
+// edited (Entity::revision), and a query that narrows the previous one only checks its results.
+class EntitySearchIndex
+{
+public:
+	// reindexes entities that were added, replaced or edited since the last call
+	void update(Bsp* map);
+
+	// indexes of the entities that pass the filter, in order. The worldspawn is never included.
+	// Calls update first.
+	std::vector<int> query(Bsp* map, Fgd* fgd, const EntityFilter& filter);
+
+	// same result as query, checking every entity without an index
+	static std::vector<int> scan(Bsp* map, Fgd* fgd, const EntityFilter& filter);
+
+	void clear();
+
+	int lastReindexCount = 0; // entities reindexed by the last update
+	int lastCheckCount = 0;   // entities checked against the last query
+
+private:
+	struct IndexedEntity
+	{
+		Entity* ent = NULL;
+		unsigned int revision = 0;
+		std::string classname; // as it is in the entity, for fgd lookups
+		std::string lowerClassname;
+		std::vector<std::string> keys;      // lowercase, in key order
+		std::vector<std::string> values;    // lowercase
+		std::vector<std::string> keyValues; // value stored under the lowercase key ("" if there is none)
+	};
+
+	// entity indexes. Reindexed entities are appended again, so lists are sorted lazily and can
+	// have stale entries, which fail the final check.
+	struct Postings
+	{
+		std::vector<int> ids;
+		size_t sortedSize = 0;
+
+		const std::vector<int>& sorted();
+	};
+
+	std::vector<IndexedEntity> ents;
+	std::unordered_map<std::string, Postings> classBuckets;
+	std::unordered_map<unsigned int, Postings> keyTrigrams;
+	std::unordered_map<unsigned int, Postings> valueTrigrams;
+	size_t staleEntities = 0;
+	unsigned int generation = 0; // changes whenever an entity is reindexed
+
+	EntityFilter lastFilter;
+	Fgd* lastFgd = NULL;
+	unsigned int lastGeneration = 0;
+	bool hasLastResult = false;
+	std::vector<int> lastResult;
+
+	static void tokenize(IndexedEntity& indexed, Entity* ent);
+	static bool matches(const IndexedEntity& indexed, const EntityFilter& filter);
+	void addPostings(int idx);
+	void rebuildPostings();
+};
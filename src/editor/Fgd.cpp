@@ -1,5 +1,6 @@
 #include "Fgd.h"
 #include <set>
+#include <sstream>
 
 std::map<std::string, int> fgdKeyTypes{
 	{"integer", FGD_KEY_INTEGER},
@@ -72,9 +73,78 @@ bool Fgd::parse()
 		return false;
 	}
 
+	int len = 0;
+	char* data = loadFile(path, len);
+	if (!data)
+	{
+		return false;
+	}
+	std::string contents(data, len);
+	delete[] data;
+
+	parseContents(contents);
+	return true;
+}
+
+static unsigned long long fnv1a_64(const char* data, size_t len)
+{
+	unsigned long long hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < len; i++)
+	{
+		hash ^= (unsigned char)data[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+bool Fgd::parse(const std::string& cacheDir)
+{
+	if (!fileExists(path))
+	{
+		return false;
+	}
+
+	int len = 0;
+	char* data = loadFile(path, len);
+	if (!data)
+	{
+		return false;
+	}
+	std::string contents(data, len);
+	delete[] data;
+
+	std::error_code ec;
+	long long size = len;
+	long long mtime = (long long)fs::last_write_time(path, ec).time_since_epoch().count();
+	unsigned long long hash = fnv1a_64(contents.data(), contents.size());
+	std::string fileKey;
+	fileKey.append((const char*)&size, sizeof(size));
+	fileKey.append((const char*)&mtime, sizeof(mtime));
+	fileKey.append((const char*)&hash, sizeof(hash));
+
+	// one cache per fgd path, fgds with the same name can be in different folders
+	std::string absPath = fs::absolute(path, ec).lexically_normal().string();
+	std::string cachePath = cacheDir + fmt::format("{}_{:016x}.fgdcache", name, fnv1a_64(absPath.data(), absPath.size()));
+
+	if (readCache(cachePath, fileKey))
+	{
+		loadedFromCache = true;
+		return true;
+	}
+
+	parseContents(contents);
+	if (!writeCache(cachePath, fileKey))
+	{
+		logf("Failed to write FGD cache {}\n", cachePath);
+	}
+	return true;
+}
+
+void Fgd::parseContents(const std::string& contents)
+{
 	logf("Parsing {}\n", path);
 
-	std::ifstream in(path);
+	std::istringstream in(contents);
 
 	lineNum = 0;
 
@@ -142,9 +212,306 @@ bool Fgd::parse()
 		}
 	}
 
+	delete fgdClass;
+
 	processClassInheritance();
 	createEntGroups();
 	setSpawnflagNames();
+}
+
+// cache files are written in native byte order, they never leave the machine
+struct FgdCacheWriter
+{
+	std::string data;
+
+	void write(const void* src, size_t len)
+	{
+		data.append((const char*)src, len);
+	}
+	void writeInt(int v)
+	{
+		write(&v, sizeof(v));
+	}
+	void writeBool(bool v)
+	{
+		data.push_back(v ? 1 : 0);
+	}
+	void writeString(const std::string& s)
+	{
+		writeInt((int)s.size());
+		write(s.data(), s.size());
+	}
+};
+
+struct FgdCacheReader
+{
+	const char* pos;
+	const char* end;
+	bool ok = true;
+
+	void read(void* dst, size_t len)
+	{
+		if (!ok || (size_t)(end - pos) < len)
+		{
+			ok = false;
+			memset(dst, 0, len);
+			return;
+		}
+		memcpy(dst, pos, len);
+		pos += len;
+	}
+	int readInt()
+	{
+		int v;
+		read(&v, sizeof(v));
+		return v;
+	}
+	// counts are checked against the remaining data, so a damaged file can't make huge allocations
+	int readCount()
+	{
+		int v = readInt();
+		if (v < 0 || v > end - pos)
+		{
+			ok = false;
+			return 0;
+		}
+		return v;
+	}
+	bool readBool()
+	{
+		char v;
+		read(&v, 1);
+		return v != 0;
+	}
+	std::string readString()
+	{
+		int len = readCount();
+		std::string s(pos, ok ? len : 0);
+		pos += ok ? len : 0;
+		return s;
+	}
+};
+
+bool Fgd::writeCache(const std::string& cachePath, const std::string& fileKey)
+{
+	FgdCacheWriter out;
+	out.write("BGFC", 4);
+	out.writeInt(FGD_CACHE_VERSION);
+	out.writeString(fileKey);
+
+	std::map<FgdClass*, int> classIndexes;
+	out.writeInt((int)classes.size());
+	for (size_t i = 0; i < classes.size(); i++)
+	{
+		FgdClass& c = *classes[i];
+		classIndexes[classes[i]] = (int)i;
+
+		out.writeInt(c.classType);
+		out.writeString(c.name);
+		out.writeString(c.description);
+		out.writeInt((int)c.keyvalues.size());
+		for (KeyvalueDef& def : c.keyvalues)
+		{
+			out.writeString(def.name);
+			out.writeString(def.valueType);
+			out.writeInt(def.iType);
+			out.writeString(def.description);
+			out.writeString(def.defaultValue);
+			out.writeInt((int)def.choices.size());
+			for (KeyvalueChoice& choice : def.choices)
+			{
+				out.writeString(choice.name);
+				out.writeString(choice.svalue);
+				out.writeInt(choice.ivalue);
+				out.writeBool(choice.isInteger);
+			}
+		}
+		out.writeInt((int)c.baseClasses.size());
+		for (std::string& baseClass : c.baseClasses)
+			out.writeString(baseClass);
+		for (int k = 0; k < 32; k++)
+			out.writeString(c.spawnFlagNames[k]);
+		out.writeString(c.model);
+		out.writeString(c.sprite);
+		out.writeString(c.iconSprite);
+		out.writeBool(c.isModel);
+		out.writeBool(c.isSprite);
+		out.writeBool(c.isDecal);
+		out.writeBool(c.hasAngles);
+		out.writeInt(c.modelSequence);
+		out.writeInt(c.modelSkin);
+		out.writeInt(c.modelBody);
+		out.write(&c.mins, sizeof(vec3));
+		out.write(&c.maxs, sizeof(vec3));
+		out.write(&c.color, sizeof(COLOR3));
+		out.writeInt((int)c.otherTypes.size());
+		for (auto& it : c.otherTypes)
+		{
+			out.writeString(it.first);
+			out.writeString(it.second);
+		}
+		out.writeBool(c.colorSet);
+		out.writeBool(c.sizeSet);
+	}
+
+	for (std::vector<FgdGroup>* groups : { &pointEntGroups, &solidEntGroups })
+	{
+		out.writeInt((int)groups->size());
+		for (FgdGroup& group : *groups)
+		{
+			out.writeString(group.groupName);
+			out.writeInt((int)group.classes.size());
+			for (FgdClass* c : group.classes)
+				out.writeInt(classIndexes[c]);
+		}
+	}
+
+	out.writeInt((int)existsFlagNames.size());
+	for (size_t i = 0; i < existsFlagNames.size(); i++)
+	{
+		out.writeString(existsFlagNames[i]);
+		out.writeInt(existsFlagNamesBits[i]);
+	}
+
+	// written next to the target first, so a reader never sees half of it
+	std::string tmpPath = cachePath + ".tmp";
+	if (!writeFile(tmpPath, out.data.data(), (int)out.data.size()))
+		return false;
+	std::error_code ec;
+	fs::rename(tmpPath, cachePath, ec);
+	if (ec)
+	{
+		fs::remove(tmpPath, ec);
+		return false;
+	}
+	return true;
+}
+
+bool Fgd::readCache(const std::string& cachePath, const std::string& fileKey)
+{
+	if (!fileExists(cachePath))
+		return false;
+
+	int len = 0;
+	char* data = loadFile(cachePath, len);
+	if (!data)
+		return false;
+
+	FgdCacheReader in;
+	in.pos = data;
+	in.end = data + len;
+
+	char magic[4];
+	in.read(magic, 4);
+	if (!in.ok || memcmp(magic, "BGFC", 4) != 0 || in.readInt() != FGD_CACHE_VERSION || in.readString() != fileKey)
+	{
+		delete[] data;
+		return false;
+	}
+
+	std::vector<FgdClass*> newClasses;
+	int classCount = in.readCount();
+	for (int i = 0; i < classCount && in.ok; i++)
+	{
+		FgdClass* c = new FgdClass();
+		newClasses.push_back(c);
+
+		c->classType = in.readInt();
+		c->name = in.readString();
+		c->description = in.readString();
+		c->keyvalues.resize(in.readCount());
+		for (KeyvalueDef& def : c->keyvalues)
+		{
+			def.name = in.readString();
+			def.valueType = in.readString();
+			def.iType = in.readInt();
+			def.description = in.readString();
+			def.defaultValue = in.readString();
+			def.choices.resize(in.readCount());
+			for (KeyvalueChoice& choice : def.choices)
+			{
+				choice.name = in.readString();
+				choice.svalue = in.readString();
+				choice.ivalue = in.readInt();
+				choice.isInteger = in.readBool();
+			}
+		}
+		c->baseClasses.resize(in.readCount());
+		for (std::string& baseClass : c->baseClasses)
+			baseClass = in.readString();
+		for (int k = 0; k < 32; k++)
+			c->spawnFlagNames[k] = in.readString();
+		c->model = in.readString();
+		c->sprite = in.readString();
+		c->iconSprite = in.readString();
+		c->isModel = in.readBool();
+		c->isSprite = in.readBool();
+		c->isDecal = in.readBool();
+		c->hasAngles = in.readBool();
+		c->modelSequence = in.readInt();
+		c->modelSkin = in.readInt();
+		c->modelBody = in.readInt();
+		in.read(&c->mins, sizeof(vec3));
+		in.read(&c->maxs, sizeof(vec3));
+		in.read(&c->color, sizeof(COLOR3));
+		int otherCount = in.readCount();
+		for (int k = 0; k < otherCount && in.ok; k++)
+		{
+			std::string key = in.readString();
+			c->otherTypes[key] = in.readString();
+		}
+		c->colorSet = in.readBool();
+		c->sizeSet = in.readBool();
+	}
+
+	std::vector<FgdGroup> newGroups[2];
+	for (int g = 0; g < 2 && in.ok; g++)
+	{
+		newGroups[g].resize(in.readCount());
+		for (FgdGroup& group : newGroups[g])
+		{
+			group.groupName = in.readString();
+			int count = in.readCount();
+			for (int k = 0; k < count && in.ok; k++)
+			{
+				int idx = in.readInt();
+				if (idx < 0 || idx >= (int)newClasses.size())
+					in.ok = false;
+				else
+					group.classes.push_back(newClasses[idx]);
+			}
+		}
+	}
+
+	std::vector<std::string> newFlagNames;
+	std::vector<int> newFlagBits;
+	int flagCount = in.readCount();
+	for (int i = 0; i < flagCount && in.ok; i++)
+	{
+		newFlagNames.push_back(in.readString());
+		newFlagBits.push_back(in.readInt());
+	}
+
+	delete[] data;
+
+	if (!in.ok)
+	{
+		logf("Ignoring damaged FGD cache {}\n", cachePath);
+		for (FgdClass* c : newClasses)
+			delete c;
+		return false;
+	}
+
+	logf("Loaded {} from cache\n", path);
+	classes = std::move(newClasses);
+	for (size_t i = 0; i < classes.size(); i++)
+	{
+		classMap[classes[i]->name] = classes[i];
+	}
+	pointEntGroups = std::move(newGroups[0]);
+	solidEntGroups = std::move(newGroups[1]);
+	existsFlagNames = std::move(newFlagNames);
+	existsFlagNamesBits = std::move(newFlagBits);
 	return true;
 }
 
@@ -313,9 +680,10 @@ void Fgd::parseKeyvalue(FgdClass& outClass)
 	def.valueType = toLowerCase(getValueInParens(keyParts[0]));
 
 	def.iType = FGD_KEY_STRING;
-	if (fgdKeyTypes.find(def.valueType) != fgdKeyTypes.end())
+	auto keyType = fgdKeyTypes.find(def.valueType);
+	if (keyType != fgdKeyTypes.end())
 	{
-		def.iType = fgdKeyTypes[def.valueType];
+		def.iType = keyType->second;
 	}
 
 	if (keyParts.size() > 1)
@@ -3,6 +3,9 @@
 #include "Wad.h"
 #include "Entity.h"
 
+// bump when FgdClass or the layout of the cache files changes
+#define FGD_CACHE_VERSION 1
+
 enum FGD_CLASS_TYPES
 {
 	FGD_CLASS_BASE,
@@ -124,7 +127,12 @@ public:
 	~Fgd();
 
 	bool parse();
+	// same as parse, but the resolved classes are loaded from a cache file in cacheDir if the fgd
+	// has the same size, modification time and contents as when it was cached. Otherwise the fgd
+	// is parsed and the cache is rewritten.
+	bool parse(const std::string& cacheDir);
 	void merge(Fgd* other);
+	bool loadedFromCache = false;
 
 	FgdClass* getFgdClass(std::string cname);
 
@@ -132,6 +140,10 @@ private:
 	int lineNum;
 	std::string line; // current line being parsed
 
+	void parseContents(const std::string& contents);
+	bool readCache(const std::string& cachePath, const std::string& fileKey);
+	bool writeCache(const std::string& cachePath, const std::string& fileKey);
+
 	void parseClassHeader(FgdClass& fgdClass);
 	void parseKeyvalue(FgdClass& outClass);
 	void parseChoicesOrFlags(KeyvalueDef& outKey);
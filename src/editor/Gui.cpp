@@ -21,6 +21,8 @@
 #include "quantizer.h"
 #include <execution>
 #include "vis.h"
+#include "radbake.h"
+#include "mipmap.h"
 
 float g_tooltip_delay = 0.6f; // time in seconds before showing a tooltip
 
@@ -164,6 +166,10 @@ void Gui::draw()
 	{
 		drawGOTOWidget();
 	}
+	if (showValidationWidget)
+	{
+		drawValidationReport();
+	}
 
 	if (app->pickMode == PICK_OBJECT)
 	{
@@ -556,6 +562,18 @@ void Gui::draw3dContextMenus()
 				pasteLightmap();
 			}
 
+			if (ImGui::MenuItem("Rebake lighting", "", false, !app->isLoading && !app->pickInfo.selectedFaces.empty()))
+			{
+				if (qrad_rebake_faces(map, app->pickInfo.selectedFaces) > 0)
+					map->getBspRender()->reloadLightmaps();
+			}
+			if (ImGui::IsItemHovered() && g.HoveredIdTimer > g_tooltip_delay)
+			{
+				ImGui::BeginTooltip();
+				ImGui::TextUnformatted("Recomputes direct light from the light entities.\nBounced light is not computed.");
+				ImGui::EndTooltip();
+			}
+
 			ImGui::EndPopup();
 		}
 	}
@@ -626,6 +644,18 @@ void Gui::draw3dContextMenus()
 				if (modelIdx >= 0)
 				{
 					BSPMODEL& model = map->models[modelIdx];
+					if (ImGui::MenuItem("Rebake lighting", 0, false, !app->isLoading))
+					{
+						if (qrad_rebake_model(map, modelIdx) > 0)
+							map->getBspRender()->reloadLightmaps();
+					}
+					if (ImGui::IsItemHovered() && g.HoveredIdTimer > g_tooltip_delay)
+					{
+						ImGui::BeginTooltip();
+						ImGui::TextUnformatted("Recomputes direct light on every face of the model.\nBounced light is not computed.");
+						ImGui::EndTooltip();
+					}
+
 					if (ImGui::BeginMenu("Hulls"))
 					{
 						if (modelIdx > 0 || map->is_bsp_model)
@@ -2275,8 +2305,7 @@ void Gui::drawMenuBar()
 		{
 			if (map)
 			{
-				logf("Validating {}\n", map->bsp_name);
-				map->validate();
+				validateMap(map);
 			}
 		}
 		ImGui::Separator();
@@ -2469,6 +2498,40 @@ void Gui::drawMenuBar()
 			rend->pushUndoCommand(command);
 		}
 
+		if (ImGui::BeginMenu("Profile stages"))
+		{
+			bool profiling = g_progress.isProfiling();
+			if (ImGui::MenuItem("Record", NULL, profiling))
+			{
+				if (profiling)
+					g_progress.stopProfile();
+				else
+					g_progress.startProfile();
+			}
+			if (ImGui::IsItemHovered() && g.HoveredIdTimer > g_tooltip_delay)
+			{
+				ImGui::BeginTooltip();
+				ImGui::TextUnformatted("Record wall time, cpu time and peak memory of clean, optimize, merge,\nvis, lighting and clipnode stages. Starting again clears the last recording.");
+				ImGui::EndTooltip();
+			}
+
+			int stageCount = g_progress.stageCount();
+			if (ImGui::MenuItem("Print to log", NULL, false, stageCount > 0))
+			{
+				g_progress.printProfile();
+			}
+			if (ImGui::MenuItem("Save chrome trace", NULL, false, stageCount > 0))
+			{
+				createDir(GetWorkDir());
+				g_progress.saveProfile(GetWorkDir() + map->bsp_name + "_profile.json");
+			}
+			if (ImGui::MenuItem("Clear", NULL, false, stageCount > 0))
+			{
+				g_progress.clearProfile();
+			}
+			ImGui::EndMenu();
+		}
+
 		if (ImGui::BeginMenu("Show clipnodes", map))
 		{
 			if (ImGui::MenuItem("[-1] - Auto", NULL, app->clipnodeRenderHull == -1))
@@ -2620,6 +2683,7 @@ void Gui::drawMenuBar()
 						map->marksurfs[i] = 0;
 					}
 				}
+				map->invalidate_face_indexes();
 			}
 			if (ImGui::IsItemHovered() && g.HoveredIdTimer > g_tooltip_delay)
 			{
@@ -3050,6 +3114,17 @@ void Gui::drawFpsOverlay()
 	if (ImGui::Begin("Overlay", 0, ImGuiWindowFlags_NoMove | ImGuiWindowFlags_NoDecoration | ImGuiWindowFlags_AlwaysAutoResize | ImGuiWindowFlags_NoSavedSettings | ImGuiWindowFlags_NoFocusOnAppearing | ImGuiWindowFlags_NoNav))
 	{
 		ImGui::Text("%.0f FPS", imgui_io->Framerate);
+		ImGui::Text("%u draw calls", g_drawStatsLast.drawCalls);
+		ImGui::Text("%u GL calls", g_drawStatsLast.glCalls);
+		ImGui::Text("%u shader, %u texture binds", g_drawStatsLast.shaderBinds, g_drawStatsLast.textureBinds);
+		if (g_drawStatsLast.uploadedBytes)
+		{
+			ImGui::Text("%llu bytes uploaded", g_drawStatsLast.uploadedBytes);
+		}
+		if (g_drawStatsLast.instancedCalls)
+		{
+			ImGui::Text("%u instances in %u calls", g_drawStatsLast.instances, g_drawStatsLast.instancedCalls);
+		}
 		if (ImGui::BeginPopupContextWindow())
 		{
 			ImGui::Checkbox("VSync", &g_settings.vsync);
@@ -3076,7 +3151,8 @@ void Gui::drawStatusMessage()
 		}
 	}
 
-	bool showStatus = (app->invalidSolid && !selectedEntity) || !app->isTransformableSolid || badSurfaceExtents || lightmapTooLarge || app->modelUsesSharedStructures;
+	bool loadingBspModels = app->bspModelLoadsTotal() > 0;
+	bool showStatus = (app->invalidSolid && !selectedEntity) || !app->isTransformableSolid || badSurfaceExtents || lightmapTooLarge || app->modelUsesSharedStructures || loadingBspModels;
 
 	if (showStatus)
 	{
@@ -3140,6 +3216,10 @@ void Gui::drawStatusMessage()
 					ImGui::EndTooltip();
 				}
 			}
+			if (loadingBspModels)
+			{
+				ImGui::Text(fmt::format("Loading BSP models {}/{}", app->bspModelLoadsDone(), app->bspModelLoadsTotal()).c_str());
+			}
 			if (lightmapTooLarge)
 			{
 				ImGui::TextColored(ImVec4(1.0f, 0.0f, 0.0f, 1.0f), "LIGHTMAP TOO LARGE");
@@ -3645,8 +3725,7 @@ void Gui::drawDebugWidget()
 			}
 			else
 			{
-				auto faceList = map->getLeafFaces(l + 1);
-				for (const auto& idx : faceList)
+				for (int idx : map->getLeafFaceSpan(l + 1))
 				{
 					map->getBspRender()->highlightFace(idx, true, COLOR4(230 + rand() % 25, 0, 0, 255), true);
 				}
@@ -3657,8 +3736,7 @@ void Gui::drawDebugWidget()
 		{
 			if (l == leafIdx || CHECKVISBIT(visData, l))
 			{
-				auto faceList = map->getLeafFaces(l + 1);
-				for (const auto& idx : faceList)
+				for (int idx : map->getLeafFaceSpan(l + 1))
 				{
 					map->getBspRender()->highlightFace(idx, true, COLOR4(0, 0, 230 + rand() % 25, 255), true);
 				}
@@ -3668,6 +3746,63 @@ void Gui::drawDebugWidget()
 	}
 }
 
+// grid of thumbnails where only the visible rows request theirs. getItem fills the request and the
+// label of a cell, and returns false for cells without a texture.
+static void draw_thumbnail_grid(ThumbnailCache& cache, int count, int thumbSize,
+	const std::function<bool(int, ThumbnailRequest&, std::string&)>& getItem)
+{
+	ImGuiStyle& style = ImGui::GetStyle();
+	float cellWidth = thumbSize + style.ItemSpacing.x;
+	int columns = std::max(1, (int)((ImGui::GetContentRegionAvail().x + style.ItemSpacing.x) / cellWidth));
+	int rows = (count + columns - 1) / columns;
+
+	ImGuiListClipper clipper;
+	clipper.Begin(rows, thumbSize + ImGui::GetTextLineHeightWithSpacing() + style.ItemSpacing.y);
+	while (clipper.Step())
+	{
+		for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; row++)
+		{
+			for (int col = 0; col < columns; col++)
+			{
+				int i = row * columns + col;
+				if (i >= count)
+					break;
+				if (col > 0)
+					ImGui::SameLine();
+
+				ThumbnailRequest req;
+				req.maxSize = thumbSize;
+				std::string label;
+				Texture* tex = getItem(i, req, label) ? cache.get(req) : NULL;
+
+				ImGui::BeginGroup();
+				ImVec2 pos = ImGui::GetCursorScreenPos();
+				ImGui::Dummy(ImVec2((float)thumbSize, (float)thumbSize));
+				if (tex)
+				{
+					float scale = (float)thumbSize / std::max(tex->width, tex->height);
+					ImVec2 size(tex->width * scale, tex->height * scale);
+					ImVec2 min(pos.x + (thumbSize - size.x) * 0.5f, pos.y + (thumbSize - size.y) * 0.5f);
+					ImGui::GetWindowDrawList()->AddImage((ImTextureID)(uint64_t)tex->id, min, ImVec2(min.x + size.x, min.y + size.y));
+				}
+				else
+				{
+					ImGui::GetWindowDrawList()->AddRect(pos, ImVec2(pos.x + thumbSize, pos.y + thumbSize), ImGui::GetColorU32(ImGuiCol_Border));
+				}
+				ImGui::PushClipRect(ImGui::GetCursorScreenPos(), ImVec2(pos.x + thumbSize, pos.y + thumbSize * 2.f), true);
+				ImGui::TextUnformatted(label.c_str());
+				ImGui::PopClipRect();
+				ImGui::EndGroup();
+				if (ImGui::IsItemHovered())
+				{
+					ImGui::SetTooltip("%s", label.c_str());
+				}
+			}
+		}
+	}
+	clipper.End();
+}
+
 void Gui::drawTextureBrowser()
 {
 	Bsp* map = app->getSelectedMap();
@@ -3677,60 +3812,118 @@ void Gui::drawTextureBrowser()
 	//ImGui::SetNextWindowContentSize(ImVec2(550, 0.0f));
 	if (ImGui::Begin("Texture browser", &showTextureBrowser, 0))
 	{
-		// Список встроенных в карту текстур, с возможностью Удалить/Экспортировать/Импортировать/Переименовать
-		// Список встроенных в карту WAD текстур, с возможностью Удалить/
-		// Список всех WAD файлов и доступных текстур, с возможностью добавления в карту ссылки или копии текстуры.
-		if (ImGui::BeginTabBar("##tabs", ImGuiTabBarFlags_::ImGuiTabBarFlags_FittingPolicyScroll |
+		static int thumbSize = 64;
+		ImGui::SetNextItemWidth(200.f);
+		ImGui::SliderInt("Thumbnail size", &thumbSize, 32, 256);
+
+		if (!mapRender || !mapRender->texturesLoaded)
+		{
+			ImGui::Text(mapRender ? "Loading textures..." : "No map selected");
+		}
+		else if (ImGui::BeginTabBar("##tabs", ImGuiTabBarFlags_::ImGuiTabBarFlags_FittingPolicyScroll |
 			ImGuiTabBarFlags_::ImGuiTabBarFlags_NoCloseWithMiddleMouseButton |
 			ImGuiTabBarFlags_::ImGuiTabBarFlags_Reorderable))
 		{
-			ImGui::Dummy(ImVec2(0, 10));
-			if (ImGui::BeginTabItem("Internal"))
-			{
-				ImGui::Dummy(ImVec2(0, 10));
-				ImGuiListClipper clipper;
-				clipper.Begin(LineOffsets.Size, 30.0f);
-				while (clipper.Step())
+			ThumbnailCache& thumbs = mapRender->textureThumbs;
+			thumbs.beginFrame();
+
+			// textures without pixel data are shown from the first wad that has them
+			auto find_in_wads = [&](const char* texName, ThumbnailRequest& req) {
+				for (Wad* wad : mapRender->wads)
 				{
+					for (int d = 0; d < (int)wad->dirEntries.size(); d++)
+					{
+						WADDIRENTRY& entry = wad->dirEntries[d];
+						if (strcasecmp(entry.szName, texName) != 0 || entry.bCompression || entry.nFilePos < 0 || entry.nFilePos >= wad->fileLen)
+							continue;
+						req.owner = wad;
+						req.index = d;
+						req.miptex = wad->filedata + entry.nFilePos;
+						req.size = std::max(0, std::min(entry.nDiskSize, wad->fileLen - entry.nFilePos));
+						return true;
+					}
+				}
+				return false;
+			};
+
+			auto get_embedded = [&](int i, ThumbnailRequest& req, std::string& label) {
+				int texOffset = ((int*)map->textures)[i + 1];
+				int lumpLen = map->bsp_header.lump[LUMP_TEXTURES].nLength;
+				if (texOffset < 0 || texOffset + (int)sizeof(BSPMIPTEX) > lumpLen)
+				{
+					label = "(missing)";
+					return false;
+				}
+				BSPMIPTEX* tex = (BSPMIPTEX*)(map->textures + texOffset);
+				label = std::string(tex->szName, strnlen(tex->szName, MAXTEXTURENAME));
+				if (tex->nOffsets[0] <= 0)
+					return find_in_wads(label.c_str(), req);
+
+				// the lump can change before the decode runs, so only this texture is copied
+				int lastMipSize = (tex->nWidth / 8) * (tex->nHeight / 8);
+				int texSize = tex->nOffsets[3] + lastMipSize + (int)sizeof(short) + (int)sizeof(COLOR3) * 256;
+				req.owner = map;
+				req.index = i;
+				req.miptex = map->textures + texOffset;
+				req.size = std::max(0, std::min(texSize, lumpLen - texOffset));
+				req.copyData = true;
+				req.palette = map->is_texture_with_pal(i) ? NULL : (const COLOR3*)quakeDefaultPalette;
+				return true;
+			};
 
-				}
-				clipper.End();
+			if (ImGui::BeginTabItem("Internal"))
+			{
+				ImGui::BeginChild("##thumbs");
+				draw_thumbnail_grid(thumbs, map->textureCount, thumbSize, get_embedded);
+				ImGui::EndChild();
 				ImGui::EndTabItem();
 			}
 			if (ImGui::BeginTabItem("Internal Names"))
 			{
-				ImGui::Dummy(ImVec2(0, 10));
+				ImGui::BeginChild("##names");
 				ImGuiListClipper clipper;
-				clipper.Begin(LineOffsets.Size, 30.0f);
+				clipper.Begin(map->textureCount);
 				while (clipper.Step())
 				{
-
+					for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++)
+					{
+						int texOffset = ((int*)map->textures)[i + 1];
+						if (texOffset < 0)
+						{
+							ImGui::Text("%d: (missing)", i);
+							continue;
+						}
+						BSPMIPTEX* tex = (BSPMIPTEX*)(map->textures + texOffset);
+						ImGui::Text("%d: %.16s (%dx%d%s)", i, tex->szName, tex->nWidth, tex->nHeight, tex->nOffsets[0] <= 0 ? ", wad" : "");
+					}
 				}
 				clipper.End();
+				ImGui::EndChild();
 				ImGui::EndTabItem();
 			}
 
-			if (mapRender)
+			for (auto& wad : mapRender->wads)
 			{
-				for (auto& wad : mapRender->wads)
+				if (ImGui::BeginTabItem(basename(wad->filename).c_str()))
 				{
-					if (ImGui::BeginTabItem(basename(wad->filename).c_str()))
-					{
-						ImGui::Dummy(ImVec2(0, 10));
-						ImGuiListClipper clipper;
-						clipper.Begin(LineOffsets.Size, 30.0f);
-						while (clipper.Step())
-						{
-
-						}
-						clipper.End();
-						ImGui::EndTabItem();
-					}
+					ImGui::BeginChild("##thumbs");
+					draw_thumbnail_grid(thumbs, (int)wad->dirEntries.size(), thumbSize, [&](int i, ThumbnailRequest& req, std::string& label) {
+						WADDIRENTRY& entry = wad->dirEntries[i];
+						label = std::string(entry.szName, strnlen(entry.szName, MAXTEXTURENAME));
+						if (entry.bCompression || entry.nFilePos < 0 || entry.nFilePos >= wad->fileLen)
+							return false;
+						req.owner = wad;
+						req.index = i;
+						req.miptex = wad->filedata + entry.nFilePos;
+						req.size = std::max(0, std::min(entry.nDiskSize, wad->fileLen - entry.nFilePos));
+						return true;
+						});
+					ImGui::EndChild();
+					ImGui::EndTabItem();
 				}
 			}
+			ImGui::EndTabBar();
 		}
-		ImGui::EndTabBar();
-
 	}
 	ImGui::End();
 }
@@ -4445,9 +4638,7 @@ void Gui::drawKeyvalueEditor_RawEditTab(int entIdx)
 					dragIds[i] = dragIds[n_next];
 					dragIds[n_next] = item;
 
-					std::string temp = ent->keyOrder[i];
-					ent->keyOrder[i] = ent->keyOrder[n_next];
-					ent->keyOrder[n_next] = temp;
+					ent->swapKeys(i, n_next);
 
 					ImGui::ResetMouseDragDelta();
 				}
@@ -5533,6 +5724,16 @@ void Gui::drawSettings()
 				ImGui::TextUnformatted("Additional cleanup option for clean similar verts.");
 				ImGui::EndTooltip();
 			}
+			ImGui::SameLine();
+
+			static const char* mip_filter_names[] = { "Point", "Box", "Kaiser" };
+			ImGui::SetNextItemWidth(pathWidth / 4);
+			ImGui::Combo("Mipmap filter", &g_settings.mipFilter, mip_filter_names, IM_ARRAYSIZE(mip_filter_names));
+			if (ImGui::IsItemHovered() && g.HoveredIdTimer > g_tooltip_delay) {
+				ImGui::BeginTooltip();
+				ImGui::TextUnformatted("How mip levels are generated for imported textures.\nPoint - old behavior, no filtering.\nBox - average in linear color space.\nKaiser - sharper windowed sinc.");
+				ImGui::EndTooltip();
+			}
 			ImGui::SetNextItemWidth(pathWidth);
 			ImGui::Text("Conditional Point Ent Triggers");
 
@@ -6373,6 +6574,76 @@ void Gui::drawImportMapWidget()
 	ImGui::End();
 }
 
+void Gui::validateMap(Bsp* map)
+{
+	logf("Validating {}\n", map->bsp_name);
+	validationReport = validate_bsp(map);
+	validationReport.print();
+	showValidationWidget = true;
+}
+
+void Gui::drawValidationReport()
+{
+	ImGui::SetNextWindowSize(ImVec2(600.f, 500.f), ImGuiCond_FirstUseEver);
+	std::string title = "Validation - " + validationReport.mapName;
+
+	if (ImGui::Begin((title + "###validation").c_str(), &showValidationWidget))
+	{
+		Bsp* map = app->getSelectedMap();
+
+		ImVec4 errorColor = ImVec4(1.0f, 0.3f, 0.3f, 1.0f);
+		ImVec4 warningColor = ImVec4(1.0f, 0.8f, 0.3f, 1.0f);
+		ImVec4 okColor = ImVec4(0.4f, 1.0f, 0.4f, 1.0f);
+
+		ImGui::TextColored(validationReport.errors ? errorColor : validationReport.warnings ? warningColor : okColor,
+			"%d errors, %d warnings (%.1f ms)", validationReport.errors, validationReport.warnings, validationReport.seconds * 1000.0);
+		ImGui::SameLine();
+		if (ImGui::Button("Validate again") && map)
+		{
+			validateMap(map);
+		}
+		ImGui::Separator();
+
+		ImGui::BeginChild("checks");
+		for (auto& check : validationReport.checks)
+		{
+			int errors = check.errorCount();
+			int warnings = check.warningCount();
+			std::string label = fmt::format("{} - {} items, {} errors, {} warnings ({:.1f} ms)###{}",
+				check.name, check.itemsChecked, errors, warnings, check.seconds * 1000.0, check.name);
+
+			ImGui::PushStyleColor(ImGuiCol_Text, errors ? errorColor : warnings ? warningColor : okColor);
+			bool open = ImGui::TreeNodeEx(label.c_str(), check.problems.empty() ? ImGuiTreeNodeFlags_Leaf : 0);
+			ImGui::PopStyleColor();
+			if (!open)
+				continue;
+
+			for (auto& p : check.problems)
+			{
+				std::string problemLabel = fmt::format("{} ({})###{}", p.what, p.count, p.what);
+				if (ImGui::TreeNode(problemLabel.c_str()))
+				{
+					for (auto& o : p.offenders)
+					{
+						if (o.index >= 0)
+							ImGui::BulletText("%d: %s", o.index, o.detail.c_str());
+						else
+							ImGui::BulletText("%s", o.detail.c_str());
+					}
+					if (p.count > (int)p.offenders.size())
+					{
+						ImGui::TextDisabled("... and %d more", p.count - (int)p.offenders.size());
+					}
+					ImGui::TreePop();
+				}
+			}
+			ImGui::TreePop();
+		}
+		ImGui::EndChild();
+	}
+	ImGui::End();
+}
+
 void Gui::drawLimits()
 {
 	ImGui::SetNextWindowSize(ImVec2(550.f, 630.f), ImGuiCond_FirstUseEver);
@@ -6652,111 +6923,43 @@ void Gui::drawEntityReport()
 				while (valueFilter.size() < MAX_FILTERS)
 					valueFilter.push_back(std::string());
 
-				for (int i = 1; i < map->ents.size(); i++)
+				EntityFilter filter;
+				if (classFilter != "(none)")
+					filter.classname = classFilter;
+				if (flagsFilter != "(none)")
+					filter.spawnflag = flagsFilter;
+				for (int k = 0; k < MAX_FILTERS; k++)
 				{
-					Entity* ent = map->ents[i];
-					std::string cname = ent->keyvalues["classname"];
-
-					bool visible = true;
-
-					if (!classFilter.empty() && classFilter != "(none)")
-					{
-						if (strcasecmp(cname.c_str(), classFilter.c_str()) != 0)
-						{
-							visible = false;
-						}
-					}
-
-					if (!flagsFilter.empty() && flagsFilter != "(none)")
-					{
-						visible = false;
-						FgdClass* fgdClass = app->fgd->getFgdClass(ent->keyvalues["classname"]);
-						if (fgdClass)
-						{
-							for (int k = 0; k < 32; k++)
-							{
-								if (fgdClass->spawnFlagNames[k] == flagsFilter)
-								{
-									visible = true;
-								}
-							}
-						}
-					}
-
-					for (int k = 0; k < MAX_FILTERS; k++)
-					{
-						if (keyFilter[k].size() && keyFilter[k][0] != '\0')
-						{
-							std::string searchKey = trimSpaces(toLowerCase(keyFilter[k]));
-
-							bool foundKey = false;
-							std::string actualKey;
-							for (int c = 0; c < ent->keyOrder.size(); c++)
-							{
-								std::string key = toLowerCase(ent->keyOrder[c]);
-								if (key == searchKey || (partialMatches && key.find(searchKey) != std::string::npos))
-								{
-									foundKey = true;
-									actualKey = std::move(key);
-									break;
-								}
-							}
-							if (!foundKey)
-							{
-								visible = false;
-								break;
-							}
+					filter.keys.push_back(trimSpaces(toLowerCase(keyFilter[k])));
+					filter.values.push_back(trimSpaces(toLowerCase(valueFilter[k])));
+				}
+				filter.partialMatches = partialMatches;
 
-							std::string searchValue = trimSpaces(toLowerCase(valueFilter[k]));
-							if (!searchValue.empty())
-							{
-								if ((partialMatches && ent->keyvalues[actualKey].find(searchValue) == std::string::npos) ||
-									(!partialMatches && ent->keyvalues[actualKey] != searchValue))
-								{
-									visible = false;
-									break;
-								}
-							}
-						}
-						else if (valueFilter[k].size() && valueFilter[k][0] != '\0')
-						{
-							std::string searchValue = trimSpaces(toLowerCase(valueFilter[k]));
-							bool foundMatch = false;
-							for (int c = 0; c < ent->keyOrder.size(); c++)
-							{
-								std::string val = toLowerCase(ent->keyvalues[ent->keyOrder[c]]);
-								if (val == searchValue || (partialMatches && val.find(searchValue) != std::string::npos))
-								{
-									foundMatch = true;
-									break;
-								}
-							}
-							if (!foundMatch)
-							{
-								visible = false;
-								break;
-							}
-						}
-					}
-					if (visible)
-					{
-						visibleEnts.push_back(i);
-					}
+				BspRenderer* renderer = map->getBspRender();
+				if (renderer)
+				{
+					visibleEnts = renderer->entSearch.query(map, app->fgd, filter);
 				}
 
 				selectedItems.clear();
 				selectedItems.resize(visibleEnts.size());
-				for (int k = 0; k < selectedItems.size(); k++)
+				if (selectAllItems)
 				{
-					if (selectAllItems)
+					// add all visible ents to the selection at once
+					std::vector<int> selectEnts = app->pickInfo.selectedEnts;
+					for (int k = 0; k < selectedItems.size(); k++)
 					{
 						selectedItems[k] = true;
 						if (!app->pickInfo.IsSelectedEnt(visibleEnts[k]))
 						{
-							app->selectEnt(map, visibleEnts[k], true);
+							selectEnts.push_back(visibleEnts[k]);
 						}
 					}
-					else
+					app->selectEnts(map, selectEnts);
+				}
+				else
+				{
+					for (int k = 0; k < selectedItems.size(); k++)
 					{
 						selectedItems[k] = app->pickInfo.IsSelectedEnt(visibleEnts[k]);
 					}
@@ -6841,14 +7044,15 @@ void Gui::drawEntityReport()
 						{
 							selectedItems[i] = !selectedItems[i];
 							lastSelect = i;
-							app->pickInfo.selectedEnts.clear();
+							std::vector<int> selectEnts;
 							for (int k = 0; k < selectedItems.size(); k++)
 							{
 								if (selectedItems[k])
 								{
-									app->selectEnt(map, visibleEnts[k], true);
+									selectEnts.push_back(visibleEnts[k]);
 								}
 							}
+							app->selectEnts(map, selectEnts);
 						}
 						else if (expected_key_mod_flags & ImGuiModFlags_Shift)
 						{
@@ -6865,14 +7069,15 @@ void Gui::drawEntityReport()
 							}
 
 
-							app->pickInfo.selectedEnts.clear();
+							std::vector<int> selectEnts;
 							for (int k = 0; k < selectedItems.size(); k++)
 							{
 								if (selectedItems[k])
 								{
-									app->selectEnt(map, visibleEnts[k], true);
+									selectEnts.push_back(visibleEnts[k]);
 								}
 							}
+							app->selectEnts(map, selectEnts);
 						}
 						else
 						{
@@ -6882,8 +7087,7 @@ void Gui::drawEntityReport()
 								i = 0;
 							selectedItems[i] = true;
 							lastSelect = i;
-							app->pickInfo.selectedEnts.clear();
-							app->selectEnt(map, visibleEnts[i], true);
+							app->selectEnt(map, visibleEnts[i]);
 							if (ImGui::IsMouseDoubleClicked(0) || app->pressed[GLFW_KEY_SPACE])
 							{
 								app->goToEnt(map, visibleEnts[i]);
@@ -8513,21 +8717,9 @@ void Gui::checkFaceErrors()
 
 	for (int i = 0; i < app->pickInfo.selectedFaces.size(); i++)
 	{
-		int size[2];
-		GetFaceLightmapSize(map, app->pickInfo.selectedFaces[i], size);
-		if ((size[0] > MAX_SURFACE_EXTENT) || (size[1] > MAX_SURFACE_EXTENT) || size[0] < 0 || size[1] < 0)
-		{
-			//logf("Bad surface extents ({} x {})\n", size[0], size[1]);
-			size[0] = std::min(size[0], MAX_SURFACE_EXTENT);
-			size[1] = std::min(size[1], MAX_SURFACE_EXTENT);
-			badSurfaceExtents = true;
-		}
-
-
-		if (size[0] * size[1] > MAX_LUXELS)
-		{
-			lightmapTooLarge = true;
-		}
+		int errors = face_lightmap_errors(map, app->pickInfo.selectedFaces[i]);
+		badSurfaceExtents |= (errors & FACE_BAD_EXTENTS) != 0;
+		lightmapTooLarge |= (errors & FACE_LIGHTMAP_TOO_LARGE) != 0;
 	}
 }
 
@@ -8,6 +8,7 @@
 #include "bsptypes.h"
 #include "Texture.h"
 #include "qtools/rad.h"
+#include "BspValidator.h"
 #include <GLFW/glfw3.h>
 
 struct ModelInfo
@@ -82,6 +83,7 @@ private:
 	bool showGOTOWidget_update = true;
 	bool showGOTOWidget = false;
 	bool showTextureBrowser = false;
+	bool showValidationWidget = false;
 	bool reloadSettings = true;
 	int settingsTab = 0;
 	bool openSavedTabs = false;
@@ -108,6 +110,8 @@ private:
 
 	bool anyHullValid[MAX_MAP_HULLS] = {false};
 
+	ValidationReport validationReport;
+
 	int guiHoverAxis; // axis being hovered in the transform menu
 	int contextMenuEnt = -1; // open entity context menu if >= 0
 	int emptyContextMenu = 0; // open context menu for rightclicking world/void
@@ -146,6 +150,8 @@ private:
 	void drawFaceEditorWidget();
 	void drawLimitTab(Bsp* map, int sortMode);
 	void drawEntityReport();
+	void drawValidationReport();
+	void validateMap(Bsp* map);
 	StatInfo calcStat(std::string name, unsigned int val, unsigned int max, bool isMem);
 	ModelInfo calcModelStat(Bsp* map, STRUCTUSAGE* modelInfo, unsigned int val, unsigned int max, bool isMem);
 	void checkValidHulls();
@@ -2,10 +2,11 @@
 #include "primitives.h"
 #include <string.h>
 
-PointEntRenderer::PointEntRenderer(Fgd* fgd, ShaderProgram* colorShader)
+PointEntRenderer::PointEntRenderer(Fgd* fgd, ShaderProgram* colorShader, ShaderProgram* instanceShader)
 {
 	this->fgd = fgd;
 	this->colorShader = colorShader;
+	this->instanceShader = instanceShader;
 
 	genPointEntCubes();
 }
@@ -17,6 +18,7 @@ PointEntRenderer::~PointEntRenderer()
 		delete entCubes[i]->buffer;
 		delete entCubes[i]->selectBuffer;
 		delete entCubes[i]->wireframeBuffer;
+		delete entCubes[i]->instanceBuffer;
 	}
 }
 
@@ -157,6 +159,11 @@ void PointEntRenderer::genCubeBuffers(EntCube* entCube)
 
 	entCube->wireframeBuffer = new VertexBuffer(colorShader, COLOR_4B | POS_3F, selectWireframeBuf, 2 * 12, GL_LINES);
 
+	// shares the cube data, owned by 'buffer'
+	entCube->instanceBuffer = NULL;
+	if (instanceShader)
+		entCube->instanceBuffer = new VertexBuffer(instanceShader, COLOR_4B | POS_3F, cube, (6 * 6) * 2, GL_TRIANGLES);
+
 	entCube->buffer->ownData = true;
 	entCube->selectBuffer->ownData = true;
 	entCube->wireframeBuffer->ownData = true;
@@ -12,14 +12,16 @@ struct EntCube
 	VertexBuffer* buffer;
 	VertexBuffer* selectBuffer; // red coloring for selected ents
 	VertexBuffer* wireframeBuffer; // yellow outline for selected ents
+	VertexBuffer* instanceBuffer; // same data as 'buffer' for the instanced shader (NULL if unsupported)
 };
 
 class PointEntRenderer
 {
 public:
 	Fgd* fgd;
+	ShaderProgram* instanceShader; // NULL if instanced drawing is not supported
 
-	PointEntRenderer(Fgd* fgd, ShaderProgram* colorShader);
+	PointEntRenderer(Fgd* fgd, ShaderProgram* colorShader, ShaderProgram* instanceShader = NULL);
 	~PointEntRenderer();
 
 	EntCube* getEntCube(Entity* ent);
@@ -3,6 +3,7 @@
 #include "ShaderProgram.h"
 #include "primitives.h"
 #include "VertexBuffer.h"
+#include "InstanceBuffer.h"
 #include "shaders.h"
 #include "Gui.h"
 #include <algorithm>
@@ -189,6 +190,22 @@ Renderer::Renderer()
 	colorShader->bind();
 	unsigned int colorMultId = glGetUniformLocation(colorShader->ID, "colorMult");
 	glUniform4f(colorMultId, 1, 1, 1, 1);
+
+	if (InstanceBuffer::isSupported())
+	{
+		colorInstancedShader = new ShaderProgram(Shaders::g_shader_cVert_instanced_vertex, Shaders::g_shader_cVert_fragment);
+		colorInstancedShader->setMatrixes(&matmodel, &matview, &projection, &modelView, &modelViewProjection);
+		colorInstancedShader->setMatrixNames(NULL, "modelViewProjection");
+		colorInstancedShader->setVertexAttributeNames("vPosition", "vColor", NULL);
+
+		colorInstancedShader->bind();
+		colorMultId = glGetUniformLocation(colorInstancedShader->ID, "colorMult");
+		glUniform4f(colorMultId, 1, 1, 1, 1);
+	}
+	else
+	{
+		logf("Instanced rendering not supported, point entities are drawn one by one\n");
+	}
 	clearSelection();
 
 	oldLeftMouse = curLeftMouse = oldRightMouse = curRightMouse = 0;
@@ -200,7 +217,7 @@ Renderer::Renderer()
 
 	g_progress.simpleMode = true;
 
-	pointEntRenderer = new PointEntRenderer(NULL, colorShader);
+	pointEntRenderer = new PointEntRenderer(NULL, colorShader, colorInstancedShader);
 
 	reloading = true;
 	fgdFuture = std::async(std::launch::async, &Renderer::loadFgds, this);
@@ -208,6 +225,7 @@ Renderer::Renderer()
 
 Renderer::~Renderer()
 {
+	cancelBspModelLoads();
 	glfwTerminate();
 }
 
@@ -412,6 +430,13 @@ void Renderer::renderLoop()
 		matmodel.rotateX((float)curTime);
 
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		g_drawStatsLast = g_drawStats;
+		g_drawStats = DrawStats();
+		// the gui and its texture callbacks bind things behind the caches back
+		Texture::invalidateBindings();
+		VertexBuffer::invalidateBindings();
+		if (drawStatsFrames > 0)
+			collectDrawStats();
 
 		if (SelectedMap && SelectedMap->is_mdl_model)
 			glClearColor(0.25, 0.25, 0.25, 1.0);
@@ -430,8 +455,6 @@ void Renderer::renderLoop()
 				continue;
 			}
 
-			mapRenderers[i]->clearDrawCache();
-
 			Bsp* curMap = mapRenderers[i]->map;
 			if (!curMap || !curMap->bsp_name.size())
 				continue;
@@ -455,43 +478,22 @@ void Renderer::renderLoop()
 				continue;
 			}
 
-			std::set<int> modelidskip;
-
-			if (curMap->ents.size() && !isLoading)
+			bool drawnAsInstances = false;
+			if (curMap->is_bsp_model && curMap->ents.size() && !isLoading)
 			{
-				if (curMap->is_bsp_model)
+				// one shared renderer for all entities that use this model
+				const std::vector<BspModelInstance>& instances = getBspModelInstances(mapRenderers[i]);
+				for (const BspModelInstance& instance : instances)
 				{
-					for (size_t n = 0; n < mapRenderers.size(); n++)
-					{
-						if (n == i)
-							continue;
-
-						Bsp* anotherMap = mapRenderers[n]->map;
-						if (anotherMap && anotherMap->ents.size())
-						{
-							vec3 anotherMapOrigin = anotherMap->ents[0]->getOrigin();
-							for (int s = 0; s < (int)anotherMap->ents.size(); s++)
-							{
-								Entity* tmpEnt = anotherMap->ents[s];
-								if (tmpEnt && tmpEnt->hasKey("model"))
-								{
-									if (!modelidskip.count(s))
-									{
-										if (basename(tmpEnt->keyvalues["model"]) == basename(curMap->bsp_path))
-										{
-											modelidskip.insert(s);
-											curMap->ents[0]->setOrAddKeyvalue("origin", (tmpEnt->getOrigin() + anotherMapOrigin).toKeyvalueString());
-											break;
-										}
-									}
-								}
-							}
-						}
-					}
+					mapRenderers[i]->render(highlightEnts, transformTarget == TRANSFORM_VERTEX, clipnodeRenderHull, &instance.origin);
 				}
+				drawnAsInstances = !instances.empty();
 			}
 
-			mapRenderers[i]->render(highlightEnts, transformTarget == TRANSFORM_VERTEX, clipnodeRenderHull);
+			if (!curMap->is_bsp_model || !drawnAsInstances)
+			{
+				mapRenderers[i]->render(highlightEnts, transformTarget == TRANSFORM_VERTEX, clipnodeRenderHull);
+			}
 
 
 			if (!mapRenderers[i]->isFinishedLoading())
@@ -574,7 +576,12 @@ void Renderer::renderLoop()
 		{
 			if (SelectedMap && SelectedMap->is_bsp_model)
 			{
-				SelectedMap->selectModelEnt();
+				// the model map itself was selected, select the first entity that shows it
+				BspRenderer* modelRenderer = SelectedMap->getBspRender();
+				int parentEntIdx = -1;
+				if (modelRenderer && !getBspModelInstances(modelRenderer).empty())
+					parentEntIdx = modelRenderer->modelInstances[0].entIdx;
+				SelectedMap->selectModelEnt(parentEntIdx);
 			}
 		}
 		if (modelIdx > 0 && pickMode == PICK_OBJECT)
@@ -612,6 +619,8 @@ void Renderer::renderLoop()
 
 		glfwSwapBuffers(window);
 
+		updateBspModelLoads();
+
 		if (reloading && fgdFuture.wait_for(std::chrono::milliseconds(0)) == std::future_status::ready)
 		{
 			postLoadFgds();
@@ -651,6 +660,65 @@ void Renderer::renderLoop()
 	glfwTerminate();
 }
 
+void Renderer::collectDrawStats()
+{
+	static DrawStats sum = DrawStats();
+	static int frames = 0;
+	static int settleFrames = 0;
+
+	bool loaded = !reloading && bspModelLoadsDone() == bspModelLoadsTotal();
+	for (size_t i = 0; i < mapRenderers.size() && loaded; i++)
+	{
+		if (mapRenderers[i] && !mapRenderers[i]->isFinishedLoading())
+			loaded = false;
+	}
+
+	// skip the frames that upload data after loading
+	if (!loaded || settleFrames < 10)
+	{
+		settleFrames = loaded ? settleFrames + 1 : 0;
+		return;
+	}
+
+	if (frames == 0)
+		drawStatsFace = -1;
+
+	sum.drawCalls += g_drawStatsLast.drawCalls;
+	sum.instancedCalls += g_drawStatsLast.instancedCalls;
+	sum.instances += g_drawStatsLast.instances;
+	sum.glCalls += g_drawStatsLast.glCalls;
+	sum.shaderBinds += g_drawStatsLast.shaderBinds;
+	sum.textureBinds += g_drawStatsLast.textureBinds;
+	sum.arrayBinds += g_drawStatsLast.arrayBinds;
+	sum.blendChanges += g_drawStatsLast.blendChanges;
+	sum.matrixUpdates += g_drawStatsLast.matrixUpdates;
+	sum.uploads += g_drawStatsLast.uploads;
+	sum.uploadedBytes += g_drawStatsLast.uploadedBytes;
+
+	if (++frames < drawStatsFrames)
+	{
+		// like clicking through faces with the face tool, measured in the next frame's stats
+		BspRenderer* mapRenderer = mapRenderers.size() ? mapRenderers[0] : NULL;
+		if (drawStatsHighlight && mapRenderer && mapRenderer->map->faceCount > 0)
+		{
+			if (drawStatsFace >= 0)
+				mapRenderer->highlightFace(drawStatsFace, false);
+			drawStatsFace = (drawStatsFace + 1) % mapRenderer->map->faceCount;
+			mapRenderer->highlightFace(drawStatsFace, true);
+		}
+		return;
+	}
+
+	double n = frames;
+	logf("Draw stats, average of {} frames:\n", frames);
+	logf("    {:.1f} GL calls\n", sum.glCalls / n);
+	logf("    {:.1f} draw calls ({:.1f} instanced, {:.1f} instances)\n", sum.drawCalls / n, sum.instancedCalls / n, sum.instances / n);
+	logf("    {:.1f} shader binds, {:.1f} texture binds, {:.1f} vertex array binds\n", sum.shaderBinds / n, sum.textureBinds / n, sum.arrayBinds / n);
+	logf("    {:.1f} blend changes, {:.1f} matrix updates\n", sum.blendChanges / n, sum.matrixUpdates / n);
+	logf("    {:.1f} buffer uploads, {:.0f} bytes uploaded\n", sum.uploads / n, sum.uploadedBytes / n);
+	glfwSetWindowShouldClose(window, GLFW_TRUE);
+}
+
 void Renderer::postLoadFgds()
 {
 	delete pointEntRenderer;
@@ -683,6 +751,7 @@ void Renderer::postLoadFgdsAndTextures()
 
 void Renderer::clearMaps()
 {
+	cancelBspModelLoads();
 	for (int i = 0; i < mapRenderers.size(); i++)
 	{
 		delete mapRenderers[i];
@@ -759,7 +828,9 @@ void Renderer::loadSettings()
 
 void Renderer::loadFgds()
 {
-	Fgd* mergedFgd = NULL;
+	// paths are resolved first, then every fgd is parsed by its own thread and merged in order
+	std::vector<Fgd*> fgds;
+	std::vector<std::string> fgdSettingPaths;
 	for (size_t i = 0; i < g_settings.fgdPaths.size(); i++)
 	{
 		if (!g_settings.fgdPaths[i].enabled)
@@ -767,21 +838,8 @@ void Renderer::loadFgds()
 		std::string newFgdPath;
 		if (FindPathInAssets(NULL, g_settings.fgdPaths[i].path, newFgdPath))
 		{
-			Fgd* tmp = new Fgd(newFgdPath);
-			if (!tmp->parse())
-			{
-				logf("Fgd {} parsing failed.\n", g_settings.fgdPaths[i].path);
-				continue;
-			}
-			if (mergedFgd == NULL)
-			{
-				mergedFgd = tmp;
-			}
-			else
-			{
-				mergedFgd->merge(tmp);
-				delete tmp;
-			}
+			fgds.push_back(new Fgd(newFgdPath));
+			fgdSettingPaths.push_back(g_settings.fgdPaths[i].path);
 		}
 		else
 		{
@@ -792,7 +850,39 @@ void Renderer::loadFgds()
 		}
 	}
 
-	swapPointEntRenderer = new PointEntRenderer(mergedFgd, colorShader);
+	std::string cacheDir = g_config_dir + "fgdcache/";
+	if (!dirExists(cacheDir))
+		createDir(cacheDir);
+
+	std::vector<std::future<bool>> parses;
+	for (Fgd* fgd : fgds)
+	{
+		parses.push_back(std::async(std::launch::async, [fgd, &cacheDir]() {
+			return fgd->parse(cacheDir);
+			}));
+	}
+
+	Fgd* mergedFgd = NULL;
+	for (size_t i = 0; i < fgds.size(); i++)
+	{
+		if (!parses[i].get())
+		{
+			logf("Fgd {} parsing failed.\n", fgdSettingPaths[i]);
+			delete fgds[i];
+			continue;
+		}
+		if (mergedFgd == NULL)
+		{
+			mergedFgd = fgds[i];
+		}
+		else
+		{
+			mergedFgd->merge(fgds[i]);
+			delete fgds[i];
+		}
+	}
+
+	swapPointEntRenderer = new PointEntRenderer(mergedFgd, colorShader, colorInstancedShader);
 }
 
 void Renderer::drawModelVerts()
@@ -1409,18 +1499,30 @@ void Renderer::cameraContextMenus()
 		Bsp* map = SelectedMap;
 
 
-		for (int i = 0; i < mapRenderers.size(); i++)
+		bool picked = false;
+		for (int i = 0; i < mapRenderers.size() && !picked; i++)
 		{
-			if (mapRenderers[i]->map && map == mapRenderers[i]->map->parentMap && mapRenderers[i]->pickPoly(pickStart, pickDir, clipnodeRenderHull, tempPick, &map) && tempPick.GetSelectedEnt() >= 0)
+			if (!mapRenderers[i]->map || map != mapRenderers[i]->map->parentMap)
+				continue;
+
+			// test every entity that shows the model and select the one that was hit
+			const std::vector<BspModelInstance>& instances = getBspModelInstances(mapRenderers[i]);
+			for (size_t n = 0; n < std::max((size_t)1, instances.size()) && !picked; n++)
 			{
-				if (map && oLdmap != map)
+				const vec3* offset = n < instances.size() ? &instances[n].origin : NULL;
+				int parentEntIdx = n < instances.size() ? instances[n].entIdx : -1;
+
+				if (mapRenderers[i]->pickPoly(pickStart, pickDir, clipnodeRenderHull, tempPick, &map, offset) && tempPick.GetSelectedEnt() >= 0)
 				{
-					tempPick = PickInfo();
-					map->selectModelEnt();
-					map = oLdmap;
-					tempPick.SetSelectedEnt(pickInfo.GetSelectedEnt());
+					if (map && oLdmap != map)
+					{
+						tempPick = PickInfo();
+						map->selectModelEnt(parentEntIdx);
+						map = oLdmap;
+						tempPick.SetSelectedEnt(pickInfo.GetSelectedEnt());
+					}
+					picked = true;
 				}
-				break;
 			}
 		}
 
@@ -1579,11 +1681,20 @@ void Renderer::pickObject()
 
 	map->getBspRender()->pickPoly(pickStart, pickDir, clipnodeRenderHull, tmpPickInfo, &map);
 
-	for (int i = 0; i < mapRenderers.size(); i++)
+	int hitParentEnt = -1;
+	for (int i = 0; i < mapRenderers.size() && map == oldmap; i++)
 	{
 		if (map == mapRenderers[i]->map->parentMap)
 		{
-			mapRenderers[i]->pickPoly(pickStart, pickDir, clipnodeRenderHull, tmpPickInfo, &map);
+			// stop at the first entity that hits, it gets selected
+			const std::vector<BspModelInstance>& instances = getBspModelInstances(mapRenderers[i]);
+			for (size_t n = 0; n < std::max((size_t)1, instances.size()) && map == oldmap; n++)
+			{
+				const vec3* offset = n < instances.size() ? &instances[n].origin : NULL;
+				mapRenderers[i]->pickPoly(pickStart, pickDir, clipnodeRenderHull, tmpPickInfo, &map, offset);
+				if (map != oldmap && offset)
+					hitParentEnt = instances[n].entIdx;
+			}
 		}
 	}
 
@@ -1600,7 +1711,7 @@ void Renderer::pickObject()
 		{
 			map->getBspRender()->highlightFace(tmpPickInfo.selectedFaces[0], false);
 		}
-		map->selectModelEnt();
+		map->selectModelEnt(hitParentEnt);
 		pickCount++;
 		return;
 	}
@@ -1884,7 +1995,7 @@ bool Renderer::transformAxisControls()
 				else
 				{
 					scaleSelectedObject(delta, scaleDirs[draggingAxis]);
-					map->getBspRender()->refreshModel(ent->getBspModelIdx());
+					map->getBspRender()->refreshModelFaceVerts(ent->getBspModelIdx());
 				}
 			}
 		}
@@ -2054,6 +2165,8 @@ void Renderer::setupView()
 
 void Renderer::reloadBspModels()
 {
+	cancelBspModelLoads();
+
 	isModelsReloading = true;
 
 	if (!mapRenderers.size())
@@ -2096,41 +2209,218 @@ void Renderer::reloadBspModels()
 
 	for (auto bsprend : sorted_renders)
 	{
-		if (bsprend)
+		if (!bsprend)
+			continue;
+
+		// every model is loaded once per map, no matter how many entities use it
+		std::set<std::string> checkedKeys;
+		std::vector<std::string> modelPaths;
+		std::vector<std::string> modelKeys;
+
+		for (auto const& entity : bsprend->map->ents)
 		{
-			for (auto const& entity : bsprend->map->ents)
+			if (!entity->hasKey("model"))
+				continue;
+
+			std::string modelPath = entity->keyvalues["model"];
+			std::string modelKey = toLowerCase(modelPath);
+			if (!modelKey.ends_with(".bsp") || checkedKeys.count(modelKey))
+				continue;
+			checkedKeys.insert(modelKey);
+			modelPaths.push_back(modelPath);
+			modelKeys.push_back(modelKey);
+		}
+
+		std::vector<std::string> newBspPaths;
+		FindPathsInAssets(bsprend->map, modelPaths, newBspPaths);
+
+		std::map<std::string, BspModelLoad*> pathLoads;
+		for (size_t k = 0; k < modelPaths.size(); k++)
+		{
+			if (newBspPaths[k].empty())
 			{
-				if (entity->hasKey("model"))
-				{
-					std::string modelPath = entity->keyvalues["model"];
-					if (toLowerCase(modelPath).ends_with(".bsp"))
-					{
-						std::string newBspPath;
-						if (FindPathInAssets(bsprend->map, modelPath, newBspPath))
-						{
-							Bsp* tmpBsp = new Bsp(newBspPath);
-							tmpBsp->is_bsp_model = true;
-							tmpBsp->parentMap = bsprend->map;
-							if (tmpBsp->bsp_valid)
-							{
-								BspRenderer* mapRenderer = new BspRenderer(tmpBsp, bspShader, fullBrightBspShader, colorShader, pointEntRenderer);
-								mapRenderers.push_back(mapRenderer);
-							}
-						}
-						else
-						{
-							logf("Missing {} model file.\n", modelPath);
-							FindPathInAssets(bsprend->map, modelPath, newBspPath, true);
-						}
-					}
-				}
+				std::string tracePath;
+				logf("Missing {} model file.\n", modelPaths[k]);
+				FindPathInAssets(bsprend->map, modelPaths[k], tracePath, true);
+				continue;
+			}
+
+			std::error_code ec;
+			std::string pathKey = fs::absolute(newBspPaths[k], ec).lexically_normal().string();
+			BspModelLoad*& load = pathLoads[pathKey];
+			if (!load)
+			{
+				load = new BspModelLoad();
+				load->parentMap = bsprend->map;
+				load->path = newBspPaths[k];
+				bspModelLoads.push_back(load);
 			}
+			load->modelKeys.push_back(modelKeys[k]);
 		}
 	}
 
+	if (bspModelLoads.empty())
+	{
+		isModelsReloading = false;
+		return;
+	}
+
+	// Bsp parsing is done by a few workers, renderers are created on the main thread when ready
+	int workerCount = std::min((int)bspModelLoads.size(), std::max(1, (int)std::thread::hardware_concurrency() - 1));
+	bspModelNextLoad = 0;
+	bspModelLoadedCount = 0;
+	for (int i = 0; i < workerCount; i++)
+	{
+		bspModelWorkers.push_back(std::async(std::launch::async, &Renderer::loadBspModelsThread, this));
+	}
+
+	// a new reload cancels this one, so edits don't have to wait for it
 	isModelsReloading = false;
 }
 
+void Renderer::loadBspModelsThread()
+{
+	while (true)
+	{
+		int idx = bspModelNextLoad++;
+		if (idx >= (int)bspModelLoads.size())
+			break;
+
+		BspModelLoad* load = bspModelLoads[idx];
+		load->bsp = new Bsp(load->path);
+		load->loaded = true;
+		bspModelLoadedCount++;
+	}
+}
+
+void Renderer::updateBspModelLoads()
+{
+	if (bspModelLoads.empty())
+		return;
+
+	bool allAdded = true;
+	for (BspModelLoad* load : bspModelLoads)
+	{
+		if (load->added)
+			continue;
+		if (!load->loaded)
+		{
+			allAdded = false;
+			continue;
+		}
+		load->added = true;
+
+		Bsp* tmpBsp = load->bsp;
+		load->bsp = NULL;
+		tmpBsp->is_bsp_model = true;
+		tmpBsp->parentMap = load->parentMap;
+		if (tmpBsp->bsp_valid)
+		{
+			BspRenderer* mapRenderer = new BspRenderer(tmpBsp, bspShader, fullBrightBspShader, colorShader, pointEntRenderer);
+			mapRenderer->modelInstanceKeys = load->modelKeys;
+			mapRenderers.push_back(mapRenderer);
+		}
+		else
+		{
+			delete tmpBsp;
+		}
+	}
+
+	if (allAdded)
+	{
+		// all results are taken, this only joins the workers
+		cancelBspModelLoads();
+	}
+}
+
+int Renderer::bspModelLoadsDone()
+{
+	return bspModelLoadedCount;
+}
+
+int Renderer::bspModelLoadsTotal()
+{
+	return (int)bspModelLoads.size();
+}
+
+void Renderer::cancelBspModelLoads()
+{
+	// loads in progress can't be interrupted, wait for them and drop the results
+	bspModelNextLoad = (int)bspModelLoads.size();
+	for (auto& worker : bspModelWorkers)
+	{
+		worker.wait();
+	}
+	bspModelWorkers.clear();
+
+	for (BspModelLoad* load : bspModelLoads)
+	{
+		delete load->bsp;
+		delete load;
+	}
+	bspModelLoads.clear();
+	bspModelLoadedCount = 0;
+}
+
+const std::vector<BspModelInstance>& Renderer::getBspModelInstances(BspRenderer* modelRenderer)
+{
+	std::vector<BspModelInstance>& instances = modelRenderer->modelInstances;
+
+	Bsp* parentMap = modelRenderer->map->parentMap;
+
+	// the parent map may be closed already
+	bool parentLoaded = false;
+	for (int i = 0; parentMap && i < mapRenderers.size(); i++)
+	{
+		if (mapRenderers[i]->map == parentMap)
+		{
+			parentLoaded = true;
+			break;
+		}
+	}
+	if (!parentLoaded || parentMap->ents.empty() || modelRenderer->modelInstanceKeys.empty())
+	{
+		instances.clear();
+		modelRenderer->modelInstancesValid = false;
+		return instances;
+	}
+
+	// any keyvalue edit changes the newest revision, adding or removing entities changes the count
+	unsigned int revision = Entity::lastRevision();
+	if (modelRenderer->modelInstancesValid && modelRenderer->modelInstancesRevision == revision
+		&& modelRenderer->modelInstancesEntCount == parentMap->ents.size())
+	{
+		return instances;
+	}
+
+	instances.clear();
+	vec3 parentOrigin = parentMap->ents[0]->getOrigin();
+	for (int s = 0; s < (int)parentMap->ents.size(); s++)
+	{
+		Entity* tmpEnt = parentMap->ents[s];
+		if (!tmpEnt->hasKey("model"))
+			continue;
+		const std::string& model = tmpEnt->keyvalues["model"];
+		if (model.size() < 4)
+			continue;
+
+		std::string modelKey = toLowerCase(model);
+		for (const std::string& key : modelRenderer->modelInstanceKeys)
+		{
+			if (key == modelKey)
+			{
+				instances.push_back({ s, tmpEnt->getOrigin() + parentOrigin });
+				break;
+			}
+		}
+	}
+
+	modelRenderer->modelInstancesRevision = revision;
+	modelRenderer->modelInstancesEntCount = parentMap->ents.size();
+	modelRenderer->modelInstancesValid = true;
+	return instances;
+}
+
 void Renderer::addMap(Bsp* map)
 {
 	if (!map->bsp_valid)
@@ -3057,6 +3347,9 @@ void Renderer::scaleSelectedObject(vec3 dir, const vec3& fromDir)
 
 void Renderer::moveSelectedVerts(const vec3& delta)
 {
+	Bsp* map = SelectedMap;
+	std::vector<int> movedVerts;
+
 	for (int i = 0; i < modelVerts.size(); i++)
 	{
 		if (modelVerts[i].selected)
@@ -3065,16 +3358,21 @@ void Renderer::moveSelectedVerts(const vec3& delta)
 			if (gridSnappingEnabled)
 				modelVerts[i].pos = snapToGrid(modelVerts[i].pos);
 			if (modelVerts[i].ptr)
+			{
 				*modelVerts[i].ptr = modelVerts[i].pos;
+				if (map)
+					movedVerts.push_back((int)(modelVerts[i].ptr - map->verts));
+			}
 		}
 	}
 
-	Bsp* map = SelectedMap;
 	int entIdx = pickInfo.GetSelectedEnt();
 	if (map && entIdx >= 0)
 	{
+		// only the faces that use the moved verts change
 		Entity* ent = map->ents[entIdx];
-		map->getBspRender()->refreshModel(ent->getBspModelIdx());
+		int modelIdx = ent->getBspModelIdx();
+		map->getBspRender()->refreshFaceVerts(map->get_model_faces_using_verts(modelIdx, movedVerts));
 	}
 }
 
@@ -3536,11 +3834,13 @@ void Renderer::deleteEnts()
 	if (map && pickInfo.selectedEnts.size() > 0)
 	{
 		bool reloadbspmdls = false;
-		std::sort(pickInfo.selectedEnts.begin(), pickInfo.selectedEnts.end());
-		std::reverse(pickInfo.selectedEnts.begin(), pickInfo.selectedEnts.end());
+		// deleting an entity clears the selection
+		std::vector<int> ents = pickInfo.selectedEnts;
+		std::sort(ents.begin(), ents.end());
+		std::reverse(ents.begin(), ents.end());
 
 
-		for (auto entIdx : pickInfo.selectedEnts)
+		for (auto entIdx : ents)
 		{
 			if (entIdx < 0)
 				continue;
@@ -3564,7 +3864,7 @@ void Renderer::deleteEnts()
 void Renderer::deselectObject()
 {
 	filterNeeded = true;
-	pickInfo.selectedEnts.clear();
+	pickInfo.ClearSelectedEnts();
 	pickInfo.selectedFaces.clear();
 	isTransformableSolid = false;
 	hoverVert = -1;
@@ -3648,6 +3948,33 @@ void Renderer::selectEnt(Bsp* map, int entIdx, bool add)
 		map->getBspRender()->saveLumpState(0xffffffff, true);
 	pickCount++; // force transform window update
 }
+
+void Renderer::selectEnts(Bsp* map, const std::vector<int>& entIdxs)
+{
+	if (!map)
+		return;
+
+	pickMode = PICK_OBJECT;
+	pickInfo.selectedFaces.clear();
+	pickInfo.SetSelectedEnts(entIdxs);
+
+	filterNeeded = true;
+
+	updateSelectionSize();
+	updateEntConnections();
+
+	bool anyBspModel = false;
+	for (int entIdx : pickInfo.selectedEnts)
+	{
+		if (entIdx < 0)
+			continue;
+		map->getBspRender()->updateEntityState(entIdx);
+		anyBspModel = anyBspModel || map->ents[entIdx]->isBspModel();
+	}
+	if (anyBspModel)
+		map->getBspRender()->saveLumpState(0xffffffff, true);
+	pickCount++; // force transform window update
+}
 void Renderer::goToFace(Bsp* map, int faceIdx)
 {
 	BSPFACE32& face = map->faces[faceIdx];
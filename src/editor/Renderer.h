@@ -9,6 +9,7 @@
 #include "Fgd.h"
 #include <thread>
 #include <future>
+#include <atomic>
 #include "Command.h"
 #include <GLFW/glfw3.h>
 #include <GL/glew.h>
@@ -85,6 +86,7 @@ public:
 	ShaderProgram* bspShader;
 	ShaderProgram* fullBrightBspShader;
 	ShaderProgram* colorShader;
+	ShaderProgram* colorInstancedShader = NULL; // point entity cubes, NULL if instancing is unsupported
 
 	double oldTime = 0.0;
 	double curTime = 0.0;
@@ -104,7 +106,13 @@ public:
 	void addMap(Bsp* map);
 
 	void reloadBspModels();
+	void updateBspModelLoads(); // adds finished background loads to mapRenderers (main thread)
+	int bspModelLoadsDone();
+	int bspModelLoadsTotal();
+	// parent map entities that use a shared bsp model renderer, rebuilt when entities change
+	const std::vector<BspModelInstance>& getBspModelInstances(BspRenderer* modelRenderer);
 	void renderLoop();
+	void collectDrawStats();
 	void postLoadFgdsAndTextures();
 	void postLoadFgds();
 	void reloadMaps();
@@ -118,6 +126,12 @@ public:
 	bool isLoading = false;
 	bool reloadingGameDir = false;
 
+	// when > 0, the average draw stats of this many frames are logged once everything
+	// is loaded and the window is closed (for measuring draw calls without a user)
+	int drawStatsFrames = 0;
+	bool drawStatsHighlight = false; // highlight a different face every measured frame
+	int drawStatsFace = -1; // face highlighted for the last measured frame
+
 	PickInfo pickInfo = PickInfo();
 	BspRenderer* getMapContainingCamera();
 	Bsp* getSelectedMap();
@@ -134,6 +148,24 @@ public:
 
 	static std::future<void> fgdFuture;
 
+	// external bsp models, one job per parent map + resolved path
+	struct BspModelLoad
+	{
+		Bsp* parentMap;
+		std::string path;
+		std::vector<std::string> modelKeys; // lowercase "model" values that resolve to path
+		Bsp* bsp = NULL;
+		std::atomic<bool> loaded{ false };
+		bool added = false;
+	};
+	std::vector<BspModelLoad*> bspModelLoads;
+	std::vector<std::future<void>> bspModelWorkers;
+	std::atomic<int> bspModelNextLoad{ 0 };
+	std::atomic<int> bspModelLoadedCount{ 0 };
+
+	void loadBspModelsThread();
+	void cancelBspModelLoads();
+
 	vec3 cameraForward;
 	vec3 cameraUp;
 	vec3 cameraRight;
@@ -289,6 +321,7 @@ public:
 	void selectFace(Bsp* map, int face, bool add = false);
 	void deselectFaces();
 	void selectEnt(Bsp* map, int entIdx, bool add = false);
+	void selectEnts(Bsp* map, const std::vector<int>& entIdxs); // replaces the selection, refreshes once
 	void goToEnt(Bsp* map, int entIdx);
 	void goToCoords(float x, float y, float z);
 	void goToFace(Bsp* map, int faceIdx);
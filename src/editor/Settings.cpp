@@ -1,6 +1,7 @@
 #include "Settings.h"
 #include "Renderer.h"
 #include "util.h"
+#include "mipmap.h"
 #include <iostream>
 #include <fstream>
 #include <string>
@@ -79,6 +80,7 @@ void AppSettings::loadDefault()
 
 	entListReload = true;
 	stripWad = false;
+	mipFilter = MIP_FILTER_BOX;
 
 	ResetBspLimits();
 }
@@ -362,6 +364,12 @@ void AppSettings::load()
 		{
 			defaultIsEmpty = atoi(val.c_str()) != 0;
 		}
+		else if (key == "mip_filter")
+		{
+			mipFilter = atoi(val.c_str());
+			if (mipFilter < MIP_FILTER_POINT || mipFilter > MIP_FILTER_KAISER)
+				mipFilter = MIP_FILTER_BOX;
+		}
 		else if (key == "FLT_MAX_COORD")
 		{
 			FLT_MAX_COORD = (float)atof(val.c_str());
@@ -677,6 +685,7 @@ void AppSettings::save(std::string path)
 	file << "reload_ents_list=" << g_settings.entListReload << std::endl;
 	file << "strip_wad_path=" << g_settings.stripWad << std::endl;
 	file << "default_is_empty=" << g_settings.defaultIsEmpty << std::endl;
+	file << "mip_filter=" << g_settings.mipFilter << std::endl;
 
 	file << "FLT_MAX_COORD=" << FLT_MAX_COORD << std::endl;
 	file << "MAX_MAP_MODELS=" << MAX_MAP_MODELS << std::endl;
@@ -51,6 +51,7 @@ struct AppSettings
 	int undoLevels;
 	int settings_tab;
 	int render_flags;
+	int mipFilter;
 
 	float fov;
 	float zfar;
@@ -0,0 +1,286 @@
+#include "ThumbnailCache.h"
+#include "Texture.h"
+#include "Wad.h"
+#include "util.h"
+#include <algorithm>
+
+int thumbnail_mip_level(int width, int height, int maxSize)
+{
+	for (int level = MIPLEVELS - 1; level > 0; level--)
+	{
+		if (std::max(width >> level, height >> level) >= maxSize)
+			return level;
+	}
+	return 0;
+}
+
+bool decode_thumbnail(const unsigned char* miptex, size_t size, int maxSize, const COLOR3* palette, ThumbnailImage& out)
+{
+	if (!miptex || size < sizeof(BSPMIPTEX))
+		return false;
+
+	BSPMIPTEX header;
+	memcpy(&header, miptex, sizeof(BSPMIPTEX));
+	header.szName[MAXTEXTURENAME - 1] = '\0';
+	if (header.nWidth <= 0 || header.nHeight <= 0 || header.nWidth > (int)MAX_TEXTURE_DIMENSION ||
+		header.nHeight > (int)MAX_TEXTURE_DIMENSION || header.nOffsets[0] <= 0)
+	{
+		return false;
+	}
+
+	int level = thumbnail_mip_level(header.nWidth, header.nHeight, maxSize);
+	int width = std::max(header.nWidth >> level, 1);
+	int height = std::max(header.nHeight >> level, 1);
+	size_t offset = (size_t)header.nOffsets[level];
+	if (header.nOffsets[level] <= 0 || offset + (size_t)width * height > size)
+		return false;
+
+	if (!palette)
+	{
+		int lastMipSize = (header.nWidth / 8) * (header.nHeight / 8);
+		size_t paletteOffset = (size_t)header.nOffsets[3] + lastMipSize + sizeof(short);
+		if (header.nOffsets[3] <= 0 || paletteOffset + sizeof(COLOR3) * 256 > size)
+			return false;
+		palette = (const COLOR3*)(miptex + paletteOffset);
+	}
+
+	const unsigned char* src = miptex + offset;
+	bool transparent = header.szName[0] == '{';
+	int sz = width * height;
+	COLOR4* pixels = new COLOR4[sz];
+	for (int k = 0; k < sz; k++)
+	{
+		if (transparent && (src[k] == 255 || palette[src[k]] == palette[255]))
+			pixels[k] = COLOR4(0, 0, 0, 0);
+		else
+			pixels[k] = palette[src[k]];
+	}
+
+	out.name = header.szName;
+	out.width = width;
+	out.height = height;
+	out.mipLevel = level;
+	out.data = (unsigned char*)pixels;
+	return true;
+}
+
+ThumbnailCache::~ThumbnailCache()
+{
+	clear();
+}
+
+int ThumbnailCache::size() const
+{
+	return (int)entries.size();
+}
+
+int ThumbnailCache::pendingCount()
+{
+	std::lock_guard<std::mutex> lock(jobMutex);
+	return (int)(queued.size() + finished.size());
+}
+
+void ThumbnailCache::decodeThread()
+{
+	while (true)
+	{
+		Job* job = NULL;
+		{
+			std::lock_guard<std::mutex> lock(jobMutex);
+			if (queued.empty())
+				break;
+			// newest first, those are the cells the user is looking at
+			job = queued.back();
+			queued.pop_back();
+		}
+
+		const unsigned char* miptex = job->copy.empty() ? job->miptex : job->copy.data();
+		job->ok = decode_thumbnail(miptex, job->size, job->maxSize, job->palette, job->image);
+
+		std::lock_guard<std::mutex> lock(jobMutex);
+		finished.push_back(job);
+	}
+}
+
+void ThumbnailCache::joinFinishedWorkers()
+{
+	for (size_t i = 0; i < workers.size(); )
+	{
+		if (workers[i].wait_for(std::chrono::milliseconds(0)) == std::future_status::ready)
+		{
+			workers[i].get();
+			workers.erase(workers.begin() + i);
+		}
+		else
+			i++;
+	}
+}
+
+void ThumbnailCache::startWorkers()
+{
+	joinFinishedWorkers();
+
+	size_t queuedCount;
+	{
+		std::lock_guard<std::mutex> lock(jobMutex);
+		queuedCount = queued.size();
+	}
+
+	// a worker that is about to exit still counts here, its jobs are picked up by the next call
+	size_t maxWorkers = std::min(std::max(1u, std::thread::hardware_concurrency() - 1), 4u);
+	while (workers.size() < std::min(queuedCount, maxWorkers))
+	{
+		workers.push_back(std::async(std::launch::async, &ThumbnailCache::decodeThread, this));
+	}
+}
+
+void ThumbnailCache::beginFrame()
+{
+	frame++;
+
+	std::vector<Job*> done;
+	{
+		std::lock_guard<std::mutex> lock(jobMutex);
+
+		// requests that weren't repeated last frame scrolled out of view before they started
+		size_t kept = 0;
+		for (Job* job : queued)
+		{
+			auto entry = entries.find(job->key);
+			if (entry != entries.end() && entry->second->lastFrame + 1 >= frame)
+			{
+				queued[kept++] = job;
+				continue;
+			}
+			if (entry != entries.end())
+			{
+				lru.erase(entry->second);
+				entries.erase(entry);
+			}
+			delete job;
+			droppedCount++;
+		}
+		queued.resize(kept);
+
+		size_t uploads = std::min(finished.size(), (size_t)maxUploadsPerFrame);
+		done.assign(finished.begin(), finished.begin() + uploads);
+		finished.erase(finished.begin(), finished.begin() + uploads);
+	}
+
+	for (Job* job : done)
+	{
+		auto entry = entries.find(job->key);
+		if (entry != entries.end())
+		{
+			Entry& e = *entry->second;
+			e.decoding = false;
+			e.failed = !job->ok;
+			if (job->ok)
+			{
+				e.texture = new Texture(job->image.width, job->image.height, job->image.data, job->image.name.c_str());
+				if (uploadToGpu)
+					e.texture->upload(GL_RGBA);
+				job->image.data = NULL;
+			}
+			decodedCount++;
+		}
+		delete[] job->image.data;
+		delete job;
+	}
+
+	// least recently used first, thumbnails that were visible last frame stay
+	auto it = lru.end();
+	while ((int)entries.size() > maxThumbnails && it != lru.begin())
+	{
+		--it;
+		if (it->lastFrame + 1 >= frame)
+			break;
+		if (it->decoding)
+			continue;
+		delete it->texture;
+		entries.erase(it->key);
+		it = lru.erase(it);
+		evictedCount++;
+	}
+
+	startWorkers();
+}
+
+Texture* ThumbnailCache::get(const ThumbnailRequest& req)
+{
+	if (!req.miptex || !req.size)
+		return NULL;
+
+	// a different thumbnail size can pick another mip of the same texture
+	int level = 0;
+	if (req.size >= sizeof(BSPMIPTEX))
+	{
+		BSPMIPTEX header;
+		memcpy(&header, req.miptex, sizeof(BSPMIPTEX));
+		level = thumbnail_mip_level(header.nWidth, header.nHeight, req.maxSize);
+	}
+
+	Key key(req.owner, req.index, level);
+	auto entry = entries.find(key);
+	if (entry != entries.end())
+	{
+		lru.splice(lru.begin(), lru, entry->second);
+		entry->second->lastFrame = frame;
+		return entry->second->texture;
+	}
+
+	Entry e;
+	e.key = key;
+	e.decoding = true;
+	e.lastFrame = frame;
+	lru.push_front(e);
+	entries[key] = lru.begin();
+
+	Job* job = new Job();
+	job->key = key;
+	job->size = req.size;
+	job->palette = req.palette;
+	job->maxSize = req.maxSize;
+	if (req.copyData)
+		job->copy.assign(req.miptex, req.miptex + req.size);
+	else
+		job->miptex = req.miptex;
+
+	{
+		std::lock_guard<std::mutex> lock(jobMutex);
+		queued.push_back(job);
+	}
+	startWorkers();
+
+	return NULL;
+}
+
+void ThumbnailCache::clear()
+{
+	{
+		std::lock_guard<std::mutex> lock(jobMutex);
+		for (Job* job : queued)
+			delete job;
+		queued.clear();
+	}
+
+	for (auto& worker : workers)
+	{
+		worker.wait();
+	}
+	workers.clear();
+
+	for (Job* job : finished)
+	{
+		delete[] job->image.data;
+		delete job;
+	}
+	finished.clear();
+
+	for (Entry& e : lru)
+	{
+		delete e.texture;
+	}
+	lru.clear();
+	entries.clear();
+}
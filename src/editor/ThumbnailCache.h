@@ -0,0 +1,112 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <mutex>
+#include <future>
+#include <tuple>
+#include "bsptypes.h"
+
+class Texture;
+
+// one decoded mip level of a texture, ready to be uploaded
+struct ThumbnailImage
+{
+	std::string name;
+	int width = 0;
+	int height = 0;
+	int mipLevel = 0;
+	unsigned char* data = NULL; // RGBA, new[]'d. The texture made from it takes ownership
+};
+
+// smallest mip level (0-3) that is still at least maxSize pixels on its longest side
+int thumbnail_mip_level(int width, int height, int maxSize);
+
+// decodes a miptex (BSPMIPTEX header followed by its mips and palette, size bytes in total) at the
+// smallest level that fits maxSize. palette overrides the embedded one (e.g. the quake palette).
+// Returns false if the miptex has no pixel data or its offsets point outside of it.
+bool decode_thumbnail(const unsigned char* miptex, size_t size, int maxSize, const COLOR3* palette, ThumbnailImage& out);
+
+// what the browser asks for. Requests are identified by owner (the Wad or the Bsp the texture is
+// in), index and the mip level maxSize picks, the rest is only read when the thumbnail isn't cached yet.
+struct ThumbnailRequest
+{
+	const void* owner = NULL;
+	int index = 0;
+	const unsigned char* miptex = NULL;
+	size_t size = 0;
+	bool copyData = false; // miptex can change before the decode runs (e.g. the map's texture lump)
+	const COLOR3* palette = NULL;
+	int maxSize = 64;
+};
+
+// Bounded LRU of texture thumbnails. Requests are decoded by a few workers, newest first, and
+// requests that were not repeated in the next frame are dropped before they start, so scrolling
+// through a big list doesn't queue up work for cells that are no longer visible. Decoded images
+// become textures in beginFrame, a limited number per frame.
+class ThumbnailCache
+{
+public:
+	int maxThumbnails = 512;
+	int maxUploadsPerFrame = 32;
+	bool uploadToGpu = true; // false keeps the textures in memory only, for running without GL
+
+	// counters for benchmarks
+	int decodedCount = 0;
+	int droppedCount = 0;
+	int evictedCount = 0;
+
+	~ThumbnailCache();
+
+	// takes finished decodes, drops stale requests and evicts old thumbnails. Call once per frame
+	// before any get.
+	void beginFrame();
+
+	// the thumbnail, or NULL while it's being decoded. Failed decodes also return NULL.
+	Texture* get(const ThumbnailRequest& req);
+
+	// waits for running decodes and deletes every thumbnail. Must be called before the data that
+	// requests point to is freed.
+	void clear();
+
+	int size() const;
+	int pendingCount();
+
+private:
+	typedef std::tuple<const void*, int, int> Key; // owner, index, mip level
+
+	struct Entry
+	{
+		Key key;
+		Texture* texture = NULL;
+		bool decoding = false;
+		bool failed = false;
+		unsigned int lastFrame = 0;
+	};
+
+	struct Job
+	{
+		Key key;
+		const unsigned char* miptex = NULL;
+		std::vector<unsigned char> copy;
+		size_t size = 0;
+		const COLOR3* palette = NULL;
+		int maxSize = 0;
+		ThumbnailImage image;
+		bool ok = false;
+	};
+
+	std::list<Entry> lru; // most recently used first
+	std::map<Key, std::list<Entry>::iterator> entries;
+	unsigned int frame = 0;
+
+	std::mutex jobMutex;
+	std::vector<Job*> queued; // newest last
+	std::vector<Job*> finished;
+	std::vector<std::future<void>> workers;
+
+	void decodeThread();
+	void startWorkers();
+	void joinFinishedWorkers();
+};
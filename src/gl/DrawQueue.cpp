@@ -0,0 +1,117 @@
+#include <GL/glew.h>
+#include "DrawQueue.h"
+#include "ShaderProgram.h"
+#include "Texture.h"
+#include "VertexBuffer.h"
+#include <algorithm>
+#include <climits>
+
+void DrawQueue::clear()
+{
+	items.clear();
+}
+
+void DrawQueue::add(int layer, VertexBuffer* buffer, int blend, Texture* const* textures, int textureCount,
+	int matrixId, const mat4x4& modelMat)
+{
+	if (!buffer || !buffer->shaderProgram)
+		return;
+
+	DrawItem item;
+	item.layer = layer;
+	item.shader = buffer->shaderProgram;
+	item.blend = blend;
+	for (int i = 0; i < DRAW_TEXTURE_UNITS; i++)
+		item.textures[i] = i < textureCount ? textures[i] : NULL;
+	item.matrixId = matrixId;
+	item.modelMat = modelMat;
+	item.buffer = buffer;
+	item.order = (int)items.size();
+	items.push_back(item);
+}
+
+static void set_blend_mode(int blend)
+{
+	if (blend == DRAW_BLEND_SATURATE)
+		glBlendFunc(GL_SRC_ALPHA_SATURATE, GL_SRC_COLOR);
+	else
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	g_drawStats.glCalls++;
+	g_drawStats.blendChanges++;
+}
+
+void DrawQueue::flush()
+{
+	if (items.empty())
+		return;
+
+	std::sort(items.begin(), items.end(), [](const DrawItem& a, const DrawItem& b) {
+		if (a.layer != b.layer)
+			return a.layer < b.layer;
+		if (a.shader->ID != b.shader->ID)
+			return a.shader->ID < b.shader->ID;
+		if (a.blend != b.blend)
+			return a.blend < b.blend;
+		for (int i = 0; i < DRAW_TEXTURE_UNITS; i++)
+		{
+			unsigned int ta = a.textures[i] ? a.textures[i]->id : 0;
+			unsigned int tb = b.textures[i] ? b.textures[i]->id : 0;
+			if (ta != tb)
+				return ta < tb;
+		}
+		if (a.matrixId != b.matrixId)
+			return a.matrixId < b.matrixId;
+		return a.order < b.order;
+	});
+
+	std::vector<std::pair<mat4x4*, mat4x4>> savedMatrices;
+	ShaderProgram* shader = NULL;
+	int matrixId = INT_MIN;
+	int blend = DRAW_BLEND_ALPHA;
+
+	for (DrawItem& item : items)
+	{
+		if (item.shader != shader || item.matrixId != matrixId)
+		{
+			// shaders can share one model matrix, so save each matrix once
+			bool saved = false;
+			for (auto& s : savedMatrices)
+				saved = saved || s.first == item.shader->modelMat;
+			if (!saved)
+				savedMatrices.push_back({ item.shader->modelMat, *item.shader->modelMat });
+
+			*item.shader->modelMat = item.modelMat;
+			if (item.shader->isBound())
+				item.shader->updateMatrixes();
+			else
+				item.shader->bind(); // uploads the matrices too
+
+			shader = item.shader;
+			matrixId = item.matrixId;
+		}
+
+		if (item.blend != blend)
+		{
+			set_blend_mode(item.blend);
+			blend = item.blend;
+		}
+
+		for (int i = 0; i < DRAW_TEXTURE_UNITS; i++)
+		{
+			if (item.textures[i])
+				item.textures[i]->bind(i);
+		}
+
+		item.buffer->drawFull();
+	}
+
+	if (blend != DRAW_BLEND_ALPHA)
+		set_blend_mode(DRAW_BLEND_ALPHA);
+
+	for (auto& s : savedMatrices)
+		*s.first = s.second;
+	if (shader && shader->isBound())
+		shader->updateMatrixes();
+
+	items.clear();
+}
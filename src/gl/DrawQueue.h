@@ -0,0 +1,46 @@
+#pragma once
+#include <vector>
+#include "mat4x4.h"
+
+class ShaderProgram;
+class Texture;
+class VertexBuffer;
+
+// texture units a queued draw can bind (diffuse + 4 lightmap styles)
+#define DRAW_TEXTURE_UNITS 5
+
+enum draw_blend_modes
+{
+	DRAW_BLEND_ALPHA,    // GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA (the default)
+	DRAW_BLEND_SATURATE, // GL_SRC_ALPHA_SATURATE, GL_SRC_COLOR
+};
+
+struct DrawItem
+{
+	int layer;       // layers are drawn in order, sorting only happens inside a layer
+	ShaderProgram* shader; // the buffer's shader
+	int blend;
+	Texture* textures[DRAW_TEXTURE_UNITS]; // NULL leaves the unit as it is
+	int matrixId;    // draws with the same id share modelMat
+	mat4x4 modelMat;
+	VertexBuffer* buffer;
+	int order;       // submission order, for a stable sort
+};
+
+// Collects the draws of a frame and issues them sorted by layer, shader, blend mode, textures and
+// model matrix, so that every state change is made once per run of draws that share it.
+class DrawQueue
+{
+public:
+	std::vector<DrawItem> items;
+
+	void clear();
+
+	// queues a full draw of the buffer with its own shader
+	void add(int layer, VertexBuffer* buffer, int blend, Texture* const* textures, int textureCount,
+		int matrixId, const mat4x4& modelMat);
+
+	// sorts and draws everything, then clears the queue. The blend mode is restored to
+	// DRAW_BLEND_ALPHA and the model matrix of each shader used is restored to what it was.
+	void flush();
+};
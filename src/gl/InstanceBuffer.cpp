@@ -0,0 +1,132 @@
+#include "InstanceBuffer.h"
+#include "util.h"
+
+InstanceBuffer::InstanceBuffer(ShaderProgram* shaderProgram)
+{
+	this->shaderProgram = shaderProgram;
+}
+
+InstanceBuffer::~InstanceBuffer()
+{
+	deleteBuffer();
+}
+
+bool InstanceBuffer::isSupported()
+{
+	return glDrawArraysInstanced != NULL && glVertexAttribDivisor != NULL;
+}
+
+void InstanceBuffer::addAttribute(int numValues, int slots, const char* varName)
+{
+	InstanceAttr attr;
+	attr.numValues = numValues;
+	attr.slots = slots;
+	attr.offset = stride;
+	attr.handle = -1;
+	attr.varName = varName;
+	attribs.push_back(attr);
+	stride += numValues * slots;
+	attributesBound = false;
+}
+
+void InstanceBuffer::clear()
+{
+	data.clear();
+	numInstances = 0;
+	uploaded = false;
+}
+
+float* InstanceBuffer::addInstance()
+{
+	size_t offset = data.size();
+	data.resize(offset + stride);
+	numInstances++;
+	uploaded = false;
+	return data.data() + offset;
+}
+
+void InstanceBuffer::bindAttributes()
+{
+	if (attributesBound || !shaderProgram)
+		return;
+
+	for (InstanceAttr& a : attribs)
+	{
+		a.handle = glGetAttribLocation(shaderProgram->ID, a.varName);
+		if (a.handle == -1)
+			logf("Could not find instance attribute: {}\n", a.varName);
+	}
+
+	attributesBound = true;
+}
+
+void InstanceBuffer::upload()
+{
+	if (vboId == (GLuint)-1)
+		glGenBuffers(1, &vboId);
+
+	glBindBuffer(GL_ARRAY_BUFFER, vboId);
+	glBufferData(GL_ARRAY_BUFFER, data.size() * sizeof(float), data.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	g_drawStats.glCalls += 3;
+	g_drawStats.uploads++;
+	g_drawStats.uploadedBytes += data.size() * sizeof(float);
+	uploaded = true;
+}
+
+void InstanceBuffer::deleteBuffer()
+{
+	if (vboId != (GLuint)-1)
+		glDeleteBuffers(1, &vboId);
+	vboId = (GLuint)-1;
+	uploaded = false;
+}
+
+void InstanceBuffer::draw(VertexBuffer* geometry, int primitive)
+{
+	if (numInstances <= 0 || !geometry)
+		return;
+
+	shaderProgram->bind();
+	bindAttributes();
+
+	if (!uploaded)
+		upload();
+
+	// instance attributes are vertex array state, so set them up on the geometry's vertex array
+	geometry->bindVertexArray();
+
+	glBindBuffer(GL_ARRAY_BUFFER, vboId);
+	g_drawStats.glCalls++;
+	for (InstanceAttr& a : attribs)
+	{
+		if (a.handle == -1)
+			continue;
+		for (int s = 0; s < a.slots; s++)
+		{
+			void* ptr = ((char*)0) + (a.offset + s * a.numValues) * sizeof(float);
+			glEnableVertexAttribArray(a.handle + s);
+			glVertexAttribPointer(a.handle + s, a.numValues, GL_FLOAT, GL_FALSE, stride * sizeof(float), ptr);
+			glVertexAttribDivisor(a.handle + s, 1);
+			g_drawStats.glCalls += 3;
+		}
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	g_drawStats.glCalls++;
+
+	geometry->drawInstanced(primitive, numInstances);
+
+	// divisors are attribute state, not program state. reset them so that
+	// other buffers using the same attribute locations draw normally
+	for (InstanceAttr& a : attribs)
+	{
+		if (a.handle == -1)
+			continue;
+		for (int s = 0; s < a.slots; s++)
+		{
+			glVertexAttribDivisor(a.handle + s, 0);
+			glDisableVertexAttribArray(a.handle + s);
+			g_drawStats.glCalls += 2;
+		}
+	}
+}
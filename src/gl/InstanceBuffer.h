@@ -0,0 +1,53 @@
+#pragma once
+#include <GL/glew.h>
+#include <vector>
+#include "ShaderProgram.h"
+#include "VertexBuffer.h"
+
+// Per-instance float attributes for drawing one VertexBuffer many times with a single draw call.
+// Instances are stored interleaved in 'data', call upload() after changing it.
+class InstanceBuffer
+{
+public:
+	std::vector<float> data;
+	int numInstances = 0;
+	ShaderProgram* shaderProgram = NULL;
+
+	InstanceBuffer(ShaderProgram* shaderProgram);
+	~InstanceBuffer();
+
+	// numValues floats per slot. Matrix attributes use one slot per column (mat4 = 4 slots of 4 values)
+	void addAttribute(int numValues, int slots, const char* varName);
+	int floatsPerInstance() const { return stride; }
+
+	// clears the instance data, keeping the allocation
+	void clear();
+	float* addInstance(); // returns storage for floatsPerInstance() values
+
+	void upload();
+	void deleteBuffer();
+
+	// geometry must use the same shader program
+	void draw(VertexBuffer* geometry, int primitive);
+
+	// instanced drawing needs GL 3.1 + ARB_instanced_arrays (call after glewInit)
+	static bool isSupported();
+
+private:
+	struct InstanceAttr
+	{
+		int numValues;
+		int slots;
+		int offset; // in floats
+		int handle;
+		const char* varName;
+	};
+
+	std::vector<InstanceAttr> attribs;
+	int stride = 0; // in floats
+	GLuint vboId = (GLuint)-1;
+	bool attributesBound = false;
+	bool uploaded = false;
+
+	void bindAttributes();
+};
@@ -1,5 +1,6 @@
 #include <GL/glew.h>
 #include "ShaderProgram.h"
+#include "VertexBuffer.h"
 #include "util.h"
 #include <string>
 
@@ -55,10 +56,17 @@ void ShaderProgram::bind()
 	{
 		g_active_shader_program = ID;
 		glUseProgram(ID);
+		g_drawStats.glCalls++;
+		g_drawStats.shaderBinds++;
 		updateMatrixes();
 	}
 }
 
+bool ShaderProgram::isBound() const
+{
+	return g_active_shader_program == ID;
+}
+
 void ShaderProgram::removeShader(int shaderID)
 {
 	glDetachShader(ID, shaderID);
@@ -84,6 +92,8 @@ void ShaderProgram::updateMatrixes()
 		glUniformMatrix4fv(modelViewID, 1, false, (float*)modelViewMat);
 	if (modelViewProjID != -1)
 		glUniformMatrix4fv(modelViewProjID, 1, false, (float*)modelViewProjMat);
+	g_drawStats.glCalls += (modelViewID != -1) + (modelViewProjID != -1);
+	g_drawStats.matrixUpdates++;
 }
 
 void ShaderProgram::setMatrixNames(const char* _modelViewMat, const char* _modelViewProjMat)
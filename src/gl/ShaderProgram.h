@@ -35,6 +35,7 @@ public:
 	// to go back to normal opengl rendering, use this:
 	// glUseProgramObject(0);
 	void bind();
+	bool isBound() const;
 
 	void removeShader(int shaderID);
 
@@ -5,6 +5,21 @@
 #include "util.h"
 #include "Settings.h"
 #include "Renderer.h"
+#include "VertexBuffer.h"
+
+// current texture of each unit, 0xFFFFFFFF = unknown
+static GLuint g_bound_textures[MAX_CACHED_TEXTURE_UNITS] = { 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF };
+static GLuint g_active_texture_unit = 0xFFFFFFFF;
+
+// a deleted texture id can be reused by the next glGenTextures
+static void forget_texture_binding(GLuint id)
+{
+	for (int i = 0; i < MAX_CACHED_TEXTURE_UNITS; i++)
+	{
+		if (g_bound_textures[i] == id)
+			g_bound_textures[i] = 0xFFFFFFFF;
+	}
+}
 
 Texture::Texture(GLsizei _width, GLsizei _height, const char* name)
 {
@@ -45,7 +60,10 @@ Texture::Texture(GLsizei _width, GLsizei _height, unsigned char* data, const cha
 Texture::~Texture()
 {
 	if (uploaded)
+	{
 		glDeleteTextures(1, &id);
+		forget_texture_binding(id);
+	}
 	delete[] data;
 }
 
@@ -54,9 +72,14 @@ void Texture::upload(int _format, bool lightmap)
 	if (uploaded)
 	{
 		glDeleteTextures(1, &id);
+		forget_texture_binding(id);
 	}
 	glGenTextures(1, &id);
 	glBindTexture(GL_TEXTURE_2D, id); // Binds this texture handle so we can load the data into it
+	if (g_active_texture_unit < MAX_CACHED_TEXTURE_UNITS)
+		g_bound_textures[g_active_texture_unit] = id;
+	else
+		invalidateBindings();
 
 	// Set up filters and wrap mode
 	if (lightmap)
@@ -125,8 +148,28 @@ void Texture::upload(int _format, bool lightmap)
 
 void Texture::bind(GLuint texnum)
 {
-	glActiveTexture(GL_TEXTURE0 + texnum);
+	if (texnum < MAX_CACHED_TEXTURE_UNITS && g_bound_textures[texnum] == id)
+		return;
+
+	if (g_active_texture_unit != texnum)
+	{
+		glActiveTexture(GL_TEXTURE0 + texnum);
+		g_active_texture_unit = texnum;
+		g_drawStats.glCalls++;
+	}
 	glBindTexture(GL_TEXTURE_2D, id);
+	g_drawStats.glCalls++;
+	g_drawStats.textureBinds++;
+
+	if (texnum < MAX_CACHED_TEXTURE_UNITS)
+		g_bound_textures[texnum] = id;
+}
+
+void Texture::invalidateBindings()
+{
+	for (int i = 0; i < MAX_CACHED_TEXTURE_UNITS; i++)
+		g_bound_textures[i] = 0xFFFFFFFF;
+	g_active_texture_unit = 0xFFFFFFFF;
 }
 
 bool IsTextureTransparent(const char* texname)
@@ -2,6 +2,9 @@
 #include <GL/glew.h>
 #include "util.h"
 
+// texture units with cached bindings, binds to higher units always reach GL
+#define MAX_CACHED_TEXTURE_UNITS 8
+
 class Texture
 {
 public:
@@ -21,9 +24,12 @@ public:
 	// upload the texture with the specified settings
 	void upload(int format, bool lightmap = false);
 
-	// use this texture for rendering
+	// use this texture for rendering. Skipped if it's already bound to that unit
 	void bind(GLuint texnum);
 
+	// forget the cached texture bindings, for when other code may have changed them
+	static void invalidateBindings();
+
 	unsigned char* data; // RGB(A) data
 
 	bool uploaded = false;
@@ -1,6 +1,12 @@
 #include "VertexBuffer.h"
 #include "util.h"
 #include <string.h>
+#include <algorithm>
+
+DrawStats g_drawStats = DrawStats();
+DrawStats g_drawStatsLast = DrawStats();
+
+static GLuint g_bound_vertex_array = 0xFFFFFFFF;
 
 VertexAttr commonAttr[VBUF_FLAGBITS] =
 {
@@ -182,54 +188,148 @@ void VertexBuffer::upload(bool hideErrors)
 	if (vboId == (GLuint)-1)
 		glGenBuffers(1, &vboId);
 
+	// the attribute setup is recorded once in the vertex array, draws only bind it
+	if (vaoId == (GLuint)-1 && glGenVertexArrays)
+		glGenVertexArrays(1, &vaoId);
+
+	bindVertexArray();
 	glBindBuffer(GL_ARRAY_BUFFER, vboId);
 	glBufferData(GL_ARRAY_BUFFER, elementSize * numVerts, data, GL_STATIC_DRAW);
+	g_drawStats.glCalls += 2;
+	g_drawStats.uploads++;
+	g_drawStats.uploadedBytes += (unsigned long long)elementSize * numVerts;
+	dirtyRanges.clear();
 
+	if (vaoId != (GLuint)-1)
+		setAttributePointers(NULL);
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	g_drawStats.glCalls++;
+}
+
+void VertexBuffer::markDirty(int startVert, int vertCount)
+{
+	int end = std::min(startVert + vertCount, numVerts);
+	startVert = std::max(startVert, 0);
+	if (end > startVert)
+		dirtyRanges.push_back({ startVert, end });
+}
+
+void VertexBuffer::uploadDirty(bool hideErrors)
+{
+	if (vboId == (GLuint)-1)
+	{
+		upload(hideErrors);
+		return;
+	}
+	if (dirtyRanges.empty())
+		return;
+
+	// merge overlapping and touching ranges, so each run of changed vertices is one call
+	std::sort(dirtyRanges.begin(), dirtyRanges.end());
+	int merged = 0;
+	for (size_t i = 1; i < dirtyRanges.size(); i++)
+	{
+		if (dirtyRanges[i].first <= dirtyRanges[merged].second)
+			dirtyRanges[merged].second = std::max(dirtyRanges[merged].second, dirtyRanges[i].second);
+		else
+			dirtyRanges[++merged] = dirtyRanges[i];
+	}
+	dirtyRanges.resize(merged + 1);
+
+	glBindBuffer(GL_ARRAY_BUFFER, vboId);
+	g_drawStats.glCalls++;
+	for (auto& range : dirtyRanges)
+	{
+		int offset = range.first * elementSize;
+		int size = (range.second - range.first) * elementSize;
+		glBufferSubData(GL_ARRAY_BUFFER, offset, size, data + offset);
+		g_drawStats.glCalls++;
+		g_drawStats.uploads++;
+		g_drawStats.uploadedBytes += size;
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	g_drawStats.glCalls++;
+
+	dirtyRanges.clear();
+}
+
+void VertexBuffer::deleteBuffer() {
+	dirtyRanges.clear();
+	if (vaoId != (GLuint)-1)
+	{
+		if (g_bound_vertex_array == vaoId)
+			g_bound_vertex_array = 0; // deleting a bound vertex array reverts to the default one
+		glDeleteVertexArrays(1, &vaoId);
+	}
+	vaoId = (GLuint)-1;
+	if (vboId != (GLuint)-1)
+		glDeleteBuffers(1, &vboId);
+	vboId = (GLuint)-1;
+}
+
+void VertexBuffer::bindVertexArray()
+{
+	GLuint target = vaoId != (GLuint)-1 ? vaoId : 0;
+	if (g_bound_vertex_array != target && glBindVertexArray)
+	{
+		glBindVertexArray(target);
+		g_bound_vertex_array = target;
+		g_drawStats.glCalls++;
+		g_drawStats.arrayBinds++;
+	}
+}
+
+void VertexBuffer::invalidateBindings()
+{
+	g_bound_vertex_array = 0xFFFFFFFF;
+}
+
+void VertexBuffer::setAttributePointers(char* offsetPtr)
+{
 	int offset = 0;
 	for (int i = 0; i < attribs.size(); i++)
 	{
 		VertexAttr& a = attribs[i];
-		void* ptr = ((char*)0) + offset;
+		void* ptr = offsetPtr + offset;
 		offset += a.size;
-		if (a.handle == -1) {
+		if (a.handle == -1)
 			continue;
-		}
-		glBindBuffer(GL_ARRAY_BUFFER, vboId);
 		glEnableVertexAttribArray(a.handle);
 		glVertexAttribPointer(a.handle, a.numValues, a.valueType, a.normalized != 0, elementSize, ptr);
+		g_drawStats.glCalls += 2;
 	}
+}
 
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+void VertexBuffer::drawRange(int _primitive, int start, int end, bool hideErrors)
+{
+	drawArrays(_primitive, start, end, 0, hideErrors);
 }
 
-void VertexBuffer::deleteBuffer() {
-	if (vboId != (GLuint)-1)
-		glDeleteBuffers(1, &vboId);
-	vboId = (GLuint)-1;
+void VertexBuffer::drawInstanced(int _primitive, int instanceCount)
+{
+	if (instanceCount <= 0)
+		return;
+	drawArrays(_primitive, 0, numVerts, instanceCount, true);
 }
 
-void VertexBuffer::drawRange(int _primitive, int start, int end, bool hideErrors)
+void VertexBuffer::drawArrays(int _primitive, int start, int end, int instanceCount, bool hideErrors)
 {
 	shaderProgram->bind();
 	bindAttributes(hideErrors);
+	bindVertexArray();
 
-	char* offsetPtr = (char*)data;
-	if (vboId != (GLuint)-1) {
-		glBindBuffer(GL_ARRAY_BUFFER, vboId);
-		offsetPtr = NULL;
-	}
+	// without a vertex array (client side data or no VAO support) the attributes are set for every draw
+	bool setAttributes = vaoId == (GLuint)-1;
+	if (setAttributes)
 	{
-		int offset = 0;
-		for (int i = 0; i < attribs.size(); i++)
-		{
-			VertexAttr& a = attribs[i];
-			void* ptr = offsetPtr + offset;
-			offset += a.size;
-			if (a.handle == -1)
-				continue;
-			glEnableVertexAttribArray(a.handle);
-			glVertexAttribPointer(a.handle, a.numValues, a.valueType, a.normalized != 0, elementSize, ptr);
+		char* offsetPtr = (char*)data;
+		if (vboId != (GLuint)-1) {
+			glBindBuffer(GL_ARRAY_BUFFER, vboId);
+			g_drawStats.glCalls++;
+			offsetPtr = NULL;
 		}
+		setAttributePointers(offsetPtr);
 	}
 
 	if (start < 0 || start > numVerts || numVerts == 0)
@@ -238,19 +338,36 @@ void VertexBuffer::drawRange(int _primitive, int start, int end, bool hideErrors
 		logf("Invalid end index: {}\n", end);
 	else if (end - start <= 0)
 		logf("Invalid draw range: {} -> {}\n", start, end);
+	else if (instanceCount > 0)
+	{
+		glDrawArraysInstanced(_primitive, start, end - start, instanceCount);
+		g_drawStats.drawCalls++;
+		g_drawStats.glCalls++;
+		g_drawStats.instancedCalls++;
+		g_drawStats.instances += instanceCount;
+	}
 	else
+	{
 		glDrawArrays(_primitive, start, end - start);
-
-	if (vboId != (GLuint)-1) {
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		g_drawStats.drawCalls++;
+		g_drawStats.glCalls++;
 	}
 
-	for (int i = 0; i < attribs.size(); i++)
+	if (setAttributes)
 	{
-		VertexAttr& a = attribs[i];
-		if (a.handle == -1)
-			continue;
-		glDisableVertexAttribArray(a.handle);
+		if (vboId != (GLuint)-1) {
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+			g_drawStats.glCalls++;
+		}
+
+		for (int i = 0; i < attribs.size(); i++)
+		{
+			VertexAttr& a = attribs[i];
+			if (a.handle == -1)
+				continue;
+			glDisableVertexAttribArray(a.handle);
+			g_drawStats.glCalls++;
+		}
 	}
 }
 
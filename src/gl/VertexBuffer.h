@@ -57,6 +57,26 @@ struct VertexAttr
 	VertexAttr(int numValues, int valueType, int handle, int normalized, const char* varName);
 };
 
+// Draw call statistics, collected by the VertexBuffer, Texture, ShaderProgram and DrawQueue wrappers.
+// Counted on the CPU side, so they work the same with any driver (including software ones).
+struct DrawStats
+{
+	unsigned int drawCalls;      // glDrawArrays + glDrawArraysInstanced calls
+	unsigned int instancedCalls; // instanced draw calls
+	unsigned int instances;      // objects drawn by the instanced calls
+	unsigned int glCalls;        // every GL call made by the wrappers, draws included
+	unsigned int shaderBinds;    // glUseProgram calls
+	unsigned int textureBinds;   // glBindTexture calls
+	unsigned int arrayBinds;     // glBindVertexArray calls
+	unsigned int blendChanges;   // glBlendFunc calls
+	unsigned int matrixUpdates;  // model/view/projection uniform uploads
+	unsigned int uploads;        // glBufferData + glBufferSubData calls
+	unsigned long long uploadedBytes; // vertex and instance data sent with those calls
+};
+
+extern DrawStats g_drawStats;     // current frame
+extern DrawStats g_drawStatsLast; // last finished frame (for the fps overlay)
+
 class VertexBuffer
 {
 public:
@@ -79,21 +99,39 @@ public:
 	void setData(void* data, int numVerts);
 
 	void upload(bool hideErrors = true);
+	// Marks vertices that were changed in data since the last upload. uploadDirty() sends only the
+	// marked ranges, or everything if the buffer was never uploaded.
+	void markDirty(int startVert, int vertCount);
+	void uploadDirty(bool hideErrors = true);
 	void deleteBuffer();
 	void setShader(ShaderProgram* program, bool hideErrors = false);
 
 	void drawRange(int primitive, int start, int end, bool hideErrors = true);
 	void draw(int primitive);
 	void drawFull();
+	// draws all vertices instanceCount times, per-instance attributes must be set up by the caller
+	void drawInstanced(int primitive, int instanceCount);
 
 	void addAttribute(int numValues, int valueType, int normalized, const char* varName);
 	void addAttribute(int type, const char* varName);
 	void bindAttributes(bool hideErrors = false); // find handles for all vertex attributes (call from main thread only)
 
+	// Binds the vertex array of an uploaded buffer, or the default one for client side data.
+	// Attributes set up after this (like instance attributes) apply to this buffer's draws.
+	void bindVertexArray();
+
+	// forget the cached vertex array binding, for when other code may have changed it
+	static void invalidateBindings();
+
 private:
 	GLuint vboId = (GLuint)-1;
+	GLuint vaoId = (GLuint)-1; // keeps the attribute setup of the uploaded buffer
+	std::vector<std::pair<int, int>> dirtyRanges; // [start, end) vertex ranges changed since the last upload
 	bool attributesBound = false;
 
 	// add attributes according to the attribute flags
 	void addAttributes(int attFlags);
+
+	void drawArrays(int primitive, int start, int end, int instanceCount, bool hideErrors);
+	void setAttributePointers(char* offsetPtr);
 };
\ No newline at end of file
@@ -34,6 +34,30 @@ namespace Shaders
 		"}\n";
 
 
+	// g_shader_cVert_vertex with a per-instance model matrix and color (fragment shader is shared)
+	const char* g_shader_cVert_instanced_vertex =
+		// object variables
+		"uniform mat4 modelViewProjection;\n"
+		"uniform vec4 colorMult;\n"
+
+		// vertex variables
+		"attribute vec3 vPosition;\n"
+		"attribute vec4 vColor;\n"
+
+		// instance variables
+		"attribute mat4 vInstanceMat;\n"
+		"attribute vec4 vInstanceColor;\n"
+
+		// fragment variables
+		"varying vec4 fColor;\n"
+
+		"void main()\n"
+		"{\n"
+		"	gl_Position = modelViewProjection * (vInstanceMat * vec4(vPosition, 1));\n"
+		"	fColor = vColor * vInstanceColor * colorMult;\n"
+		"}\n";
+
+
 	const char* g_shader_tVert_vertex =
 		// object variables
 		"uniform mat4 modelViewProjection;\n"
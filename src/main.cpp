@@ -2,11 +2,19 @@
 #include "BspMerger.h"
 #include <string>
 #include <algorithm>
+#include <numeric>
 #include <iostream>
 #include "CommandLine.h"
 #include "remap.h"
 #include "Renderer.h"
 #include "winding.h"
+#include "vis.h"
+#include "visflow.h"
+#include "radbake.h"
+#include "HullTrace.h"
+#include "BspValidator.h"
+#include "GeometryExport.h"
+#include <fstream>
 
 // super todo:
 // gui scale not accurate and mostly broken
@@ -43,7 +51,6 @@
 // can't select faces sometimes
 // make all commands available in the 3d editor
 // transforms gradually waste more and more planes+clipnodes until the map overflows (need smarter updates)
-// "Validate" doesn't return any response.. -Sparks (add a results window or something for that + clean/optimize)
 // copy-paste ents from Jack -Outerbeast
 // parse CFG and add bspguy_equip ents for each transition
 // clipnode models sometimes missing faces or extending to infinity
@@ -94,10 +101,6 @@
 // Removing HULL 0 from solid model crashes game when standing on it
 
 
-std::string g_version_string = "bspguy v4.08";
-
-bool g_verbose = false;
-
 #ifdef WIN32
 #include <Windows.h>
 #endif
@@ -134,6 +137,23 @@ bool start_viewer(const char* map)
 	return true;
 }
 
+int draw_stats(CommandLine& cli)
+{
+	if (!fileExists(cli.bspfile))
+	{
+		logf("ERROR: File not found: {}\n", cli.bspfile);
+		return 1;
+	}
+
+	Renderer renderer = Renderer();
+	renderer.drawStatsFrames = cli.hasOption("-frames") ? std::max(cli.getOptionInt("-frames"), 1) : 100;
+	renderer.drawStatsHighlight = cli.hasOption("-highlight");
+	renderer.addMap(new Bsp(cli.bspfile));
+	renderer.reloadBspModels();
+	renderer.renderLoop();
+	return 0;
+}
+
 int test()
 {
 //start_viewer("hl_c09.bsp");
@@ -308,6 +328,36 @@ int print_info(CommandLine& cli)
 	return 1;
 }
 
+int validate(CommandLine& cli)
+{
+	Bsp* map = new Bsp(cli.bspfile);
+	if (map->bsp_valid)
+	{
+		int maxOffenders = cli.hasOption("-offenders") ? std::max(cli.getOptionInt("-offenders"), 0) : VALIDATE_MAX_OFFENDERS;
+		ValidationReport report = validate_bsp(map, maxOffenders);
+
+		if (cli.hasOption("-o"))
+		{
+			std::ofstream file(cli.getOption("-o"), std::ios::trunc);
+			file << report.toJson();
+		}
+		if (cli.hasOption("-json"))
+		{
+			logf("{}", report.toJson());
+		}
+		else
+		{
+			report.print();
+			if (report.valid() && !report.warnings)
+				logf("No problems found in {} ({:.3f} seconds)\n", map->bsp_name, report.seconds);
+		}
+
+		delete map;
+		return report.valid() ? 0 : 2;
+	}
+	return 1;
+}
+
 int noclip(CommandLine& cli)
 {
 	Bsp* map = new Bsp(cli.bspfile);
@@ -596,6 +646,203 @@ int unembed(CommandLine& cli)
 	return 1;
 }
 
+int vis(CommandLine& cli)
+{
+	Bsp* map = new Bsp(cli.bspfile);
+	if (map->bsp_valid)
+	{
+		bool fast = cli.hasOption("-fast");
+		int threads = cli.hasOption("-threads") ? cli.getOptionInt("-threads") : 0;
+
+		int oldVisLength = map->visDataLength;
+		if (!qvis_generate(map, fast, threads))
+		{
+			delete map;
+			return 1;
+		}
+		logf("Vis data length {} > {}\n", oldVisLength, map->visDataLength);
+
+		if (map->isValid()) map->write(cli.hasOption("-o") ? cli.getOption("-o") : map->bsp_path);
+		logf("\n");
+		delete map;
+		return 0;
+	}
+	return 1;
+}
+
+int relight(CommandLine& cli)
+{
+	Bsp* map = new Bsp(cli.bspfile);
+	if (map->bsp_valid)
+	{
+		int rebaked = 0;
+		if (cli.hasOption("-model"))
+		{
+			int modelIdx = cli.getOptionInt("-model");
+			if (modelIdx < 0 || modelIdx >= map->modelCount)
+			{
+				logf("ERROR: model {} does not exist\n", modelIdx);
+				delete map;
+				return 1;
+			}
+			rebaked = qrad_rebake_model(map, modelIdx);
+		}
+		else
+		{
+			std::vector<int> faces(map->faceCount);
+			std::iota(faces.begin(), faces.end(), 0);
+			rebaked = qrad_rebake_faces(map, faces);
+		}
+
+		if (rebaked > 0 && map->isValid()) map->write(cli.hasOption("-o") ? cli.getOption("-o") : map->bsp_path);
+		logf("\n");
+		delete map;
+		return rebaked > 0 ? 0 : 1;
+	}
+	return 1;
+}
+
+int exportobj(CommandLine& cli)
+{
+	Bsp* map = new Bsp(cli.bspfile);
+	if (map->bsp_valid)
+	{
+		GeometryExportOptions options;
+		options.gltf = cli.hasOption("-gltf");
+		options.textures = !cli.hasOption("-notex");
+		options.lightmaps = !cli.hasOption("-nolight");
+		if (cli.hasOption("-scale"))
+			options.scale = (float)atof(cli.getOption("-scale").c_str());
+
+		std::string dir = cli.hasOption("-o") ? cli.getOption("-o") : stripExt(map->bsp_path) + "_obj";
+		if (dir.back() != '/' && dir.back() != '\\')
+			dir += "/";
+
+		auto start = std::chrono::high_resolution_clock::now();
+		bool ok = export_geometry(map, dir, options);
+		double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+		if (ok)
+			logf("Exported {} models to {} ({:.3f} seconds)\n", map->modelCount, dir, seconds);
+
+		delete map;
+		return ok ? 0 : 1;
+	}
+	return 1;
+}
+
+int trace(CommandLine& cli)
+{
+	Bsp* map = new Bsp(cli.bspfile);
+	if (!map->bsp_valid)
+	{
+		delete map;
+		return 1;
+	}
+
+	int modelIdx = cli.hasOption("-model") ? cli.getOptionInt("-model") : 0;
+	int hull = cli.hasOption("-clip") ? cli.getOptionInt("-clip") : 0;
+	if (modelIdx < 0 || modelIdx >= map->modelCount)
+	{
+		logf("ERROR: model {} does not exist\n", modelIdx);
+		delete map;
+		return 1;
+	}
+	if (hull < 0 || hull >= MAX_MAP_HULLS)
+	{
+		logf("ERROR: invalid hull {}\n", hull);
+		delete map;
+		return 1;
+	}
+
+	HullTracer tracer(map, modelIdx);
+	std::ostringstream out;
+	int problems = 0;
+
+	if (cli.hasOption("-rays"))
+	{
+		std::ifstream file(cli.getOption("-rays"));
+		if (!file.is_open())
+		{
+			logf("ERROR: failed to open {}\n", cli.getOption("-rays"));
+			delete map;
+			return 1;
+		}
+
+		std::vector<vec3> starts;
+		std::vector<vec3> ends;
+		std::string line;
+		while (std::getline(file, line))
+		{
+			vec3 s, e;
+			if (sscanf(line.c_str(), "%f %f %f %f %f %f", &s.x, &s.y, &s.z, &e.x, &e.y, &e.z) == 6)
+			{
+				starts.push_back(s);
+				ends.push_back(e);
+			}
+		}
+
+		std::vector<TraceResult> results(starts.size());
+		for (size_t i = 0; i < starts.size(); i += TRACE_PACKET_MAX)
+		{
+			int count = (int)std::min(starts.size() - i, (size_t)TRACE_PACKET_MAX);
+			tracer.tracePacket(&starts[i], &ends[i], count, hull, &results[i]);
+		}
+
+		// one line per ray: fraction, end position, plane normal, contents, start solid, all solid
+		for (const TraceResult& res : results)
+		{
+			out << fmt::format("{:.6f} {:.3f} {:.3f} {:.3f} {:.3f} {:.3f} {:.3f} {} {} {}\n",
+				res.fraction, res.endpos.x, res.endpos.y, res.endpos.z,
+				res.planeNormal.x, res.planeNormal.y, res.planeNormal.z,
+				res.contents, res.startSolid ? 1 : 0, res.allSolid ? 1 : 0);
+			if (res.startSolid)
+				problems++;
+		}
+		logf("Traced {} rays in hull {}, {} started in solid\n", results.size(), hull, problems);
+	}
+	else
+	{
+		// collision audit: point entities that are stuck in the world
+		int checked = 0;
+		for (size_t i = 1; i < map->ents.size(); i++)
+		{
+			Entity* ent = map->ents[i];
+			if (ent->getBspModelIdx() >= 0 || !ent->hasKey("origin"))
+				continue;
+
+			vec3 origin = parseVector(ent->keyvalues["origin"]);
+			std::string cname = ent->keyvalues["classname"];
+			checked++;
+
+			if (tracer.pointContents(origin, 0) == CONTENTS_SOLID)
+			{
+				out << fmt::format("{} \"{}\" at ({}) is inside solid\n", i, cname, origin.toKeyvalueString());
+				problems++;
+			}
+			else if (cname.starts_with("info_player_") && tracer.hasHull(1)
+				&& tracer.pointContents(origin, 1) == CONTENTS_SOLID)
+			{
+				out << fmt::format("{} \"{}\" at ({}) has no room for a standing player\n", i, cname, origin.toKeyvalueString());
+				problems++;
+			}
+		}
+		logf("Checked {} point entities, {} are stuck\n", checked, problems);
+	}
+
+	if (cli.hasOption("-o"))
+	{
+		std::ofstream file(cli.getOption("-o"), std::ios::trunc);
+		file << out.str();
+	}
+	else
+	{
+		logf("{}", out.str());
+	}
+
+	delete map;
+	return problems > 0 ? 2 : 0;
+}
+
 void print_help(const std::string& command)
 {
 	if (command == "merge")
@@ -626,6 +873,7 @@ void print_help(const std::string& command)
 			"  -gap \"X,Y,Z\" : Amount of extra space to add between each map\n"
 			"  -v\n"
 			"  -verbose     : Verbose console output.\n"
+			"  -profile [f] : Time each merge stage and save them as a chrome trace to f.\n"
 		);
 	}
 	else if (command == "info")
@@ -642,6 +890,20 @@ void print_help(const std::string& command)
 			"  -all          : Show the full list of models when using -limit.\n"
 		);
 	}
+	else if (command == "validate")
+	{
+		logf("{}",
+			"validate - Check the BSP for bad indexes and other problems.\n\n"
+
+			"Usage:   bspguy validate <mapname> [options]\n"
+			"Example: bspguy validate svencoop1.bsp -o report.json\n"
+
+			"\n[Options]\n"
+			"  -json         : Print the report as JSON instead of text.\n"
+			"  -o <file>     : Also write the JSON report to a file.\n"
+			"  -offenders #  : How many offenders to list for each problem. Default is 16.\n"
+		);
+	}
 	else if (command == "noclip")
 	{
 		logf("{}",
@@ -717,13 +979,82 @@ void print_help(const std::string& command)
 			"Example: bspguy unembed c1a0.bsp\n"
 		);
 	}
+	else if (command == "vis")
+	{
+		logf("{}",
+			"vis - Regenerates the visibility data (PVS) of the world.\n\n"
+
+			"Usage:   bspguy vis <mapname> [options]\n"
+			"Example: bspguy vis merged.bsp -fast\n"
+
+			"\n[Options]\n"
+			"  -fast       : Only run the base portal flood. Much faster, but more leaves\n"
+			"                are visible from each other than with a full vis.\n"
+			"  -threads #  : Number of threads for the portal flow. Default is all cores.\n"
+			"  -o <file>   : Output file. By default, <mapname> is overwritten.\n"
+		);
+	}
+	else if (command == "relight")
+	{
+		logf("{}",
+			"relight - Recomputes direct lighting from the light entities, without bounced light.\n\n"
+
+			"Usage:   bspguy relight <mapname> [options]\n"
+			"Example: bspguy relight merged.bsp -model 12\n"
+
+			"\n[Options]\n"
+			"  -model #  : Only rebake the faces of this model. By default, every face is rebaked.\n"
+			"  -o <file> : Output file. By default, <mapname> is overwritten.\n"
+		);
+	}
+	else if (command == "trace")
+	{
+		logf("{}",
+			"trace - Traces rays through the collision hulls, or finds stuck entities.\n\n"
+
+			"Usage:   bspguy trace <mapname> [options]\n"
+			"Example: bspguy trace c1a0.bsp -rays rays.txt -clip 1 -o hits.txt\n"
+
+			"\nWithout -rays, point entities whose origin is inside solid are listed.\n"
+
+			"\n[Options]\n"
+			"  -rays <file> : Trace every line of the file (\"startX startY startZ endX endY endZ\").\n"
+			"                 Each result line is \"fraction endX endY endZ normalX normalY normalZ\n"
+			"                 contents startsolid allsolid\".\n"
+			"  -clip #      : Hull to trace the rays in (0-3). Default is 0.\n"
+			"  -model #     : Model to trace against. Default is 0 (the world).\n"
+			"  -o <file>    : Write the results to a file instead of the console.\n"
+		);
+	}
+	else if (command == "drawstats")
+	{
+		logf("{}",
+			"drawstats - Open a map in the 3D view and log the GL calls it takes to draw a frame.\n"
+			"            The counts are taken on the CPU side, so any driver works, including\n"
+			"            Mesa llvmpipe (LIBGL_ALWAYS_SOFTWARE=1) on a virtual display.\n\n"
+
+			"Usage:   bspguy drawstats <mapname> [options]\n"
+			"Example: bspguy drawstats c1a0.bsp -frames 200\n"
+
+			"\n[Options]\n"
+			"  -frames #  : Number of frames to average once the map has loaded. Default is 100.\n"
+			"  -highlight : Highlight a different face every frame, to measure selection updates.\n"
+		);
+	}
 	else if (command == "exportobj")
 	{
 		logf("{}",
-			"exportobj - Export bsp geometry to obj [WIP].\n\n"
+			"exportobj - Export the brush models to obj, without opening a window.\n\n"
+
+			"Usage:   bspguy exportobj <mapname> [options]\n"
+			"Example: bspguy exportobj c1a0.bsp -gltf -scale 0.0254\n"
 
-			"Usage:   bspguy exportobj <mapname>\n"
-			"Example: bspguy exportobj c1a0.bsp\n"
+			"\n[Options]\n"
+			"  -o <dir>      : Output directory. Default is <mapname>_obj next to the map.\n"
+			"  -gltf         : Also write a .gltf/.bin per model, with lightmap uvs in TEXCOORD_1.\n"
+			"  -scale <n>    : Multiply every vertex by n. Default is 1.\n"
+			"  -notex        : Don't write the embedded textures.\n"
+			"  -nolight      : Don't write the lightmap atlases.\n"
 		);
 	}
 	else
@@ -735,16 +1066,24 @@ void print_help(const std::string& command)
 
 			"\n<Commands>\n"
 			"  info      : Show BSP data summary\n"
+			"  validate  : Check the BSP for bad indexes\n"
 			"  merge     : Merges two or more maps together\n"
 			"  noclip    : Delete some clipnodes/nodes from the BSP\n"
 			"  delete    : Delete BSP models\n"
 			"  simplify  : Simplify BSP models\n"
 			"  transform : Apply 3D transformations to the BSP\n"
 			"  unembed   : Deletes embedded texture data\n"
-			"  exportobj   : Export bsp geometry to obj [WIP]\n"
+			"  vis       : Regenerate visibility data\n"
+			"  relight   : Rebake direct lighting\n"
+			"  trace     : Trace rays or find stuck entities\n"
+			"  exportobj : Export bsp geometry to obj/gltf\n"
+			"  drawstats : Log the GL calls per frame of the 3D view\n"
 			"  no command : Open empty bspguy window\n"
 
 			"\nRun 'bspguy <command> help' to read about a specific command.\n"
+			"\nAdd '-profile [file]' to any command to print the wall time, cpu time and peak\n"
+			"memory of each stage and save them as a chrome trace (chrome://tracing or\n"
+			"ui.perfetto.dev). The default file is <mapname>_profile.json.\n"
 			"\nTo launch the 3D editor. Drag and drop a .bsp file onto the executable,\n"
 			"or run 'bspguy <mapname>'"
 		);
@@ -856,6 +1195,82 @@ LONG CALLBACK unhandled_handler(EXCEPTION_POINTERS* e)
 }
 #endif
 #endif
+int run_command(CommandLine& cli)
+{
+	if (cli.command == "info")
+	{
+		return print_info(cli);
+	}
+	else if (cli.command == "validate")
+	{
+		return validate(cli);
+	}
+	else if (cli.command == "noclip")
+	{
+		return noclip(cli);
+	}
+	else if (cli.command == "exportobj")
+	{
+		return exportobj(cli);
+	}
+	else if (cli.command == "simplify")
+	{
+		return simplify(cli);
+	}
+	else if (cli.command == "delete")
+	{
+		return deleteCmd(cli);
+	}
+	else if (cli.command == "transform")
+	{
+		return transform(cli);
+	}
+	else if (cli.command == "merge")
+	{
+		return merge_maps(cli);
+	}
+	else if (cli.command == "unembed")
+	{
+		return unembed(cli);
+	}
+	else if (cli.command == "vis")
+	{
+		return vis(cli);
+	}
+	else if (cli.command == "relight")
+	{
+		return relight(cli);
+	}
+	else if (cli.command == "trace")
+	{
+		return trace(cli);
+	}
+	else if (cli.command == "drawstats")
+	{
+		return draw_stats(cli);
+	}
+	else 
+	{
+		if (cli.bspfile.size() == 0)
+			logf("{}\n", "Open editor with empty map.");
+		else
+		{
+			if (cli.askingForHelp)
+			{
+				print_help(cli.command);
+				return 0;
+			}
+		}
+		logf("{}\n", ("Start bspguy editor with: " + cli.bspfile));
+		logf("Load settings from : {}\n", g_settings_path);
+		if (!start_viewer(cli.bspfile.c_str()))
+		{
+			logf("ERROR: File not found: {}", cli.bspfile);
+		}
+	}
+	return 0;
+}
+
 int main(int argc, char* argv[])
 {
 	setlocale(LC_ALL, ".utf8");
@@ -902,66 +1317,28 @@ int main(int argc, char* argv[])
 		return 0;
 	}
 
-	if (cli.command == "exportobj")
-	{
-		Bsp* tmpBsp = new Bsp(cli.bspfile);
-		tmpBsp->ExportToObjWIP(cli.bspfile);
-		delete tmpBsp;
-		return 0;
-	}
-
 	if (cli.hasOption("-v") || cli.hasOption("-verbose"))
 	{
 		g_verbose = true;
 	}
 
-	if (cli.command == "info")
-	{
-		return print_info(cli);
-	}
-	else if (cli.command == "noclip")
+	std::string profilePath;
+	if (cli.hasOption("-profile"))
 	{
-		return noclip(cli);
+		profilePath = cli.getOption("-profile");
+		if (profilePath.empty() || profilePath[0] == '-')
+			profilePath = stripExt(cli.bspfile) + "_profile.json";
+		g_progress.startProfile();
 	}
-	else if (cli.command == "simplify")
-	{
-		return simplify(cli);
-	}
-	else if (cli.command == "delete")
-	{
-		return deleteCmd(cli);
-	}
-	else if (cli.command == "transform")
-	{
-		return transform(cli);
-	}
-	else if (cli.command == "merge")
-	{
-		return merge_maps(cli);
-	}
-	else if (cli.command == "unembed")
+
+	int ret = run_command(cli);
+
+	if (profilePath.size())
 	{
-		return unembed(cli);
+		g_progress.stopProfile();
+		g_progress.printProfile();
+		g_progress.saveProfile(profilePath);
 	}
-	else 
-	{
-		if (cli.bspfile.size() == 0)
-			logf("{}\n", "Open editor with empty map.");
-		else
-		{
-			if (cli.askingForHelp)
-			{
-				print_help(cli.command);
-				return 0;
-			}
-		}
-		logf("{}\n", ("Start bspguy editor with: " + cli.bspfile));
-		logf("Load settings from : {}\n", g_settings_path);
-		if (!start_viewer(cli.bspfile.c_str()))
-		{
-			logf("ERROR: File not found: {}", cli.bspfile);
-		}
-	}
-	return 0;
+	return ret;
 }
 
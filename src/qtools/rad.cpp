@@ -199,8 +199,9 @@ bool CanFindFacePosition(Bsp* bsp, int facenum)
 
 static bool TestSampleFrag(Bsp* bsp, int facenum, float s, float t, const float square[2][2], int maxsize)
 {
-	const vec3 v_s = {s, 0, 0};
-	const vec3 v_t = {0, t, 0};
+	// texture space axes, the sample rectangle is clipped against [smin, smax] x [tmin, tmax]
+	const vec3 v_s = {1, 0, 0};
+	const vec3 v_t = {0, 1, 0};
 
 	samplefrag_t head;
 
@@ -419,8 +420,8 @@ void CalcPoints(Bsp* bsp, lightinfo_t* l, unsigned char* LuxelFlags)
 {
 	const int       h = l->texsize[1] + 1;
 	const int       w = l->texsize[0] + 1;
-	const float     starts = l->texmins[0] * TEXTURE_STEP * 1.0f;
-	const float     startt = l->texmins[1] * TEXTURE_STEP * 1.0f;
+	const float     starts = l->texmins[0] * (int)TEXTURE_STEP * 1.0f;
+	const float     startt = l->texmins[1] * (int)TEXTURE_STEP * 1.0f;
 	unsigned char* pLuxelFlags;
 
 	for (int t = 0; t < h; t++)
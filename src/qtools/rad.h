@@ -117,4 +117,9 @@ void GetFaceLightmapSize(Bsp* bsp, int facenum, int size[2]);
 int GetFaceLightmapSizeBytes(Bsp* bsp, int facenum);
 bool GetFaceExtents(Bsp* bsp, int facenum, int mins_out[2], int maxs_out[2]);
 bool CalcFaceExtents(Bsp* bsp, lightinfo_t* l);
-void CalcPoints(Bsp* bsp, lightinfo_t* l, unsigned char* LuxelFlags);
\ No newline at end of file
+void CalcPoints(Bsp* bsp, lightinfo_t* l, unsigned char* LuxelFlags);
+
+void ApplyMatrix(const matrix_t& m, const vec3 in, vec3& out);
+bool InvertMatrix(const matrix_t& m, matrix_t& m_inverse);
+// texture space (s, t, distance to the face plane) of a world position
+void TranslateWorldToTex(Bsp* bsp, int facenum, matrix_t& m);
\ No newline at end of file
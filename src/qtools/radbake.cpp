@@ -0,0 +1,710 @@
+#include "radbake.h"
+#include "rad.h"
+#include "winding.h"
+#include "Bsp.h"
+#include "util.h"
+#include <algorithm>
+#include <chrono>
+#include <cfloat>
+#include <execution>
+#include <map>
+#include <numeric>
+#include <thread>
+
+// Direct lighting for faces that were moved, scaled or created in the editor. Lights are parsed like
+// hlrad does, falloff and gamma are close to hlrad's defaults, but there is no bounce, no texture
+// lights and no sample nudging, so the result is an approximation of a full compile.
+
+#define RAD_LIGHT_SCALE 4096.0f	// inverse square falloff, a light is at full brightness at 64 units
+#define RAD_GAMMA 0.55f			// hlrad -gamma default
+#define RAD_DEFAULT_LIGHT 200.0f	// brightness of lights without a "_light" key
+#define RAD_SAMPLE_OFFSET 1.0f		// samples are lifted off their face so they don't shadow themselves
+#define RAD_HIT_EPSILON 0.01f
+#define RAD_MIN_LIGHT 0.01f		// lights weaker than this at a sample are not traced
+#define RAD_SUN_DISTANCE 65536.0f
+#define RAD_BVH_LEAF_TRIS 4
+#define RAD_BVH_STACK 64
+
+enum RadLightType
+{
+	RAD_LIGHT_POINT,
+	RAD_LIGHT_SPOT,
+	RAD_LIGHT_SUN
+};
+
+struct RadLight
+{
+	RadLightType type;
+	vec3 origin;
+	vec3 dir;		// direction the light shines to (spot/sun)
+	vec3 intensity;
+	float stopdot;	// cos of the inner cone
+	float stopdot2;	// cos of the outer cone
+	int style;
+};
+
+struct RadTri
+{
+	vec3 v0, e1, e2;
+	bool sky;
+};
+
+struct RadBvhNode
+{
+	vec3 mins, maxs;
+	int first;	// first child node (the second one follows it), or first triangle of a leaf
+	int count;	// number of triangles in a leaf, 0 for inner nodes
+};
+
+struct RadScene
+{
+	std::vector<RadLight> lights;
+	std::vector<RadTri> tris;
+	std::vector<RadBvhNode> nodes;
+};
+
+static const char* face_texture_name(Bsp* map, const BSPFACE32& face)
+{
+	BSPTEXTUREINFO& info = map->texinfos[face.iTextureInfo];
+	if (info.iMiptex < 0 || info.iMiptex >= map->textureCount)
+		return "";
+	int offset = ((int*)map->textures)[info.iMiptex + 1];
+	if (offset < 0)
+		return "";
+	return ((BSPMIPTEX*)(map->textures + offset))->szName;
+}
+
+static std::vector<vec3> get_model_origins(Bsp* map)
+{
+	std::vector<vec3> origins(map->modelCount);
+	for (Entity* ent : map->ents)
+	{
+		int modelIdx = ent->getBspModelIdx();
+		if (modelIdx > 0 && modelIdx < map->modelCount)
+			origins[modelIdx] = ent->getOrigin();
+	}
+	return origins;
+}
+
+//
+// Light entities
+//
+
+static vec3 parse_light_intensity(Entity* ent)
+{
+	std::string value = ent->hasKey("_light") ? ent->keyvalues["_light"] : (ent->hasKey("light") ? ent->keyvalues["light"] : "");
+	float v[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	int count = sscanf(value.c_str(), "%f %f %f %f", &v[0], &v[1], &v[2], &v[3]);
+
+	// "_light" is "r g b brightness", "r g b" or "brightness", like in hlrad
+	if (count == 4)
+		return vec3(v[0], v[1], v[2]) * (v[3] / 255.0f);
+	if (count == 3)
+		return vec3(v[0], v[1], v[2]);
+	if (count == 1)
+		return vec3(v[0], v[0], v[0]);
+	return vec3(RAD_DEFAULT_LIGHT, RAD_DEFAULT_LIGHT, RAD_DEFAULT_LIGHT);
+}
+
+static vec3 parse_light_direction(Bsp* map, Entity* ent)
+{
+	if (ent->hasKey("target") && !ent->keyvalues["target"].empty())
+	{
+		const std::string& target = ent->keyvalues["target"];
+		for (Entity* other : map->ents)
+		{
+			if (other->hasKey("targetname") && other->keyvalues["targetname"] == target)
+			{
+				vec3 dir = other->getOrigin() - ent->getOrigin();
+				if (dir.length() > EPSILON)
+					return dir.normalize();
+				break;
+			}
+		}
+	}
+
+	vec3 angles = ent->hasKey("angles") ? parseVector(ent->keyvalues["angles"]) : vec3();
+	float yaw = ent->hasKey("angle") ? (float)atof(ent->keyvalues["angle"].c_str()) : angles.y;
+	float pitch = ent->hasKey("pitch") ? (float)atof(ent->keyvalues["pitch"].c_str()) : angles.x;
+
+	if (yaw == -1.0f)
+		return vec3(0.0f, 0.0f, 1.0f);
+	if (yaw == -2.0f)
+		return vec3(0.0f, 0.0f, -1.0f);
+
+	yaw *= PI / 180.0f;
+	pitch *= PI / 180.0f;
+	return vec3(cos(yaw) * cos(pitch), sin(yaw) * cos(pitch), sin(pitch));
+}
+
+static void collect_lights(Bsp* map, std::vector<RadLight>& lights)
+{
+	for (Entity* ent : map->ents)
+	{
+		if (!ent->hasKey("classname"))
+			continue;
+		const std::string& cname = ent->keyvalues["classname"];
+
+		RadLight light = RadLight();
+		if (cname == "light")
+			light.type = RAD_LIGHT_POINT;
+		else if (cname == "light_spot")
+			light.type = RAD_LIGHT_SPOT;
+		else if (cname == "light_environment")
+			light.type = RAD_LIGHT_SUN;
+		else
+			continue;
+
+		light.origin = ent->getOrigin();
+		light.intensity = parse_light_intensity(ent);
+		light.style = ent->hasKey("style") ? atoi(ent->keyvalues["style"].c_str()) : 0;
+		if (light.style < 0 || light.style >= 255)
+			continue;
+		if (light.intensity.x <= 0.0f && light.intensity.y <= 0.0f && light.intensity.z <= 0.0f)
+			continue;
+
+		if (light.type != RAD_LIGHT_POINT)
+		{
+			light.dir = parse_light_direction(map, ent);
+		}
+		if (light.type == RAD_LIGHT_SPOT)
+		{
+			float cone = ent->hasKey("_cone") ? (float)atof(ent->keyvalues["_cone"].c_str()) : 0.0f;
+			float cone2 = ent->hasKey("_cone2") ? (float)atof(ent->keyvalues["_cone2"].c_str()) : 0.0f;
+			if (cone <= 0.0f)
+				cone = 10.0f;
+			if (cone2 < cone)
+				cone2 = cone;
+			light.stopdot = cos(cone * PI / 180.0f);
+			light.stopdot2 = cos(cone2 * PI / 180.0f);
+		}
+
+		lights.push_back(light);
+	}
+}
+
+//
+// Shadow rays
+//
+
+static void add_face_tris(Bsp* map, RadScene& scene, int faceIdx, const vec3& offset)
+{
+	BSPFACE32& face = map->faces[faceIdx];
+	const char* texname = face_texture_name(map, face);
+
+	// light passes through water and tool textures
+	if (texname[0] == '!' || strncasecmp(texname, "water", 5) == 0 || strcasecmp(texname, "aaatrigger") == 0)
+		return;
+
+	bool sky = strcasecmp(texname, "sky") == 0;
+	vec3 first;
+	vec3 last;
+	for (int e = 0; e < face.nEdges; e++)
+	{
+		int edgeIdx = map->surfedges[face.iFirstEdge + e];
+		BSPEDGE32& edge = map->edges[abs(edgeIdx)];
+		vec3 v = map->verts[edgeIdx >= 0 ? edge.iVertex[0] : edge.iVertex[1]] + offset;
+
+		if (e == 0)
+			first = v;
+		else if (e >= 2)
+			scene.tris.push_back({ first, last - first, v - first, sky });
+		last = v;
+	}
+}
+
+static void build_bvh_node(RadScene& scene, std::vector<int>& order, const std::vector<vec3>& centers,
+	const std::vector<vec3>& triMins, const std::vector<vec3>& triMaxs, int nodeIdx, int first, int count)
+{
+	vec3 mins(FLT_MAX, FLT_MAX, FLT_MAX);
+	vec3 maxs(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	vec3 cmins = mins;
+	vec3 cmaxs = maxs;
+	for (int i = first; i < first + count; i++)
+	{
+		int tri = order[i];
+		for (int k = 0; k < 3; k++)
+		{
+			mins[k] = std::min(mins[k], triMins[tri][k]);
+			maxs[k] = std::max(maxs[k], triMaxs[tri][k]);
+			cmins[k] = std::min(cmins[k], centers[tri][k]);
+			cmaxs[k] = std::max(cmaxs[k], centers[tri][k]);
+		}
+	}
+	scene.nodes[nodeIdx].mins = mins;
+	scene.nodes[nodeIdx].maxs = maxs;
+
+	int axis = 0;
+	vec3 extent = cmaxs - cmins;
+	if (extent.y > extent[axis])
+		axis = 1;
+	if (extent.z > extent[axis])
+		axis = 2;
+
+	if (count <= RAD_BVH_LEAF_TRIS || extent[axis] <= EPSILON)
+	{
+		scene.nodes[nodeIdx].first = first;
+		scene.nodes[nodeIdx].count = count;
+		return;
+	}
+
+	// median split along the widest axis of the triangle centers
+	int mid = first + count / 2;
+	std::nth_element(order.begin() + first, order.begin() + mid, order.begin() + first + count, [&](int a, int b)
+		{
+			return centers[a][axis] < centers[b][axis];
+		});
+
+	int child = (int)scene.nodes.size();
+	scene.nodes.resize(scene.nodes.size() + 2);
+	scene.nodes[nodeIdx].first = child;
+	scene.nodes[nodeIdx].count = 0;
+
+	build_bvh_node(scene, order, centers, triMins, triMaxs, child, first, mid - first);
+	build_bvh_node(scene, order, centers, triMins, triMaxs, child + 1, mid, first + count - mid);
+}
+
+static void build_bvh(RadScene& scene)
+{
+	int numTris = (int)scene.tris.size();
+	if (numTris == 0)
+		return;
+
+	std::vector<vec3> centers(numTris);
+	std::vector<vec3> triMins(numTris);
+	std::vector<vec3> triMaxs(numTris);
+	for (int i = 0; i < numTris; i++)
+	{
+		const RadTri& tri = scene.tris[i];
+		vec3 v1 = tri.v0 + tri.e1;
+		vec3 v2 = tri.v0 + tri.e2;
+		for (int k = 0; k < 3; k++)
+		{
+			triMins[i][k] = std::min(tri.v0[k], std::min(v1[k], v2[k]));
+			triMaxs[i][k] = std::max(tri.v0[k], std::max(v1[k], v2[k]));
+		}
+		centers[i] = (triMins[i] + triMaxs[i]) * 0.5f;
+	}
+
+	std::vector<int> order(numTris);
+	std::iota(order.begin(), order.end(), 0);
+
+	scene.nodes.reserve(numTris * 2 / RAD_BVH_LEAF_TRIS + 1);
+	scene.nodes.resize(1);
+	build_bvh_node(scene, order, centers, triMins, triMaxs, 0, 0, numTris);
+
+	// store the triangles in leaf order
+	std::vector<RadTri> sorted(numTris);
+	for (int i = 0; i < numTris; i++)
+		sorted[i] = scene.tris[order[i]];
+	scene.tris.swap(sorted);
+}
+
+static inline bool ray_hits_box(const RadBvhNode& node, const vec3& org, const float invDir[3], float tmax)
+{
+	float tmin = 0.0f;
+	for (int k = 0; k < 3; k++)
+	{
+		float t0 = (node.mins[k] - org[k]) * invDir[k];
+		float t1 = (node.maxs[k] - org[k]) * invDir[k];
+		if (t0 > t1)
+			std::swap(t0, t1);
+		tmin = std::max(tmin, t0);
+		tmax = std::min(tmax, t1);
+		if (tmin > tmax)
+			return false;
+	}
+	return true;
+}
+
+static inline bool ray_hits_tri(const RadTri& tri, const vec3& org, const vec3& dir, float tmax, float& t)
+{
+	vec3 p = crossProduct(dir, tri.e2);
+	float det = dotProduct(tri.e1, p);
+	if (fabs(det) < 1e-8f)
+		return false;
+	float invDet = 1.0f / det;
+
+	vec3 s = org - tri.v0;
+	float u = dotProduct(s, p) * invDet;
+	if (u < 0.0f || u > 1.0f)
+		return false;
+
+	vec3 q = crossProduct(s, tri.e1);
+	float v = dotProduct(dir, q) * invDet;
+	if (v < 0.0f || u + v > 1.0f)
+		return false;
+
+	t = dotProduct(tri.e2, q) * invDet;
+	return t > RAD_HIT_EPSILON && t < tmax;
+}
+
+// returns the closest triangle hit before tmax (any hit if anyHit is set), or -1
+static int trace_ray(const RadScene& scene, const vec3& org, const vec3& dir, float tmax, bool anyHit)
+{
+	if (scene.nodes.empty())
+		return -1;
+
+	float invDir[3] = { 1.0f / dir.x, 1.0f / dir.y, 1.0f / dir.z };
+	int stack[RAD_BVH_STACK];
+	int stackSize = 0;
+	int best = -1;
+
+	stack[stackSize++] = 0;
+	while (stackSize > 0)
+	{
+		const RadBvhNode& node = scene.nodes[stack[--stackSize]];
+		if (!ray_hits_box(node, org, invDir, tmax))
+			continue;
+
+		if (node.count > 0)
+		{
+			for (int i = node.first; i < node.first + node.count; i++)
+			{
+				float t;
+				if (ray_hits_tri(scene.tris[i], org, dir, tmax, t))
+				{
+					best = i;
+					tmax = t;
+					if (anyHit)
+						return best;
+				}
+			}
+		}
+		else if (stackSize + 2 <= RAD_BVH_STACK)
+		{
+			stack[stackSize++] = node.first + 1;
+			stack[stackSize++] = node.first;
+		}
+	}
+	return best;
+}
+
+//
+// Lightmaps
+//
+
+static vec3 gather_light(const RadScene& scene, const vec3& pos, const vec3& normal, int style)
+{
+	vec3 total;
+	for (const RadLight& light : scene.lights)
+	{
+		if (light.style != style)
+			continue;
+
+		if (light.type == RAD_LIGHT_SUN)
+		{
+			vec3 toSun = light.dir * -1.0f;
+			float dot = dotProduct(normal, toSun);
+			if (dot <= 0.0f)
+				continue;
+
+			// the sun only reaches samples that can see the sky
+			int hit = trace_ray(scene, pos, toSun, RAD_SUN_DISTANCE, false);
+			if (hit >= 0 && !scene.tris[hit].sky)
+				continue;
+			total += light.intensity * dot;
+			continue;
+		}
+
+		vec3 delta = light.origin - pos;
+		float dist = std::max(delta.length(), 1.0f);
+		vec3 dir = delta / dist;
+		float dot = dotProduct(normal, dir);
+		if (dot <= 0.0f)
+			continue;
+
+		float scale = dot * RAD_LIGHT_SCALE / (dist * dist);
+		if (light.type == RAD_LIGHT_SPOT)
+		{
+			float dot2 = -dotProduct(dir, light.dir);
+			if (dot2 <= light.stopdot2)
+				continue;
+			if (dot2 < light.stopdot)
+				scale *= (dot2 - light.stopdot2) / (light.stopdot - light.stopdot2);
+		}
+
+		float brightest = std::max(light.intensity.x, std::max(light.intensity.y, light.intensity.z));
+		if (brightest * scale < RAD_MIN_LIGHT)
+			continue;
+
+		if (trace_ray(scene, pos, dir, dist - RAD_SAMPLE_OFFSET, true) >= 0)
+			continue;
+		total += light.intensity * scale;
+	}
+	return total;
+}
+
+static COLOR3 final_light_color(vec3 light)
+{
+	for (int k = 0; k < 3; k++)
+	{
+		light[k] = light[k] > 0.0f ? pow(light[k] / 256.0f, RAD_GAMMA) * 256.0f : 0.0f;
+	}
+
+	// scale down overbright samples without changing their hue
+	float brightest = std::max(light.x, std::max(light.y, light.z));
+	if (brightest > 255.0f)
+		light *= 255.0f / brightest;
+
+	return COLOR3((unsigned char)light.x, (unsigned char)light.y, (unsigned char)light.z);
+}
+
+// bakes all style layers of a face, returns false if the face can't have a lightmap
+static bool bake_face(Bsp* map, const RadScene& scene, int faceIdx, const vec3& offset, std::vector<COLOR3>& output)
+{
+	BSPFACE32& face = map->faces[faceIdx];
+	if (map->texinfos[face.iTextureInfo].nFlags & TEX_SPECIAL)
+		return false;
+
+	lightinfo_t l;
+	memset(&l, 0, sizeof(l));
+	l.surfnum = faceIdx;
+	l.face = &face;
+	if (!CalcFaceExtents(map, &l))
+		return false;
+
+	int w = l.texsize[0] + 1;
+	int h = l.texsize[1] + 1;
+	int luxels = w * h;
+
+	matrix_t worldToTex;
+	matrix_t texToWorld;
+	TranslateWorldToTex(map, faceIdx, worldToTex);
+	if (!InvertMatrix(worldToTex, texToWorld))
+		return false;
+
+	std::vector<unsigned char> flags(luxels);
+	CalcPoints(map, &l, flags.data());
+
+	int styles[MAXLIGHTMAPS];
+	int layers = 0;
+	for (int k = 0; k < MAXLIGHTMAPS; k++)
+	{
+		if (face.nStyles[k] != 255)
+			styles[layers++] = face.nStyles[k];
+	}
+	if (layers == 0)
+		styles[layers++] = 0; // unlit faces get the normal style
+
+	vec3 normal = getPlaneFromFace(map, &face).vNormal;
+	std::vector<vec3> light(luxels * layers);
+	std::vector<unsigned char> done(luxels);
+	int doneCount = 0;
+
+	for (int t = 0; t < h; t++)
+	{
+		for (int s = 0; s < w; s++)
+		{
+			if (flags[s + w * t] != LightNormal)
+				continue;
+
+			vec3 tex((l.texmins[0] + s) * (int)TEXTURE_STEP * 1.0f, (l.texmins[1] + t) * (int)TEXTURE_STEP * 1.0f, 0.0f);
+			vec3 pos;
+			ApplyMatrix(texToWorld, tex, pos);
+			pos += offset + normal * RAD_SAMPLE_OFFSET;
+
+			for (int k = 0; k < layers; k++)
+				light[k * luxels + s + w * t] = gather_light(scene, pos, normal, styles[k]);
+			done[s + w * t] = 1;
+			doneCount++;
+		}
+	}
+
+	if (doneCount == 0)
+	{
+		// face is smaller than a luxel, light everything from its center
+		Winding winding(map, face);
+		vec3 center;
+		for (int i = 0; i < winding.m_NumPoints; i++)
+			center += winding.m_Points[i];
+		center = center / (float)std::max(winding.m_NumPoints, 1);
+		vec3 pos = center + offset + normal * RAD_SAMPLE_OFFSET;
+
+		for (int k = 0; k < layers; k++)
+		{
+			vec3 value = gather_light(scene, pos, normal, styles[k]);
+			std::fill(light.begin() + k * luxels, light.begin() + (k + 1) * luxels, value);
+		}
+		std::fill(done.begin(), done.end(), 1);
+		doneCount = luxels;
+	}
+
+	// luxels outside of the face copy their lit neighbours, like the propagation in CalcPoints
+	while (doneCount < luxels)
+	{
+		std::vector<unsigned char> nextDone = done;
+		for (int t = 0; t < h; t++)
+		{
+			for (int s = 0; s < w; s++)
+			{
+				if (done[s + w * t])
+					continue;
+
+				const int ns[4] = { s + 1, s - 1, s, s };
+				const int nt[4] = { t, t, t + 1, t - 1 };
+				int count = 0;
+				for (int n = 0; n < 4; n++)
+				{
+					if (ns[n] < 0 || ns[n] >= w || nt[n] < 0 || nt[n] >= h || !done[ns[n] + w * nt[n]])
+						continue;
+					for (int k = 0; k < layers; k++)
+						light[k * luxels + s + w * t] += light[k * luxels + ns[n] + w * nt[n]];
+					count++;
+				}
+				if (count > 0)
+				{
+					for (int k = 0; k < layers; k++)
+						light[k * luxels + s + w * t] /= (float)count;
+					nextDone[s + w * t] = 1;
+					doneCount++;
+				}
+			}
+		}
+		done.swap(nextDone);
+	}
+
+	output.resize(luxels * layers);
+	for (int i = 0; i < luxels * layers; i++)
+		output[i] = final_light_color(light[i]);
+	return true;
+}
+
+int qrad_rebake_faces(Bsp* map, const std::vector<int>& faces)
+{
+	ProfileScope profile("Rebake lighting");
+	auto start = std::chrono::high_resolution_clock::now();
+
+	RadScene scene;
+	collect_lights(map, scene.lights);
+	if (scene.lights.empty())
+	{
+		logf("RAD: map has no light entities\n");
+		return 0;
+	}
+
+	// shadows are cast by the world and by entities marked as opaque for hlrad
+	std::vector<vec3> modelOrigins = get_model_origins(map);
+	std::vector<bool> opaqueModels(map->modelCount);
+	if (map->modelCount > 0)
+		opaqueModels[0] = true;
+	for (Entity* ent : map->ents)
+	{
+		int modelIdx = ent->getBspModelIdx();
+		if (modelIdx > 0 && modelIdx < map->modelCount && ent->hasKey("zhlt_lightflags") &&
+			(atoi(ent->keyvalues["zhlt_lightflags"].c_str()) & 2))
+			opaqueModels[modelIdx] = true;
+	}
+	for (int m = 0; m < map->modelCount; m++)
+	{
+		if (!opaqueModels[m])
+			continue;
+		BSPMODEL& model = map->models[m];
+		for (int i = model.iFirstFace; i < model.iFirstFace + model.nFaces && i < map->faceCount; i++)
+			add_face_tris(map, scene, i, modelOrigins[m]);
+	}
+	build_bvh(scene);
+
+	std::vector<int> faceModels(map->faceCount, 0);
+	for (int m = 0; m < map->modelCount; m++)
+	{
+		BSPMODEL& model = map->models[m];
+		for (int i = model.iFirstFace; i < model.iFirstFace + model.nFaces && i < map->faceCount; i++)
+			faceModels[i] = m;
+	}
+
+	std::vector<int> targets;
+	targets.reserve(faces.size());
+	for (int faceIdx : faces)
+	{
+		if (faceIdx >= 0 && faceIdx < map->faceCount)
+			targets.push_back(faceIdx);
+	}
+
+	int numFaces = (int)targets.size();
+	std::vector<std::vector<COLOR3>> results(numFaces);
+	std::vector<unsigned char> baked(numFaces);
+
+	g_progress.update("Rebaking lightmaps", numFaces);
+	int blockSize = std::max(1, (int)std::thread::hardware_concurrency()) * 16;
+	std::vector<int> ids;
+	for (int first = 0; first < numFaces; first += blockSize)
+	{
+		int count = std::min(blockSize, numFaces - first);
+		ids.resize(count);
+		std::iota(ids.begin(), ids.end(), first);
+		std::for_each(std::execution::par, ids.begin(), ids.end(), [&](int i)
+			{
+				int faceIdx = targets[i];
+				baked[i] = bake_face(map, scene, faceIdx, modelOrigins[faceModels[faceIdx]], results[i]);
+			});
+		for (int i = 0; i < count; i++)
+			g_progress.tick();
+	}
+	g_progress.clear();
+
+	// a lightmap is rewritten in place when it isn't shared and the new one fits in its old space
+	std::map<int, int> offsetUsers;
+	for (int i = 0; i < map->faceCount; i++)
+	{
+		if (map->faces[i].nLightmapOffset >= 0 && map->lightmap_count(i) > 0)
+			offsetUsers[map->faces[i].nLightmapOffset]++;
+	}
+
+	std::vector<unsigned char> appended;
+	int rebaked = 0;
+	for (int i = 0; i < numFaces; i++)
+	{
+		if (!baked[i])
+			continue;
+
+		BSPFACE32& face = map->faces[targets[i]];
+		int size = (int)(results[i].size() * sizeof(COLOR3));
+
+		auto used = offsetUsers.find(face.nLightmapOffset);
+		bool inPlace = false;
+		if (used != offsetUsers.end() && used->second == 1)
+		{
+			auto next = std::next(used);
+			int available = (next != offsetUsers.end() ? next->first : map->lightDataLength) - face.nLightmapOffset;
+			inPlace = size <= available;
+		}
+
+		if (inPlace)
+		{
+			memcpy(map->lightdata + face.nLightmapOffset, results[i].data(), size);
+		}
+		else
+		{
+			face.nLightmapOffset = map->lightDataLength + (int)appended.size();
+			appended.insert(appended.end(), (unsigned char*)results[i].data(), (unsigned char*)results[i].data() + size);
+		}
+
+		if (face.nStyles[0] == 255)
+		{
+			face.nStyles[0] = 0;
+		}
+		rebaked++;
+	}
+
+	if (!appended.empty())
+	{
+		map->append_lump(LUMP_LIGHTING, appended.data(), appended.size());
+	}
+
+	double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+	logf("RAD: rebaked {} of {} faces with {} lights, {} bytes of new lightmaps, {:.2f} seconds\n",
+		rebaked, numFaces, scene.lights.size(), appended.size(), seconds);
+	return rebaked;
+}
+
+int qrad_rebake_model(Bsp* map, int modelIdx)
+{
+	if (modelIdx < 0 || modelIdx >= map->modelCount)
+		return 0;
+
+	BSPMODEL& model = map->models[modelIdx];
+	std::vector<int> faces(model.nFaces);
+	std::iota(faces.begin(), faces.end(), model.iFirstFace);
+	return qrad_rebake_faces(map, faces);
+}
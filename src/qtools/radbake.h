@@ -0,0 +1,14 @@
+#pragma once
+#include <vector>
+
+class Bsp;
+
+// Recomputes the direct lighting of the given faces from the light entities of the map and writes
+// it into the lighting lump, without running an external RAD. Shadows are traced against the world
+// faces. Faces keep their light styles, and every style is lit by the lights using that style.
+// Bounced light is not computed, so rebaked faces are usually darker than their neighbours.
+// Returns the number of faces that were rebaked.
+int qrad_rebake_faces(Bsp* map, const std::vector<int>& faces);
+
+// rebakes every face of a model (after moving, scaling or creating it)
+int qrad_rebake_model(Bsp* map, int modelIdx);
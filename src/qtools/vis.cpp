@@ -1,6 +1,13 @@
 #include "vis.h"
 #include "bsptypes.h"
 #include "Bsp.h"
+#include <algorithm>
+#include <execution>
+#include <numeric>
+#include <unordered_map>
+#include <string_view>
+#include <bit>
+#include <thread>
 
 bool g_debug_shift = false;
 
@@ -168,14 +175,35 @@ bool shiftVis(unsigned char* vis, int len, int offsetLeaf, int shift)
 	return overflow;
 }
 
-// decompress this map's vis data into arrays of bits where each bit indicates if a leaf is visible or not
-// iterationLeaves = number of leaves to decompress vis for
-// visDataLeafCount = total leaves in this map (exluding the shared solid leaf 0)
-// newNumLeaves = total leaves that will be in the map after merging is finished (again, excluding solid leaf 0)
-void decompress_vis_lump(BSPLEAF32* leafLump, unsigned char* visLump, unsigned char* output,
-	int iterationLeaves, int visDataLeafCount, int newNumLeaves, int leafMemSize, int visLumpMemSize)
+int count_vis_rows(BSPLEAF32* leafLump, int iterationLeaves, int leafMemSize, int visLumpMemSize)
+{
+	if (iterationLeaves / 8 < 0)
+	{
+		logf("Fatal error! Overflow decompressing VIS lump! #1\n");
+		return 0;
+	}
+
+	// rows are independent, but stop at the first bad leaf like a serial pass would
+	int rowCount = 0;
+	for (; rowCount < iterationLeaves; rowCount++)
+	{
+		if ((rowCount + 1) * sizeof(BSPLEAF32) >= leafMemSize)
+		{
+			logf("Fatal error! Overflow decompressing VIS lump! {} leaf of {} #0\n", rowCount + 1, leafMemSize / sizeof(BSPLEAF32));
+			break;
+		}
+		if (leafLump[rowCount + 1].nVisOffset >= visLumpMemSize)
+		{
+			logf("Fatal error! Overflow decompressing VIS lump! {} of {} #1\n", leafLump[rowCount + 1].nVisOffset, visLumpMemSize);
+			break;
+		}
+	}
+	return rowCount;
+}
+
+void decompress_vis_row(BSPLEAF32* leafLump, unsigned char* visLump, unsigned char* dest, int row,
+	int iterationLeaves, int visDataLeafCount, int newNumLeaves, int visLumpMemSize)
 {
-	unsigned char* dest;
 	int oldVisRowSize = ((visDataLeafCount + 63) & ~63) >> 3;
 	int newVisRowSize = ((newNumLeaves + 63) & ~63) >> 3;
 
@@ -187,243 +215,378 @@ void decompress_vis_lump(BSPLEAF32* leafLump, unsigned char* visLump, unsigned c
 		lastChunkMask = lastChunkMask | (1 << k);
 	}
 
-	for (int i = 0; i < iterationLeaves; i++)
+	if (leafLump[row + 1].nVisOffset < 0)
 	{
-		g_progress.tick();
-		dest = output + i * newVisRowSize;
-		if (lastUsedIdx >= 0)
-		{
-			if ((i + 1) * sizeof(BSPLEAF32) >= leafMemSize)
-			{
-				logf("Fatal error! Overflow decompressing VIS lump! {} leaf of {} #0\n", i + 1, leafMemSize / sizeof(BSPLEAF32));
-				return;
-			}
+		memset(dest, 255, lastUsedIdx);
+		dest[lastUsedIdx] |= lastChunkMask;
+		return;
+	}
 
-			if (leafLump[i + 1].nVisOffset < 0)
-			{
-				memset(dest, 255, lastUsedIdx);
-				dest[lastUsedIdx] |= lastChunkMask;
-				continue;
-			}
+	DecompressVis((unsigned char*)(visLump + leafLump[row + 1].nVisOffset), dest, oldVisRowSize, visDataLeafCount, visLumpMemSize - leafLump[row + 1].nVisOffset);
 
-			if (leafLump[i + 1].nVisOffset >= visLumpMemSize)
-			{
-				logf("Fatal error! Overflow decompressing VIS lump! {} of {} #1\n",leafLump[i + 1].nVisOffset,visLumpMemSize);
-				return;
-			}
-			// Tracing ... 
-			// logf("Leaef vis offset : {} of {} lump size\n", leafLump[i].nVisOffset, visLumpMemSize);
-			DecompressVis((unsigned char*)(visLump + leafLump[i + 1].nVisOffset), dest, oldVisRowSize, visDataLeafCount, visLumpMemSize - leafLump[i + 1].nVisOffset);
-
-			// Leaf visibility row lengths are multiples of 64 leaves, so there are usually some unused bits at the end.
-			// Maps sometimes set those unused bits randomly (e.g. leaf index 100 is marked visible, but there are only 90 leaves...)
-			// Leaves for submodels also don't matter and can be set to 0 to save space during recompression.
-			if (lastUsedIdx < newVisRowSize)
-			{
-				dest[lastUsedIdx] &= lastChunkMask;
-				int sz = newVisRowSize - (lastUsedIdx + 1);
-				//lastUsedIdx = lastUsedIdx + 1 + sz;
-				memset(dest + lastUsedIdx + 1, 0, sz);
-			}
-		}
-		else
+	// Leaf visibility row lengths are multiples of 64 leaves, so there are usually some unused bits at the end.
+	// Maps sometimes set those unused bits randomly (e.g. leaf index 100 is marked visible, but there are only 90 leaves...)
+	// Leaves for submodels also don't matter and can be set to 0 to save space during recompression.
+	if (lastUsedIdx < newVisRowSize)
+	{
+		dest[lastUsedIdx] &= lastChunkMask;
+		int sz = newVisRowSize - (lastUsedIdx + 1);
+		memset(dest + lastUsedIdx + 1, 0, sz);
+	}
+}
+
+// decompress this map's vis data into arrays of bits where each bit indicates if a leaf is visible or not
+// iterationLeaves = number of leaves to decompress vis for
+// visDataLeafCount = total leaves in this map (exluding the shared solid leaf 0)
+// newNumLeaves = total leaves that will be in the map after merging is finished (again, excluding solid leaf 0)
+void decompress_vis_lump(BSPLEAF32* leafLump, unsigned char* visLump, unsigned char* output,
+	int iterationLeaves, int visDataLeafCount, int newNumLeaves, int leafMemSize, int visLumpMemSize)
+{
+	int newVisRowSize = ((newNumLeaves + 63) & ~63) >> 3;
+
+	int rowCount = count_vis_rows(leafLump, iterationLeaves, leafMemSize, visLumpMemSize);
+
+	std::vector<int> rows(rowCount);
+	std::iota(rows.begin(), rows.end(), 0);
+
+	std::for_each(std::execution::par_unseq, rows.begin(), rows.end(), [&](int i)
 		{
-			logf("Fatal error! Overflow decompressing VIS lump! #1\n");
-			return;
-		}
+			decompress_vis_row(leafLump, visLump, output + i * newVisRowSize, i,
+				iterationLeaves, visDataLeafCount, newNumLeaves, visLumpMemSize);
+		});
+
+	for (int i = 0; i < rowCount; i++)
+	{
+		g_progress.tick();
 	}
 }
 
+// The RLE kernels below look at 8 bytes at a time. Vis rows are mostly long runs
+// of zero bytes (compressed) or long runs of non-zero bytes (literals), so this
+// skips most of the per-byte branching of the original qvis loops.
+
+// high bit of every zero byte is set (bytes above the first zero byte may be false positives)
+static inline uint64_t zero_byte_mask(uint64_t v)
+{
+	return (v - UINT64_C(0x0101010101010101)) & ~v & UINT64_C(0x8080808080808080);
+}
+
+static inline uint64_t load_u64(const unsigned char* p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+// index of the lowest set byte (little endian load)
+static inline unsigned int first_marked_byte(uint64_t mask)
+{
+	if constexpr (std::endian::native == std::endian::little)
+		return (unsigned int)std::countr_zero(mask) >> 3;
+	else
+		return (unsigned int)std::countl_zero(mask) >> 3;
+}
+
+// number of non-zero bytes at the start of p
+static inline unsigned int nonzero_run(const unsigned char* p, unsigned int len)
+{
+	unsigned int i = 0;
+	for (; i + 8 <= len; i += 8)
+	{
+		uint64_t zeros = zero_byte_mask(load_u64(p + i));
+		if (zeros)
+			return i + first_marked_byte(zeros);
+	}
+	while (i < len && p[i])
+		i++;
+	return i;
+}
+
+// number of zero bytes at the start of p
+static inline unsigned int zero_run(const unsigned char* p, unsigned int len)
+{
+	unsigned int i = 0;
+	for (; i + 8 <= len; i += 8)
+	{
+		uint64_t v = load_u64(p + i);
+		if (v)
+			return i + first_marked_byte(v);
+	}
+	while (i < len && !p[i])
+		i++;
+	return i;
+}
+
 //
 // BEGIN COPIED QVIS CODE
 //
 
 void DecompressVis(unsigned char* src, unsigned char* dest, unsigned int dest_length, unsigned int numLeaves, unsigned int src_length)
 {
-	unsigned char* startsrc = src;
-	unsigned char* startdst = dest;
-
-	int             c;
-	unsigned char* out;
-	int             row;
-
-	row = (numLeaves + 7) >> 3; // same as the length used by VIS program in CompressVis
+	unsigned int row = (numLeaves + 7) >> 3; // same as the length used by VIS program in CompressVis
 	// The wrong size will cause DecompressVis to spend extremely long time once the source pointer runs into the invalid area in g_dvisdata (for example, in BuildFaceLights, some faces could hang for a few seconds), and sometimes to crash.
 
-	out = dest;
+	unsigned int out = 0;
+	unsigned int in = 0;
 
-	do
+	while (out < row)
 	{
-		if (*src)
+		if (in >= src_length)
 		{
-			if (out > startdst + dest_length)
-			{
-				logf("Fatal error! Decompress vis dest overflow {} > {} #0!\n", (int)(out - startdst), dest_length);
-				return;
-			}
-			if (src > startsrc + src_length)
-			{
-				logf("Fatal error! Decompress vis src overflow {} > {} #1!\n", (int)(src - startsrc), src_length);
-				return;
-			}
-			*out = *src;
-			out++;
-			src++;
-			continue;
+			logf("Fatal error! Decompress vis src overflow {} > {} #1!\n", in, src_length);
+			return;
 		}
 
-		c = src[1];
-		src += 2;
-		while (c)
+		if (src[in])
 		{
-			if (out > startdst + dest_length)
-			{
-				logf("Fatal error! Decompress vis dest overflow {} > {} #0!\n", (int)(out - startdst), dest_length);
-				return;
-			}
-			*out = 0;
-			out++;
-			c--;
-
-			if (out - dest >= row)
+			unsigned int count = nonzero_run(src + in, std::min(row - out, src_length - in));
+			if (out + count > dest_length)
 			{
+				logf("Fatal error! Decompress vis dest overflow {} > {} #0!\n", out + count, dest_length);
 				return;
 			}
+			memcpy(dest + out, src + in, count);
+			out += count;
+			in += count;
+			continue;
 		}
-	} while (out - dest < row);
-}
-
-int CompressVis(unsigned char* src, unsigned int src_length, unsigned char* dest, unsigned int dest_length)
-{
-	unsigned int    j;
-	unsigned char* dest_p = dest;
-	unsigned int    current_length = 0;
-
-	for (j = 0; j < src_length; j++)
-	{
-		current_length++;
 
-		if (current_length > dest_length)
+		if (in + 1 >= src_length)
 		{
-			logf("Fatal error! Decompress vis overflow {} > {} #0!", current_length, dest_length);
-			return (int)(dest_p - dest);
+			logf("Fatal error! Decompress vis src overflow {} > {} #1!\n", in + 2, src_length);
+			return;
 		}
 
-		*dest_p = src[j];
-		dest_p++;
-
-
-		if (src[j])
+		unsigned int count = std::min((unsigned int)src[in + 1], row - out);
+		in += 2;
+		if (out + count > dest_length)
 		{
-			continue;
+			logf("Fatal error! Decompress vis dest overflow {} > {} #0!\n", out + count, dest_length);
+			return;
 		}
+		memset(dest + out, 0, count);
+		out += count;
+	}
+}
 
-		unsigned char   rep = 1;
+int CompressVis(unsigned char* src, unsigned int src_length, unsigned char* dest, unsigned int dest_length)
+{
+	unsigned int in = 0;
+	unsigned int out = 0;
 
-		for (j++; j < src_length; j++)
+	while (in < src_length)
+	{
+		// literal bytes are copied as is
+		unsigned int count = nonzero_run(src + in, src_length - in);
+		if (count)
 		{
-			if (src[j] || rep == 255)
-			{
-				break;
-			}
-			else
+			if (out + count > dest_length)
 			{
-				rep++;
+				memcpy(dest + out, src + in, dest_length - out);
+				logf("Fatal error! Decompress vis overflow {} > {} #0!", out + count, dest_length);
+				return (int)dest_length;
 			}
+			memcpy(dest + out, src + in, count);
+			out += count;
+			in += count;
+			if (in >= src_length)
+				break;
 		}
-		current_length++;
-		if (current_length > dest_length)
+
+		// zero bytes become (0, run length) pairs of up to 255 bytes
+		count = zero_run(src + in, std::min(src_length - in, 255u));
+		if (out + 2 > dest_length)
 		{
-			logf("Fatal error! Decompress vis overflow {} > {} #0!", current_length, dest_length);
-			return (int)(dest_p - dest);
+			if (out < dest_length)
+				dest[out++] = 0;
+			logf("Fatal error! Decompress vis overflow {} > {} #0!", out + 1, dest_length);
+			return (int)out;
 		}
-		*dest_p = rep;
-		dest_p++;
-		j--;
+		dest[out++] = 0;
+		dest[out++] = (unsigned char)count;
+		in += count;
 	}
 
-	return (int)(dest_p - dest);
+	return (int)out;
 }
 
 int CompressAll(BSPLEAF32* leafs, unsigned char* uncompressed, unsigned char* output, int numLeaves, int iterLeaves, int bufferSize, int maxLeafs)
 {
-	int x = 0;
-
-	unsigned char* dest;
-	unsigned char* src;
 	unsigned int g_bitbytes = ((numLeaves + 63) & ~63) >> 3;
 
-	unsigned char* vismap_p = output;
-
-	int* sharedRows = new int[iterLeaves];
-	for (int i = 0; i < iterLeaves; i++)
+	int rowCount = std::max(iterLeaves, 0);
+	bool leafOverflow = false;
+	if (rowCount > maxLeafs - 1)
 	{
-		src = uncompressed + i * g_bitbytes;
+		rowCount = std::max(maxLeafs - 1, 0);
+		leafOverflow = true;
+	}
+
+	std::vector<int> rows(rowCount);
+	std::iota(rows.begin(), rows.end(), 0);
+
+	// identical rows share the same compressed data, hash them first to avoid comparing every row pair
+	std::vector<size_t> rowHashes(rowCount);
+	std::for_each(std::execution::par_unseq, rows.begin(), rows.end(), [&](int i)
+		{
+			rowHashes[i] = std::hash<std::string_view>{}(std::string_view((const char*)uncompressed + (size_t)i * g_bitbytes, g_bitbytes));
+		});
 
+	std::vector<int> sharedRows(rowCount);
+	std::vector<int> uniqueRows;
+	std::unordered_map<size_t, std::vector<int>> rowsByHash;
+	for (int i = 0; i < rowCount; i++)
+	{
 		sharedRows[i] = i;
-		for (int k = 0; k < i; k++)
+		std::vector<int>& candidates = rowsByHash[rowHashes[i]];
+		for (int k : candidates)
 		{
-			if (sharedRows[k] != k)
-			{
-				continue; // already compared in an earlier row
-			}
-			unsigned char* previous = uncompressed + k * g_bitbytes;
-			if (memcmp(src, previous, g_bitbytes) == 0)
+			if (memcmp(uncompressed + (size_t)i * g_bitbytes, uncompressed + (size_t)k * g_bitbytes, g_bitbytes) == 0)
 			{
 				sharedRows[i] = k;
 				break;
 			}
 		}
+		if (sharedRows[i] == i)
+		{
+			candidates.push_back(i);
+			uniqueRows.push_back(i);
+		}
 		g_progress.tick();
 	}
 
-	unsigned char* compressed = new unsigned char[MAX_MAP_LEAVES / 8];
-
-	for (int i = 0; i < iterLeaves; i++)
+	// compress unique rows in parallel, then lay them out with a prefix sum of their sizes
+	std::vector<std::vector<unsigned char>> compressedRows(uniqueRows.size());
+	std::vector<int> uniqueIds(uniqueRows.size());
+	std::iota(uniqueIds.begin(), uniqueIds.end(), 0);
+	std::for_each(std::execution::par, uniqueIds.begin(), uniqueIds.end(), [&](int u)
+		{
+			thread_local std::vector<unsigned char> compressed;
+			compressed.resize(MAX_MAP_LEAVES / 8);
+			int x = CompressVis(uncompressed + (size_t)uniqueRows[u] * g_bitbytes, g_bitbytes, compressed.data(), (unsigned int)compressed.size());
+			compressedRows[u].assign(compressed.begin(), compressed.begin() + x);
+		});
+
+	std::vector<int> rowOffsets(uniqueRows.size());
+	int totalSize = 0;
+	size_t writeRows = uniqueRows.size();
+	int stopRow = rowCount;
+	for (size_t u = 0; u < uniqueRows.size(); u++)
 	{
-		if (i + 1 >= maxLeafs)
+		rowOffsets[u] = totalSize;
+		totalSize += (int)compressedRows[u].size();
+		if (totalSize >= bufferSize)
 		{
-			logf("Fatal error! leaf array overflow leafs[{}] of {}\n", i + 1, maxLeafs);
-			return (int)(vismap_p - output);
+			logf("Fatal error! Vismap expansion overflow {} > {}\n", (void*)(output + totalSize), (void*)(output + bufferSize));
+			writeRows = u;
+			stopRow = uniqueRows[u];
+			break;
 		}
+	}
 
+	std::for_each(std::execution::par_unseq, uniqueIds.begin(), uniqueIds.begin() + writeRows, [&](int u)
+		{
+			memcpy(output + rowOffsets[u], compressedRows[u].data(), compressedRows[u].size());
+		});
+
+	size_t u = 0;
+	for (int i = 0; i < stopRow; i++)
+	{
 		if (sharedRows[i] != i)
 		{
-			if (sharedRows[i] + 1 >= maxLeafs)
-			{
-				logf("Fatal error! leaf array overflow leafs[{}] of {} (in sharedRows)\n", (int)(sharedRows[i] + 1), maxLeafs);
-				return (int)(vismap_p - output);
-			}
 			leafs[i + 1].nVisOffset = leafs[sharedRows[i] + 1].nVisOffset;
 			continue;
 		}
+		leafs[i + 1].nVisOffset = rowOffsets[u++]; // leaf 0 is a common solid
+	}
 
-		memset(compressed, 0, MAX_MAP_LEAVES / 8);
+	if (leafOverflow && stopRow == rowCount)
+	{
+		logf("Fatal error! leaf array overflow leafs[{}] of {}\n", rowCount + 1, maxLeafs);
+	}
 
-		src = uncompressed + i * g_bitbytes;
+	return totalSize;
+}
 
-		// Compress all leafs into global compression buffer
-		x = CompressVis(src, g_bitbytes, compressed, MAX_MAP_LEAVES / 8);
+int CompressAllStreamed(BSPLEAF32* leafs, const VisRowSource& getRow, std::vector<unsigned char>& output, int numLeaves, int iterLeaves, int bufferSize, int maxLeafs)
+{
+	unsigned int g_bitbytes = ((numLeaves + 63) & ~63) >> 3;
 
-		dest = vismap_p;
-		vismap_p += x;
+	int rowCount = std::max(iterLeaves, 0);
+	bool leafOverflow = false;
+	if (rowCount > maxLeafs - 1)
+	{
+		rowCount = std::max(maxLeafs - 1, 0);
+		leafOverflow = true;
+	}
 
-		if (vismap_p >= output + bufferSize)
-		{
-			logf("Fatal error! Vismap expansion overflow {} > {}\n", (void*)vismap_p, (void*)(output + bufferSize));
-			return (int)(vismap_p - output);
-		}
+	output.clear();
 
-		leafs[i + 1].nVisOffset = (int)(dest - output);            // leaf 0 is a common solid
+	// a block of rows is generated and compressed in parallel, then appended in row order,
+	// so only a few uncompressed rows per thread exist at any time
+	int blockSize = (int)std::max(std::thread::hardware_concurrency(), 1u) * 16;
+	std::vector<std::vector<unsigned char>> compressedRows(std::min(blockSize, rowCount));
+	std::vector<int> blockRows;
 
-		memcpy(dest, compressed, x);
-	}
+	// identical rows share the same compressed data. compression is lossless, so comparing
+	// compressed rows gives the same result as comparing the uncompressed ones
+	std::unordered_map<size_t, std::vector<std::pair<int, int>>> rowsByHash; // offset and length in output
+
+	int stopRow = rowCount;
+	for (int start = 0; start < stopRow; start += blockSize)
+	{
+		int count = std::min(blockSize, rowCount - start);
+		blockRows.resize(count);
+		std::iota(blockRows.begin(), blockRows.end(), start);
 
+		std::for_each(std::execution::par, blockRows.begin(), blockRows.end(), [&](int i)
+			{
+				thread_local std::vector<unsigned char> row;
+				thread_local std::vector<unsigned char> compressed;
+				row.assign(g_bitbytes, 0xFF);
+				compressed.resize(MAX_MAP_LEAVES / 8);
+				getRow(i, row.data());
+				int x = CompressVis(row.data(), g_bitbytes, compressed.data(), (unsigned int)compressed.size());
+				compressedRows[i - start].assign(compressed.begin(), compressed.begin() + x);
+			});
+
+		for (int i = start; i < start + count; i++)
+		{
+			std::vector<unsigned char>& data = compressedRows[i - start];
+			std::vector<std::pair<int, int>>& candidates = rowsByHash[std::hash<std::string_view>{}(std::string_view((const char*)data.data(), data.size()))];
+
+			int offset = -1;
+			for (const std::pair<int, int>& k : candidates)
+			{
+				if (k.second == (int)data.size() && memcmp(output.data() + k.first, data.data(), data.size()) == 0)
+				{
+					offset = k.first;
+					break;
+				}
+			}
+			if (offset < 0)
+			{
+				offset = (int)output.size();
+				if (offset + (int)data.size() >= bufferSize)
+				{
+					logf("Fatal error! Vismap expansion overflow {} > {}\n", offset + data.size(), bufferSize);
+					stopRow = i;
+					break;
+				}
+				candidates.push_back({ offset, (int)data.size() });
+				output.insert(output.end(), data.begin(), data.end());
+			}
+			leafs[i + 1].nVisOffset = offset; // leaf 0 is a common solid
+			g_progress.tick();
+		}
+	}
 
-	delete[] compressed;
-	delete[] sharedRows;
+	if (leafOverflow && stopRow == rowCount)
+	{
+		logf("Fatal error! leaf array overflow leafs[{}] of {}\n", rowCount + 1, maxLeafs);
+	}
 
-	return (int)(vismap_p - output);
+	return (int)output.size();
 }
 
 bool CHECKBITFROMBYTES(unsigned char* bytes, int bitid)
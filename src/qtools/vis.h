@@ -1,4 +1,6 @@
 #include "util.h"
+#include <functional>
+#include <vector>
 
 struct BSPLEAF32;
 
@@ -11,12 +13,28 @@ bool shiftVis(unsigned char* vis, int len, int offsetLeaf, int shift);
 void decompress_vis_lump(BSPLEAF32* leafLump,  unsigned char* visLump, unsigned char* output,
 						 int iterationLeaves, int visDataLeafCount, int newNumLeaves, int leafMemSize, int visLumpMemSize);
 
+// number of rows decompress_vis_lump would decompress (it stops at the first leaf with a bad vis offset)
+int count_vis_rows(BSPLEAF32* leafLump, int iterationLeaves, int leafMemSize, int visLumpMemSize);
+
+// decompress a single row exactly like decompress_vis_lump does, dest must be filled with 0xFF
+void decompress_vis_row(BSPLEAF32* leafLump, unsigned char* visLump, unsigned char* dest, int row,
+						int iterationLeaves, int visDataLeafCount, int newNumLeaves, int visLumpMemSize);
+
 void DecompressVis(unsigned char* src, unsigned char* dest, unsigned int dest_length, unsigned int numLeaves, unsigned int src_length);
 
 int CompressVis(unsigned char* src, unsigned int src_length, unsigned char* dest, unsigned int dest_length);
 
 int CompressAll(BSPLEAF32* leafs, unsigned char* uncompressed, unsigned char* output, int numLeaves, int iterLeaves, int bufferSize, int leafMemSize);
 
+// writes the uncompressed vis row of a leaf (leaf 0 excluded) to dest, which holds
+// ((numLeaves + 63) & ~63) >> 3 bytes set to 0xFF.
+// called from multiple threads at once
+typedef std::function<void(int row, unsigned char* dest)> VisRowSource;
+
+// same result as CompressAll, but rows are requested from getRow a block at a time instead of
+// reading a dense numLeaves * rowSize matrix, so memory use stays at a few rows per thread
+int CompressAllStreamed(BSPLEAF32* leafs, const VisRowSource& getRow, std::vector<unsigned char>& output, int numLeaves, int iterLeaves, int bufferSize, int leafMemSize);
+
 void DecompressLeafVis(unsigned char* src, unsigned int src_len, unsigned char* dest, unsigned int dest_length);
 
 extern bool g_debug_shift;
@@ -0,0 +1,903 @@
+#include "visflow.h"
+#include "vis.h"
+#include "winding.h"
+#include "Bsp.h"
+#include "util.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <execution>
+#include <memory>
+#include <numeric>
+#include <thread>
+
+// Portal generation and PVS flood for the world model, based on qbsp's portal code and qvis.
+// Windings are kept in double precision, the first windings of every node span the whole map.
+
+struct VisPoint
+{
+	double x, y, z;
+};
+
+struct VisPlane
+{
+	VisPoint normal;
+	double dist;
+};
+
+typedef std::vector<VisPoint> VisWinding;
+
+#define PORTAL_EPSILON 0.05	// qbsp ON_EPSILON
+#define FLOW_EPSILON 0.1	// qvis ON_EPSILON
+#define EDGE_LENGTH 0.2		// windings with less than 3 edges longer than this are dropped
+#define EQUAL_EPSILON 0.001	// qvis VectorCompare
+#define BASE_WINDING_RANGE 262144.0
+#define MAX_NODE_DEPTH 1024		// guards against node loops in broken maps
+
+static inline double vdot(const VisPoint& a, const VisPoint& b)
+{
+	return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static inline VisPoint vsub(const VisPoint& a, const VisPoint& b)
+{
+	return { a.x - b.x, a.y - b.y, a.z - b.z };
+}
+
+static inline VisPoint vcross(const VisPoint& a, const VisPoint& b)
+{
+	return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+}
+
+static inline VisPlane flip_plane(const VisPlane& p)
+{
+	return { { -p.normal.x, -p.normal.y, -p.normal.z }, -p.dist };
+}
+
+static VisWinding base_winding(const VisPlane& plane)
+{
+	// find the major axis
+	double n[3] = { plane.normal.x, plane.normal.y, plane.normal.z };
+	int x = 0;
+	for (int i = 1; i < 3; i++)
+	{
+		if (fabs(n[i]) > fabs(n[x]))
+			x = i;
+	}
+
+	VisPoint vup = { 0, 0, 0 };
+	if (x == 2)
+		vup.x = 1;
+	else
+		vup.z = 1;
+
+	double v = vdot(vup, plane.normal);
+	vup = { vup.x - v * plane.normal.x, vup.y - v * plane.normal.y, vup.z - v * plane.normal.z };
+	double len = sqrt(vdot(vup, vup));
+	vup = { vup.x / len * BASE_WINDING_RANGE, vup.y / len * BASE_WINDING_RANGE, vup.z / len * BASE_WINDING_RANGE };
+
+	VisPoint org = { plane.normal.x * plane.dist, plane.normal.y * plane.dist, plane.normal.z * plane.dist };
+	VisPoint vright = vcross(vup, plane.normal);
+
+	// winding faces the plane normal
+	VisWinding w(4);
+	w[0] = { org.x - vright.x + vup.x, org.y - vright.y + vup.y, org.z - vright.z + vup.z };
+	w[1] = { org.x + vright.x + vup.x, org.y + vright.y + vup.y, org.z + vright.z + vup.z };
+	w[2] = { org.x + vright.x - vup.x, org.y + vright.y - vup.y, org.z + vright.z - vup.z };
+	w[3] = { org.x - vright.x - vup.x, org.y - vright.y - vup.y, org.z - vright.z - vup.z };
+	return w;
+}
+
+static int winding_side(const VisWinding& w, const VisPlane& plane, double epsilon)
+{
+	bool front = false;
+	bool back = false;
+	for (const VisPoint& p : w)
+	{
+		double d = vdot(p, plane.normal) - plane.dist;
+		if (d > epsilon)
+			front = true;
+		else if (d < -epsilon)
+			back = true;
+	}
+	if (front && back)
+		return SIDE_CROSS;
+	if (front)
+		return SIDE_FRONT;
+	if (back)
+		return SIDE_BACK;
+	return SIDE_ON;
+}
+
+static inline VisPoint split_point(const VisPoint& p1, const VisPoint& p2, double d1, double d2, const VisPlane& split)
+{
+	double dot = d1 / (d1 - d2);
+	VisPoint mid = { p1.x + dot * (p2.x - p1.x), p1.y + dot * (p2.y - p1.y), p1.z + dot * (p2.z - p1.z) };
+	// avoid round off error when possible
+	if (split.normal.x == 1.0) mid.x = split.dist;
+	else if (split.normal.x == -1.0) mid.x = -split.dist;
+	if (split.normal.y == 1.0) mid.y = split.dist;
+	else if (split.normal.y == -1.0) mid.y = -split.dist;
+	if (split.normal.z == 1.0) mid.z = split.dist;
+	else if (split.normal.z == -1.0) mid.z = -split.dist;
+	return mid;
+}
+
+// splits w into the parts in front of and behind the plane (either can end up empty)
+static void split_winding(const VisWinding& w, const VisPlane& split, double epsilon, VisWinding& front, VisWinding& back)
+{
+	size_t n = w.size();
+	thread_local std::vector<double> dists;
+	thread_local std::vector<int> sides;
+	dists.resize(n + 1);
+	sides.resize(n + 1);
+
+	int counts[3] = { 0, 0, 0 };
+	for (size_t i = 0; i < n; i++)
+	{
+		double d = vdot(w[i], split.normal) - split.dist;
+		dists[i] = d;
+		sides[i] = d > epsilon ? SIDE_FRONT : (d < -epsilon ? SIDE_BACK : SIDE_ON);
+		counts[sides[i]]++;
+	}
+	dists[n] = dists[0];
+	sides[n] = sides[0];
+
+	front.clear();
+	back.clear();
+	if (!counts[SIDE_FRONT] && !counts[SIDE_BACK])
+		return;
+	if (!counts[SIDE_BACK])
+	{
+		front = w;
+		return;
+	}
+	if (!counts[SIDE_FRONT])
+	{
+		back = w;
+		return;
+	}
+
+	for (size_t i = 0; i < n; i++)
+	{
+		const VisPoint& p1 = w[i];
+		if (sides[i] == SIDE_ON)
+		{
+			front.push_back(p1);
+			back.push_back(p1);
+			continue;
+		}
+		if (sides[i] == SIDE_FRONT)
+			front.push_back(p1);
+		else
+			back.push_back(p1);
+
+		if (sides[i + 1] == SIDE_ON || sides[i + 1] == sides[i])
+			continue;
+
+		VisPoint mid = split_point(p1, w[(i + 1) % n], dists[i], dists[i + 1], split);
+		front.push_back(mid);
+		back.push_back(mid);
+	}
+}
+
+// keeps the part of w in front of the plane. returns false if nothing is left
+// (a winding lying on the plane is removed too, like qvis ClipWinding without keepon)
+static bool clip_winding(VisWinding& w, const VisPlane& split, double epsilon, VisWinding& scratch)
+{
+	size_t n = w.size();
+	thread_local std::vector<double> dists;
+	thread_local std::vector<int> sides;
+	dists.resize(n + 1);
+	sides.resize(n + 1);
+
+	int counts[3] = { 0, 0, 0 };
+	for (size_t i = 0; i < n; i++)
+	{
+		double d = vdot(w[i], split.normal) - split.dist;
+		dists[i] = d;
+		sides[i] = d > epsilon ? SIDE_FRONT : (d < -epsilon ? SIDE_BACK : SIDE_ON);
+		counts[sides[i]]++;
+	}
+	dists[n] = dists[0];
+	sides[n] = sides[0];
+
+	if (!counts[SIDE_FRONT])
+	{
+		w.clear();
+		return false;
+	}
+	if (!counts[SIDE_BACK])
+		return true;
+
+	scratch.clear();
+	for (size_t i = 0; i < n; i++)
+	{
+		const VisPoint& p1 = w[i];
+		if (sides[i] == SIDE_ON)
+		{
+			scratch.push_back(p1);
+			continue;
+		}
+		if (sides[i] == SIDE_FRONT)
+			scratch.push_back(p1);
+
+		if (sides[i + 1] == SIDE_ON || sides[i + 1] == sides[i])
+			continue;
+
+		scratch.push_back(split_point(p1, w[(i + 1) % n], dists[i], dists[i + 1], split));
+	}
+	w.swap(scratch);
+	return w.size() >= 3;
+}
+
+static bool winding_is_tiny(const VisWinding& w)
+{
+	int edges = 0;
+	for (size_t i = 0; i < w.size(); i++)
+	{
+		VisPoint d = vsub(w[(i + 1) % w.size()], w[i]);
+		if (vdot(d, d) > EDGE_LENGTH * EDGE_LENGTH && ++edges == 3)
+			return false;
+	}
+	return true;
+}
+
+static inline VisPlane get_node_plane(Bsp* map, const BSPNODE32& node)
+{
+	const BSPPLANE& p = map->planes[node.iPlane];
+	return { { p.vNormal.x, p.vNormal.y, p.vNormal.z }, p.fDist };
+}
+
+static inline bool is_portal_leaf(Bsp* map, int leafIdx)
+{
+	return leafIdx > 0 && leafIdx < map->leafCount && map->leaves[leafIdx].nContents != CONTENTS_SOLID;
+}
+
+// sends a winding that lies on a node plane down the subtree and collects the pieces that end up in
+// non-solid leaves. dir points from the plane into the side being searched, it decides where
+// pieces that are coplanar with a deeper node go
+static void push_portal_winding(Bsp* map, int nodeIdx, const VisWinding& w, const VisPoint& dir,
+	std::vector<std::pair<int, VisWinding>>& pieces, int depth)
+{
+	if (nodeIdx < 0)
+	{
+		if (is_portal_leaf(map, ~nodeIdx))
+			pieces.push_back({ ~nodeIdx, w });
+		return;
+	}
+	if (nodeIdx >= map->nodeCount || depth > MAX_NODE_DEPTH)
+		return;
+
+	const BSPNODE32& node = map->nodes[nodeIdx];
+	VisPlane plane = get_node_plane(map, node);
+
+	int side = winding_side(w, plane, PORTAL_EPSILON);
+	if (side == SIDE_ON)
+		side = vdot(plane.normal, dir) > 0 ? SIDE_FRONT : SIDE_BACK;
+
+	if (side == SIDE_FRONT)
+	{
+		push_portal_winding(map, node.iChildren[0], w, dir, pieces, depth + 1);
+	}
+	else if (side == SIDE_BACK)
+	{
+		push_portal_winding(map, node.iChildren[1], w, dir, pieces, depth + 1);
+	}
+	else
+	{
+		VisWinding front, back;
+		split_winding(w, plane, PORTAL_EPSILON, front, back);
+		if (front.size() >= 3)
+			push_portal_winding(map, node.iChildren[0], front, dir, pieces, depth + 1);
+		if (back.size() >= 3)
+			push_portal_winding(map, node.iChildren[1], back, dir, pieces, depth + 1);
+	}
+}
+
+struct PortalNode
+{
+	int nodeIdx;
+	std::vector<VisPlane> bounds; // the node's volume is in front of all of these
+};
+
+static void collect_portal_nodes(Bsp* map, int nodeIdx, std::vector<VisPlane>& bounds, std::vector<PortalNode>& out)
+{
+	if (nodeIdx < 0 || nodeIdx >= map->nodeCount || bounds.size() > MAX_NODE_DEPTH + 6)
+		return;
+
+	out.push_back({ nodeIdx, bounds });
+
+	const BSPNODE32& node = map->nodes[nodeIdx];
+	VisPlane plane = get_node_plane(map, node);
+
+	bounds.push_back(plane);
+	collect_portal_nodes(map, node.iChildren[0], bounds, out);
+	bounds.back() = flip_plane(plane);
+	collect_portal_nodes(map, node.iChildren[1], bounds, out);
+	bounds.pop_back();
+}
+
+void qvis_make_portals(Bsp* map, std::vector<VisPortal>& portals)
+{
+	portals.clear();
+	if (map->modelCount <= 0 || map->nodeCount <= 0)
+		return;
+
+	BSPMODEL& world = map->models[0];
+
+	// the world box keeps the first node windings finite
+	std::vector<VisPlane> bounds;
+	for (int i = 0; i < 3; i++)
+	{
+		VisPlane minPlane = { { 0, 0, 0 }, 0 };
+		VisPlane maxPlane = { { 0, 0, 0 }, 0 };
+		(&minPlane.normal.x)[i] = 1.0;
+		minPlane.dist = world.nMins[i] - 16.0;
+		(&maxPlane.normal.x)[i] = -1.0;
+		maxPlane.dist = -(world.nMaxs[i] + 16.0);
+		bounds.push_back(minPlane);
+		bounds.push_back(maxPlane);
+	}
+
+	std::vector<PortalNode> nodes;
+	collect_portal_nodes(map, world.iHeadnodes[0], bounds, nodes);
+
+	g_progress.update("Generating portals", (int)nodes.size());
+
+	// every node plane separates the leaves on its front side from the ones on its back side
+	std::vector<std::vector<VisPortal>> nodePortals(nodes.size());
+	std::vector<int> ids(nodes.size());
+	std::iota(ids.begin(), ids.end(), 0);
+	std::for_each(std::execution::par, ids.begin(), ids.end(), [&](int i)
+		{
+			const BSPNODE32& node = map->nodes[nodes[i].nodeIdx];
+			VisPlane plane = get_node_plane(map, node);
+
+			VisWinding w = base_winding(plane);
+			VisWinding scratch;
+			for (const VisPlane& b : nodes[i].bounds)
+			{
+				if (!clip_winding(w, b, PORTAL_EPSILON, scratch))
+					return;
+			}
+			if (winding_is_tiny(w))
+				return;
+
+			std::vector<std::pair<int, VisWinding>> frontPieces;
+			std::vector<std::pair<int, VisWinding>> backPieces;
+			push_portal_winding(map, node.iChildren[0], w, plane.normal, frontPieces, 0);
+
+			VisPoint backDir = { -plane.normal.x, -plane.normal.y, -plane.normal.z };
+			for (const std::pair<int, VisWinding>& fp : frontPieces)
+			{
+				backPieces.clear();
+				push_portal_winding(map, node.iChildren[1], fp.second, backDir, backPieces, 0);
+
+				for (const std::pair<int, VisWinding>& bp : backPieces)
+				{
+					if (bp.first == fp.first || winding_is_tiny(bp.second))
+						continue;
+
+					VisPortal p;
+					p.points.reserve(bp.second.size());
+					for (const VisPoint& v : bp.second)
+						p.points.push_back(vec3((float)v.x, (float)v.y, (float)v.z));
+					p.normal = vec3((float)plane.normal.x, (float)plane.normal.y, (float)plane.normal.z);
+					p.dist = (float)plane.dist;
+					p.leafs[0] = fp.first;
+					p.leafs[1] = bp.first;
+					nodePortals[i].push_back(p);
+				}
+			}
+		});
+
+	for (size_t i = 0; i < nodePortals.size(); i++)
+	{
+		portals.insert(portals.end(), nodePortals[i].begin(), nodePortals[i].end());
+		g_progress.tick();
+	}
+}
+
+//
+// PVS flood (qvis)
+//
+
+enum FlowStatus
+{
+	FLOW_NONE,
+	FLOW_WORKING,
+	FLOW_DONE
+};
+
+struct FlowPortal
+{
+	VisWinding winding;
+	VisPlane plane;	// faces into the leaf this portal leads to
+	int leaf;		// vis leaf (bsp leaf - 1) this portal leads to
+	VisPoint origin;
+	double radius;
+	int numMightSee;
+	std::vector<uint64_t> mightsee; // leaves the base flood reached
+	std::vector<uint64_t> vis;      // leaves the full flow reached, valid once status is FLOW_DONE
+};
+
+struct FlowLeaf
+{
+	std::vector<int> portals; // portals leading out of this leaf
+};
+
+struct FlowFrame
+{
+	std::vector<uint64_t> mightsee;
+	VisWinding source;
+	VisWinding pass;
+};
+
+struct FlowStack
+{
+	const VisWinding* source;
+	const VisWinding* pass;
+	VisPlane portalPlane;
+	const uint64_t* mightsee;
+};
+
+struct FlowContext
+{
+	std::vector<FlowPortal> portals;
+	std::vector<FlowLeaf> leafs;
+	std::unique_ptr<std::atomic<int>[]> status;
+	int bitlongs;
+};
+
+struct FlowThread
+{
+	FlowContext* ctx;
+	FlowPortal* base;
+	uint64_t* leafvis;
+	std::vector<std::unique_ptr<FlowFrame>> frames; // reused by recursion depth
+	VisWinding scratch;
+};
+
+static void set_portal_bounds(FlowPortal& p)
+{
+	VisPoint total = { 0, 0, 0 };
+	for (const VisPoint& v : p.winding)
+	{
+		total.x += v.x;
+		total.y += v.y;
+		total.z += v.z;
+	}
+	double n = (double)p.winding.size();
+	p.origin = { total.x / n, total.y / n, total.z / n };
+
+	p.radius = 0;
+	for (const VisPoint& v : p.winding)
+	{
+		VisPoint d = vsub(v, p.origin);
+		p.radius = std::max(p.radius, sqrt(vdot(d, d)));
+	}
+}
+
+// conservative set of leaves every portal might see: flood through all portals that are
+// in front of the portal and have the portal in front of them
+static void base_portal_vis(FlowContext& ctx, int portalIdx)
+{
+	FlowPortal& p = ctx.portals[portalIdx];
+	int numPortals = (int)ctx.portals.size();
+
+	thread_local std::vector<char> portalfront;
+	thread_local std::vector<int> floodStack;
+	portalfront.assign(numPortals, 0);
+
+	for (int j = 0; j < numPortals; j++)
+	{
+		if (j == portalIdx)
+			continue;
+		const FlowPortal& tp = ctx.portals[j];
+
+		// quick rejects with the bounding spheres
+		if (vdot(tp.origin, p.plane.normal) - p.plane.dist < -tp.radius)
+			continue;
+		if (vdot(p.origin, tp.plane.normal) - tp.plane.dist > p.radius)
+			continue;
+
+		size_t k;
+		for (k = 0; k < tp.winding.size(); k++)
+		{
+			if (vdot(tp.winding[k], p.plane.normal) - p.plane.dist > FLOW_EPSILON)
+				break;
+		}
+		if (k == tp.winding.size())
+			continue; // no points on front
+
+		for (k = 0; k < p.winding.size(); k++)
+		{
+			if (vdot(p.winding[k], tp.plane.normal) - tp.plane.dist < -FLOW_EPSILON)
+				break;
+		}
+		if (k == p.winding.size())
+			continue; // no points on back
+
+		portalfront[j] = 1;
+	}
+
+	p.mightsee.assign(ctx.bitlongs, 0);
+	p.numMightSee = 0;
+
+	floodStack.clear();
+	floodStack.push_back(p.leaf);
+	while (!floodStack.empty())
+	{
+		int leafnum = floodStack.back();
+		floodStack.pop_back();
+
+		uint64_t bit = UINT64_C(1) << (leafnum & 63);
+		if (p.mightsee[leafnum >> 6] & bit)
+			continue;
+		p.mightsee[leafnum >> 6] |= bit;
+		p.numMightSee++;
+
+		for (int pnum : ctx.leafs[leafnum].portals)
+		{
+			if (portalfront[pnum])
+				floodStack.push_back(ctx.portals[pnum].leaf);
+		}
+	}
+}
+
+// clips target to the volume between source and pass, see qvis ClipToSeperators
+static bool clip_to_separators(const VisWinding& source, const VisWinding& pass, VisWinding& target, bool flipclip, VisWinding& scratch)
+{
+	size_t numSource = source.size();
+	for (size_t i = 0; i < numSource; i++)
+	{
+		size_t l = (i + 1) % numSource;
+		VisPoint v1 = vsub(source[l], source[i]);
+
+		// find a vertex of pass that makes a plane that puts all of the
+		// vertexes of pass on the front side and all of the vertexes of
+		// source on the back side
+		for (size_t j = 0; j < pass.size(); j++)
+		{
+			VisPoint v2 = vsub(pass[j], source[i]);
+
+			VisPlane plane;
+			plane.normal = vcross(v1, v2);
+
+			// if points don't make a valid plane, skip it
+			double length = vdot(plane.normal, plane.normal);
+			if (length < FLOW_EPSILON)
+				continue;
+			length = 1.0 / sqrt(length);
+			plane.normal = { plane.normal.x * length, plane.normal.y * length, plane.normal.z * length };
+			plane.dist = vdot(pass[j], plane.normal);
+
+			// find out which side of the generated separating plane has the source portal
+			bool fliptest = false;
+			size_t k;
+			for (k = 0; k < numSource; k++)
+			{
+				if (k == i || k == l)
+					continue;
+				double d = vdot(source[k], plane.normal) - plane.dist;
+				if (d < -FLOW_EPSILON)
+				{
+					// source is on the negative side, so we want all pass and target on the positive side
+					fliptest = false;
+					break;
+				}
+				else if (d > FLOW_EPSILON)
+				{
+					// source is on the positive side, so we want all pass and target on the negative side
+					fliptest = true;
+					break;
+				}
+			}
+			if (k == numSource)
+				continue; // planar with source portal
+
+			if (fliptest)
+				plane = flip_plane(plane);
+
+			// if all of the pass portal points are now on the positive side, this is the separating plane
+			int front = 0;
+			for (k = 0; k < pass.size(); k++)
+			{
+				if (k == j)
+					continue;
+				double d = vdot(pass[k], plane.normal) - plane.dist;
+				if (d < -FLOW_EPSILON)
+					break;
+				else if (d > FLOW_EPSILON)
+					front++;
+			}
+			if (k != pass.size())
+				continue; // points on negative side, not a separating plane
+			if (!front)
+				continue; // planar with separating plane
+
+			// flip the normal if we want the back side
+			if (flipclip)
+				plane = flip_plane(plane);
+
+			// clip target by the separating plane
+			if (!clip_winding(target, plane, FLOW_EPSILON, scratch))
+				return false; // target is not visible
+
+			break; // one separator per source edge is enough
+		}
+	}
+	return true;
+}
+
+static void recursive_leaf_flow(FlowThread& thread, int leafnum, const FlowStack& prevstack, size_t depth)
+{
+	FlowContext& ctx = *thread.ctx;
+
+	// mark the leaf as visible
+	thread.leafvis[leafnum >> 6] |= UINT64_C(1) << (leafnum & 63);
+
+	if (depth >= thread.frames.size())
+	{
+		thread.frames.push_back(std::make_unique<FlowFrame>());
+		thread.frames.back()->mightsee.resize(ctx.bitlongs);
+	}
+	FlowFrame& frame = *thread.frames[depth];
+	uint64_t* might = frame.mightsee.data();
+	const uint64_t* vis = thread.leafvis;
+
+	FlowStack stack;
+	stack.mightsee = might;
+
+	// check all portals for flowing into other leafs
+	for (int pnum : ctx.leafs[leafnum].portals)
+	{
+		FlowPortal& p = ctx.portals[pnum];
+
+		if (!(prevstack.mightsee[p.leaf >> 6] & (UINT64_C(1) << (p.leaf & 63))))
+			continue; // can't possibly see it
+
+		// if the portal can't see anything we haven't already seen, skip it
+		const uint64_t* test = ctx.status[pnum].load(std::memory_order_acquire) == FLOW_DONE ? p.vis.data() : p.mightsee.data();
+		bool more = false;
+		for (int j = 0; j < ctx.bitlongs; j++)
+		{
+			might[j] = prevstack.mightsee[j] & test[j];
+			if (might[j] & ~vis[j])
+				more = true;
+		}
+		if (!more)
+			continue; // can't see anything new
+
+		// get plane of portal, point normal into the neighbor leaf
+		stack.portalPlane = p.plane;
+		VisPlane backplane = flip_plane(p.plane);
+
+		if (fabs(prevstack.portalPlane.normal.x - backplane.normal.x) < EQUAL_EPSILON
+			&& fabs(prevstack.portalPlane.normal.y - backplane.normal.y) < EQUAL_EPSILON
+			&& fabs(prevstack.portalPlane.normal.z - backplane.normal.z) < EQUAL_EPSILON)
+			continue; // can't go out a coplanar face
+
+		frame.pass = p.winding;
+		if (!clip_winding(frame.pass, thread.base->plane, FLOW_EPSILON, thread.scratch))
+			continue;
+
+		if (!prevstack.pass)
+		{
+			// the second leaf can only be blocked if coplanar
+			stack.source = prevstack.source;
+			stack.pass = &frame.pass;
+			recursive_leaf_flow(thread, p.leaf, stack, depth + 1);
+			continue;
+		}
+
+		if (!clip_winding(frame.pass, prevstack.portalPlane, FLOW_EPSILON, thread.scratch))
+			continue;
+
+		frame.source = *prevstack.source;
+		if (!clip_winding(frame.source, backplane, FLOW_EPSILON, thread.scratch))
+			continue;
+
+		if (!clip_to_separators(frame.source, *prevstack.pass, frame.pass, false, thread.scratch))
+			continue;
+		if (!clip_to_separators(*prevstack.pass, frame.source, frame.pass, true, thread.scratch))
+			continue;
+		if (!clip_to_separators(frame.pass, *prevstack.pass, frame.source, false, thread.scratch))
+			continue;
+		if (!clip_to_separators(*prevstack.pass, frame.pass, frame.source, true, thread.scratch))
+			continue;
+
+		stack.source = &frame.source;
+		stack.pass = &frame.pass;
+
+		// flow through it for real
+		recursive_leaf_flow(thread, p.leaf, stack, depth + 1);
+	}
+}
+
+static void portal_flow(FlowThread& thread, int portalIdx)
+{
+	FlowContext& ctx = *thread.ctx;
+	FlowPortal& p = ctx.portals[portalIdx];
+
+	ctx.status[portalIdx].store(FLOW_WORKING, std::memory_order_relaxed);
+	p.vis.assign(ctx.bitlongs, 0);
+
+	thread.base = &p;
+	thread.leafvis = p.vis.data();
+
+	FlowStack head;
+	head.source = &p.winding;
+	head.pass = NULL;
+	head.portalPlane = p.plane;
+	head.mightsee = p.mightsee.data();
+
+	recursive_leaf_flow(thread, p.leaf, head, 0);
+
+	ctx.status[portalIdx].store(FLOW_DONE, std::memory_order_release);
+}
+
+bool qvis_generate(Bsp* map, bool fast, int threads)
+{
+	if (map->modelCount <= 0 || map->leafCount <= 1)
+	{
+		logf("VIS: map has no world leaves\n");
+		return false;
+	}
+
+	ProfileScope profile("VIS " + map->bsp_name);
+	auto start = std::chrono::high_resolution_clock::now();
+
+	int numVisLeaves = std::min(map->models[0].nVisLeafs, map->leafCount - 1);
+
+	std::vector<VisPortal> portals;
+	qvis_make_portals(map, portals);
+	g_progress.clear();
+
+	FlowContext ctx;
+	ctx.bitlongs = (numVisLeaves + 63) >> 6;
+	ctx.leafs.resize(numVisLeaves);
+	ctx.portals.reserve(portals.size() * 2);
+
+	// every portal is flowed through in both directions
+	for (const VisPortal& vp : portals)
+	{
+		if (vp.leafs[0] > numVisLeaves || vp.leafs[1] > numVisLeaves)
+			continue;
+
+		VisPlane plane = { { vp.normal.x, vp.normal.y, vp.normal.z }, vp.dist };
+		VisWinding w;
+		for (const vec3& v : vp.points)
+			w.push_back({ v.x, v.y, v.z });
+
+		FlowPortal forward;
+		forward.winding = w;
+		forward.plane = flip_plane(plane);
+		forward.leaf = vp.leafs[1] - 1;
+		set_portal_bounds(forward);
+		ctx.leafs[vp.leafs[0] - 1].portals.push_back((int)ctx.portals.size());
+		ctx.portals.push_back(std::move(forward));
+
+		FlowPortal backward;
+		backward.winding.assign(w.rbegin(), w.rend());
+		backward.plane = plane;
+		backward.leaf = vp.leafs[0] - 1;
+		set_portal_bounds(backward);
+		ctx.leafs[vp.leafs[1] - 1].portals.push_back((int)ctx.portals.size());
+		ctx.portals.push_back(std::move(backward));
+	}
+
+	int numPortals = (int)ctx.portals.size();
+	ctx.status = std::make_unique<std::atomic<int>[]>(numPortals);
+	for (int i = 0; i < numPortals; i++)
+		ctx.status[i].store(FLOW_NONE, std::memory_order_relaxed);
+
+	logf("VIS: {} world leaves, {} portals\n", numVisLeaves, portals.size());
+
+	g_progress.update("Base vis", numPortals);
+	std::vector<int> ids(numPortals);
+	std::iota(ids.begin(), ids.end(), 0);
+	std::for_each(std::execution::par, ids.begin(), ids.end(), [&](int i)
+		{
+			base_portal_vis(ctx, i);
+		});
+	for (int i = 0; i < numPortals; i++)
+	{
+		g_progress.tick();
+	}
+	g_progress.clear();
+
+	if (!fast && numPortals > 0)
+	{
+		// portals that might see the least are finished first, later portals use their results
+		std::sort(ids.begin(), ids.end(), [&](int a, int b)
+			{
+				return ctx.portals[a].numMightSee < ctx.portals[b].numMightSee;
+			});
+
+		if (threads <= 0)
+			threads = (int)std::max(std::thread::hardware_concurrency(), 1u);
+		threads = std::min(threads, numPortals);
+
+		std::atomic<int> nextWork{ 0 };
+		std::atomic<int> doneWork{ 0 };
+		std::vector<std::thread> workers;
+		for (int t = 0; t < threads; t++)
+		{
+			workers.emplace_back([&]()
+				{
+					FlowThread thread;
+					thread.ctx = &ctx;
+					int work;
+					while ((work = nextWork.fetch_add(1)) < numPortals)
+					{
+						portal_flow(thread, ids[work]);
+						doneWork++;
+					}
+				});
+		}
+
+		// progress meter is not thread safe, tick it from here
+		g_progress.update("Portal flow", numPortals);
+		int ticked = 0;
+		while (ticked < numPortals)
+		{
+			int done = doneWork.load();
+			for (; ticked < done; ticked++)
+			{
+				g_progress.tick();
+			}
+			if (ticked < numPortals)
+				std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		}
+		for (std::thread& worker : workers)
+			worker.join();
+		g_progress.clear();
+	}
+
+	// leaf vis = everything its portals can see, plus itself
+	int visLeafCount = map->leafCount - 1;
+	unsigned int rowSize = ((visLeafCount + 63) & ~63) >> 3;
+	std::atomic<long long> totalVisible{ 0 };
+
+	auto getRow = [&](int row, unsigned char* dest)
+		{
+			thread_local std::vector<uint64_t> bits;
+			bits.assign(ctx.bitlongs, 0);
+			bits[row >> 6] |= UINT64_C(1) << (row & 63);
+			for (int pnum : ctx.leafs[row].portals)
+			{
+				const FlowPortal& p = ctx.portals[pnum];
+				const std::vector<uint64_t>& portalBits = fast ? p.mightsee : p.vis;
+				for (int j = 0; j < ctx.bitlongs; j++)
+					bits[j] |= portalBits[j];
+			}
+
+			memset(dest, 0, rowSize);
+			long long count = 0;
+			for (int j = 0; j < ctx.bitlongs; j++)
+			{
+				count += std::popcount(bits[j]);
+				for (int b = 0; b < 8 && j * 8 + b < (int)rowSize; b++)
+					dest[j * 8 + b] = (unsigned char)(bits[j] >> (b * 8));
+			}
+			totalVisible += count;
+		};
+
+	g_progress.update("Compressing vis", numVisLeaves);
+	std::vector<unsigned char> compressedVis;
+	int visLen = CompressAllStreamed(map->leaves, getRow, compressedVis, visLeafCount, numVisLeaves, (int)MAX_MAP_VISDATA, map->leafCount);
+	g_progress.clear();
+
+	unsigned char* newVisLump = new unsigned char[visLen];
+	memcpy(newVisLump, compressedVis.data(), visLen);
+	map->replace_lump(LUMP_VISIBILITY, newVisLump, visLen);
+
+	double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+	logf("VIS: average leaves visible {}, {} bytes compressed, {:.2f} seconds\n",
+		numVisLeaves > 0 ? totalVisible / numVisLeaves : 0, visLen, seconds);
+
+	return true;
+}
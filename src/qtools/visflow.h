@@ -0,0 +1,23 @@
+#pragma once
+#include <vector>
+#include "vectors.h"
+
+class Bsp;
+
+// portal between two non-solid leaves of the world model
+struct VisPortal
+{
+	std::vector<vec3> points; // wound so that the winding faces leafs[0]
+	vec3 normal;              // plane of the portal, facing leafs[0]
+	float dist;
+	int leafs[2];             // bsp leaf indexes (the shared solid leaf 0 never has portals)
+};
+
+// generates the portals between all world leaves by pushing every node plane of the
+// world model through the node tree below it, like qbsp does when writing a .prt file
+void qvis_make_portals(Bsp* map, std::vector<VisPortal>& portals);
+
+// recomputes the PVS of every world leaf from the portals and replaces the visibility lump.
+// fast = stop after the base portal flood (conservative, like "vis -fast")
+// threads = number of flow threads, 0 uses all cores
+bool qvis_generate(Bsp* map, bool fast, int threads = 0);
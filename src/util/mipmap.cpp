@@ -0,0 +1,333 @@
+#include <algorithm>
+#include <execution>
+#include <numeric>
+#include <cmath>
+#include <climits>
+#include <cstring>
+#include "mipmap.h"
+
+#define PALINDEX_CELL_BITS 4
+#define PALINDEX_CELL_SIZE (256 >> PALINDEX_CELL_BITS)
+#define PALINDEX_CELLS (1 << (PALINDEX_CELL_BITS * 3))
+
+#define KAISER_ALPHA 4.0
+#define KAISER_RADIUS 2 // in output texels
+#define MIP_PI 3.14159265358979323846
+
+static int colorDistSq(int r, int g, int b, const COLOR3& c)
+{
+	int dr = r - c.r;
+	int dg = g - c.g;
+	int db = b - c.b;
+	return dr * dr + dg * dg + db * db;
+}
+
+// distance from value to the [lo, hi] range, and to the farthest end of it
+static void axisDist(int v, int lo, int hi, int& dmin, int& dmax)
+{
+	dmin = v < lo ? lo - v : (v > hi ? v - hi : 0);
+	dmax = std::max(std::abs(v - lo), std::abs(v - hi));
+}
+
+PaletteIndex::PaletteIndex(const COLOR3* palette, int colorCount, int skipIndex)
+{
+	colorCount = std::clamp(colorCount, 0, 256);
+	for (int i = 0; i < 256; i++)
+		pal[i] = i < colorCount ? palette[i] : COLOR3();
+
+	std::vector<unsigned char> colors;
+	for (int i = 0; i < colorCount; i++)
+	{
+		if (i != skipIndex)
+			colors.push_back((unsigned char)i);
+	}
+	if (colors.empty())
+		colors.push_back(0);
+
+	std::vector<std::vector<unsigned char>> cells(PALINDEX_CELLS);
+	std::vector<int> cellIds(PALINDEX_CELLS);
+	std::iota(cellIds.begin(), cellIds.end(), 0);
+
+	std::for_each(std::execution::par_unseq, cellIds.begin(), cellIds.end(), [&](int cell)
+		{
+			int lo[3], hi[3];
+			for (int a = 0; a < 3; a++)
+			{
+				lo[a] = ((cell >> (PALINDEX_CELL_BITS * a)) & ((1 << PALINDEX_CELL_BITS) - 1)) * PALINDEX_CELL_SIZE;
+				hi[a] = lo[a] + PALINDEX_CELL_SIZE - 1;
+			}
+
+			int dmin[256];
+			int bestMax = INT_MAX;
+			for (unsigned char k : colors)
+			{
+				const COLOR3& c = pal[k];
+				int mn[3], mx[3];
+				axisDist(c.r, lo[0], hi[0], mn[0], mx[0]);
+				axisDist(c.g, lo[1], hi[1], mn[1], mx[1]);
+				axisDist(c.b, lo[2], hi[2], mn[2], mx[2]);
+				dmin[k] = mn[0] * mn[0] + mn[1] * mn[1] + mn[2] * mn[2];
+				bestMax = std::min(bestMax, mx[0] * mx[0] + mx[1] * mx[1] + mx[2] * mx[2]);
+			}
+
+			// a color further than the worst case of the best color can never win inside this cell
+			for (unsigned char k : colors)
+			{
+				if (dmin[k] <= bestMax)
+					cells[cell].push_back(k);
+			}
+		});
+
+	cellStart.resize(PALINDEX_CELLS + 1);
+	cellStart[0] = 0;
+	for (int i = 0; i < PALINDEX_CELLS; i++)
+		cellStart[i + 1] = cellStart[i] + (unsigned int)cells[i].size();
+
+	cellColors.resize(cellStart[PALINDEX_CELLS]);
+	for (int i = 0; i < PALINDEX_CELLS; i++)
+		std::copy(cells[i].begin(), cells[i].end(), cellColors.begin() + cellStart[i]);
+}
+
+unsigned char PaletteIndex::GetNearest(const COLOR3& c) const
+{
+	int cell = (c.r >> (8 - PALINDEX_CELL_BITS))
+		| ((c.g >> (8 - PALINDEX_CELL_BITS)) << PALINDEX_CELL_BITS)
+		| ((c.b >> (8 - PALINDEX_CELL_BITS)) << (PALINDEX_CELL_BITS * 2));
+
+	unsigned char best = cellColors[cellStart[cell]];
+	int bestDist = INT_MAX;
+	for (unsigned int i = cellStart[cell]; i < cellStart[cell + 1]; i++)
+	{
+		int dist = colorDistSq(c.r, c.g, c.b, pal[cellColors[i]]);
+		if (dist < bestDist)
+		{
+			bestDist = dist;
+			best = cellColors[i];
+			if (dist == 0)
+				break;
+		}
+	}
+	return best;
+}
+
+struct LinearColor
+{
+	// premultiplied by alpha
+	float r, g, b, a;
+};
+
+static float g_srgb_to_linear[256];
+static unsigned char g_linear_to_srgb[4096];
+
+static void initColorTables()
+{
+	static bool initialized = [] {
+		for (int i = 0; i < 256; i++)
+		{
+			double c = i / 255.0;
+			g_srgb_to_linear[i] = (float)(c <= 0.04045 ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4));
+		}
+		for (int i = 0; i < 4096; i++)
+		{
+			double l = i / 4095.0;
+			double c = l <= 0.0031308 ? l * 12.92 : 1.055 * pow(l, 1.0 / 2.4) - 0.055;
+			g_linear_to_srgb[i] = (unsigned char)std::clamp((int)(c * 255.0 + 0.5), 0, 255);
+		}
+		return true;
+	}();
+	(void)initialized;
+}
+
+static unsigned char linearToSrgb(float l)
+{
+	return g_linear_to_srgb[std::clamp((int)(l * 4095.0f + 0.5f), 0, 4095)];
+}
+
+static double besselI0(double x)
+{
+	double sum = 1.0;
+	double term = 1.0;
+	for (int k = 1; k < 32; k++)
+	{
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+		if (term < sum * 1e-12)
+			break;
+	}
+	return sum;
+}
+
+// 1D filter taps for reducing by 'div', source texel = outTexel * div + offset
+struct MipKernel
+{
+	std::vector<int> offsets;
+	std::vector<float> weights;
+};
+
+static MipKernel makeMipKernel(int filter, int div)
+{
+	MipKernel kernel;
+	if (filter == MIP_FILTER_KAISER)
+	{
+		double radius = KAISER_RADIUS * div;
+		int maxOffset = (int)ceil(radius) + div;
+		double sum = 0.0;
+		for (int o = -maxOffset; o <= maxOffset; o++)
+		{
+			// distance between source texel center and output texel center, in source texels
+			double d = o + 0.5 - div * 0.5;
+			double t = d / radius;
+			if (fabs(t) >= 1.0)
+				continue;
+			double x = d / div;
+			double sinc = fabs(x) < 1e-9 ? 1.0 : sin(MIP_PI * x) / (MIP_PI * x);
+			double w = sinc * besselI0(KAISER_ALPHA * sqrt(1.0 - t * t)) / besselI0(KAISER_ALPHA);
+			if (fabs(w) < 1e-6)
+				continue;
+			kernel.offsets.push_back(o);
+			kernel.weights.push_back((float)w);
+			sum += w;
+		}
+		for (auto& w : kernel.weights)
+			w = (float)(w / sum);
+	}
+	else
+	{
+		for (int o = 0; o < div; o++)
+		{
+			kernel.offsets.push_back(o);
+			kernel.weights.push_back(1.0f / div);
+		}
+	}
+	return kernel;
+}
+
+void GenerateMipMaps(unsigned char* mips[MIPLEVELS], int width, int height, const COLOR3* palette, int colorCount,
+					 int filter, int transparentIndex)
+{
+	if (filter == MIP_FILTER_POINT)
+	{
+		for (int i = 1; i < MIPLEVELS; i++)
+		{
+			int div = 1 << i;
+			int mipWidth = width / div;
+			int mipHeight = height / div;
+			for (int y = 0; y < mipHeight; y++)
+			{
+				for (int x = 0; x < mipWidth; x++)
+				{
+					mips[i][y * mipWidth + x] = mips[0][(y * div) * width + x * div];
+				}
+			}
+		}
+		return;
+	}
+
+	initColorTables();
+
+	PaletteIndex palIndex(palette, colorCount, transparentIndex);
+
+	// level 0 in premultiplied linear space
+	std::vector<LinearColor> source(width * height);
+	for (int i = 0; i < width * height; i++)
+	{
+		unsigned char idx = mips[0][i];
+		if (idx == transparentIndex)
+		{
+			source[i] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		}
+		else
+		{
+			const COLOR3& c = palette[idx];
+			source[i] = { g_srgb_to_linear[c.r], g_srgb_to_linear[c.g], g_srgb_to_linear[c.b], 1.0f };
+		}
+	}
+
+	MipKernel kernels[MIPLEVELS];
+	std::vector<LinearColor> rowsFiltered[MIPLEVELS];
+	for (int i = 1; i < MIPLEVELS; i++)
+	{
+		kernels[i] = makeMipKernel(filter, 1 << i);
+		rowsFiltered[i].resize((width >> i) * height);
+	}
+
+	// one job per (level, row), so levels don't wait on each other
+	std::vector<std::pair<int, int>> jobs;
+	for (int i = 1; i < MIPLEVELS; i++)
+	{
+		for (int y = 0; y < height; y++)
+			jobs.emplace_back(i, y);
+	}
+
+	// horizontal pass: source rows -> rows with mip width
+	std::for_each(std::execution::par_unseq, jobs.begin(), jobs.end(), [&](const std::pair<int, int>& job)
+		{
+			int level = job.first;
+			int y = job.second;
+			int div = 1 << level;
+			int mipWidth = width / div;
+			const MipKernel& kernel = kernels[level];
+			const LinearColor* srcRow = &source[y * width];
+			LinearColor* dstRow = &rowsFiltered[level][y * mipWidth];
+
+			for (int x = 0; x < mipWidth; x++)
+			{
+				LinearColor sum = { 0.0f, 0.0f, 0.0f, 0.0f };
+				for (size_t k = 0; k < kernel.offsets.size(); k++)
+				{
+					// textures tile, so wrap around the edges
+					int sx = ((x * div + kernel.offsets[k]) % width + width) % width;
+					float w = kernel.weights[k];
+					sum.r += srcRow[sx].r * w;
+					sum.g += srcRow[sx].g * w;
+					sum.b += srcRow[sx].b * w;
+					sum.a += srcRow[sx].a * w;
+				}
+				dstRow[x] = sum;
+			}
+		});
+
+	jobs.clear();
+	for (int i = 1; i < MIPLEVELS; i++)
+	{
+		for (int y = 0; y < (height >> i); y++)
+			jobs.emplace_back(i, y);
+	}
+
+	// vertical pass + palette mapping
+	std::for_each(std::execution::par_unseq, jobs.begin(), jobs.end(), [&](const std::pair<int, int>& job)
+		{
+			int level = job.first;
+			int y = job.second;
+			int div = 1 << level;
+			int mipWidth = width / div;
+			const MipKernel& kernel = kernels[level];
+			const std::vector<LinearColor>& rows = rowsFiltered[level];
+			unsigned char* dst = mips[level] + y * mipWidth;
+
+			for (int x = 0; x < mipWidth; x++)
+			{
+				LinearColor sum = { 0.0f, 0.0f, 0.0f, 0.0f };
+				for (size_t k = 0; k < kernel.offsets.size(); k++)
+				{
+					int sy = ((y * div + kernel.offsets[k]) % height + height) % height;
+					const LinearColor& c = rows[sy * mipWidth + x];
+					float w = kernel.weights[k];
+					sum.r += c.r * w;
+					sum.g += c.g * w;
+					sum.b += c.b * w;
+					sum.a += c.a * w;
+				}
+
+				if (transparentIndex >= 0 && sum.a < 0.5f)
+				{
+					dst[x] = (unsigned char)transparentIndex;
+					continue;
+				}
+
+				float invAlpha = sum.a > 0.0001f ? 1.0f / sum.a : 1.0f;
+				COLOR3 c(linearToSrgb(sum.r * invAlpha), linearToSrgb(sum.g * invAlpha), linearToSrgb(sum.b * invAlpha));
+				dst[x] = palIndex.GetNearest(c);
+			}
+		});
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <vector>
+#include "bsplimits.h"
+#include "bsptypes.h"
+
+enum MipFilter
+{
+	MIP_FILTER_POINT,  // take the top-left texel of every block (old behavior)
+	MIP_FILTER_BOX,	   // average every block in linear space
+	MIP_FILTER_KAISER  // kaiser windowed sinc in linear space (sharper, may ring)
+};
+
+// Exact nearest palette color search (squared rgb distance).
+// The rgb cube is split into 16x16x16 cells and every cell keeps only the palette
+// entries that can be nearest for some color inside of it, so a lookup tests a
+// handful of colors instead of the whole palette. Immutable after construction,
+// one index can be shared by all threads.
+class PaletteIndex
+{
+public:
+	// skipIndex is never returned (used for transparent color of '{' textures)
+	PaletteIndex(const COLOR3* palette, int colorCount, int skipIndex = -1);
+
+	unsigned char GetNearest(const COLOR3& c) const;
+
+private:
+	COLOR3 pal[256];
+	std::vector<unsigned int> cellStart; // CELLS + 1 offsets into cellColors
+	std::vector<unsigned char> cellColors;
+};
+
+// Generates mip levels 1..MIPLEVELS-1 from the palette indexes of level 0.
+// mips[0] must contain width * height indexes, other levels must be allocated.
+// Every level is filtered directly from level 0, levels and rows are processed in parallel.
+// transparentIndex: palette index for transparent texels ('{' textures), or -1
+void GenerateMipMaps(unsigned char* mips[MIPLEVELS], int width, int height, const COLOR3* palette, int colorCount,
+					 int filter, int transparentIndex = -1);
@@ -0,0 +1,92 @@
+#include "pathcache.h"
+#include "util.h"
+
+PathCache g_path_cache;
+
+static std::string path_name_key(const std::string& name)
+{
+#ifdef WIN32
+	return toLowerCase(name);
+#else
+	return name;
+#endif
+}
+
+bool PathCache::fileExists(const std::string& path)
+{
+	if (path.empty())
+		return false;
+
+	fs::path p(path);
+	std::string name = p.filename().string();
+	if (name.empty() || name == "." || name == "..")
+		return ::fileExists(path);
+
+	// the directory is used as written ("a/link/../b" must behave like the OS resolves it),
+	// only made absolute so that a change of the working dir can't return stale results
+	std::error_code ec;
+	fs::path dir = p.parent_path();
+	fs::path absDir = fs::absolute(dir.empty() ? fs::path(".") : dir, ec);
+	if (ec)
+		return ::fileExists(path);
+	std::string dirKey = absDir.string();
+
+	auto now = std::chrono::steady_clock::now();
+
+	std::lock_guard<std::mutex> guard(lock);
+
+	auto it = dirs.find(dirKey);
+	if (it == dirs.end())
+	{
+		it = dirs.emplace(dirKey, DirListing()).first;
+		list(absDir, it->second);
+	}
+	else if (now - it->second.checked > std::chrono::milliseconds(REVALIDATE_MS))
+	{
+		DirListing& listing = it->second;
+		fs::file_time_type mtime = fs::last_write_time(absDir, ec);
+		bool exists = !ec && fs::is_directory(absDir, ec);
+		if (exists != listing.exists || (exists && mtime != listing.mtime))
+		{
+			list(absDir, listing);
+		}
+		listing.checked = now;
+	}
+
+	const DirListing& listing = it->second;
+	return listing.exists && listing.files.count(path_name_key(name));
+}
+
+void PathCache::list(const fs::path& dir, DirListing& listing)
+{
+	listing.files.clear();
+	listing.checked = std::chrono::steady_clock::now();
+
+	std::error_code ec;
+	listing.exists = fs::is_directory(dir, ec) && !ec;
+	if (!listing.exists)
+		return;
+	listing.mtime = fs::last_write_time(dir, ec);
+
+	for (fs::directory_iterator iter(dir, ec), end; !ec && iter != end; iter.increment(ec))
+	{
+		// same rule as fileExists(): anything that exists and is not a directory (symlinks followed)
+		std::error_code typeEc;
+		fs::file_status status = iter->status(typeEc);
+		if (!fs::exists(status) || fs::is_directory(status))
+			continue;
+		listing.files.insert(path_name_key(iter->path().filename().string()));
+	}
+}
+
+void PathCache::clear()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	dirs.clear();
+}
+
+size_t PathCache::dirCount()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return dirs.size();
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <filesystem>
+#include <chrono>
+#include <mutex>
+
+// Answers fileExists() from cached directory listings.
+// Every directory is listed once, later lookups of files in it are hash lookups.
+// A listing is revalidated by the directory mtime (which changes when entries are
+// added, removed or renamed), at most once per REVALIDATE_MS, so a file created or
+// deleted by another program may be reported wrong for that long.
+// Names are matched like the file system does: case-insensitive on Windows,
+// exact elsewhere, so results are the same as with fileExists(). Thread safe.
+class PathCache
+{
+public:
+	bool fileExists(const std::string& path);
+
+	// forget all listings (call after writing files that must be found right away)
+	void clear();
+
+	size_t dirCount();
+
+	static const int REVALIDATE_MS = 1000;
+
+private:
+	struct DirListing
+	{
+		bool exists = false;
+		std::filesystem::file_time_type mtime;
+		std::chrono::steady_clock::time_point checked;
+		std::unordered_set<std::string> files; // non-directory entries (lowercase on Windows)
+	};
+
+	std::mutex lock;
+	std::unordered_map<std::string, DirListing> dirs;
+
+	void list(const std::filesystem::path& dir, DirListing& listing);
+};
+
+extern PathCache g_path_cache;
@@ -11,9 +11,11 @@
 #ifdef WIN32
 #include <Windows.h>
 #include <Shlobj.h>
+#include <psapi.h>
 #else 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/resource.h>
 #include <unistd.h>
 #endif
 #include <stdio.h>
@@ -22,7 +24,10 @@
 #include "Renderer.h"
 
 #include "Bsp.h"
+#include "pathcache.h"
 
+std::string g_version_string = "bspguy v4.08";
+bool g_verbose = false;
 bool DebugKeyPressed = false;
 ProgressMeter g_progress;
 int g_render_flags;
@@ -52,6 +57,7 @@ char* loadFile(const std::string& fileName, int& length)
 
 bool writeFile(const std::string& fileName, const char* data, int len)
 {
+	g_path_cache.clear(); // the file may be new
 	std::ofstream file(fileName, std::ios::trunc | std::ios::binary);
 	if (!file.is_open() || len <= 0)
 	{
@@ -64,6 +70,7 @@ bool writeFile(const std::string& fileName, const char* data, int len)
 
 bool writeFile(const std::string& fileName, const std::string& data)
 {
+	g_path_cache.clear(); // the file may be new
 	std::ofstream file(fileName, std::ios::trunc | std::ios::binary);
 	if (!file.is_open() || !data.size())
 	{
@@ -1220,6 +1227,41 @@ std::string getConfigDir()
 	SHGetFolderPathW(NULL, CSIDL_PROFILE, NULL, 0, path);
 	return fs::path(path).string() + "/AppData/Roaming/bspguy/";
 }
+
+size_t getMemoryUsage()
+{
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return 0;
+	return counters.WorkingSetSize;
+}
+
+size_t getPeakMemoryUsage()
+{
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return 0;
+	return counters.PeakWorkingSetSize;
+}
+
+bool resetPeakMemoryUsage()
+{
+	return false;
+}
+
+double getCpuTime()
+{
+	FILETIME creation, exit, kernel, user;
+	if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+		return 0.0;
+	ULARGE_INTEGER k, u;
+	k.LowPart = kernel.dwLowDateTime;
+	k.HighPart = kernel.dwHighDateTime;
+	u.LowPart = user.dwLowDateTime;
+	u.HighPart = user.dwHighDateTime;
+	// 100 ns units
+	return (k.QuadPart + u.QuadPart) / 10000000.0;
+}
 #else 
 void print_color(int colors)
 {
@@ -1247,6 +1289,64 @@ std::string getConfigDir()
 {
 	return getenv("HOME") + std::string("/.config/bspguy/");
 }
+
+size_t getMemoryUsage()
+{
+	long pages = 0;
+	long residentPages = 0;
+	FILE* file = fopen("/proc/self/statm", "r");
+	if (!file)
+		return 0;
+	if (fscanf(file, "%ld %ld", &pages, &residentPages) != 2)
+		residentPages = 0;
+	fclose(file);
+	return (size_t)residentPages * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+size_t getPeakMemoryUsage()
+{
+	// VmHWM follows clear_refs resets, ru_maxrss doesn't
+	FILE* file = fopen("/proc/self/status", "r");
+	if (file)
+	{
+		char line[256];
+		size_t kb = 0;
+		while (fgets(line, sizeof(line), file))
+		{
+			if (sscanf(line, "VmHWM: %zu kB", &kb) == 1)
+				break;
+		}
+		fclose(file);
+		if (kb)
+			return kb * 1024;
+	}
+
+	rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+#ifdef __APPLE__
+	return (size_t)usage.ru_maxrss;
+#else
+	return (size_t)usage.ru_maxrss * 1024;
+#endif
+}
+
+bool resetPeakMemoryUsage()
+{
+	FILE* file = fopen("/proc/self/clear_refs", "w");
+	if (!file)
+		return false;
+	bool ok = fputs("5", file) >= 0;
+	return fclose(file) == 0 && ok;
+}
+
+double getCpuTime()
+{
+	rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0.0;
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000000.0;
+}
 #endif
 
 
@@ -1411,10 +1511,12 @@ void SimpeColorReduce(COLOR3* image, int size)
 	}
 }
 
+// probes the same candidates in the same order as before, existence checks are answered
+// from cached directory listings (see PathCache)
 bool FindPathInAssets(Bsp* map, const std::string& path, std::string& outpath, bool tracesearch)
 {
 	int fPathId = 1;
-	if (fileExists(path))
+	if (g_path_cache.fileExists(path))
 	{
 		outpath = path;
 		return true;
@@ -1440,7 +1542,7 @@ bool FindPathInAssets(Bsp* map, const std::string& path, std::string& outpath, b
 		outTrace << "-------------START PATH TRACING-------------\n";
 		outTrace << "Search paths [" << fPathId++ << "] : [" << path.c_str() << "]\n";
 	}
-	if (fileExists(path))
+	if (g_path_cache.fileExists(path))
 	{
 		outpath = path;
 		return true;
@@ -1449,7 +1551,7 @@ bool FindPathInAssets(Bsp* map, const std::string& path, std::string& outpath, b
 	{
 		outTrace << "Search paths [" << fPathId++ << "] : [" << (GetCurrentDir() + path) << "]\n";
 	}
-	if (fileExists(GetCurrentDir() + path))
+	if (g_path_cache.fileExists(GetCurrentDir() + path))
 	{
 		outpath = GetCurrentDir() + path;
 		return true;
@@ -1458,7 +1560,7 @@ bool FindPathInAssets(Bsp* map, const std::string& path, std::string& outpath, b
 	{
 		outTrace << "Search paths [" << fPathId++ << "] : [" << (GetWorkDir() + path) << "]\n";
 	}
-	if (fileExists(GetWorkDir() + path))
+	if (g_path_cache.fileExists(GetWorkDir() + path))
 	{
 		outpath = GetWorkDir() + path;
 		return true;
@@ -1468,7 +1570,7 @@ bool FindPathInAssets(Bsp* map, const std::string& path, std::string& outpath, b
 	{
 		outTrace << "Search paths [" << fPathId++ << "] : [" << (GetGameDir() + path) << "]\n";
 	}
-	if (fileExists(GetGameDir() + path))
+	if (g_path_cache.fileExists(GetGameDir() + path))
 	{
 		outpath = GetGameDir() + path;
 		return true;
@@ -1483,7 +1585,7 @@ bool FindPathInAssets(Bsp* map, const std::string& path, std::string& outpath, b
 			{
 				outTrace << "Search paths [" << fPathId++ << "] : [" << (dir.path + path) << "]\n";
 			}
-			if (fileExists(dir.path + path))
+			if (g_path_cache.fileExists(dir.path + path))
 			{
 				outpath = dir.path + path;
 				return true;
@@ -1493,7 +1595,7 @@ bool FindPathInAssets(Bsp* map, const std::string& path, std::string& outpath, b
 			{
 				outTrace << "Search paths [" << fPathId++ << "] : [" << (dir.path + path) << "]\n";
 			}
-			if (dir.path.find(':') == std::string::npos && fileExists(dir.path + path))
+			if (dir.path.find(':') == std::string::npos && g_path_cache.fileExists(dir.path + path))
 			{
 				outpath = dir.path + path;
 				return true;
@@ -1502,7 +1604,7 @@ bool FindPathInAssets(Bsp* map, const std::string& path, std::string& outpath, b
 			{
 				outTrace << "Search paths [" << fPathId++ << "] : [" << (GetCurrentDir() + dir.path + path) << "]\n";
 			}
-			if (fileExists(GetCurrentDir() + dir.path + path))
+			if (g_path_cache.fileExists(GetCurrentDir() + dir.path + path))
 			{
 				outpath = GetCurrentDir() + dir.path + path;
 				return true;
@@ -1511,7 +1613,7 @@ bool FindPathInAssets(Bsp* map, const std::string& path, std::string& outpath, b
 			{
 				outTrace << "Search paths [" << fPathId++ << "] : [" << (GetGameDir() + dir.path + path) << "]\n";
 			}
-			if (fileExists(GetGameDir() + dir.path + path))
+			if (g_path_cache.fileExists(GetGameDir() + dir.path + path))
 			{
 				outpath = GetGameDir() + dir.path + path;
 				return true;
@@ -1527,7 +1629,7 @@ bool FindPathInAssets(Bsp* map, const std::string& path, std::string& outpath, b
 		{
 			outTrace << "Search paths [" << fPathId++ << "] : [" << (stripFileName(stripFileName(map->bsp_path)) + "/" + path) << "]\n";
 		}
-		if (fileExists((stripFileName(stripFileName(map->bsp_path)) + "/" + path)))
+		if (g_path_cache.fileExists((stripFileName(stripFileName(map->bsp_path)) + "/" + path)))
 		{
 			outpath = stripFileName(stripFileName(map->bsp_path)) + "/" + path;
 			return true;
@@ -1542,6 +1644,21 @@ bool FindPathInAssets(Bsp* map, const std::string& path, std::string& outpath, b
 	return false;
 }
 
+int FindPathsInAssets(Bsp* map, const std::vector<std::string>& paths, std::vector<std::string>& outpaths)
+{
+	int found = 0;
+	outpaths.clear();
+	outpaths.resize(paths.size());
+	for (size_t i = 0; i < paths.size(); i++)
+	{
+		if (FindPathInAssets(map, paths[i], outpaths[i]))
+			found++;
+		else
+			outpaths[i].clear();
+	}
+	return found;
+}
+
 
 void FixupAllSystemPaths()
 {
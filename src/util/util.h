@@ -166,6 +166,14 @@ void WriteBMP(const std::string& fileName, unsigned char* pixels, int width, int
 
 std::string getConfigDir();
 
+// resident memory of the process in bytes, 0 if the OS doesn't say
+size_t getMemoryUsage();
+size_t getPeakMemoryUsage();
+// starts measuring the peak from the current usage again. Returns false where that's not possible (windows)
+bool resetPeakMemoryUsage();
+// cpu time used by all threads of the process, in seconds
+double getCpuTime();
+
 extern fs::path g_current_dir;
 std::string GetCurrentDir();
 std::string GetWorkDir();
@@ -181,6 +189,8 @@ int ColorDistance(COLOR3 color, COLOR3 other);
 void SimpeColorReduce(COLOR3* image, int size);
 
 bool FindPathInAssets(Bsp * map, const std::string& path, std::string& outpath, bool tracesearch = false);
+// resolves all paths, outpaths[i] is empty if paths[i] was not found. returns the found count
+int FindPathsInAssets(Bsp* map, const std::vector<std::string>& paths, std::vector<std::string>& outpaths);
 void FixupAllSystemPaths();
 
 int BoxOnPlaneSide(const vec3& emins, const vec3& emaxs, const BSPPLANE* p);
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <cmath>
 
 #define PI 3.141592f
 
@@ -19,30 +20,30 @@ struct vec3
 	}
 	vec3(const vec3& other) : x(other.x), y(other.y), z(other.z)
 	{
-		if (abs(x) < EPSILON)
+		if (std::fabs(x) < EPSILON)
 		{
 			x = +0.0f;
 		}
-		if (abs(y) < EPSILON)
+		if (std::fabs(y) < EPSILON)
 		{
 			y = +0.0f;
 		}
-		if (abs(z) < EPSILON)
+		if (std::fabs(z) < EPSILON)
 		{
 			z = +0.0f;
 		}
 	}
 	vec3(float x, float y, float z) : x(x), y(y), z(z)
 	{
-		if (abs(x) < EPSILON)
+		if (std::fabs(x) < EPSILON)
 		{
 			x = +0.0f;
 		}
-		if (abs(y) < EPSILON)
+		if (std::fabs(y) < EPSILON)
 		{
 			y = +0.0f;
 		}
-		if (abs(z) < EPSILON)
+		if (std::fabs(z) < EPSILON)
 		{
 			z = +0.0f;
 		}
@@ -128,16 +129,16 @@ struct vec2
 	float x, y;
 	vec2() : x(0), y(0)
 	{
-		if (abs(x) < EPSILON)
+		if (std::fabs(x) < EPSILON)
 			x = +0.0f;
-		if (abs(y) < EPSILON)
+		if (std::fabs(y) < EPSILON)
 			y = +0.0f;
 	}
 	vec2(float x, float y) : x(x), y(y)
 	{
-		if (abs(x) < EPSILON)
+		if (std::fabs(x) < EPSILON)
 			x = +0.0f;
-		if (abs(y) < EPSILON)
+		if (std::fabs(y) < EPSILON)
 			y = +0.0f;
 	}
 	vec2 swap();
@@ -177,33 +178,33 @@ struct vec4
 	}
 	vec4(float x, float y, float z) : x(x), y(y), z(z), w(1)
 	{
-		if (abs(x) < EPSILON)
+		if (std::fabs(x) < EPSILON)
 			x = +0.0f;
-		if (abs(y) < EPSILON)
+		if (std::fabs(y) < EPSILON)
 			y = +0.0f;
-		if (abs(z) < EPSILON)
+		if (std::fabs(z) < EPSILON)
 			z = +0.0f;
 	}
 	vec4(float x, float y, float z, float w) : x(x), y(y), z(z), w(w)
 	{
-		if (abs(x) < EPSILON)
+		if (std::fabs(x) < EPSILON)
 			x = +0.0f;
-		if (abs(y) < EPSILON)
+		if (std::fabs(y) < EPSILON)
 			y = +0.0f;
-		if (abs(z) < EPSILON)
+		if (std::fabs(z) < EPSILON)
 			z = +0.0f;
-		if (abs(w) < EPSILON)
+		if (std::fabs(w) < EPSILON)
 			w = +0.0f;
 	}
 	vec4(const vec3& v, float a) : x(v.x), y(v.y), z(v.z), w(a)
 	{
-		if (abs(x) < EPSILON)
+		if (std::fabs(x) < EPSILON)
 			x = +0.0f;
-		if (abs(y) < EPSILON)
+		if (std::fabs(y) < EPSILON)
 			y = +0.0f;
-		if (abs(z) < EPSILON)
+		if (std::fabs(z) < EPSILON)
 			z = +0.0f;
-		if (abs(w) < EPSILON)
+		if (std::fabs(w) < EPSILON)
 			w = +0.0f;
 	}
 	vec3 xyz();